@@ -27,6 +27,11 @@ OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
  * 6 write single register = 2 byte address, 2 byte value
  * 15 write multiple coils = 2 byte starting address, 2 byte quantity of coils, 1 byte byte count, N bytes of data  (header is only 4 bytes)
  * 16 write multiple registers = 2 byte starting address, 2 byte quantity of registers, 1 byte byte count, N bytes of data (header is only 4 bytes)
+ * 22 mask write register = 2 byte address, 2 byte AND mask, 2 byte OR mask (header is 6 bytes)
+ * 23 read/write multiple registers = 2 byte read address, 2 byte read quantity, 2 byte write address, 2 byte write quantity, 1 byte byte count, N bytes of data (header is 8 bytes)
+ * 24 read FIFO queue = 2 byte FIFO pointer address (header is 2 bytes)
+ * 20 read file record = 1 byte byte count, N sub-requests of 1 byte reference type, 2 byte file, 2 byte record, 2 byte length (no header)
+ * 21 write file record = 1 byte byte count, N sub-requests of 1 byte reference type, 2 byte file, 2 byte record, 2 byte length, 2*length bytes of data (no header)
  */
 
 #ifndef MODBUS_HTONS
@@ -65,12 +70,341 @@ static void modbus_memmove(void * dst, void * src, uint16_t count) {
 #endif
 #define MODBUS_UNUSED(x) (void)(x)
 
+#ifndef BMB_REGISTER_BANK_LOCK //Can be defined to make register bank updates atomic with respect to an interrupt
+#define BMB_REGISTER_BANK_LOCK()
+#define BMB_REGISTER_BANK_UNLOCK()
+#endif //BMB_REGISTER_BANK_LOCK
+
+//Flags describing the frame shape of a function code
+#define BMB_FUNCTION_SUPPORTED      (0x01) //The function is implemented
+#define BMB_FUNCTION_BYTE_COUNT     (0x02) //The request carries a byte count and data section after the header
+#define BMB_FUNCTION_READ           (0x04) //The response carries a byte count and the data read
+#define BMB_FUNCTION_FILE           (0x08) //The byte count is taken from the frame and the data is streamed to the file record callbacks
+#define BMB_FUNCTION_WRITE          (0x10) //Only writes, so it can be broadcast
+
+#ifdef BMB_CLIENT_READ_WRITE_FUNCTION
+#define BMB_READ_WRITE_SUPPORTED    BMB_FUNCTION_SUPPORTED
+#else
+#define BMB_READ_WRITE_SUPPORTED    0
+#endif //BMB_CLIENT_READ_WRITE_FUNCTION
+
+#ifdef BMB_CLIENT_FILE_RECORD
+#define BMB_FILE_RECORD_SUPPORTED   BMB_FUNCTION_SUPPORTED
+#else
+#define BMB_FILE_RECORD_SUPPORTED   0
+#endif //BMB_CLIENT_FILE_RECORD
+
+#ifdef BMB_STATISTICS //Diagnostics and get comm event counter are answered from the counters
+#define BMB_STATISTICS_SUPPORTED    BMB_FUNCTION_SUPPORTED
+#define BMB_COUNT(bmodbus, counter) ((bmodbus)->statistics.counter++)
+#else
+#define BMB_STATISTICS_SUPPORTED    0
+#define BMB_COUNT(bmodbus, counter)
+#endif //BMB_STATISTICS
+
+#ifdef BMB_MASTER_CALLBACK //Tells the application a master request is complete, response is NULL if it was given up
+#define MASTER_COMPLETE(bmodbus, response) do{ if((bmodbus)->callback != NULL){ (bmodbus)->callback((bmodbus)->callback_context, (response)); } }while(0)
+#else
+#define MASTER_COMPLETE(bmodbus, response) do{ (void)(response); }while(0)
+#endif //BMB_MASTER_CALLBACK
+
+//File record limits from the modbus specification
+#define BMB_FILE_REFERENCE_TYPE     (6)
+#define BMB_FILE_RECORDS_PER_FILE   (10000)
+#define BMB_FILE_MAXIMUM_BYTE_COUNT (0xF5)
+
+typedef struct{
+    uint8_t flags;
+    uint8_t header_length; //Bytes after the function code and before the byte count (or the CRC)
+    uint8_t bits_per_unit; //Bits per counted item, 1 for coils, 16 for registers and 0 if there is no count
+    uint16_t max_count; //Maximum count allowed by the modbus specification
+}bmodbus_function_t;
+
+//Indexed by function code, entries without BMB_FUNCTION_SUPPORTED are not implemented
+static const bmodbus_function_t bmodbus_functions[] = {
+    {0,                                                                      0, 0,  0},    //0x00 Invalid
+    {BMB_FUNCTION_SUPPORTED | BMB_FUNCTION_READ,                             4, 1,  2000}, //0x01 Read coils
+    {BMB_FUNCTION_SUPPORTED | BMB_FUNCTION_READ,                             4, 1,  2000}, //0x02 Read discrete inputs
+    {BMB_FUNCTION_SUPPORTED | BMB_FUNCTION_READ,                             4, 16, 125},  //0x03 Read holding registers
+    {BMB_FUNCTION_SUPPORTED | BMB_FUNCTION_READ,                             4, 16, 125},  //0x04 Read input registers
+    {BMB_FUNCTION_SUPPORTED | BMB_FUNCTION_WRITE,                            4, 0,  1},    //0x05 Write single coil
+    {BMB_FUNCTION_SUPPORTED | BMB_FUNCTION_WRITE,                            4, 0,  1},    //0x06 Write single register
+    {0,                                                                      0, 0,  0},    //0x07 Read exception status
+    {BMB_STATISTICS_SUPPORTED,                                               4, 0,  1},    //0x08 Diagnostics
+    {0,                                                                      0, 0,  0},    //0x09
+    {0,                                                                      0, 0,  0},    //0x0A
+    {BMB_STATISTICS_SUPPORTED,                                               0, 0,  0},    //0x0B Get comm event counter
+    {0,                                                                      0, 0,  0},    //0x0C Get comm event log
+    {0,                                                                      0, 0,  0},    //0x0D
+    {0,                                                                      0, 0,  0},    //0x0E
+    {BMB_FUNCTION_SUPPORTED | BMB_FUNCTION_BYTE_COUNT | BMB_FUNCTION_WRITE, 4, 1,  1968}, //0x0F Write multiple coils
+    {BMB_FUNCTION_SUPPORTED | BMB_FUNCTION_BYTE_COUNT | BMB_FUNCTION_WRITE, 4, 16, 123},  //0x10 Write multiple registers
+    {0,                                                                      0, 0,  0},    //0x11 Report server ID
+    {0,                                                                      0, 0,  0},    //0x12
+    {0,                                                                      0, 0,  0},    //0x13
+    {BMB_FILE_RECORD_SUPPORTED | BMB_FUNCTION_BYTE_COUNT | BMB_FUNCTION_FILE, 0, 8, BMB_FILE_MAXIMUM_BYTE_COUNT}, //0x14 Read file record
+    {BMB_FILE_RECORD_SUPPORTED | BMB_FUNCTION_BYTE_COUNT | BMB_FUNCTION_FILE | BMB_FUNCTION_WRITE, 0, 8, BMB_FILE_MAXIMUM_BYTE_COUNT}, //0x15 Write file record
+    {BMB_FUNCTION_SUPPORTED | BMB_FUNCTION_WRITE,                            6, 0,  1},    //0x16 Mask write register
+    {BMB_READ_WRITE_SUPPORTED | BMB_FUNCTION_BYTE_COUNT | BMB_FUNCTION_READ, 8, 16, 121},  //0x17 Read/write multiple registers
+    {BMB_FUNCTION_SUPPORTED,                                                 2, 0,  31},   //0x18 Read FIFO queue
+};
+#define BMB_FUNCTION_TABLE_SIZE (sizeof(bmodbus_functions) / sizeof(bmodbus_functions[0]))
+
+//Read FIFO queue responses are limited to 31 values by the specification, and also by the response buffer
+#define BMB_FIFO_MAXIMUM_COUNT ((((BMB_MAXIMUM_MESSAGE_SIZE) - 8) / 2) < 31 ? (((BMB_MAXIMUM_MESSAGE_SIZE) - 8) / 2) : 31)
+
+//States in which a received byte is part of the CRC calculation
+#define CLIENT_CRC_STATES (((uint16_t)1 << CLIENT_STATE_FUNCTION_CODE) | ((uint16_t)1 << CLIENT_STATE_HEADER) | \
+    ((uint16_t)1 << CLIENT_STATE_HEADER_CHECK) | ((uint16_t)1 << CLIENT_STATE_DATA) | ((uint16_t)1 << CLIENT_STATE_FOOTER) | \
+    ((uint16_t)1 << CLIENT_STATE_REJECTING))
+
+#ifdef BMB_CLIENT_ASCII
+#define CLIENT_IS_ASCII(bmodbus) ((bmodbus)->ascii.enabled)
+#else
+#define CLIENT_IS_ASCII(bmodbus) (0)
+#endif //BMB_CLIENT_ASCII
+
+#ifdef BMB_MONITOR //A monitor follows frames of any valid size, it only keeps the data that fits the buffer
+#define CLIENT_IS_PROMISCUOUS(bmodbus) ((bmodbus)->promiscuous)
+#define CLIENT_DATA_FITS(bmodbus) ((bmodbus)->index < sizeof((bmodbus)->payload.request.data))
+#else
+#define CLIENT_IS_PROMISCUOUS(bmodbus) (0)
+#define CLIENT_DATA_FITS(bmodbus) (1)
+#endif //BMB_MONITOR
+
+//Largest RTU response (with its CRC) that fits the buffer in the framing in use, ASCII takes two characters per byte
+//plus ':', the LRC and CR LF (see ascii_encode)
+#define BMB_ASCII_RESPONSE_ROOM ((((BMB_MAXIMUM_MESSAGE_SIZE) < 0xFF ? (BMB_MAXIMUM_MESSAGE_SIZE) : 0xFF) - 5) / 2 + 2)
+#define CLIENT_RESPONSE_ROOM(bmodbus) (CLIENT_IS_ASCII(bmodbus) ? BMB_ASCII_RESPONSE_ROOM : (BMB_MAXIMUM_MESSAGE_SIZE))
+//Values a read FIFO queue response can carry in the framing in use
+#define CLIENT_FIFO_ROOM(bmodbus) ((CLIENT_RESPONSE_ROOM(bmodbus) - 8) / 2 < BMB_FIFO_MAXIMUM_COUNT ? (CLIENT_RESPONSE_ROOM(bmodbus) - 8) / 2 : BMB_FIFO_MAXIMUM_COUNT)
+
+//Read/write multiple registers reads up to 125 registers, the table holds the limit of the write
+#define BMB_READ_WRITE_MAXIMUM_READ (125)
+
+#ifdef BMB_LATENCY
+#define BMB_LATENCY_SUB_BUCKETS (4) //Linear buckets per power of two
+
+static void latency_clear(modbus_latency_t *latency){
+    uint16_t i;
+    for(i = 0; i < sizeof(modbus_latency_t) / sizeof(uint16_t); i++){ //Only 16 bit counts
+        ((uint16_t *)latency)[i] = 0;
+    }
+}
+
+//Adds a latency to the histogram of its function code
+static void latency_record(modbus_latency_t *latency, uint8_t function, uint32_t microseconds){
+    uint32_t units = microseconds >> BMB_LATENCY_SHIFT;
+    uint8_t bucket = 0;
+    uint16_t * count;
+    if(function >= BMB_LATENCY_FUNCTIONS){
+        return;
+    }
+    //The leading bits pick the power of two and the next two bits the linear bucket inside it
+    while(units >= 2 * BMB_LATENCY_SUB_BUCKETS){
+        units >>= 1;
+        bucket += BMB_LATENCY_SUB_BUCKETS;
+    }
+    bucket += (uint8_t)units;
+    if(bucket >= BMB_LATENCY_BUCKETS){
+        bucket = BMB_LATENCY_BUCKETS - 1;
+    }
+    count = &(latency->function[function].count[bucket]);
+    if(*count != 0xFFFF){
+        (*count)++;
+    }
+}
+
+uint32_t bmodbus_latency_bucket_microseconds(uint8_t bucket){
+    if(bucket < BMB_LATENCY_SUB_BUCKETS){
+        return (uint32_t)bucket << BMB_LATENCY_SHIFT;
+    }
+    return ((uint32_t)(BMB_LATENCY_SUB_BUCKETS + bucket % BMB_LATENCY_SUB_BUCKETS) << (bucket / BMB_LATENCY_SUB_BUCKETS - 1)) << BMB_LATENCY_SHIFT;
+}
+
+uint32_t bmodbus_latency_percentile(const modbus_latency_histogram_t *histogram, uint16_t permille){
+    uint32_t total = 0, target, seen = 0;
+    uint8_t i;
+    for(i = 0; i < BMB_LATENCY_BUCKETS; i++){
+        total += histogram->count[i];
+    }
+    if(total == 0){
+        return 0;
+    }
+    target = (total * permille + 999) / 1000; //Rank of the latency, rounded up
+    if(target == 0){
+        target = 1;
+    }
+    for(i = 0; i < BMB_LATENCY_BUCKETS - 1; i++){
+        seen += histogram->count[i];
+        if(seen >= target){
+            break;
+        }
+    }
+    return bmodbus_latency_bucket_microseconds(i);
+}
+#endif //BMB_LATENCY
+
+#ifdef BMB_BUS_PROFILE
+void bmodbus_bus_profile_init(modbus_bus_profile_t *profile, uint32_t interframe_delay){
+    uint8_t i;
+    profile->interframe_delay = interframe_delay;
+    profile->bytes = 0;
+    profile->frames = 0;
+    profile->longest_gap = 0;
+    for(i = 0; i < BMB_BUS_GAP_BUCKETS; i++){
+        profile->gaps[i] = 0;
+    }
+    profile->turnaround_total = 0;
+    profile->turnaround_minimum = 0xFFFFFFFF;
+    profile->turnaround_maximum = 0;
+    profile->turnarounds = 0;
+    profile->started = 0;
+    profile->awaiting = 0;
+}
+
+void bmodbus_bus_profile_byte(modbus_bus_profile_t *profile, uint32_t microseconds){
+    uint32_t gap = microseconds - profile->last, delay;
+    uint8_t bucket = 0;
+    profile->bytes++;
+    if(!profile->started){
+        profile->started = 1;
+        profile->start = microseconds;
+        profile->frames = 1;
+    }else if(profile->awaiting){ //The first byte of the response
+        gap = microseconds - profile->sent;
+        profile->turnaround_total += gap;
+        profile->turnarounds++;
+        if(gap < profile->turnaround_minimum){
+            profile->turnaround_minimum = gap;
+        }
+        if(gap > profile->turnaround_maximum){
+            profile->turnaround_maximum = gap;
+        }
+        profile->frames++;
+    }else if(gap > profile->interframe_delay){ //A new frame, only frame boundaries pay for the gap statistics
+        profile->frames++;
+        if(gap > profile->longest_gap){
+            profile->longest_gap = gap;
+        }
+        for(delay = profile->interframe_delay * 2; (gap >= delay) && (bucket < BMB_BUS_GAP_BUCKETS - 1); delay *= 2){
+            bucket++;
+        }
+        if(profile->gaps[bucket] != 0xFFFF){
+            profile->gaps[bucket]++;
+        }
+    }
+    profile->awaiting = 0;
+    profile->last = microseconds;
+}
+
+void bmodbus_bus_profile_sent(modbus_bus_profile_t *profile, uint32_t microseconds, uint16_t bytes){
+    if(!profile->started){
+        profile->started = 1;
+        profile->start = microseconds;
+    }
+    profile->frames++;
+    profile->bytes += bytes;
+    profile->sent = microseconds;
+    profile->last = microseconds;
+    profile->awaiting = 1;
+}
+
+uint16_t bmodbus_bus_utilization(const modbus_bus_profile_t *profile, uint32_t microseconds_per_byte){
+    uint32_t busy = profile->bytes * microseconds_per_byte;
+    uint32_t window = profile->last - profile->start + microseconds_per_byte; //The first byte started before its timestamp
+    uint32_t utilization;
+    if(!profile->started){
+        return 0;
+    }
+    if(busy < 0xFFFFFFFF / 1000){
+        utilization = busy * 1000 / window;
+    }else{ //Long windows lose a little precision instead of overflowing
+        utilization = busy / (window / 1000);
+    }
+    return (uint16_t)((utilization > 1000) ? 1000 : utilization);
+}
+#endif //BMB_BUS_PROFILE
+
+#ifdef BMB_CAPTURE
+//Appends an unsigned LEB128 varint, returns the new length
+static uint8_t capture_varint(uint8_t *buffer, uint8_t n, uint32_t value){
+    while(value >= 0x80){
+        buffer[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[n++] = (uint8_t)value;
+    return n;
+}
+
+void bmodbus_capture_init(modbus_capture_t *capture, modbus_capture_write_t write, void * context){
+    static const uint8_t header[] = {'B', 'M', 'B', 'C', BMB_CAPTURE_VERSION};
+    capture->write = write;
+    capture->context = context;
+    capture->last = 0;
+    write(context, header, sizeof(header));
+}
+
+void bmodbus_capture_record(modbus_capture_t *capture, uint32_t microseconds, uint8_t direction, const uint8_t * bytes, uint16_t length, uint32_t extra){
+    uint8_t header[16];
+    uint8_t n;
+    n = capture_varint(header, 0, microseconds - capture->last);
+    header[n++] = direction;
+    n = capture_varint(header, n, length);
+    if(BMB_CAPTURE_HAS_EXTRA(direction, length)){
+        n = capture_varint(header, n, extra);
+    }
+    capture->last = microseconds;
+    capture->write(capture->context, header, n);
+    capture->write(capture->context, bytes, length);
+}
+#endif //BMB_CAPTURE
+
+#ifdef BMB_STATISTICS
+static void statistics_clear(modbus_statistics_t *statistics){
+    uint8_t i;
+    for(i = 0; i < sizeof(modbus_statistics_t) / sizeof(uint16_t); i++){ //Only 16 bit counters
+        ((uint16_t *)statistics)[i] = 0;
+    }
+}
+#endif //BMB_STATISTICS
+
 void bmodbus_client_init(modbus_client_t *bmodbus, uint32_t interframe_delay, uint8_t client_address){
     bmodbus->state = CLIENT_STATE_IDLE;
+    bmodbus->broadcast = 0;
+#ifdef BMB_CLIENT_ASCII
+    bmodbus->ascii.enabled = 0;
+#endif //BMB_CLIENT_ASCII
     bmodbus->interframe_delay = interframe_delay;
     bmodbus->client_address = client_address;
     bmodbus->crc.half = 0xFFFF;
     bmodbus->byte_count = 0;
+#ifdef BMB_CLIENT_REGISTER_BANK
+    bmodbus->holding_registers = NULL;
+#endif //BMB_CLIENT_REGISTER_BANK
+#ifdef BMB_CLIENT_FIFO_QUEUE
+    bmodbus->fifo = NULL;
+#endif //BMB_CLIENT_FIFO_QUEUE
+#ifdef BMB_CLIENT_FILE_RECORD
+    bmodbus->files = NULL;
+#endif //BMB_CLIENT_FILE_RECORD
+#ifdef BMB_STATISTICS
+    statistics_clear(&(bmodbus->statistics));
+#endif //BMB_STATISTICS
+#ifdef BMB_LATENCY
+    latency_clear(&(bmodbus->latency));
+    bmodbus->latency_clock = NULL;
+    bmodbus->latency_pending = 0;
+#endif //BMB_LATENCY
+#ifdef BMB_BUS_PROFILE
+    bmodbus->bus_profile = NULL;
+#endif //BMB_BUS_PROFILE
+#ifdef BMB_MONITOR
+    bmodbus->promiscuous = 0;
+#endif //BMB_MONITOR
+#ifdef BMB_CAPTURE
+    bmodbus->capture = NULL;
+#endif //BMB_CAPTURE
 }
 
 void bmodbus_client_deinit(modbus_client_t *bmodbus){
@@ -90,60 +424,457 @@ static uint16_t crc_update(uint16_t crc, uint8_t byte) {
     return crc;
 }
 
-void bmodbus_client_next_byte(modbus_client_t *bmodbus, uint32_t microseconds, uint8_t byte){
-    //If the time delta is greater than the interframe delay, we should reset the state machine, and then process from scratch
-    if((microseconds - bmodbus->last_microseconds) > bmodbus->interframe_delay){
-        bmodbus->state = CLIENT_STATE_IDLE;
-        bmodbus->byte_count = 0;
-        bmodbus->crc.half = 0xFFFF;
+uint16_t bmodbus_crc(const uint8_t * data, uint16_t length){
+    uint16_t crc = 0xFFFF;
+    while(length--){
+        crc = crc_update(crc, *data++);
     }
-    bmodbus->last_microseconds = microseconds;
+    return crc;
+}
+
+#ifdef BMB_SCATTER_GATHER
+//Fills in the header, payload and CRC spans, the CRC runs over the first two spans so no copy of the frame is needed
+static modbus_uart_vector_t * vector_build(modbus_uart_vector_t * vector, const uint8_t * header, uint16_t header_length, const uint8_t * payload, uint16_t payload_length){
+    uint16_t crc = 0xFFFF, i;
+    for(i = 0; i < header_length; i++){
+        crc = crc_update(crc, header[i]);
+    }
+    for(i = 0; i < payload_length; i++){
+        crc = crc_update(crc, payload[i]);
+    }
+    vector->crc[0] = crc & 0xFF;
+    vector->crc[1] = (crc & 0xFF00) >> 8;
+    vector->span[0].data = header;
+    vector->span[0].length = header_length;
+    vector->span[1].data = payload;
+    vector->span[1].length = payload_length;
+    vector->span[2].data = vector->crc;
+    vector->span[2].length = 2;
+    vector->count = 3;
+    return vector;
+}
+
+//A frame that is already contiguous (CRC included) goes in the first span
+static modbus_uart_vector_t * vector_single(modbus_uart_vector_t * vector, const uint8_t * frame, uint16_t length){
+    vector->span[0].data = frame;
+    vector->span[0].length = length;
+    vector->span[1].length = 0;
+    vector->span[2].length = 0;
+    vector->count = 1;
+    return vector;
+}
+#endif //BMB_SCATTER_GATHER
+
+#if defined(BMB_CLIENT_ASCII) || defined(BMB_MASTER_ASCII)
+//Decoder states
+#define BMB_ASCII_IDLE  (0) //Waiting for ':'
+#define BMB_ASCII_HIGH  (1) //Waiting for the first digit of a byte (or CR)
+#define BMB_ASCII_LOW   (2) //Waiting for the second digit of a byte
+#define BMB_ASCII_LF    (3) //Waiting for the LF that ends the frame
+
+//Decoder events
+#define BMB_ASCII_NONE  (0) //Nothing to do yet
+#define BMB_ASCII_START (1) //':' seen, a new frame starts
+#define BMB_ASCII_BYTE  (2) //A byte was decoded into value
+#define BMB_ASCII_END   (3) //CR LF seen and the LRC is valid, the frame is complete
+#define BMB_ASCII_ERROR (4) //The frame is malformed and has been dropped
+
+//Value of the characters '0' to 'f', 0xFF if it is not a hex digit (both cases are accepted)
+static const uint8_t bmodbus_hex_values['f' - '0' + 1] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 10, 11, 12, 13, 14, 15, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 10, 11, 12, 13, 14, 15
+};
+static const uint8_t bmodbus_hex_digits[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
+
+static uint8_t ascii_hex_value(uint8_t c){
+    c = (uint8_t)(c - '0'); //Characters below '0' wrap around and fail the range check
+    return (c < sizeof(bmodbus_hex_values)) ? bmodbus_hex_values[c] : 0xFF;
+}
+
+//Decodes two hex digits at once, returns 0 if either is not a hex digit
+static uint8_t ascii_hex_pair(uint8_t high, uint8_t low, uint8_t *value){
+    high = ascii_hex_value(high);
+    low = ascii_hex_value(low);
+    if((high | low) & 0xF0){
+        return 0;
+    }
+    *value = (uint8_t)((high << 4) | low);
+    return 1;
+}
+
+static void ascii_init(modbus_ascii_t *ascii, uint8_t enabled){
+    ascii->enabled = enabled;
+    ascii->state = BMB_ASCII_IDLE;
+}
+
+//Adds a decoded byte to the frame, each byte is held back until the next one arrives since the last one is the LRC
+static uint8_t ascii_decoded(modbus_ascii_t *ascii, uint8_t value){
+    uint8_t event = BMB_ASCII_NONE;
+    ascii->lrc = (uint8_t)(ascii->lrc + value);
+    if(ascii->held){
+        ascii->value = ascii->last;
+        event = BMB_ASCII_BYTE;
+    }
+    ascii->held = 1;
+    ascii->last = value;
+    return event;
+}
+
+//Runs one character through the ASCII framing, returns a BMB_ASCII_ event
+static uint8_t ascii_next_char(modbus_ascii_t *ascii, uint8_t c){
+    uint8_t value;
+    if(c == ':'){ //Always starts a new frame, whatever came before
+        ascii->state = BMB_ASCII_HIGH;
+        ascii->held = 0;
+        ascii->lrc = 0;
+        return BMB_ASCII_START;
+    }
+    switch(ascii->state){
+        case BMB_ASCII_HIGH:
+            if(c == '\r'){
+                ascii->state = BMB_ASCII_LF;
+                return BMB_ASCII_NONE;
+            }
+            value = ascii_hex_value(c);
+            if(value != 0xFF){
+                ascii->high = value;
+                ascii->state = BMB_ASCII_LOW;
+                return BMB_ASCII_NONE;
+            }
+            break;
+        case BMB_ASCII_LOW:
+            value = ascii_hex_value(c);
+            if(value != 0xFF){
+                ascii->state = BMB_ASCII_HIGH;
+                return ascii_decoded(ascii, (uint8_t)((ascii->high << 4) | value));
+            }
+            break;
+        case BMB_ASCII_LF:
+            if((c == '\n') && ascii->held && (ascii->lrc == 0)){ //The LRC makes the sum of all bytes zero
+                ascii->state = BMB_ASCII_IDLE;
+                return BMB_ASCII_END;
+            }
+            break;
+        default: //Waiting for ':'
+            return BMB_ASCII_NONE;
+    }
+    ascii->state = BMB_ASCII_IDLE;
+    return BMB_ASCII_ERROR;
+}
+
+//Turns an RTU frame (with its CRC) into an ASCII frame in place, returns the new length or 0 if it does not fit
+static uint16_t ascii_encode(uint8_t *frame, uint16_t length){
+    uint16_t i, n = length - 2, size = 2 * n + 5; //':', two digits per byte and for the LRC, then CR LF
+    uint8_t lrc = 0, value;
+    if((size > BMB_MAXIMUM_MESSAGE_SIZE) || (size > 0xFF)){
+        return 0;
+    }
+    for(i = 0; i < n; i++){
+        lrc = (uint8_t)(lrc + frame[i]);
+    }
+    lrc = (uint8_t)(0 - lrc);
+    frame[size - 1] = '\n';
+    frame[size - 2] = '\r';
+    frame[size - 3] = bmodbus_hex_digits[lrc & 0x0F];
+    frame[size - 4] = bmodbus_hex_digits[lrc >> 4];
+    //Working backwards never overwrites a byte that has not been expanded yet
+    for(i = n; i > 0; i--){
+        value = frame[i - 1];
+        frame[2 * i] = bmodbus_hex_digits[value & 0x0F];
+        frame[2 * i - 1] = bmodbus_hex_digits[value >> 4];
+    }
+    frame[0] = ':';
+    return size;
+}
+#endif //BMB_CLIENT_ASCII || BMB_MASTER_ASCII
+
+//Returns the frame shape of a function code, or NULL if the function is not supported
+static const bmodbus_function_t * bmodbus_function_shape(uint8_t function){
+    if((function >= BMB_FUNCTION_TABLE_SIZE) || !(bmodbus_functions[function].flags & BMB_FUNCTION_SUPPORTED)){
+        return NULL;
+    }
+    return &bmodbus_functions[function];
+}
+
+uint16_t bmodbus_request_length(const uint8_t * frame, uint16_t length){
+    const bmodbus_function_t * shape;
+    uint16_t count_index;
+    if(length < 2){
+        return 0;
+    }
+    shape = bmodbus_function_shape(frame[1]);
+    if(shape == NULL){
+        return length; //Nothing tells where it ends, it is rejected as a whole
+    }
+    if(!(shape->flags & BMB_FUNCTION_BYTE_COUNT)){
+        return 2 + shape->header_length + 2;
+    }
+    count_index = 2 + shape->header_length; //The byte count follows the header
+    if(length <= count_index){
+        return 0;
+    }
+    return count_index + 1 + frame[count_index] + 2;
+}
+
+//Rejected frames whose length is given by the byte count that comes next
+#define BMB_REJECT_BYTE_COUNT (0xFFFF)
+
+//Skips the rest of a frame that will be answered with an exception, the reply is only sent once its CRC is valid
+//remaining is the number of bytes left after this one (CRC included), BMB_REJECT_BYTE_COUNT, or 0 if it is not known
+static void client_reject(modbus_client_t *bmodbus, uint8_t exception, uint16_t remaining){
+    if(bmodbus->broadcast){ //Nobody would be listening to the exception
+        bmodbus->state = CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE;
+        return;
+    }
+    bmodbus->payload.request.function = bmodbus->function;
+    bmodbus->payload.request.result = (int8_t)exception;
+    bmodbus->index = 0;
+    bmodbus->reject_remaining = remaining;
+    bmodbus->state = CLIENT_STATE_REJECTING;
+}
+
+//Checks the values of the header against the specification, returns the exception code or 0 if it is valid
+static uint8_t client_header_exception(modbus_client_t *bmodbus, const bmodbus_function_t * shape){
+    uint16_t count;
+    if(shape->flags & BMB_FUNCTION_FILE){ //Only the byte count, it is checked when it arrives
+        return 0;
+    }
+    if(shape->bits_per_unit){ //The count is the last word of the header
+        count = bmodbus->header.word[shape->header_length / 2 - 1];
+        if((count == 0) || (count > shape->max_count)){
+            return MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+        }
+        //Valid requests can still be too large for the buffer, the data written is received into it
+        if(!CLIENT_IS_PROMISCUOUS(bmodbus) && (shape->flags & BMB_FUNCTION_BYTE_COUNT) && (((uint32_t)count * shape->bits_per_unit + 7) / 8 > sizeof(bmodbus->payload.request.data))){
+            return MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+        }
+#ifdef BMB_CLIENT_READ_WRITE_FUNCTION
+        if(bmodbus->function == 0x17){ //The registers read are the first count
+            count = bmodbus->header.word[1];
+            if((count == 0) || (count > BMB_READ_WRITE_MAXIMUM_READ)){
+                return MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+            }
+        }
+#endif //BMB_CLIENT_READ_WRITE_FUNCTION
+        //and the data read is answered in place, after the address, function and byte count and before the CRC
+        if(!CLIENT_IS_PROMISCUOUS(bmodbus) && (shape->flags & BMB_FUNCTION_READ) && (3 + ((uint32_t)count * shape->bits_per_unit + 7) / 8 + 2 > CLIENT_RESPONSE_ROOM(bmodbus))){
+            return MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+        }
+    }else if((bmodbus->function == 5) && (bmodbus->header.word[1] != 0x0000) && (bmodbus->header.word[1] != 0xFF00)){
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+    }
+    return 0;
+}
+
+static void client_header_complete(modbus_client_t *bmodbus, const bmodbus_function_t * shape){
+    uint8_t i;
+    //Endianness conversion
+    for(i = 0; i < shape->header_length / 2; i++){
+        bmodbus->header.word[i] = MODBUS_HTONS(bmodbus->header.word[i]);
+    }
+    i = client_header_exception(bmodbus, shape);
+    if(i){
+        client_reject(bmodbus, i, (shape->flags & BMB_FUNCTION_BYTE_COUNT) ? BMB_REJECT_BYTE_COUNT : 2);
+    }else if(shape->flags & BMB_FUNCTION_FILE){
+        bmodbus->state = CLIENT_STATE_HEADER_CHECK; //The byte count is the only length information
+    }else if(shape->flags & BMB_FUNCTION_BYTE_COUNT){
+        //The count is always the last word of the header, it is converted to the number of data bytes expected
+        bmodbus->byte_size = (uint8_t)(((uint32_t)bmodbus->header.word[shape->header_length / 2 - 1] * shape->bits_per_unit + 7) / 8);
+        bmodbus->state = CLIENT_STATE_HEADER_CHECK;
+    }else{
+        bmodbus->state = CLIENT_STATE_FOOTER;
+    }
+}
+
+#ifdef BMB_CLIENT_FILE_RECORD
+void bmodbus_client_set_file_records(modbus_client_t *bmodbus, const modbus_file_record_t *files){
+    bmodbus->files = files;
+}
+
+//Validates the byte count of a file record request and prepares the sub-request parser, returns the exception code or 0
+static uint8_t client_file_record_start(modbus_client_t *bmodbus, uint8_t byte_count){
+    if(bmodbus->files == NULL){
+        return MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+    }
+    if((byte_count < 7) || (byte_count > BMB_FILE_MAXIMUM_BYTE_COUNT)){
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+    }
+    if((bmodbus->function == 0x15) && (3 + byte_count + 2 > CLIENT_RESPONSE_ROOM(bmodbus))){
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE; //The response is an echo of the request, so it has to fit
+    }
+    bmodbus->byte_size = byte_count;
+    bmodbus->file_index = 0;
+    bmodbus->file_remaining = 0;
+    bmodbus->file_offset = 3; //Address, function and length come first in the read response
+    bmodbus->file_status = 0;
+    return 0;
+}
+
+//Streams one data byte of a file record request, sub-request headers are collected and record data is passed to the callbacks
+static void client_file_record_byte(modbus_client_t *bmodbus, uint8_t byte){
+    const modbus_file_record_t * files = bmodbus->files;
+    uint16_t value, length, i;
+    int8_t status;
+    if(bmodbus->function == 0x15){
+        bmodbus->payload.response.data[3 + bmodbus->index] = byte; //Write responses are an echo of the request
+    }
+    if(bmodbus->file_remaining){ //Record data of a write sub-request
+        bmodbus->file_remaining--;
+        if(!(bmodbus->file_remaining & 1)){ //Low byte, the high byte is already in the echo
+            value = ((uint16_t)bmodbus->payload.response.data[3 + bmodbus->index - 1] << 8) | byte;
+            if(bmodbus->file_status == 0){
+                bmodbus->file_status = files->write(files->context, bmodbus->file_number, bmodbus->file_record, value);
+            }
+            bmodbus->file_record++;
+        }
+    }else if(bmodbus->file_index == 0){
+        if((byte != BMB_FILE_REFERENCE_TYPE) && (bmodbus->file_status == 0)){
+            bmodbus->file_status = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        }
+        bmodbus->file_index++;
+    }else{
+        bmodbus->header.byte[bmodbus->file_index - 1] = byte;
+        bmodbus->file_index++;
+        if(bmodbus->file_index == 7){ //Sub-request header complete
+            bmodbus->file_index = 0;
+            bmodbus->file_number = MODBUS_HTONS(bmodbus->header.word[0]);
+            bmodbus->file_record = MODBUS_HTONS(bmodbus->header.word[1]);
+            length = MODBUS_HTONS(bmodbus->header.word[2]);
+            if(bmodbus->function == 0x15){
+                //The record data can't run past the byte count, what is left of it is skipped otherwise
+                bmodbus->file_remaining = bmodbus->byte_size - bmodbus->index - 1;
+                if((uint32_t)2 * length > bmodbus->file_remaining){
+                    if(bmodbus->file_status == 0){
+                        bmodbus->file_status = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+                    }
+                }else{
+                    bmodbus->file_remaining = 2 * length;
+                }
+            }else if(((uint32_t)bmodbus->file_offset + 2 + 2 * length + 2 > CLIENT_RESPONSE_ROOM(bmodbus)) ||
+                     ((uint32_t)bmodbus->file_offset - 3 + 2 + 2 * length > BMB_FILE_MAXIMUM_BYTE_COUNT)){
+                bmodbus->file_status = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE; //The read response would not fit
+            }
+            if(((bmodbus->file_record >= BMB_FILE_RECORDS_PER_FILE) || (length > BMB_FILE_RECORDS_PER_FILE - bmodbus->file_record)) &&
+               (bmodbus->file_status == 0)){
+                bmodbus->file_status = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS; //Records are numbered 0 to 9999
+            }
+            if((bmodbus->function == 0x14) && (bmodbus->file_status == 0)){
+                //Reads are pulled from the source straight into the response
+                bmodbus->payload.response.data[bmodbus->file_offset++] = 1 + 2 * length;
+                bmodbus->payload.response.data[bmodbus->file_offset++] = BMB_FILE_REFERENCE_TYPE;
+                for(i = 0; (i < length) && (bmodbus->file_status == 0); i++){
+                    status = files->read(files->context, bmodbus->file_number, bmodbus->file_record + i, &value);
+                    if(status){
+                        bmodbus->file_status = status;
+                    }
+                    bmodbus->payload.response.data[bmodbus->file_offset++] = (value & 0xFF00) >> 8;
+                    bmodbus->payload.response.data[bmodbus->file_offset++] = value & 0xFF;
+                }
+            }
+        }
+    }
+}
+
+//Tells the application whether the records streamed by a write file record request can be committed
+static void client_file_record_complete(modbus_client_t *bmodbus, uint8_t valid){
+    if((bmodbus->function == 0x15) && (bmodbus->files != NULL) && (bmodbus->files->write_complete != NULL)){
+        bmodbus->files->write_complete(bmodbus->files->context, valid && (bmodbus->file_status == 0));
+    }
+}
+#endif //BMB_CLIENT_FILE_RECORD
+
+//Drops whatever frame was in progress and waits for the address of the next one
+static void client_frame_restart(modbus_client_t *bmodbus){
+    if((CLIENT_CRC_STATES | ((uint16_t)1 << CLIENT_STATE_FOOTER2)) & ((uint16_t)1 << bmodbus->state)){
+        BMB_COUNT(bmodbus, framing_errors); //The frame was cut short
+    }
+#ifdef BMB_LATENCY
+    bmodbus->latency_pending = 0; //Any request being handled is lost
+#endif //BMB_LATENCY
+#ifdef BMB_CLIENT_FILE_RECORD
+    if((bmodbus->state == CLIENT_STATE_DATA) || (bmodbus->state == CLIENT_STATE_FOOTER) || (bmodbus->state == CLIENT_STATE_FOOTER2)){
+        client_file_record_complete(bmodbus, 0); //The frame was cut short
+    }
+#endif //BMB_CLIENT_FILE_RECORD
+    bmodbus->state = CLIENT_STATE_IDLE;
+    bmodbus->byte_count = 0;
+    bmodbus->crc.half = 0xFFFF;
+}
+
+//Runs one byte of the frame through the state machine, the framing (RTU timing or ASCII delimiters) is handled by the caller
+static void client_parse_byte(modbus_client_t *bmodbus, uint8_t byte){
+    const bmodbus_function_t * shape;
+    uint8_t i;
     switch(bmodbus->state){
         case CLIENT_STATE_IDLE:
-            if(byte == bmodbus->client_address){
+            BMB_COUNT(bmodbus, frames);
+#ifdef BMB_MONITOR
+            if(bmodbus->promiscuous){
+                bmodbus->client_address = byte;
+            }
+#endif //BMB_MONITOR
+            if((byte == bmodbus->client_address) || (byte == MODBUS_BROADCAST_ADDRESS)){
+                BMB_COUNT(bmodbus, frames_for_us);
+                bmodbus->broadcast = (byte == MODBUS_BROADCAST_ADDRESS);
                 bmodbus->state = CLIENT_STATE_FUNCTION_CODE;
             }else{
-                //FIXME we should add optional tracking of errors for debug purposes
-                //FIXME future work, we can add broadcast here
                 bmodbus->state = CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE;
             }
             break;
         case CLIENT_STATE_FUNCTION_CODE:
             bmodbus->function = byte;
-            bmodbus->state = CLIENT_STATE_HEADER;
+            shape = bmodbus_function_shape(byte);
+            if(shape == NULL){
+                client_reject(bmodbus, MODBUS_EXCEPTION_ILLEGAL_FUNCTION, 0); //The shape of the frame is not known
+            }else if(bmodbus->broadcast && !(shape->flags & BMB_FUNCTION_WRITE)){
+                bmodbus->state = CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE; //Only writes can be broadcast
+            }else if(shape->header_length){
+                bmodbus->state = CLIENT_STATE_HEADER;
+            }else{
+                client_header_complete(bmodbus, shape);
+            }
             break;
         case CLIENT_STATE_HEADER:
+            shape = &bmodbus_functions[bmodbus->function];
             bmodbus->header.byte[bmodbus->byte_count-2] = byte;
-            if(bmodbus->byte_count == 5){
-                //Endianness conversion
-                bmodbus->header.word[0] = MODBUS_HTONS(bmodbus->header.word[0]);
-                bmodbus->header.word[1] = MODBUS_HTONS(bmodbus->header.word[1]);
-                if(bmodbus->function == 16) { //These are the only functions that have a byte count
-                    bmodbus->state = CLIENT_STATE_HEADER_CHECK;
-                    bmodbus->byte_size = 2 * bmodbus->header.word[1]; //Bytes for number of registers
-                    //FIXME -- ensure byte_size cannot be more than 250
-                }else if(bmodbus->function == 15){
-                    bmodbus->state = CLIENT_STATE_HEADER_CHECK;
-                    bmodbus->byte_size = (bmodbus->header.word[1] + 7) / 8;//Bytes for target number of bits
-                    //FIXME -- ensure byte_size cannot be more than 250
-                }else{
-                    bmodbus->state = CLIENT_STATE_FOOTER;
-                }
+            if(bmodbus->byte_count == 1 + shape->header_length){
+                client_header_complete(bmodbus, shape);
             }
             break;
         case CLIENT_STATE_HEADER_CHECK:
-            if(byte == bmodbus->byte_size) { //It contains a byte count and we compare it with 2x the number of 16bit registers
+#ifdef BMB_CLIENT_FILE_RECORD
+            if(bmodbus_functions[bmodbus->function].flags & BMB_FUNCTION_FILE){
+                i = client_file_record_start(bmodbus, byte);
+                if(i){
+                    client_reject(bmodbus, i, (uint16_t)byte + 2);
+                }else{
+                    bmodbus->index = 0;
+                    bmodbus->state = CLIENT_STATE_DATA;
+                }
+                break;
+            }
+#endif //BMB_CLIENT_FILE_RECORD
+            if(byte == bmodbus->byte_size) { //It contains a byte count and we compare it with the size computed from the header
                 bmodbus->index = 0;
                 bmodbus->state = CLIENT_STATE_DATA;
             }else{
-                //FIXME we should add optional tracking of errors for debug purposes
-                bmodbus->state = CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE;
+                BMB_COUNT(bmodbus, framing_errors);
+                client_reject(bmodbus, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, (uint16_t)byte + 2);
             }
             break;
         case CLIENT_STATE_DATA:
-            ((uint8_t*)bmodbus->payload.request.data)[bmodbus->index] = byte;
-            if(bmodbus->index & 1){ //Endianness conversion every completed word
-                bmodbus->payload.request.data[bmodbus->index/2] = MODBUS_HTONS(bmodbus->payload.request.data[bmodbus->index/2]);
+#ifdef BMB_CLIENT_FILE_RECORD
+            if(bmodbus_functions[bmodbus->function].flags & BMB_FUNCTION_FILE){
+                client_file_record_byte(bmodbus, byte);
+            }else
+#endif //BMB_CLIENT_FILE_RECORD
+            if(CLIENT_DATA_FITS(bmodbus)){
+                ((uint8_t*)bmodbus->payload.request.data)[bmodbus->index] = byte;
+                if((bmodbus->index & 1) && (bmodbus_functions[bmodbus->function].bits_per_unit == 16)){ //Endianness conversion every completed word
+                    bmodbus->payload.request.data[bmodbus->index/2] = MODBUS_HTONS(bmodbus->payload.request.data[bmodbus->index/2]);
+                }
             }
             bmodbus->index++;
             if(bmodbus->index == bmodbus->byte_size){
@@ -158,7 +889,10 @@ void bmodbus_client_next_byte(modbus_client_t *bmodbus, uint32_t microseconds, u
             if(bmodbus->crc.byte[1] == byte){
                 bmodbus->state = CLIENT_STATE_FOOTER2;
             }else{
-                //FIXME bad CRC
+                BMB_COUNT(bmodbus, crc_errors);
+#ifdef BMB_CLIENT_FILE_RECORD
+                client_file_record_complete(bmodbus, 0);
+#endif //BMB_CLIENT_FILE_RECORD
                 bmodbus->state = CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE;
             }
             break;
@@ -166,45 +900,245 @@ void bmodbus_client_next_byte(modbus_client_t *bmodbus, uint32_t microseconds, u
             if(bmodbus->crc.byte[0] == byte){
                 //FIXME --  either process the request OR just wait for a polling entry (pending request)
                 bmodbus->payload.request.function = bmodbus->function;
+#ifdef BMB_CLIENT_FILE_RECORD
+                if(bmodbus_functions[bmodbus->function].flags & BMB_FUNCTION_FILE){
+                    //The callbacks already did the work, so the response is ready
+                    if((bmodbus->file_index || bmodbus->file_remaining) && (bmodbus->file_status == 0)){
+                        bmodbus->file_status = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE; //The last sub-request was truncated
+                    }
+                    client_file_record_complete(bmodbus, 1);
+                    bmodbus->payload.request.result = bmodbus->file_status;
+                    bmodbus->state = CLIENT_STATE_RESPONSE_READY;
+                    break;
+                }
+#endif //BMB_CLIENT_FILE_RECORD
                 bmodbus->payload.request.address = bmodbus->header.word[0];
                 //Here we prep the request struct for higher layers
-                switch (bmodbus->function) {
-                    case 5:
+                if(bmodbus_functions[bmodbus->function].bits_per_unit){
+                    bmodbus->payload.request.size = bmodbus->header.word[1];
+#ifdef BMB_CLIENT_READ_WRITE_FUNCTION
+                    if(bmodbus->function == 0x17){ //The second address and count describe the write
+                        bmodbus->payload.request.address2 = bmodbus->header.word[2];
+                        bmodbus->payload.request.size2 = bmodbus->header.word[3];
+                    }
+#endif //BMB_CLIENT_READ_WRITE_FUNCTION
+                }else{ //Single writes carry their value (or masks) in the header
+                    if(bmodbus->function == 5){ //Only 0x0000 and 0xFF00 get this far
                         bmodbus->header.word[1] = bmodbus->header.word[1]?1:0;
-                        bmodbus->payload.request.size = 1;
-                        bmodbus->payload.request.data[0] = bmodbus->header.word[1];
-                        break;
-                    case 6:
-                        bmodbus->payload.request.size = 1;
-                        bmodbus->payload.request.data[0] = bmodbus->header.word[1];
-                        break;
-                    case 15:
-                    case 16:
-                    case 3:
-                    case 4:
-                    case 2:
-                    case 1:
-                        bmodbus->payload.request.size = bmodbus->header.word[1];
-                        break;
-                    default:
-                        break;
+                    }
+                    bmodbus->payload.request.size = (bmodbus_functions[bmodbus->function].header_length > 2) ? 1 : 0; //FIFO reads have no values yet
+                    for(i = 1; i < bmodbus_functions[bmodbus->function].header_length / 2; i++){
+                        bmodbus->payload.request.data[i - 1] = bmodbus->header.word[i];
+                    }
                 }
                 bmodbus->payload.request.result = 0;
                 bmodbus->state = CLIENT_STATE_PROCESSING_REQUEST;
             }else{
-                //FIXME bad CRC
+                BMB_COUNT(bmodbus, crc_errors);
+#ifdef BMB_CLIENT_FILE_RECORD
+                client_file_record_complete(bmodbus, 0);
+#endif //BMB_CLIENT_FILE_RECORD
                 bmodbus->state = CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE;
             }
             break;
+        case CLIENT_STATE_REJECTING:
+            if(CLIENT_IS_ASCII(bmodbus)){ //ASCII frames end with CR LF
+                break;
+            }
+            if(bmodbus->reject_remaining == BMB_REJECT_BYTE_COUNT){
+                bmodbus->reject_remaining = (uint16_t)byte + 2;
+            }else if(bmodbus->reject_remaining){ //The frame ends after a known number of bytes, its CRC has to be valid there
+                bmodbus->reject_remaining--;
+                if(bmodbus->reject_remaining == 0){
+                    if(crc_update(bmodbus->crc.half, byte) == 0){
+                        bmodbus->state = CLIENT_STATE_RESPONSE_READY;
+                    }else{
+                        BMB_COUNT(bmodbus, crc_errors);
+                        bmodbus->state = CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE;
+                    }
+                }
+            }else if(bmodbus->index && (crc_update(bmodbus->crc.half, byte) == 0)){
+                //The length of a frame with an unknown function is not known, it ends once the CRC over everything received is valid
+                bmodbus->state = CLIENT_STATE_RESPONSE_READY;
+            }
+            bmodbus->index++;
+            break;
         default: //Ignore bytes in all other states
             break;
     }
     bmodbus->byte_count++;
-    if((bmodbus->state == CLIENT_STATE_FUNCTION_CODE) || (bmodbus->state == CLIENT_STATE_HEADER) || (bmodbus->state == CLIENT_STATE_HEADER_CHECK) || (bmodbus->state == CLIENT_STATE_DATA) || (bmodbus->state == CLIENT_STATE_FOOTER)){
+    if(CLIENT_CRC_STATES & ((uint16_t)1 << bmodbus->state)){
         bmodbus->crc.half = crc_update(bmodbus->crc.half, byte);
     }
 }
 
+//States in which the client is receiving, as opposed to handling a request or sending its response
+#define CLIENT_RECEIVING_STATES (((uint16_t)1 << CLIENT_STATE_IDLE) | ((uint16_t)1 << CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE) | \
+    ((uint16_t)1 << CLIENT_STATE_FUNCTION_CODE) | ((uint16_t)1 << CLIENT_STATE_HEADER) | ((uint16_t)1 << CLIENT_STATE_HEADER_CHECK) | \
+    ((uint16_t)1 << CLIENT_STATE_DATA) | ((uint16_t)1 << CLIENT_STATE_FOOTER) | ((uint16_t)1 << CLIENT_STATE_FOOTER2) | \
+    ((uint16_t)1 << CLIENT_STATE_REJECTING))
+
+#ifdef BMB_CLIENT_ASCII
+void bmodbus_client_set_ascii(modbus_client_t *bmodbus, uint8_t enable){
+    ascii_init(&(bmodbus->ascii), enable);
+}
+
+//The LRC has been checked, so the frame gets the CRC the RTU state machine expects
+static void client_ascii_end(modbus_client_t *bmodbus){
+    uint16_t crc = bmodbus->crc.half;
+    if(bmodbus->state == CLIENT_STATE_FOOTER){
+        client_parse_byte(bmodbus, crc & 0xFF);
+        client_parse_byte(bmodbus, (crc & 0xFF00) >> 8);
+    }else if(bmodbus->state == CLIENT_STATE_REJECTING){
+        bmodbus->state = CLIENT_STATE_RESPONSE_READY;
+    }else{ //The frame length does not match its header
+        client_frame_restart(bmodbus);
+        bmodbus->state = CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE;
+    }
+}
+
+static void client_ascii_char(modbus_client_t *bmodbus, uint32_t microseconds, uint8_t c){
+    uint8_t event;
+    if(!(CLIENT_RECEIVING_STATES & ((uint16_t)1 << bmodbus->state))){
+        if(c == ':'){
+            BMB_COUNT(bmodbus, overruns);
+        }
+        return; //The previous request is still being handled
+    }
+    if((bmodbus->ascii.state != BMB_ASCII_IDLE) && ((microseconds - bmodbus->last_microseconds) > bmodbus->interframe_delay)){
+        //Too long between characters, drop the frame until the next ':'
+        client_frame_restart(bmodbus);
+        bmodbus->state = CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE;
+        bmodbus->ascii.state = BMB_ASCII_IDLE;
+    }
+    bmodbus->last_microseconds = microseconds;
+    event = ascii_next_char(&(bmodbus->ascii), c);
+    switch(event){
+        case BMB_ASCII_START:
+            client_frame_restart(bmodbus);
+            break;
+        case BMB_ASCII_BYTE:
+            client_parse_byte(bmodbus, bmodbus->ascii.value);
+            break;
+        case BMB_ASCII_END:
+            client_ascii_end(bmodbus);
+            break;
+        case BMB_ASCII_ERROR:
+            client_frame_restart(bmodbus);
+            bmodbus->state = CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE;
+            break;
+        default:
+            break;
+    }
+}
+#endif //BMB_CLIENT_ASCII
+
+static void client_next_byte(modbus_client_t *bmodbus, uint32_t microseconds, uint8_t byte){
+#ifdef BMB_BUS_PROFILE
+    if(bmodbus->bus_profile != NULL){
+        bmodbus_bus_profile_byte(bmodbus->bus_profile, microseconds);
+    }
+#endif //BMB_BUS_PROFILE
+#ifdef BMB_CLIENT_ASCII
+    if(bmodbus->ascii.enabled){
+        client_ascii_char(bmodbus, microseconds, byte);
+        return;
+    }
+#endif //BMB_CLIENT_ASCII
+    //If the time delta is greater than the interframe delay, we should reset the state machine, and then process from scratch
+    if((microseconds - bmodbus->last_microseconds) > bmodbus->interframe_delay){
+        if((bmodbus->state == CLIENT_STATE_PROCESSING_REQUEST) || (bmodbus->state == CLIENT_STATE_RESPONSE_READY)){
+            BMB_COUNT(bmodbus, overruns); //The request being handled is lost
+        }
+        client_frame_restart(bmodbus);
+    }
+    bmodbus->last_microseconds = microseconds;
+    client_parse_byte(bmodbus, byte);
+}
+
+void bmodbus_client_next_byte(modbus_client_t *bmodbus, uint32_t microseconds, uint8_t byte){
+#ifdef BMB_CAPTURE
+    if(bmodbus->capture != NULL){
+        bmodbus_capture_record(bmodbus->capture, microseconds, BMB_CAPTURE_CLIENT, &byte, 1, 0);
+    }
+#endif //BMB_CAPTURE
+    client_next_byte(bmodbus, microseconds, byte);
+}
+
+void bmodbus_client_received(modbus_client_t *bmodbus, uint32_t microseconds, uint8_t * bytes, uint8_t length, uint32_t microseconds_per_byte){
+    //Performs the receiving based upon the data received by repeatedly calling _next_byte
+    uint32_t t;
+    uint8_t i = 0;
+#ifdef BMB_CLIENT_ASCII
+    uint8_t hex;
+#endif //BMB_CLIENT_ASCII
+    if(length == 0){ //Skip empty requests
+        return;
+    }
+#ifdef BMB_CAPTURE
+    if(bmodbus->capture != NULL){
+        bmodbus_capture_record(bmodbus->capture, microseconds, BMB_CAPTURE_CLIENT, bytes, length, microseconds_per_byte);
+    }
+#endif //BMB_CAPTURE
+    t = microseconds - (length-1) * microseconds_per_byte;
+#ifdef BMB_CLIENT_ASCII
+    if(bmodbus->ascii.enabled){
+        while(i < length){
+            //Bulk path, whole hex pairs are decoded without going through the character state machine
+            if((i + 1 < length) && (bmodbus->ascii.state == BMB_ASCII_HIGH) && ((t - bmodbus->last_microseconds) <= bmodbus->interframe_delay) &&
+               ascii_hex_pair(bytes[i], bytes[i + 1], &hex)){
+                if(ascii_decoded(&(bmodbus->ascii), hex) == BMB_ASCII_BYTE){
+                    client_parse_byte(bmodbus, bmodbus->ascii.value);
+                }
+#ifdef BMB_BUS_PROFILE
+                if(bmodbus->bus_profile != NULL){
+                    bmodbus_bus_profile_byte(bmodbus->bus_profile, t);
+                    bmodbus_bus_profile_byte(bmodbus->bus_profile, t + microseconds_per_byte);
+                }
+#endif //BMB_BUS_PROFILE
+                t += 2 * microseconds_per_byte;
+                bmodbus->last_microseconds = t - microseconds_per_byte;
+                i += 2;
+            }else{
+                client_next_byte(bmodbus, t, bytes[i]); //Goes to client_ascii_char()
+                t += microseconds_per_byte;
+                i++;
+            }
+        }
+        return;
+    }
+#endif //BMB_CLIENT_ASCII
+    for(; i<length; i++){
+        client_next_byte(bmodbus, t, bytes[i]);
+        t += microseconds_per_byte;
+    }
+}
+
+void bmodbus_client_received_packet(modbus_client_t *bmodbus, uint32_t microseconds, const uint8_t * bytes, uint16_t length){
+    uint16_t i;
+#ifdef BMB_CAPTURE
+    if(bmodbus->capture != NULL){
+        bmodbus_capture_record(bmodbus->capture, microseconds, BMB_CAPTURE_CLIENT | BMB_CAPTURE_PACKET, bytes, length, 0);
+    }
+#endif //BMB_CAPTURE
+    if(!(CLIENT_RECEIVING_STATES & ((uint16_t)1 << bmodbus->state))){
+        BMB_COUNT(bmodbus, overruns);
+        return; //Still handling the previous request
+    }
+    //The packet boundary is the frame boundary, so no timing is involved
+    client_frame_restart(bmodbus);
+    bmodbus->last_microseconds = microseconds;
+    for(i = 0; i < length; i++){
+#ifdef BMB_CLIENT_ASCII
+        if(bmodbus->ascii.enabled){
+            client_ascii_char(bmodbus, microseconds, bytes[i]);
+            continue;
+        }
+#endif //BMB_CLIENT_ASCII
+        client_parse_byte(bmodbus, bytes[i]);
+    }
+}
+
 void bmodbus_client_loop(modbus_client_t *bmodbus, uint32_t microsecond){
     //FIXME -- currently not implemented
     MODBUS_UNUSED(bmodbus);
@@ -213,68 +1147,107 @@ void bmodbus_client_loop(modbus_client_t *bmodbus, uint32_t microsecond){
 }
 
 static void bmodbus_encode_client_response(modbus_client_t *bmodbus){
+    const bmodbus_function_t * shape = bmodbus_function_shape(bmodbus->function); //Only NULL for exceptions
     uint16_t temp1, temp2;
     int i;
     //This takes the request and encodes it into the response (assuming processing is completed)
-    switch (bmodbus->function){
-        case 5:
-        case 6:
-            //If failed return no response
-            if(bmodbus->payload.request.result){
-                bmodbus->payload.response.size = 0;
-                break;
-            }
-            if(bmodbus->function == 5) {
-                bmodbus->payload.request.data[0] = bmodbus->payload.request.data[0] ? 0xff00 : 0x0000;
+    if((bmodbus->function == 0x18) && (bmodbus->payload.request.result == 0) && (bmodbus->payload.request.size > CLIENT_FIFO_ROOM(bmodbus))
+#ifdef BMB_CLIENT_FIFO_QUEUE
+       && ((bmodbus->fifo == NULL) || (bmodbus->payload.request.address != bmodbus->fifo_address))
+#endif //BMB_CLIENT_FIFO_QUEUE
+      ){
+        //A queue longer than the response holds (31 values at most) is refused rather than cut short
+        bmodbus->payload.request.result = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+    }
+    if(bmodbus->broadcast){
+        //Broadcasts are applied but never answered
+        bmodbus->payload.response.size = 0;
+    }else if(bmodbus->payload.request.result > 0){
+        //Exception response, the function code gets its top bit set below
+        bmodbus->payload.response.data[2] = (uint8_t)bmodbus->payload.request.result;
+        bmodbus->payload.response.size = 3;
+    }else if(bmodbus->payload.request.result){
+        //If failed return no response
+        bmodbus->payload.response.size = 0;
+#ifdef BMB_CLIENT_FILE_RECORD
+    }else if(shape->flags & BMB_FUNCTION_FILE){
+        //The response was built while the request streamed in
+        if(bmodbus->function == 0x14){
+            bmodbus->payload.response.data[2] = bmodbus->file_offset - 3;
+            bmodbus->payload.response.size = bmodbus->file_offset;
+        }else{
+            bmodbus->payload.response.data[2] = bmodbus->byte_size;
+            bmodbus->payload.response.size = 3 + bmodbus->byte_size;
+        }
+#endif //BMB_CLIENT_FILE_RECORD
+    }else if(bmodbus->function == 0x18){
+        //Read FIFO queue has a 16 bit byte count, then the FIFO count and the values
+#ifdef BMB_CLIENT_FIFO_QUEUE
+        if((bmodbus->fifo != NULL) && (bmodbus->payload.request.address == bmodbus->fifo_address)){
+            //Drain the queue straight into the response frame, values that do not fit stay for the next read
+            temp1 = 0;
+            while((temp1 < CLIENT_FIFO_ROOM(bmodbus)) && (bmodbus->fifo->head != bmodbus->fifo->tail)){
+                temp2 = bmodbus->fifo->buffer[bmodbus->fifo->tail & bmodbus->fifo->mask];
+                bmodbus->payload.response.data[6 + 2 * temp1] = (temp2 & 0xFF00) >> 8;
+                bmodbus->payload.response.data[7 + 2 * temp1] = temp2 & 0xFF;
+                bmodbus->fifo->tail++;
+                temp1++;
             }
-            temp1 = bmodbus->payload.request.data[0];
-            temp2 = bmodbus->payload.request.address;
-            bmodbus->payload.response.size = 6;
-            bmodbus->payload.response.data[2] = (temp2 & 0xFF00) >> 8;
-            bmodbus->payload.response.data[3] = temp2 & 0xFF;
-            bmodbus->payload.response.data[4] = (temp1 & 0xFF00) >> 8;
-            bmodbus->payload.response.data[5] = temp1 & 0xFF;
-            break;
-        case 16:
-            //If failed return no response
-            if(bmodbus->payload.request.result){
-                bmodbus->payload.response.size = 0;
-                break;
+        }else
+#endif //BMB_CLIENT_FIFO_QUEUE
+        {
+            temp1 = bmodbus->payload.request.size; //Checked against CLIENT_FIFO_ROOM above
+            for(i=0;i<temp1;i++){
+                bmodbus->payload.request.data[i] = MODBUS_HTONS(bmodbus->payload.request.data[i]);
             }
-            //Store values from the request for the response
+            MODBUS_MEMMOVE(bmodbus->payload.response.data+6, bmodbus->payload.request.data, 2*temp1);
+        }
+        bmodbus->payload.response.data[2] = 0;
+        bmodbus->payload.response.data[3] = 2 + 2*temp1;
+        bmodbus->payload.response.data[4] = 0;
+        bmodbus->payload.response.data[5] = temp1;
+        bmodbus->payload.response.size = 6 + 2*temp1;
+    }else if(!(shape->flags & BMB_FUNCTION_READ)){
+        //Writes echo the address and either the count or the values written
+        temp2 = bmodbus->payload.request.address;
+        if(shape->bits_per_unit){
             temp1 = bmodbus->payload.request.size;
-            temp2 = bmodbus->payload.request.address;
+        }else if(bmodbus->function == 5) {
+            temp1 = bmodbus->payload.request.data[0] ? 0xff00 : 0x0000;
+        }else{
+            temp1 = bmodbus->payload.request.data[0];
+        }
+        if(bmodbus->function == 0x16){ //The OR mask is echoed as well, it is moved before the data is overwritten
+            bmodbus->payload.response.data[7] = bmodbus->payload.request.data[1] & 0xFF;
+            bmodbus->payload.response.data[6] = (bmodbus->payload.request.data[1] & 0xFF00) >> 8;
+            bmodbus->payload.response.size = 8;
+        }else{
             bmodbus->payload.response.size = 6;
-            bmodbus->payload.response.data[2] = (temp2 & 0xFF00) >> 8;
-            bmodbus->payload.response.data[3] = temp2 & 0xFF;
-            bmodbus->payload.response.data[4] = (temp1 & 0xFF00) >> 8;
-            bmodbus->payload.response.data[5] = temp1 & 0xFF;
-            break;
-        case 3:
-        case 4:
-            //If failed return no response
-            if(bmodbus->payload.request.result){
-                bmodbus->payload.response.size = 0;
-                break;
-            }
-            //Store values from the request for the response
-            temp1 = bmodbus->payload.request.size;
+        }
+        bmodbus->payload.response.data[2] = (temp2 & 0xFF00) >> 8;
+        bmodbus->payload.response.data[3] = temp2 & 0xFF;
+        bmodbus->payload.response.data[4] = (temp1 & 0xFF00) >> 8;
+        bmodbus->payload.response.data[5] = temp1 & 0xFF;
+    }else{
+        //Reads return a byte count followed by the packed bits or registers
+        temp1 = (uint16_t)(((uint32_t)bmodbus->payload.request.size * shape->bits_per_unit + 7) / 8);
+        if(shape->bits_per_unit == 16){
             //Endian flip the results
-            for(i=0;i<temp1;i++){
+            for(i=0;i<temp1/2;i++){
                 bmodbus->payload.request.data[i] = MODBUS_HTONS(bmodbus->payload.request.data[i]);
             }
-            //Move the payload data to the response at the offset
-            MODBUS_MEMMOVE(bmodbus->payload.response.data+3, bmodbus->payload.request.data, 2*temp1);
-            //FIXME above move could overflow buffer on a weird read request
-            bmodbus->payload.response.size = 3 + 2*temp1;
-            bmodbus->payload.response.data[2] = 2*temp1;
-            break;
+        }
+        //Move the payload data to the response at the offset
+        //The count was checked against the buffer when the header arrived (client_header_exception), so it fits
+        MODBUS_MEMMOVE(bmodbus->payload.response.data+3, bmodbus->payload.request.data, temp1);
+        bmodbus->payload.response.size = 3 + temp1;
+        bmodbus->payload.response.data[2] = temp1;
     }
     if(bmodbus->payload.response.size) {
         uint16_t response_crc = 0xFFFF;
         //All responses start the same...
         bmodbus->payload.response.data[0] = bmodbus->client_address;
-        bmodbus->payload.response.data[1] = bmodbus->function;
+        bmodbus->payload.response.data[1] = bmodbus->function | ((bmodbus->payload.request.result > 0) ? 0x80 : 0);
         //Calculate the CRC
         for (i = 0; i < bmodbus->payload.response.size; i++) {
             response_crc = crc_update(response_crc, bmodbus->payload.response.data[i]);
@@ -285,17 +1258,238 @@ static void bmodbus_encode_client_response(modbus_client_t *bmodbus){
     }
 }
 
+#ifdef BMB_CLIENT_REGISTER_BANK
+void bmodbus_client_set_holding_registers(modbus_client_t *bmodbus, uint16_t *registers, uint16_t start_address, uint16_t count){
+    bmodbus->holding_registers = registers;
+    bmodbus->holding_start = start_address;
+    bmodbus->holding_count = count;
+}
+
+//Returns the bank storage for count registers starting at address, or NULL if any of them are outside the bank
+static uint16_t * client_bank_registers(modbus_client_t *bmodbus, uint16_t address, uint16_t count){
+    if((bmodbus->holding_registers == NULL) || (address < bmodbus->holding_start) ||
+       ((uint32_t)address + count > (uint32_t)bmodbus->holding_start + bmodbus->holding_count)){
+        return NULL;
+    }
+    return bmodbus->holding_registers + (address - bmodbus->holding_start);
+}
+
+//Applies holding register requests that are completely inside the bank, so the response is ready without the application
+static void client_service_bank(modbus_client_t *bmodbus){
+    modbus_request_t * request = &(bmodbus->payload.request);
+    uint16_t * registers = NULL;
+    uint16_t i;
+    switch(request->function){
+        case 3: //Read holding registers
+        case 6: //Write single register
+        case 16: //Write multiple registers
+        case 0x16: //Mask write register
+            registers = client_bank_registers(bmodbus, request->address, request->size);
+            break;
+#ifdef BMB_CLIENT_READ_WRITE_FUNCTION
+        case 0x17: //Read/write multiple registers, both ranges must be inside the bank
+            if(client_bank_registers(bmodbus, request->address2, request->size2) != NULL){
+                registers = client_bank_registers(bmodbus, request->address, request->size);
+            }
+            break;
+#endif //BMB_CLIENT_READ_WRITE_FUNCTION
+        default:
+            break;
+    }
+    if(registers == NULL){ //Not for the bank, the application handles it
+        return;
+    }
+    BMB_REGISTER_BANK_LOCK();
+    switch(request->function){
+        case 3:
+            for(i = 0; i < request->size; i++){
+                request->data[i] = registers[i];
+            }
+            break;
+        case 6:
+        case 16:
+            for(i = 0; i < request->size; i++){
+                registers[i] = request->data[i];
+            }
+            break;
+        case 0x16:
+            registers[0] = (registers[0] & request->data[0]) | (request->data[1] & (uint16_t)~request->data[0]);
+            break;
+#ifdef BMB_CLIENT_READ_WRITE_FUNCTION
+        case 0x17: //The write happens before the read
+            for(i = 0; i < request->size2; i++){
+                bmodbus->holding_registers[request->address2 - bmodbus->holding_start + i] = request->data[i];
+            }
+            for(i = 0; i < request->size; i++){
+                request->data[i] = registers[i];
+            }
+            break;
+#endif //BMB_CLIENT_READ_WRITE_FUNCTION
+        default:
+            break;
+    }
+    BMB_REGISTER_BANK_UNLOCK();
+    bmodbus->state = CLIENT_STATE_RESPONSE_READY;
+}
+#endif //BMB_CLIENT_REGISTER_BANK
+
+#ifdef BMB_CLIENT_FIFO_QUEUE
+void bmodbus_fifo_init(modbus_fifo_t *fifo, uint16_t *buffer, uint8_t capacity){
+    fifo->buffer = buffer;
+    fifo->mask = capacity - 1;
+    fifo->head = 0;
+    fifo->tail = 0;
+}
+
+int8_t bmodbus_fifo_push(modbus_fifo_t *fifo, uint16_t value){
+    if((uint8_t)(fifo->head - fifo->tail) > fifo->mask){ //Full
+        return -1;
+    }
+    fifo->buffer[fifo->head & fifo->mask] = value;
+    fifo->head++;
+    return 0;
+}
+
+void bmodbus_client_set_fifo(modbus_client_t *bmodbus, uint16_t fifo_address, modbus_fifo_t *fifo){
+    bmodbus->fifo = fifo;
+    bmodbus->fifo_address = fifo_address;
+}
+#endif //BMB_CLIENT_FIFO_QUEUE
+
+#ifdef BMB_STATISTICS
+//Answers diagnostics and get comm event counter from the counters, both responses are two words like a single write echo
+static void client_service_diagnostics(modbus_client_t *bmodbus){
+    modbus_request_t * request = &(bmodbus->payload.request);
+    modbus_statistics_t * statistics = &(bmodbus->statistics);
+    if(request->function == 0x0B){
+        request->address = 0x0000; //The status, never busy as the request is being answered
+        request->data[0] = statistics->events;
+        return;
+    }
+    switch(request->address){ //The sub-function, the data word is echoed unless it is a counter
+        case MODBUS_DIAGNOSTIC_RETURN_QUERY_DATA:
+            break;
+        case MODBUS_DIAGNOSTIC_CLEAR_COUNTERS:
+            statistics_clear(statistics);
+            break;
+        case MODBUS_DIAGNOSTIC_BUS_MESSAGE_COUNT:
+            request->data[0] = statistics->frames;
+            break;
+        case MODBUS_DIAGNOSTIC_BUS_ERROR_COUNT:
+            request->data[0] = statistics->crc_errors;
+            break;
+        case MODBUS_DIAGNOSTIC_EXCEPTION_COUNT:
+            request->data[0] = statistics->exceptions;
+            break;
+        case MODBUS_DIAGNOSTIC_SERVER_MESSAGE_COUNT:
+            request->data[0] = statistics->frames_for_us;
+            break;
+        case MODBUS_DIAGNOSTIC_NO_RESPONSE_COUNT:
+            request->data[0] = statistics->no_responses;
+            break;
+        case MODBUS_DIAGNOSTIC_NAK_COUNT:
+            request->data[0] = 0;
+            break;
+        case MODBUS_DIAGNOSTIC_BUSY_COUNT:
+            request->data[0] = statistics->busy;
+            break;
+        case MODBUS_DIAGNOSTIC_OVERRUN_COUNT:
+            request->data[0] = statistics->overruns;
+            break;
+        case MODBUS_DIAGNOSTIC_CLEAR_OVERRUN:
+            statistics->overruns = 0;
+            break;
+        default:
+            request->result = MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+            break;
+    }
+}
+#endif //BMB_STATISTICS
+
+#if defined(BMB_CLIENT_REGISTER_BANK) || defined(BMB_CLIENT_FIFO_QUEUE) || defined(BMB_STATISTICS)
+//Handles requests the library can answer by itself, they move to CLIENT_STATE_RESPONSE_READY
+static void client_service_request(modbus_client_t *bmodbus){
+#ifdef BMB_STATISTICS
+    if((bmodbus->payload.request.function == 0x08) || (bmodbus->payload.request.function == 0x0B)){
+        client_service_diagnostics(bmodbus);
+        bmodbus->state = CLIENT_STATE_RESPONSE_READY;
+        return;
+    }
+#endif //BMB_STATISTICS
+#ifdef BMB_CLIENT_FIFO_QUEUE
+    if((bmodbus->payload.request.function == 0x18) && (bmodbus->fifo != NULL) && (bmodbus->payload.request.address == bmodbus->fifo_address)){
+        bmodbus->state = CLIENT_STATE_RESPONSE_READY; //The queue is drained when the response is encoded
+        return;
+    }
+#endif //BMB_CLIENT_FIFO_QUEUE
+#ifdef BMB_CLIENT_REGISTER_BANK
+    client_service_bank(bmodbus);
+#endif //BMB_CLIENT_REGISTER_BANK
+}
+#else
+#define client_service_request(bmodbus) MODBUS_UNUSED(bmodbus)
+#endif //BMB_CLIENT_REGISTER_BANK || BMB_CLIENT_FIFO_QUEUE || BMB_STATISTICS
+
+#ifdef BMB_STATISTICS
+//Counts the outcome of a request once its response has been built
+static void client_count_response(modbus_client_t *bmodbus){
+    int8_t result = bmodbus->payload.request.result;
+    if(bmodbus->broadcast || (result < 0)){
+        bmodbus->statistics.no_responses++;
+    }else if(result > 0){
+        bmodbus->statistics.exceptions++;
+        if(result == MODBUS_EXCEPTION_SERVER_DEVICE_BUSY){
+            bmodbus->statistics.busy++;
+        }
+    }
+    if((result == 0) && (bmodbus->function != 0x0B)){ //Fetching the counter is not an event
+        bmodbus->statistics.events++;
+    }
+}
+#else
+#define client_count_response(bmodbus) MODBUS_UNUSED(bmodbus)
+#endif //BMB_STATISTICS
+
+#ifdef BMB_LATENCY
+//Timestamps the request the first time the application sees it
+static void client_latency_start(modbus_client_t *bmodbus){
+    if(!bmodbus->latency_pending && (bmodbus->latency_clock != NULL) &&
+       ((bmodbus->state == CLIENT_STATE_PROCESSING_REQUEST) || (bmodbus->state == CLIENT_STATE_RESPONSE_READY))){
+        bmodbus->latency_start = bmodbus->latency_clock();
+        bmodbus->latency_pending = 1;
+    }
+}
+#else
+#define client_latency_start(bmodbus) MODBUS_UNUSED(bmodbus)
+#endif //BMB_LATENCY
+
 modbus_request_t * bmodbus_client_get_request(modbus_client_t * bmodbus){
+    client_latency_start(bmodbus);
     if(bmodbus->state == CLIENT_STATE_PROCESSING_REQUEST){
-        return &(bmodbus->payload.request);
+        client_service_request(bmodbus);
+        if(bmodbus->state == CLIENT_STATE_PROCESSING_REQUEST){
+            return &(bmodbus->payload.request);
+        }
     }
     return NULL;
 }
 
 modbus_uart_data_t * bmodbus_client_get_response(modbus_client_t * bmodbus){
+    client_latency_start(bmodbus);
     if(bmodbus->state == CLIENT_STATE_PROCESSING_REQUEST){
+        client_service_request(bmodbus);
+    }
+    if((bmodbus->state == CLIENT_STATE_PROCESSING_REQUEST) || (bmodbus->state == CLIENT_STATE_RESPONSE_READY)){
         //Here we process the request data structure into the UART response
         bmodbus_encode_client_response(bmodbus);
+#ifdef BMB_CLIENT_ASCII
+        if(bmodbus->ascii.enabled && bmodbus->payload.response.size){
+            //Responses were sized for ASCII before anything was read or written (CLIENT_RESPONSE_ROOM), so this only
+            //fails with buffers too small for a mask write echo (21 bytes), which are left unanswered
+            bmodbus->payload.response.size = (uint8_t)ascii_encode(bmodbus->payload.response.data, bmodbus->payload.response.size);
+        }
+#endif //BMB_CLIENT_ASCII
+        client_count_response(bmodbus);
         bmodbus->state = CLIENT_STATE_SENDING_RESPONSE;
         return &(bmodbus->payload.response);
     }else if(bmodbus->state == CLIENT_STATE_SENDING_RESPONSE){
@@ -304,44 +1498,219 @@ modbus_uart_data_t * bmodbus_client_get_response(modbus_client_t * bmodbus){
     return NULL;
 }
 
+#ifdef BMB_SCATTER_GATHER
+modbus_uart_vector_t * bmodbus_client_get_response_vector(modbus_client_t * bmodbus, const uint8_t * payload, modbus_uart_vector_t * vector){
+    const bmodbus_function_t * shape;
+    modbus_uart_data_t * response;
+    uint16_t length;
+    client_latency_start(bmodbus);
+    if(bmodbus->state == CLIENT_STATE_PROCESSING_REQUEST){
+        client_service_request(bmodbus);
+    }
+    shape = bmodbus_function_shape(bmodbus->function);
+    if((payload != NULL) && (bmodbus->state == CLIENT_STATE_PROCESSING_REQUEST) && !bmodbus->broadcast && !CLIENT_IS_ASCII(bmodbus) &&
+       (bmodbus->payload.request.result == 0) && (shape != NULL) && (shape->flags & BMB_FUNCTION_READ) && !(shape->flags & BMB_FUNCTION_FILE)){
+        //Only the address, function and byte count are built, the data is sent from the application
+        length = (uint16_t)(((uint32_t)bmodbus->payload.request.size * shape->bits_per_unit + 7) / 8);
+        bmodbus->payload.response.data[0] = bmodbus->client_address;
+        bmodbus->payload.response.data[1] = bmodbus->function;
+        bmodbus->payload.response.data[2] = (uint8_t)length;
+        bmodbus->payload.response.size = 3;
+        client_count_response(bmodbus);
+        bmodbus->state = CLIENT_STATE_SENDING_RESPONSE;
+        return vector_build(vector, bmodbus->payload.response.data, 3, payload, length);
+    }
+    response = bmodbus_client_get_response(bmodbus);
+    if(response == NULL){
+        return NULL;
+    }
+    return vector_single(vector, response->data, response->size);
+}
+#endif //BMB_SCATTER_GATHER
+
 void bmodbus_client_send_complete(modbus_client_t * bmodbus){
     //This is called when the response has been sent
     if(bmodbus->state == CLIENT_STATE_SENDING_RESPONSE){
+#ifdef BMB_LATENCY
+        if(bmodbus->latency_pending){
+            latency_record(&(bmodbus->latency), bmodbus->function, bmodbus->latency_clock() - bmodbus->latency_start);
+        }
+#endif //BMB_LATENCY
         bmodbus->state = CLIENT_STATE_IDLE;
         bmodbus->byte_count = 0;
         bmodbus->crc.half = 0xFFFF;
     }
+#ifdef BMB_LATENCY
+    bmodbus->latency_pending = 0;
+#endif //BMB_LATENCY
+}
+
+#ifdef BMB_STATISTICS
+const modbus_statistics_t * bmodbus_client_statistics(modbus_client_t *bmodbus){
+    return &(bmodbus->statistics);
+}
+
+void bmodbus_client_clear_statistics(modbus_client_t *bmodbus){
+    statistics_clear(&(bmodbus->statistics));
+}
+#endif //BMB_STATISTICS
+
+#ifdef BMB_CAPTURE
+void bmodbus_client_set_capture(modbus_client_t *bmodbus, modbus_capture_t *capture){
+    bmodbus->capture = capture;
+}
+#endif //BMB_CAPTURE
+
+#ifdef BMB_BUS_PROFILE
+void bmodbus_client_set_bus_profile(modbus_client_t *bmodbus, modbus_bus_profile_t *profile){
+    bmodbus->bus_profile = profile;
+}
+#endif //BMB_BUS_PROFILE
+
+#ifdef BMB_LATENCY
+void bmodbus_client_set_latency_clock(modbus_client_t *bmodbus, modbus_clock_t clock){
+    bmodbus->latency_clock = clock;
+}
+
+const modbus_latency_t * bmodbus_client_latency(modbus_client_t *bmodbus){
+    return &(bmodbus->latency);
+}
+
+void bmodbus_client_clear_latency(modbus_client_t *bmodbus){
+    latency_clear(&(bmodbus->latency));
 }
+#endif //BMB_LATENCY
 
 #ifndef BMODBUS_NO_MASTER
 void bmodbus_master_init(modbus_master_t *bmodbus, uint32_t interframe_delay){
     bmodbus->state = MASTER_STATE_IDLE;
     bmodbus->interframe_delay = interframe_delay;
+    bmodbus->turnaround_delay = BMB_TURNAROUND_DELAY_MICROSECONDS;
     bmodbus->crc.half = 0xFFFF;
     bmodbus->byte_count = 0;
+#ifdef BMB_MASTER_ASCII
+    ascii_init(&(bmodbus->ascii), 0);
+#endif //BMB_MASTER_ASCII
+#ifdef BMB_STATISTICS
+    statistics_clear(&(bmodbus->statistics));
+    bmodbus->failed = 0;
+#endif //BMB_STATISTICS
+#ifdef BMB_LATENCY
+    latency_clear(&(bmodbus->latency));
+#endif //BMB_LATENCY
+#ifdef BMB_BUS_PROFILE
+    bmodbus->bus_profile = NULL;
+#endif //BMB_BUS_PROFILE
+#ifdef BMB_CAPTURE
+    bmodbus->capture = NULL;
+#endif //BMB_CAPTURE
+#ifdef BMB_MASTER_CALLBACK
+    bmodbus->callback = NULL;
+#endif //BMB_MASTER_CALLBACK
+}
+
+#ifdef BMB_MASTER_ASCII
+void bmodbus_master_set_ascii(modbus_master_t *bmodbus, uint8_t enable){
+    ascii_init(&(bmodbus->ascii), enable);
+}
+#endif //BMB_MASTER_ASCII
+
+void bmodbus_master_set_turnaround_delay(modbus_master_t *bmodbus, uint32_t turnaround_delay){
+    bmodbus->turnaround_delay = turnaround_delay;
+}
+
+void bmodbus_master_loop(modbus_master_t *bmodbus, uint32_t microseconds){
+    if((bmodbus->state == MASTER_STATE_TURNAROUND) && ((microseconds - bmodbus->last_microseconds) >= bmodbus->turnaround_delay)){
+        //Nothing comes back from a broadcast, it is complete once every client had the time to apply it
+        bmodbus->payload.response.function = bmodbus->function;
+        bmodbus->payload.response.address = bmodbus->register_address;
+        bmodbus->payload.response.size = 0;
+        bmodbus->payload.response.result = 0;
+        bmodbus->state = MASTER_STATE_RESPONSE_READY;
+        MASTER_COMPLETE(bmodbus, &(bmodbus->payload.response));
+    }
 }
 
 void bmodbus_master_send_complete(modbus_master_t * bmodbus, uint32_t microseconds){
     //This is called when the response has been sent
     if(bmodbus->state == MASTER_STATE_SENDING_REQUEST){
         bmodbus->last_microseconds = microseconds;
+#ifdef BMB_LATENCY
+        bmodbus->latency_start = microseconds;
+#endif //BMB_LATENCY
+#ifdef BMB_BUS_PROFILE
+        if(bmodbus->bus_profile != NULL){
+            bmodbus_bus_profile_sent(bmodbus->bus_profile, microseconds, bmodbus->payload.request.size);
+        }
+#endif //BMB_BUS_PROFILE
+#ifdef BMB_CAPTURE
+        if(bmodbus->capture != NULL){ //The expected length lets a replay wait for the response like the master did
+            bmodbus_capture_record(bmodbus->capture, microseconds, BMB_CAPTURE_MASTER_SENT, bmodbus->payload.request.data,
+                                   bmodbus->payload.request.size, bmodbus->payload.request.expected_response_size);
+        }
+#endif //BMB_CAPTURE
         bmodbus->byte_count = 0;
         bmodbus->crc.half = 0xFFFF;
-        bmodbus->state = MASTER_STATE_WAITING_FOR_RESPONSE;
+        if(bmodbus->client_address == MODBUS_BROADCAST_ADDRESS){
+            bmodbus->state = MASTER_STATE_TURNAROUND; //Completed by bmodbus_master_loop()
+        }else{
+            bmodbus->state = MASTER_STATE_WAITING_FOR_RESPONSE;
+        }
+    }
+}
+
+//Concatenates the records of every sub-response into the response data, returns nonzero if the response is malformed
+static uint8_t master_file_record_response(modbus_master_t *bmodbus){
+    uint16_t offset = 3, end = 3 + bmodbus->payload.request.data[2], length, i;
+    uint8_t * frame = bmodbus->payload.request.data;
+    if(end != bmodbus->byte_count - 2){
+        return 1;
+    }
+    bmodbus->payload.response.size = 0;
+    while(offset < end){
+        length = frame[offset];
+        if((length < 1) || !(length & 1) || (frame[offset + 1] != BMB_FILE_REFERENCE_TYPE) || (offset + 1 + length > end)){
+            return 1;
+        }
+        offset += 2;
+        //The output never overtakes the input since it skips the length and reference bytes
+        for(i = 0; i < length / 2; i++){
+            bmodbus->payload.response.data[bmodbus->payload.response.size++] = ((uint16_t)frame[offset] << 8) | frame[offset + 1];
+            offset += 2;
+        }
     }
+    return 0;
+}
+
+//Drops a response that cannot be used and gives up on the request, error 3 is a bad CRC and the others are framing errors
+static void master_drop_response(modbus_master_t *bmodbus, uint8_t error){
+    MODBUS_UNUSED(error); //Only used by the hooks
+    MODBUS_MASTER_ERROR(error);
+#ifdef BMB_STATISTICS
+    if(error == 3){
+        bmodbus->statistics.crc_errors++;
+    }else{
+        bmodbus->statistics.framing_errors++;
+    }
+    bmodbus->failed = 1;
+#endif //BMB_STATISTICS
+    bmodbus->state = MASTER_STATE_IDLE;
+    MASTER_COMPLETE(bmodbus, NULL);
 }
 
 static void master_receive_completed(modbus_master_t *bmodbus){
+    const bmodbus_function_t * shape;
+    uint16_t status, value;
     //Here we validate the request and then handle it, it must only be called after a complete message has been received
     bmodbus->state = MASTER_STATE_PROCESSING_RESPONSE;
+    BMB_COUNT(bmodbus, frames);
     if(bmodbus->payload.request.data[0] != bmodbus->client_address){
-        MODBUS_MASTER_ERROR(1);
-        bmodbus->state = MASTER_STATE_IDLE;
+        master_drop_response(bmodbus, 1);
         return;
     }
-    if(bmodbus->payload.request.data[1] != bmodbus->function){
-        MODBUS_MASTER_ERROR(2);
-        bmodbus->state = MASTER_STATE_IDLE;
+    BMB_COUNT(bmodbus, frames_for_us);
+    if((bmodbus->payload.request.data[1] & 0x7F) != bmodbus->function){
+        master_drop_response(bmodbus, 2);
         return;
     }
     //Check the crc
@@ -351,59 +1720,134 @@ static void master_receive_completed(modbus_master_t *bmodbus){
     }
     expected = (bmodbus->payload.request.data[bmodbus->byte_count - 1] << 8) | bmodbus->payload.request.data[bmodbus->byte_count - 2];
     if(crc != expected){
-        MODBUS_MASTER_ERROR(3);
-        bmodbus->state = MASTER_STATE_IDLE;
+        master_drop_response(bmodbus, 3);
         return;
     }
     //Valid message, now parse it into the response
-    switch (bmodbus->function) {
-        case 5: //Write single coil
-            bmodbus->payload.response.size=1;
-            bmodbus->payload.response.data[0] = (bmodbus->payload.request.data[2]?1 : 0);
+    shape = &bmodbus_functions[bmodbus->function];
+    if(bmodbus->payload.request.data[1] & 0x80){ //Exception, the code is passed on as the result
+        BMB_COUNT(bmodbus, exceptions);
+        bmodbus->payload.response.result = (int8_t)bmodbus->payload.request.data[2];
+        bmodbus->payload.response.size = 0;
+    }else if(bmodbus->function == 0x18){ //Read FIFO queue
+        bmodbus->payload.response.size = ((uint16_t)bmodbus->payload.request.data[4] << 8) | bmodbus->payload.request.data[5];
+        if(2 + 2 * bmodbus->payload.response.size != bmodbus->payload.request.data[3]){
+            master_drop_response(bmodbus, 4);
+            return;
+        }
+        MODBUS_MEMMOVE((uint8_t *) (bmodbus->payload.response.data), bmodbus->payload.request.data + 6, 2 * bmodbus->payload.response.size);
+        for (uint8_t i = 0; i < bmodbus->payload.response.size; i++) {
+            bmodbus->payload.response.data[i] = MODBUS_HTONS(bmodbus->payload.response.data[i]);
+        }
+        bmodbus->payload.response.result = 0;
+    }else if(bmodbus->function == 0x14){ //Read file record
+        if(master_file_record_response(bmodbus)){
+            master_drop_response(bmodbus, 4);
+            return;
+        }
+        bmodbus->payload.response.result = 0;
+    }else if((bmodbus->function == 0x08) || (bmodbus->function == 0x0B)){ //The sub-function (or the status) and a data word
+        status = ((uint16_t)bmodbus->payload.request.data[2] << 8) | bmodbus->payload.request.data[3];
+        value = ((uint16_t)bmodbus->payload.request.data[4] << 8) | bmodbus->payload.request.data[5];
+        if(bmodbus->function == 0x0B){
+            bmodbus->payload.response.data[0] = status;
+            bmodbus->payload.response.data[1] = value;
+            bmodbus->payload.response.size = 2;
+        }else{
+            bmodbus->payload.response.data[0] = value;
+            bmodbus->payload.response.size = 1;
+        }
+        bmodbus->payload.response.result = 0;
+    }else if(bmodbus->function == 5){ //Write single coil
+        bmodbus->payload.response.size=1;
+        bmodbus->payload.response.data[0] = (bmodbus->payload.request.data[4]?1 : 0);
+    }else if(!(shape->flags & BMB_FUNCTION_READ)){ //Writes have nothing to return
+        bmodbus->payload.response.size = 0;
+        bmodbus->payload.response.result = 0; //Success
+    }else{ //Reads
+        if (bmodbus->byte_count - 5 != bmodbus->payload.request.data[2]) {
+            master_drop_response(bmodbus, 4);
+            return;
+        }
+        MODBUS_MEMMOVE((uint8_t *) (bmodbus->payload.response.data), bmodbus->payload.request.data + 3,
+                       bmodbus->byte_count - 5);
+        bmodbus->payload.response.result = 0;
+        bmodbus->payload.response.size = bmodbus->byte_count - 5;
+        //These operate on word by word, so we need to convert the endianness
+        if (shape->bits_per_unit == 16) {
+            bmodbus->payload.response.size = bmodbus->payload.response.size / 2; //Number of words
+            for (uint8_t i = 0; i < bmodbus->payload.response.size; i++) {
+                bmodbus->payload.response.data[i] = MODBUS_HTONS(bmodbus->payload.response.data[i]);
+            }
+        }
+    }
+    bmodbus->payload.response.function = bmodbus->function;
+    bmodbus->payload.response.address = bmodbus->register_address;
+    bmodbus->state = MASTER_STATE_RESPONSE_READY;
+#ifdef BMB_LATENCY
+    latency_record(&(bmodbus->latency), bmodbus->function, bmodbus->last_microseconds - bmodbus->latency_start);
+#endif //BMB_LATENCY
+    MASTER_COMPLETE(bmodbus, &(bmodbus->payload.response));
+}
+
+#ifdef BMB_MASTER_ASCII
+static void master_ascii_byte(modbus_master_t *bmodbus, uint8_t byte){
+    if(bmodbus->byte_count + 2 >= BMB_MAXIMUM_MESSAGE_SIZE){
+        BMB_COUNT(bmodbus, overruns);
+        bmodbus->ascii.state = BMB_ASCII_IDLE; //No room left for the frame and its CRC
+    }else{
+        bmodbus->payload.request.data[bmodbus->byte_count++] = byte;
+    }
+}
+
+static void master_ascii_char(modbus_master_t *bmodbus, uint32_t microseconds, uint8_t c){
+    uint16_t crc = 0xFFFF;
+    uint8_t i;
+    if((bmodbus->ascii.state != BMB_ASCII_IDLE) && ((microseconds - bmodbus->last_microseconds) > bmodbus->interframe_delay)){
+        bmodbus->ascii.state = BMB_ASCII_IDLE; //Too long between characters, drop the frame until the next ':'
+    }
+    bmodbus->last_microseconds = microseconds;
+    switch(ascii_next_char(&(bmodbus->ascii), c)){
+        case BMB_ASCII_START:
+            bmodbus->byte_count = 0;
             break;
-        case 6: //Write single register
-        case 15: //Write multiple coils
-        case 16: //Write multiple registers
-            bmodbus->payload.response.size = 0;
-            bmodbus->payload.response.result = 0; //Success
+        case BMB_ASCII_BYTE:
+            master_ascii_byte(bmodbus, bmodbus->ascii.value);
             break;
-        case 1: //Read coils
-        case 2: //Read discrete inputs
-        case 3: //Read holding registers
-        case 4: //Read input registers
-            if (bmodbus->byte_count - 5 != bmodbus->payload.request.data[2]) {
-                MODBUS_MASTER_ERROR(4);
-                bmodbus->state = MASTER_STATE_IDLE;
-                return;
-            }
-            MODBUS_MEMMOVE((uint8_t *) (bmodbus->payload.response.data), bmodbus->payload.request.data + 3,
-                           bmodbus->byte_count - 5);
-            bmodbus->payload.response.result = 0;
-            bmodbus->payload.response.size = bmodbus->byte_count - 5;
-            //These operate on word by word, so we need to convert the endianness
-            if ((bmodbus->function == 3) || (bmodbus->function == 4)) {
-                bmodbus->payload.response.size = bmodbus->payload.response.size / 2; //Number of words
-                for (uint8_t i = 0; i < bmodbus->payload.response.size; i++) {
-                    bmodbus->payload.response.data[i] = MODBUS_HTONS(bmodbus->payload.response.data[i]);
-                }
+        case BMB_ASCII_END:
+            if(bmodbus->byte_count < 3){
+                break;
             }
-
+            //The LRC has been checked, append the CRC so the frame looks like RTU to the parser
+            for(i = 0; i < bmodbus->byte_count; i++){
+                crc = crc_update(crc, bmodbus->payload.request.data[i]);
+            }
+            bmodbus->payload.request.data[bmodbus->byte_count++] = crc & 0xFF;
+            bmodbus->payload.request.data[bmodbus->byte_count++] = (crc & 0xFF00) >> 8;
+            master_receive_completed(bmodbus);
             break;
         default:
-            MODBUS_MASTER_ERROR(5);
-            bmodbus->state = MASTER_STATE_IDLE;
-            return;
+            break;
     }
-    bmodbus->payload.response.function = bmodbus->function;
-    bmodbus->payload.response.address = bmodbus->register_address;
-    bmodbus->state = MASTER_STATE_RESPONSE_READY;
 }
+#endif //BMB_MASTER_ASCII
 
-void bmodbus_master_next_byte(modbus_master_t *bmodbus, uint32_t microseconds, uint8_t byte){
+static void master_next_byte(modbus_master_t *bmodbus, uint32_t microseconds, uint8_t byte){
     //As we receive bytes, we should populate the buffer OR ignore them based upon the state, and eventually trigger the state change
+#ifdef BMB_BUS_PROFILE
+    if(bmodbus->bus_profile != NULL){
+        bmodbus_bus_profile_byte(bmodbus->bus_profile, microseconds);
+    }
+#endif //BMB_BUS_PROFILE
     if(bmodbus->state != MASTER_STATE_WAITING_FOR_RESPONSE){
         return;
     }
+#ifdef BMB_MASTER_ASCII
+    if(bmodbus->ascii.enabled){
+        master_ascii_char(bmodbus, microseconds, byte);
+        return;
+    }
+#endif //BMB_MASTER_ASCII
     if((microseconds - bmodbus->last_microseconds) > bmodbus->interframe_delay){
         //If the time delta is greater than the interframe delay, we should reset the state machine, and then process from scratch
         bmodbus->byte_count = 0;
@@ -412,106 +1856,184 @@ void bmodbus_master_next_byte(modbus_master_t *bmodbus, uint32_t microseconds, u
     bmodbus->last_microseconds = microseconds;
     bmodbus->payload.request.data[bmodbus->byte_count] = byte;
     bmodbus->byte_count++;
+    if((bmodbus->byte_count == 2) && (byte == (bmodbus->function | 0x80))){
+        //Exception responses are always 5 bytes, whatever the request expected
+        bmodbus->payload.request.expected_response_size = 5;
+    }else if((bmodbus->function == 0x18) && (bmodbus->byte_count == 4) && (bmodbus->payload.request.data[1] == 0x18)){
+        //Read FIFO queue responses carry a 16 bit byte count, so the real length is known now
+        if((bmodbus->payload.request.data[2] != 0) || (bmodbus->payload.request.data[3] > 2 + 2 * BMB_FIFO_MAXIMUM_COUNT)){
+            master_drop_response(bmodbus, 6);
+            return;
+        }
+        bmodbus->payload.request.expected_response_size = 6 + bmodbus->payload.request.data[3];
+    }
     if(bmodbus->byte_count >= bmodbus->payload.request.expected_response_size){
         //Here we can process the request
         master_receive_completed(bmodbus);
     }
 }
 
+void bmodbus_master_next_byte(modbus_master_t *bmodbus, uint32_t microseconds, uint8_t byte){
+#ifdef BMB_CAPTURE
+    if(bmodbus->capture != NULL){
+        bmodbus_capture_record(bmodbus->capture, microseconds, BMB_CAPTURE_MASTER, &byte, 1, 0);
+    }
+#endif //BMB_CAPTURE
+    master_next_byte(bmodbus, microseconds, byte);
+}
+
 void bmodbus_master_received(modbus_master_t *bmodbus, uint32_t microseconds, uint8_t * bytes, uint8_t length, uint32_t microseconds_per_byte){
     //Performs the receiving based upon the data received by repeatedly calling _next_byte
     uint32_t t;
+    uint8_t i = 0;
+#ifdef BMB_MASTER_ASCII
+    uint8_t hex;
+#endif //BMB_MASTER_ASCII
     if(length == 0){ //Skip empty requests
         return;
     }
+#ifdef BMB_CAPTURE
+    if(bmodbus->capture != NULL){
+        bmodbus_capture_record(bmodbus->capture, microseconds, BMB_CAPTURE_MASTER, bytes, length, microseconds_per_byte);
+    }
+#endif //BMB_CAPTURE
     t = microseconds - (length-1) * microseconds_per_byte;
-    for(uint8_t i=0; i<length; i++){
-        bmodbus_master_next_byte(bmodbus, t, bytes[i]);
+#ifdef BMB_MASTER_ASCII
+    if(bmodbus->ascii.enabled){
+        while((i < length) && (bmodbus->state == MASTER_STATE_WAITING_FOR_RESPONSE)){
+            //Bulk path, whole hex pairs are decoded without going through the character state machine
+            if((i + 1 < length) && (bmodbus->ascii.state == BMB_ASCII_HIGH) && ((t - bmodbus->last_microseconds) <= bmodbus->interframe_delay) &&
+               ascii_hex_pair(bytes[i], bytes[i + 1], &hex)){
+                if(ascii_decoded(&(bmodbus->ascii), hex) == BMB_ASCII_BYTE){
+                    master_ascii_byte(bmodbus, bmodbus->ascii.value);
+                }
+#ifdef BMB_BUS_PROFILE
+                if(bmodbus->bus_profile != NULL){
+                    bmodbus_bus_profile_byte(bmodbus->bus_profile, t);
+                    bmodbus_bus_profile_byte(bmodbus->bus_profile, t + microseconds_per_byte);
+                }
+#endif //BMB_BUS_PROFILE
+                t += 2 * microseconds_per_byte;
+                bmodbus->last_microseconds = t - microseconds_per_byte;
+                i += 2;
+            }else{
+                master_next_byte(bmodbus, t, bytes[i]); //Goes to master_ascii_char()
+                t += microseconds_per_byte;
+                i++;
+            }
+        }
+        return;
+    }
+#endif //BMB_MASTER_ASCII
+    for(; i<length; i++){
+        master_next_byte(bmodbus, t, bytes[i]);
         t += microseconds_per_byte;
     }
 }
 
-modbus_uart_request_t * modbus_master_send_internal(modbus_master_t *bmodbus, uint8_t client_address, uint8_t function, uint16_t start_address, uint16_t value_or_count, uint16_t * data, uint8_t expected){
-    int i;
-    uint16_t crc = 0xFFFF;
+void bmodbus_master_received_packet(modbus_master_t *bmodbus, uint32_t microseconds, const uint8_t * bytes, uint16_t length){
+    uint16_t i;
+    //The response is assembled from every packet since bmodbus_master_send_complete(), without interframe timing
+#ifdef BMB_CAPTURE
+    if(bmodbus->capture != NULL){
+        bmodbus_capture_record(bmodbus->capture, microseconds, BMB_CAPTURE_MASTER | BMB_CAPTURE_PACKET, bytes, length, 0);
+    }
+#endif //BMB_CAPTURE
+    bmodbus->last_microseconds = microseconds;
+    for(i = 0; i < length; i++){
+        master_next_byte(bmodbus, microseconds, bytes[i]);
+    }
+}
+
+//Checks the master is free to send and starts a request frame, returns 0 if the request cannot be sent
+static uint8_t master_start_request(modbus_master_t *bmodbus, uint8_t client_address, uint8_t function, uint16_t start_address){
     //Check the state prior to sending
     if((bmodbus->state != MASTER_STATE_IDLE) && (bmodbus->state != MASTER_STATE_RESPONSE_READY)){
         //Error, we are not idle, fail to send!
-        return NULL;
+        return 0;
+    }
+    if((client_address == MODBUS_BROADCAST_ADDRESS) && !(bmodbus_functions[function].flags & BMB_FUNCTION_WRITE)){
+        return 0; //Reads cannot be broadcast
     }
+#ifdef BMB_STATISTICS
+    if(bmodbus->failed && (bmodbus->client_address == client_address) && (bmodbus->function == function)){
+        bmodbus->statistics.retries++;
+    }
+    bmodbus->failed = 0;
+#endif //BMB_STATISTICS
     bmodbus->state = MASTER_STATE_SENDING_REQUEST;
     bmodbus->client_address = client_address;
     bmodbus->register_address = start_address;
     bmodbus->function = function;
     bmodbus->byte_count = 0;
     bmodbus->payload.request.data[0] = client_address;
-    crc = crc_update(crc, client_address);
     bmodbus->payload.request.data[1] = function;
-    crc = crc_update(crc, function);
-    if(function == 16) { //value contains count in these functions
-        bmodbus->payload.request.data[2] = MODBUS_FIRST_BYTE(start_address);
-        bmodbus->payload.request.data[3] = MODBUS_SECOND_BYTE(start_address);
-        bmodbus->payload.request.data[4] = MODBUS_FIRST_BYTE(value_or_count);
-        bmodbus->payload.request.data[5] = MODBUS_SECOND_BYTE(value_or_count);
-        bmodbus->payload.request.data[6] = value_or_count * 2;
-        for(i=2; i<7; i++){
-            crc = crc_update(crc, bmodbus->payload.request.data[i]);
-        }
-        for (i = 0; i < value_or_count; i++) {
-            uint8_t temp = MODBUS_FIRST_BYTE(data[i]);
-            bmodbus->payload.request.data[i * 2 + 7] = temp;
-            crc = crc_update(crc, temp);
-            temp = MODBUS_SECOND_BYTE(data[i]);
-            bmodbus->payload.request.data[i * 2 + 8] = temp;
-            crc = crc_update(crc, temp);
-        }
-        uint16_bytes crc_bytes;
-        crc_bytes.half = MODBUS_HTONS(crc);
-        bmodbus->payload.request.data[value_or_count * 2 + 7] = crc_bytes.byte[1];
-        bmodbus->payload.request.data[value_or_count * 2 + 8] = crc_bytes.byte[0];
-        bmodbus->payload.request.size = value_or_count * 2 + 9;
-    }else if(function == 15){
-        bmodbus->payload.request.data[2] = MODBUS_FIRST_BYTE(start_address);
-        bmodbus->payload.request.data[3] = MODBUS_SECOND_BYTE(start_address);
-        bmodbus->payload.request.data[4] = MODBUS_FIRST_BYTE(value_or_count);
-        bmodbus->payload.request.data[5] = MODBUS_SECOND_BYTE(value_or_count);
-        bmodbus->payload.request.data[6] = (value_or_count + 7) / 8; //Number of bytes from number of bits
-        for(i=2; i<7; i++){
-            crc = crc_update(crc, bmodbus->payload.request.data[i]);
-        }
-        for (i = 0; i < (value_or_count + 7) / 8; i++) {
-            bmodbus->payload.request.data[i + 7] = ((uint8_t*)data)[i];
-            crc = crc_update(crc, function);
-        }
-        uint16_bytes crc_bytes;
-        crc_bytes.half = MODBUS_HTONS(crc);
-        bmodbus->payload.request.data[(value_or_count + 7) / 8 + 7] = crc_bytes.byte[1];
-        bmodbus->payload.request.data[(value_or_count + 7) / 8 + 8] = crc_bytes.byte[0];
-    }else{
-        bmodbus->payload.request.data[2] = MODBUS_FIRST_BYTE(start_address);
-        bmodbus->payload.request.data[3] = MODBUS_SECOND_BYTE(start_address);
-        if(function == 5){
-            if(value_or_count){
-                value_or_count = 0xFF00;
-            }else{
-                value_or_count = 0x0000;
-            }
-        }
-        bmodbus->payload.request.data[4] = MODBUS_FIRST_BYTE(value_or_count);
-        bmodbus->payload.request.data[5] = MODBUS_SECOND_BYTE(value_or_count);
-        for(i=0;i<4;i++){
-            crc = crc_update(crc, bmodbus->payload.request.data[i+2]);
+    return 1;
+}
+
+//Appends the CRC to the first n bytes of the request frame
+static modbus_uart_request_t * master_finish_request(modbus_master_t *bmodbus, uint16_t n, uint8_t expected){
+    uint16_t i;
+    uint16_t crc = 0xFFFF;
+    for(i = 0; i < n; i++){
+        crc = crc_update(crc, bmodbus->payload.request.data[i]);
+    }
+    bmodbus->payload.request.data[n++] = crc & 0xFF;
+    bmodbus->payload.request.data[n++] = (crc & 0xFF00) >> 8;
+#ifdef BMB_MASTER_ASCII
+    if(bmodbus->ascii.enabled){
+        n = ascii_encode(bmodbus->payload.request.data, n);
+        if(n == 0){ //Too long once it is hex encoded
+            bmodbus->state = MASTER_STATE_IDLE;
+            return NULL;
         }
-        uint16_bytes crc_bytes;
-        crc_bytes.half = MODBUS_HTONS(crc);
-        bmodbus->payload.request.data[6] = crc_bytes.byte[1];
-        bmodbus->payload.request.data[7] = crc_bytes.byte[0];
-        bmodbus->payload.request.size = 8;
     }
+#endif //BMB_MASTER_ASCII
+    bmodbus->payload.request.size = (uint8_t)n;
     bmodbus->payload.request.expected_response_size = expected;
     return &(bmodbus->payload.request);
 }
 
+modbus_uart_request_t * modbus_master_send_internal(modbus_master_t *bmodbus, uint8_t client_address, uint8_t function, uint16_t start_address, uint16_t value_or_count, uint16_t * data, uint16_t expected){
+    const bmodbus_function_t * shape = bmodbus_function_shape(function);
+    uint16_t i, n, bytes;
+    if(shape == NULL){
+        return NULL;
+    }
+    if(shape->bits_per_unit && ((value_or_count == 0) || (value_or_count > shape->max_count))){
+        return NULL; //The count is outside what the specification allows, the response size would not be valid
+    }
+    bytes = (shape->flags & BMB_FUNCTION_BYTE_COUNT) ? (uint16_t)(((uint32_t)value_or_count * shape->bits_per_unit + 7) / 8) : 0;
+    if((expected > BMB_MAXIMUM_MESSAGE_SIZE) || (6 + 1 + bytes + 2 > BMB_MAXIMUM_MESSAGE_SIZE)){
+        return NULL; //The request or its response would not fit the buffer
+    }
+    if(!master_start_request(bmodbus, client_address, function, start_address)){
+        return NULL;
+    }
+    if(function == 5){
+        value_or_count = value_or_count ? 0xFF00 : 0x0000;
+    }
+    bmodbus->payload.request.data[2] = MODBUS_FIRST_BYTE(start_address);
+    bmodbus->payload.request.data[3] = MODBUS_SECOND_BYTE(start_address);
+    bmodbus->payload.request.data[4] = MODBUS_FIRST_BYTE(value_or_count); //value contains count in the multiple functions
+    bmodbus->payload.request.data[5] = MODBUS_SECOND_BYTE(value_or_count);
+    n = 6;
+    if(shape->flags & BMB_FUNCTION_BYTE_COUNT){
+        bmodbus->payload.request.data[n++] = (uint8_t)bytes;
+        if(shape->bits_per_unit == 16){
+            for(i = 0; i < value_or_count; i++){
+                bmodbus->payload.request.data[n++] = MODBUS_FIRST_BYTE(data[i]);
+                bmodbus->payload.request.data[n++] = MODBUS_SECOND_BYTE(data[i]);
+            }
+        }else{ //Bits are packed in byte order
+            for(i = 0; i < bytes; i++){
+                bmodbus->payload.request.data[n++] = ((uint8_t*)data)[i];
+            }
+        }
+    }
+    return master_finish_request(bmodbus, n, (uint8_t)expected);
+}
+
 modbus_uart_request_t * bmodbus_master_read_coils(modbus_master_t *bmodbus, uint8_t client_address, uint16_t start_address, uint16_t count){
     return modbus_master_send_internal(bmodbus, client_address, 1, start_address, count, NULL, (count+7)/8 + 5);
 }
@@ -537,10 +2059,686 @@ modbus_uart_request_t * bmodbus_master_write_multiple_registers(modbus_master_t
     return modbus_master_send_internal(bmodbus, client_address, 16, address, count, data, 8);
 }
 
+#ifdef BMB_SCATTER_GATHER
+modbus_uart_vector_t * bmodbus_master_write_multiple_vector(modbus_master_t *bmodbus, uint8_t client_address, uint8_t function, uint16_t address, uint16_t count, const uint8_t *data, modbus_uart_vector_t * vector){
+    const bmodbus_function_t * shape = bmodbus_function_shape(function);
+    uint16_t bytes;
+    if(((function != 15) && (function != 16)) || (count == 0) || (count > shape->max_count)){
+        return NULL;
+    }
+    if(!master_start_request(bmodbus, client_address, function, address)){
+        return NULL;
+    }
+    bytes = (uint16_t)(((uint32_t)count * shape->bits_per_unit + 7) / 8);
+    bmodbus->payload.request.data[2] = MODBUS_FIRST_BYTE(address);
+    bmodbus->payload.request.data[3] = MODBUS_SECOND_BYTE(address);
+    bmodbus->payload.request.data[4] = MODBUS_FIRST_BYTE(count);
+    bmodbus->payload.request.data[5] = MODBUS_SECOND_BYTE(count);
+    bmodbus->payload.request.data[6] = (uint8_t)bytes;
+#ifdef BMB_MASTER_ASCII
+    if(bmodbus->ascii.enabled){
+        //Hex encoding needs the whole frame in the buffer
+        if(7 + bytes + 2 > BMB_MAXIMUM_MESSAGE_SIZE){
+            bmodbus->state = MASTER_STATE_IDLE;
+            return NULL;
+        }
+        MODBUS_MEMMOVE(bmodbus->payload.request.data + 7, (void *)data, bytes);
+        if(master_finish_request(bmodbus, 7 + bytes, 8) == NULL){
+            return NULL;
+        }
+        return vector_single(vector, bmodbus->payload.request.data, bmodbus->payload.request.size);
+    }
+#endif //BMB_MASTER_ASCII
+    bmodbus->payload.request.size = 7;
+    bmodbus->payload.request.expected_response_size = 8;
+    return vector_build(vector, bmodbus->payload.request.data, 7, data, bytes);
+}
+#endif //BMB_SCATTER_GATHER
+
+modbus_uart_request_t * bmodbus_master_mask_write_register(modbus_master_t *bmodbus, uint8_t client_address, uint16_t address, uint16_t and_mask, uint16_t or_mask){
+    if(!master_start_request(bmodbus, client_address, 0x16, address)){
+        return NULL;
+    }
+    bmodbus->payload.request.data[2] = MODBUS_FIRST_BYTE(address);
+    bmodbus->payload.request.data[3] = MODBUS_SECOND_BYTE(address);
+    bmodbus->payload.request.data[4] = MODBUS_FIRST_BYTE(and_mask);
+    bmodbus->payload.request.data[5] = MODBUS_SECOND_BYTE(and_mask);
+    bmodbus->payload.request.data[6] = MODBUS_FIRST_BYTE(or_mask);
+    bmodbus->payload.request.data[7] = MODBUS_SECOND_BYTE(or_mask);
+    return master_finish_request(bmodbus, 8, 10);
+}
+
+modbus_uart_request_t * bmodbus_master_read_fifo_queue(modbus_master_t *bmodbus, uint8_t client_address, uint16_t fifo_address){
+    if(!master_start_request(bmodbus, client_address, 0x18, fifo_address)){
+        return NULL;
+    }
+    bmodbus->payload.request.data[2] = MODBUS_FIRST_BYTE(fifo_address);
+    bmodbus->payload.request.data[3] = MODBUS_SECOND_BYTE(fifo_address);
+    //The length is only known once the byte count arrives, so expect the largest response until then
+    return master_finish_request(bmodbus, 4, 8 + 2 * BMB_FIFO_MAXIMUM_COUNT);
+}
+
+modbus_uart_request_t * bmodbus_master_diagnostics(modbus_master_t *bmodbus, uint8_t client_address, uint16_t sub_function, uint16_t data){
+    if(!master_start_request(bmodbus, client_address, 0x08, sub_function)){
+        return NULL;
+    }
+    bmodbus->payload.request.data[2] = MODBUS_FIRST_BYTE(sub_function);
+    bmodbus->payload.request.data[3] = MODBUS_SECOND_BYTE(sub_function);
+    bmodbus->payload.request.data[4] = MODBUS_FIRST_BYTE(data);
+    bmodbus->payload.request.data[5] = MODBUS_SECOND_BYTE(data);
+    return master_finish_request(bmodbus, 6, 8);
+}
+
+modbus_uart_request_t * bmodbus_master_get_comm_event_counter(modbus_master_t *bmodbus, uint8_t client_address){
+    if(!master_start_request(bmodbus, client_address, 0x0B, 0)){
+        return NULL;
+    }
+    return master_finish_request(bmodbus, 2, 8);
+}
+
+modbus_uart_request_t * bmodbus_master_read_write_multiple_registers(modbus_master_t *bmodbus, uint8_t client_address, uint16_t read_address, uint16_t read_count, uint16_t write_address, uint16_t write_count, uint16_t *data){
+    uint16_t i, n;
+    if((read_count == 0) || (read_count > 125) || (write_count == 0) || (write_count > bmodbus_functions[0x17].max_count) ||
+       (read_count * 2 + 5 > BMB_MAXIMUM_MESSAGE_SIZE) || (11 + write_count * 2 + 2 > BMB_MAXIMUM_MESSAGE_SIZE)){
+        return NULL; //Outside the specification, or the request or its response would not fit the buffer
+    }
+    if(!master_start_request(bmodbus, client_address, 0x17, read_address)){
+        return NULL;
+    }
+    bmodbus->payload.request.data[2] = MODBUS_FIRST_BYTE(read_address);
+    bmodbus->payload.request.data[3] = MODBUS_SECOND_BYTE(read_address);
+    bmodbus->payload.request.data[4] = MODBUS_FIRST_BYTE(read_count);
+    bmodbus->payload.request.data[5] = MODBUS_SECOND_BYTE(read_count);
+    bmodbus->payload.request.data[6] = MODBUS_FIRST_BYTE(write_address);
+    bmodbus->payload.request.data[7] = MODBUS_SECOND_BYTE(write_address);
+    bmodbus->payload.request.data[8] = MODBUS_FIRST_BYTE(write_count);
+    bmodbus->payload.request.data[9] = MODBUS_SECOND_BYTE(write_count);
+    bmodbus->payload.request.data[10] = (uint8_t)(write_count * 2);
+    n = 11;
+    for(i = 0; i < write_count; i++){
+        bmodbus->payload.request.data[n++] = MODBUS_FIRST_BYTE(data[i]);
+        bmodbus->payload.request.data[n++] = MODBUS_SECOND_BYTE(data[i]);
+    }
+    return master_finish_request(bmodbus, n, read_count*2 + 5);
+}
+
+//Writes the sub-request headers (and data for writes) of a file record request, returns the frame length
+static uint16_t master_file_record_request(modbus_master_t *bmodbus, const modbus_file_subrequest_t *subrequests, uint8_t count, uint8_t with_data){
+    uint16_t i, n = 3;
+    uint8_t j;
+    for(j = 0; j < count; j++){
+        bmodbus->payload.request.data[n++] = BMB_FILE_REFERENCE_TYPE;
+        bmodbus->payload.request.data[n++] = MODBUS_FIRST_BYTE(subrequests[j].file);
+        bmodbus->payload.request.data[n++] = MODBUS_SECOND_BYTE(subrequests[j].file);
+        bmodbus->payload.request.data[n++] = MODBUS_FIRST_BYTE(subrequests[j].record);
+        bmodbus->payload.request.data[n++] = MODBUS_SECOND_BYTE(subrequests[j].record);
+        bmodbus->payload.request.data[n++] = MODBUS_FIRST_BYTE(subrequests[j].length);
+        bmodbus->payload.request.data[n++] = MODBUS_SECOND_BYTE(subrequests[j].length);
+        for(i = 0; with_data && (i < subrequests[j].length); i++){
+            bmodbus->payload.request.data[n++] = MODBUS_FIRST_BYTE(subrequests[j].data[i]);
+            bmodbus->payload.request.data[n++] = MODBUS_SECOND_BYTE(subrequests[j].data[i]);
+        }
+    }
+    bmodbus->payload.request.data[2] = (uint8_t)(n - 3);
+    return n;
+}
+
+modbus_uart_request_t * bmodbus_master_read_file_record(modbus_master_t *bmodbus, uint8_t client_address, const modbus_file_subrequest_t *subrequests, uint8_t count){
+    uint32_t response = 0;
+    uint8_t j;
+    for(j = 0; j < count; j++){
+        response += 2 + 2 * (uint32_t)subrequests[j].length;
+    }
+    if((count == 0) || (7 * (uint16_t)count > BMB_FILE_MAXIMUM_BYTE_COUNT) || (5 + 7 * (uint16_t)count > BMB_MAXIMUM_MESSAGE_SIZE) ||
+       (response > BMB_FILE_MAXIMUM_BYTE_COUNT) || (5 + response > BMB_MAXIMUM_MESSAGE_SIZE)){
+        return NULL;
+    }
+    if(!master_start_request(bmodbus, client_address, 0x14, subrequests[0].record)){
+        return NULL;
+    }
+    return master_finish_request(bmodbus, master_file_record_request(bmodbus, subrequests, count, 0), (uint8_t)(5 + response));
+}
+
+modbus_uart_request_t * bmodbus_master_write_file_record(modbus_master_t *bmodbus, uint8_t client_address, const modbus_file_subrequest_t *subrequests, uint8_t count){
+    uint32_t bytes = 0;
+    uint8_t j;
+    for(j = 0; j < count; j++){
+        bytes += 7 + 2 * (uint32_t)subrequests[j].length;
+    }
+    if((count == 0) || (bytes > BMB_FILE_MAXIMUM_BYTE_COUNT) || (5 + bytes > BMB_MAXIMUM_MESSAGE_SIZE)){
+        return NULL;
+    }
+    if(!master_start_request(bmodbus, client_address, 0x15, subrequests[0].record)){
+        return NULL;
+    }
+    //The response is an echo of the request
+    return master_finish_request(bmodbus, master_file_record_request(bmodbus, subrequests, count, 1), (uint8_t)(5 + bytes));
+}
+
+void bmodbus_master_file_transfer_init(modbus_file_transfer_t *transfer, uint8_t client_address, uint16_t file, uint16_t record, const uint16_t *data, uint32_t count){
+    transfer->data = data;
+    transfer->remaining = count;
+    transfer->file = file;
+    transfer->record = record;
+    transfer->in_flight = 0;
+    transfer->client_address = client_address;
+    transfer->result = 0;
+}
+
+//Commits the request in flight once it has been acknowledged, stops at an exception, or forgets it so it is sent again
+//if there was no valid response
+static void master_file_transfer_update(modbus_master_t *bmodbus, modbus_file_transfer_t *transfer){
+    if(transfer->in_flight == 0){
+        return;
+    }
+    if((bmodbus->state == MASTER_STATE_RESPONSE_READY) && (bmodbus->function == 0x15) &&
+       (bmodbus->client_address == transfer->client_address)){
+        transfer->result = bmodbus->payload.response.result; //Sending the records again would get the same exception
+        if(transfer->result == 0){
+            transfer->data += transfer->in_flight;
+            transfer->remaining -= transfer->in_flight;
+            transfer->record += transfer->in_flight;
+            while(transfer->record >= BMB_FILE_RECORDS_PER_FILE){
+                transfer->record -= BMB_FILE_RECORDS_PER_FILE;
+                transfer->file++;
+            }
+        }
+        transfer->in_flight = 0;
+    }else if((bmodbus->state == MASTER_STATE_IDLE) || (bmodbus->state == MASTER_STATE_RESPONSE_READY)){
+        transfer->in_flight = 0;
+    }
+}
+
+modbus_uart_request_t * bmodbus_master_file_transfer_next(modbus_master_t *bmodbus, modbus_file_transfer_t *transfer){
+    modbus_file_subrequest_t subrequests[2];
+    modbus_uart_request_t * request;
+    uint16_t budget, records;
+    uint8_t count = 0;
+    master_file_transfer_update(bmodbus, transfer);
+    if(transfer->in_flight || (transfer->remaining == 0) || transfer->result){
+        return NULL;
+    }
+    //Pack as many records as the frame allows, a request can only span two files as each holds 10000 records
+    budget = BMB_MAXIMUM_MESSAGE_SIZE - 5;
+    if(budget > BMB_FILE_MAXIMUM_BYTE_COUNT){
+        budget = BMB_FILE_MAXIMUM_BYTE_COUNT;
+    }
+    subrequests[0].file = transfer->file;
+    subrequests[0].record = transfer->record;
+    subrequests[0].data = transfer->data;
+    records = (budget - 7) / 2;
+    if(records > BMB_FILE_RECORDS_PER_FILE - transfer->record){
+        records = BMB_FILE_RECORDS_PER_FILE - transfer->record;
+    }
+    if(records > transfer->remaining){
+        records = (uint16_t)transfer->remaining;
+    }
+    subrequests[0].length = records;
+    budget -= 7 + 2 * records;
+    count++;
+    if((transfer->remaining > records) && (budget >= 9)){
+        subrequests[1].file = transfer->file + 1;
+        subrequests[1].record = 0;
+        subrequests[1].data = transfer->data + records;
+        subrequests[1].length = (budget - 7) / 2;
+        if(subrequests[1].length > transfer->remaining - records){
+            subrequests[1].length = (uint16_t)(transfer->remaining - records);
+        }
+        records += subrequests[1].length;
+        count++;
+    }
+    request = bmodbus_master_write_file_record(bmodbus, transfer->client_address, subrequests, count);
+    if(request != NULL){
+        transfer->in_flight = records;
+    }
+    return request;
+}
+
+uint8_t bmodbus_master_file_transfer_done(modbus_master_t *bmodbus, modbus_file_transfer_t *transfer){
+    master_file_transfer_update(bmodbus, transfer);
+    return (transfer->in_flight == 0) && ((transfer->remaining == 0) || transfer->result);
+}
+
 modbus_request_t * bmodbus_master_get_response(modbus_master_t *bmodbus){
     if(bmodbus->state == MASTER_STATE_RESPONSE_READY){
         return &(bmodbus->payload.response);
     }
     return NULL;
 }
-#endif //BMODBUS_NO_MASTER
\ No newline at end of file
+
+void bmodbus_master_timeout(modbus_master_t *bmodbus){
+    if(bmodbus->state == MASTER_STATE_WAITING_FOR_RESPONSE){
+        BMB_COUNT(bmodbus, timeouts);
+#ifdef BMB_STATISTICS
+        bmodbus->failed = 1;
+#endif //BMB_STATISTICS
+    }
+    if(bmodbus->state != MASTER_STATE_RESPONSE_READY){
+        uint8_t given_up = (bmodbus->state != MASTER_STATE_IDLE) && (bmodbus->state != MASTER_NO_INIT);
+        bmodbus->state = MASTER_STATE_IDLE;
+        if(given_up){
+            MASTER_COMPLETE(bmodbus, NULL);
+        }
+    }
+}
+
+#ifdef BMB_STATISTICS
+const modbus_statistics_t * bmodbus_master_statistics(modbus_master_t *bmodbus){
+    return &(bmodbus->statistics);
+}
+
+void bmodbus_master_clear_statistics(modbus_master_t *bmodbus){
+    statistics_clear(&(bmodbus->statistics));
+}
+#endif //BMB_STATISTICS
+
+#ifdef BMB_MASTER_CALLBACK
+void bmodbus_master_set_callback(modbus_master_t *bmodbus, modbus_master_callback_t callback, void * context){
+    bmodbus->callback = callback;
+    bmodbus->callback_context = context;
+}
+#endif //BMB_MASTER_CALLBACK
+
+#ifdef BMB_CAPTURE
+void bmodbus_master_set_capture(modbus_master_t *bmodbus, modbus_capture_t *capture){
+    bmodbus->capture = capture;
+}
+#endif //BMB_CAPTURE
+
+#ifdef BMB_BUS_PROFILE
+void bmodbus_master_set_bus_profile(modbus_master_t *bmodbus, modbus_bus_profile_t *profile){
+    bmodbus->bus_profile = profile;
+}
+#endif //BMB_BUS_PROFILE
+
+#ifdef BMB_LATENCY
+const modbus_latency_t * bmodbus_master_latency(modbus_master_t *bmodbus){
+    return &(bmodbus->latency);
+}
+
+void bmodbus_master_clear_latency(modbus_master_t *bmodbus){
+    latency_clear(&(bmodbus->latency));
+}
+#endif //BMB_LATENCY
+#endif //BMODBUS_NO_MASTER
+
+#if defined(BMB_MONITOR) && !defined(BMODBUS_NO_MASTER)
+void bmodbus_monitor_init(modbus_monitor_t *monitor, uint32_t interframe_delay, uint32_t response_timeout, modbus_monitor_callback_t callback, void * context){
+    bmodbus_client_init(&(monitor->requests), interframe_delay, MODBUS_BROADCAST_ADDRESS);
+    monitor->requests.promiscuous = 1;
+    bmodbus_master_init(&(monitor->responses), interframe_delay);
+    monitor->response_timeout = response_timeout;
+    monitor->skip_remaining = 0;
+    monitor->callback = callback;
+    monitor->context = context;
+}
+
+//Length of the response to a request from the specification, 0 if it cannot be decoded. It can be larger than the
+//buffer, the master state machine is only given the responses that fit
+static uint16_t monitor_response_size(modbus_client_t *requests){
+    const modbus_request_t * request = &(requests->payload.request);
+    const bmodbus_function_t * shape;
+    if(requests->broadcast || (requests->function >= BMB_FUNCTION_TABLE_SIZE)){
+        return 0;
+    }
+    if(requests->state == CLIENT_STATE_RESPONSE_READY){ //Rejected, a client answers with an exception
+        return (bmodbus_functions[requests->function].flags & BMB_FUNCTION_FILE) ? 0 : 5;
+    }
+    shape = &bmodbus_functions[requests->function];
+    if(requests->function == 0x18){ //The real length is read from the byte count
+        return 8 + 2 * 31;
+    }
+    if(requests->function == 0x16){
+        return 10;
+    }
+    if(shape->flags & BMB_FUNCTION_READ){
+        return (uint16_t)(((uint32_t)request->size * shape->bits_per_unit + 7) / 8 + 5);
+    }
+    return 8; //Writes and diagnostics echo two words
+}
+
+static void monitor_emit(modbus_monitor_t *monitor, const modbus_request_t * response, uint8_t response_too_large){
+    modbus_client_t * requests = &(monitor->requests);
+    modbus_transaction_t transaction;
+    transaction.request = &(requests->payload.request);
+    transaction.response = response;
+    transaction.request_microseconds = requests->last_microseconds;
+    transaction.response_microseconds = monitor->responses.last_microseconds;
+    transaction.client_address = requests->client_address;
+#if BMB_MAXIMUM_MESSAGE_SIZE < 256 //Byte counts are at most 255, so a 256 byte buffer holds them all
+    transaction.request_too_large = (requests->state == CLIENT_STATE_PROCESSING_REQUEST) &&
+        (bmodbus_functions[requests->function].flags & BMB_FUNCTION_BYTE_COUNT) && (requests->byte_size > sizeof(requests->payload.request.data));
+#else
+    transaction.request_too_large = 0;
+#endif
+    transaction.response_too_large = response_too_large;
+    if(monitor->callback != NULL){
+        monitor->callback(monitor->context, &transaction);
+    }
+    monitor->requests.state = CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE; //Restarts at the next interframe gap
+    monitor->responses.state = MASTER_STATE_IDLE;
+    monitor->skip_remaining = 0;
+}
+
+//Once the start of a response gives its length, responses too large for the buffer are skipped by it (0 otherwise)
+static uint16_t monitor_skip_length(modbus_monitor_t *monitor, uint8_t byte){
+    const modbus_master_t * responses = &(monitor->responses);
+    uint16_t length = 0;
+    if(responses->function == 0x18){ //The 16 bit byte count follows the function code
+        if((responses->byte_count == 3) && (responses->payload.request.data[1] == 0x18) &&
+           (responses->payload.request.data[2] == 0) && (byte <= 2 + 2 * 31)){
+            length = 6 + byte;
+        }
+    }else if((responses->byte_count == 1) && (byte == responses->function)){ //Not an exception
+        length = monitor->response_size;
+    }
+    return (length > BMB_MAXIMUM_MESSAGE_SIZE) ? length : 0;
+}
+
+//Checks one byte of a response too large for the buffer, it is reported once its CRC has been seen
+static void monitor_skip_byte(modbus_monitor_t *monitor, uint32_t microseconds, uint8_t byte){
+    monitor->skip_crc = crc_update(monitor->skip_crc, byte);
+    monitor->responses.last_microseconds = microseconds;
+    monitor->skip_remaining--;
+    if(monitor->skip_remaining == 0){
+        monitor_emit(monitor, NULL, monitor->skip_crc == 0); //The CRC over a frame and its CRC is 0
+    }
+}
+
+//The frame received after the request was not its response, the request is reported alone and the frame is parsed as a request
+static void monitor_unanswered(modbus_monitor_t *monitor){
+    uint8_t frame[BMB_MAXIMUM_MESSAGE_SIZE];
+    uint32_t microseconds = monitor->responses.last_microseconds;
+    uint8_t i, length = monitor->responses.byte_count;
+    for(i = 0; i < length; i++){
+        frame[i] = monitor->responses.payload.request.data[i];
+    }
+    monitor_emit(monitor, NULL, 0);
+    client_frame_restart(&(monitor->requests));
+    monitor->requests.last_microseconds = microseconds;
+    for(i = 0; i < length; i++){
+        bmodbus_monitor_next_byte(monitor, microseconds, frame[i]);
+    }
+}
+
+void bmodbus_monitor_next_byte(modbus_monitor_t *monitor, uint32_t microseconds, uint8_t byte){
+    modbus_master_t * responses = &(monitor->responses);
+    uint16_t expected, i;
+    if(responses->state == MASTER_STATE_WAITING_FOR_RESPONSE){
+        if(responses->byte_count ? ((microseconds - responses->last_microseconds) > responses->interframe_delay) :
+           ((microseconds - responses->last_microseconds) > monitor->response_timeout)){
+            if(monitor->skip_remaining){
+                monitor_emit(monitor, NULL, 0); //Cut short, what was skipped cannot be parsed again
+            }else{
+                monitor_unanswered(monitor); //Too short to be the response, or nothing came back in time
+            }
+        }else if(!monitor->skip_remaining && ((uint16_t)responses->byte_count + 1 > BMB_MAXIMUM_MESSAGE_SIZE)){
+            monitor_unanswered(monitor); //Longer than any response the buffer holds and not skipped, so not the response
+        }
+    }
+    if(responses->state == MASTER_STATE_WAITING_FOR_RESPONSE){
+        if(!monitor->skip_remaining){
+            expected = monitor_skip_length(monitor, byte);
+            if(expected){
+                monitor->skip_crc = 0xFFFF;
+                for(i = 0; i < responses->byte_count; i++){
+                    monitor->skip_crc = crc_update(monitor->skip_crc, responses->payload.request.data[i]);
+                }
+                monitor->skip_remaining = (uint8_t)(expected - responses->byte_count);
+            }
+        }
+        if(monitor->skip_remaining){
+            monitor_skip_byte(monitor, microseconds, byte);
+            return;
+        }
+        bmodbus_master_next_byte(responses, microseconds, byte);
+        if(responses->state == MASTER_STATE_RESPONSE_READY){
+            monitor_emit(monitor, &(responses->payload.response), 0);
+        }else if(responses->state == MASTER_STATE_IDLE){ //Not a valid response
+            monitor_unanswered(monitor);
+        }
+        return;
+    }
+    bmodbus_client_next_byte(&(monitor->requests), microseconds, byte);
+    if((monitor->requests.state != CLIENT_STATE_PROCESSING_REQUEST) && (monitor->requests.state != CLIENT_STATE_RESPONSE_READY)){
+        return;
+    }
+    //A complete request, the master state machine is set up as if it had sent it
+    expected = monitor_response_size(&(monitor->requests));
+    if(expected == 0){
+        responses->last_microseconds = microseconds;
+        monitor_emit(monitor, NULL, 0);
+        return;
+    }
+    monitor->response_size = expected;
+    responses->client_address = monitor->requests.client_address;
+    responses->function = monitor->requests.function;
+    responses->register_address = monitor->requests.payload.request.address;
+    responses->byte_count = 0;
+    responses->payload.request.expected_response_size = (uint8_t)expected; //At most 255 bytes, larger than the buffer when skipped
+    responses->last_microseconds = microseconds;
+    responses->state = MASTER_STATE_WAITING_FOR_RESPONSE;
+}
+
+void bmodbus_monitor_received(modbus_monitor_t *monitor, uint32_t microseconds, const uint8_t * bytes, uint16_t length, uint32_t microseconds_per_byte){
+    uint32_t t;
+    uint16_t i;
+    if(length == 0){
+        return;
+    }
+    t = microseconds - (length - 1) * microseconds_per_byte;
+    for(i = 0; i < length; i++){
+        bmodbus_monitor_next_byte(monitor, t, bytes[i]);
+        t += microseconds_per_byte;
+    }
+}
+#endif //BMB_MONITOR && !BMODBUS_NO_MASTER
+
+#if defined(BMB_MASTER_POOL) && !defined(BMODBUS_NO_MASTER)
+void bmodbus_pool_init(modbus_pool_t *pool, modbus_pool_bus_t *buses, uint8_t bus_count, modbus_pool_entry_t *entries, uint16_t entry_count, uint32_t interframe_delay, uint32_t timeout, modbus_pool_send_t send, void * context){
+    uint16_t i;
+    pool->buses = buses;
+    pool->bus_count = bus_count;
+    pool->entries = entries;
+    pool->entry_count = entry_count;
+    pool->timeout = timeout;
+    pool->send = send;
+    pool->context = context;
+    pool->done_head = BMB_POOL_NONE;
+    pool->done_tail = BMB_POOL_NONE;
+    //Every entry starts on the free list
+    for(i = 0; i < entry_count; i++){
+        entries[i].next = (i + 1 < entry_count) ? (uint16_t)(i + 1) : BMB_POOL_NONE;
+    }
+    pool->free = entry_count ? 0 : BMB_POOL_NONE;
+    for(i = 0; i < bus_count; i++){
+        bmodbus_master_init(&(buses[i].master), interframe_delay);
+        buses[i].master.last_microseconds = 0; //The first request waits for the interframe delay, as after any frame
+        buses[i].head = BMB_POOL_NONE;
+        buses[i].tail = BMB_POOL_NONE;
+        buses[i].in_flight = BMB_POOL_NONE;
+        buses[i].sending = 0;
+    }
+}
+
+modbus_master_t * bmodbus_pool_master(modbus_pool_t *pool, uint8_t bus){
+    return &(pool->buses[bus].master);
+}
+
+int8_t bmodbus_pool_submit(modbus_pool_t *pool, uint8_t bus, uint8_t client_address, uint8_t function, uint16_t address, uint16_t value_or_count, uint16_t *data, void * cookie){
+    modbus_pool_bus_t * line;
+    modbus_pool_entry_t * entry;
+    uint16_t index = pool->free;
+    if((index == BMB_POOL_NONE) || (bus >= pool->bus_count)){
+        return -1;
+    }
+    switch(function){ //The functions pool_build() knows
+        case 5:
+        case 6:
+            break;
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+        case 15:
+        case 16:
+        case 0x16:
+        case 0x18:
+            if(data == NULL){
+                return -1;
+            }
+            break;
+        default:
+            return -1;
+    }
+    entry = &(pool->entries[index]);
+    pool->free = entry->next;
+    entry->cookie = cookie;
+    entry->data = data;
+    entry->address = address;
+    entry->value_or_count = value_or_count;
+    entry->size = 0;
+    entry->client_address = client_address;
+    entry->function = function;
+    entry->result = 0;
+    entry->bus = bus;
+    entry->next = BMB_POOL_NONE;
+    //Appended to the queue of the bus
+    line = &(pool->buses[bus]);
+    if(line->tail == BMB_POOL_NONE){
+        line->head = index;
+    }else{
+        pool->entries[line->tail].next = index;
+    }
+    line->tail = index;
+    return 0;
+}
+
+//Moves a transaction to the completion queue
+static void pool_complete(modbus_pool_t *pool, uint16_t index, int8_t result){
+    pool->entries[index].result = result;
+    pool->entries[index].next = BMB_POOL_NONE;
+    if(pool->done_tail == BMB_POOL_NONE){
+        pool->done_head = index;
+    }else{
+        pool->entries[pool->done_tail].next = index;
+    }
+    pool->done_tail = index;
+}
+
+//Copies what the client returned to the transaction, only reads have values to keep
+static void pool_response(modbus_pool_t *pool, uint16_t index, modbus_request_t * response){
+    modbus_pool_entry_t * entry = &(pool->entries[index]);
+    uint16_t bytes;
+    entry->size = response->size;
+    if((response->result == 0) && (entry->data != NULL) && (response->size)){
+        switch(entry->function){
+            case 1: //Coils and discrete inputs are packed bytes
+            case 2:
+                bytes = response->size;
+                break;
+            case 3:
+            case 4:
+                bytes = 2 * response->size;
+                break;
+            case 0x18: //The client decides how many values come back, value_or_count is the room in data
+                if(entry->size > entry->value_or_count){
+                    entry->size = entry->value_or_count;
+                }
+                bytes = 2 * entry->size;
+                break;
+            default:
+                bytes = 0;
+                break;
+        }
+        MODBUS_MEMMOVE((uint8_t *)entry->data, (uint8_t *)response->data, bytes);
+    }
+    pool_complete(pool, index, response->result);
+}
+
+//Builds the request of a transaction on the master of its bus
+static modbus_uart_request_t * pool_build(modbus_master_t *master, const modbus_pool_entry_t * entry){
+    switch(entry->function){
+        case 1: return bmodbus_master_read_coils(master, entry->client_address, entry->address, entry->value_or_count);
+        case 2: return bmodbus_master_read_discrete_inputs(master, entry->client_address, entry->address, entry->value_or_count);
+        case 3: return bmodbus_master_read_holding_registers(master, entry->client_address, entry->address, entry->value_or_count);
+        case 4: return bmodbus_master_read_input_registers(master, entry->client_address, entry->address, entry->value_or_count);
+        case 5: return bmodbus_master_write_single_coil(master, entry->client_address, entry->address, entry->value_or_count);
+        case 6: return bmodbus_master_write_single_register(master, entry->client_address, entry->address, entry->value_or_count);
+        case 15: return bmodbus_master_write_multiple_coils(master, entry->client_address, entry->address, entry->value_or_count, (uint8_t *)entry->data);
+        case 16: return bmodbus_master_write_multiple_registers(master, entry->client_address, entry->address, entry->value_or_count, entry->data);
+        case 0x16: return bmodbus_master_mask_write_register(master, entry->client_address, entry->address, entry->data[0], entry->data[1]);
+        case 0x18: return bmodbus_master_read_fifo_queue(master, entry->client_address, entry->address);
+        default: return NULL;
+    }
+}
+
+void bmodbus_pool_loop(modbus_pool_t *pool, uint32_t microseconds){
+    modbus_pool_bus_t * line;
+    modbus_master_t * master;
+    modbus_uart_request_t * request;
+    modbus_request_t * response;
+    uint16_t index;
+    uint8_t bus;
+    for(bus = 0; bus < pool->bus_count; bus++){
+        line = &(pool->buses[bus]);
+        master = &(line->master);
+        bmodbus_master_loop(master, microseconds);
+        if((line->in_flight != BMB_POOL_NONE) && !line->sending){
+            response = bmodbus_master_get_response(master);
+            if(response != NULL){
+                pool_response(pool, line->in_flight, response);
+                line->in_flight = BMB_POOL_NONE;
+            }else if(master->state == MASTER_STATE_IDLE){ //The master dropped the response
+                pool_complete(pool, line->in_flight, BMB_POOL_BAD_RESPONSE);
+                line->in_flight = BMB_POOL_NONE;
+            }else if((master->state == MASTER_STATE_WAITING_FOR_RESPONSE) && ((microseconds - line->sent) >= pool->timeout)){
+                bmodbus_master_timeout(master);
+                pool_complete(pool, line->in_flight, BMB_POOL_TIMEOUT);
+                line->in_flight = BMB_POOL_NONE;
+            }
+        }
+        //The next request waits for the line to be quiet, after the response or whatever a late client sent
+        while((line->in_flight == BMB_POOL_NONE) && (line->head != BMB_POOL_NONE) &&
+              ((microseconds - master->last_microseconds) >= master->interframe_delay)){
+            index = line->head;
+            line->head = pool->entries[index].next;
+            if(line->head == BMB_POOL_NONE){
+                line->tail = BMB_POOL_NONE;
+            }
+            request = pool_build(master, &(pool->entries[index]));
+            if(request == NULL){
+                pool_complete(pool, index, BMB_POOL_REFUSED);
+                continue;
+            }
+            line->in_flight = index;
+            line->sending = 1;
+            pool->send(pool->context, bus, request->data, request->size);
+        }
+    }
+}
+
+void bmodbus_pool_send_complete(modbus_pool_t *pool, uint8_t bus, uint32_t microseconds){
+    modbus_pool_bus_t * line = &(pool->buses[bus]);
+    if(line->sending){
+        line->sending = 0;
+        line->sent = microseconds;
+        bmodbus_master_send_complete(&(line->master), microseconds);
+    }
+}
+
+uint8_t bmodbus_pool_completion(modbus_pool_t *pool, modbus_pool_entry_t *completion){
+    uint16_t index = pool->done_head;
+    if(index == BMB_POOL_NONE){
+        return 0;
+    }
+    *completion = pool->entries[index];
+    pool->done_head = pool->entries[index].next;
+    if(pool->done_head == BMB_POOL_NONE){
+        pool->done_tail = BMB_POOL_NONE;
+    }
+    pool->entries[index].next = pool->free;
+    pool->free = index;
+    return 1;
+}
+#endif //BMB_MASTER_POOL && !BMODBUS_NO_MASTER
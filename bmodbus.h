@@ -51,15 +51,51 @@ extern "C" {
 #ifndef BMB_MAXIMUM_MESSAGE_SIZE
 #define BMB_MAXIMUM_MESSAGE_SIZE 32
 #endif
-//FIXME -- unsure what's the exact number here, but it may change based upon supported commands
-#define BMB_MAXIMUM_REGISTER_COUNT ((BMB_MAXIMUM_MESSAGE_SIZE - 7) / 2)
+//Largest register read that fits the buffer (address, function, byte count, registers and CRC), 125 at 256 bytes.
+//Larger requests are refused with an illegal data value exception as soon as their header arrives. ASCII responses
+//take two characters per byte, so an ASCII client answers reads of up to (BMB_MAXIMUM_MESSAGE_SIZE - 11) / 4 registers (61 at 256).
+#define BMB_MAXIMUM_REGISTER_COUNT ((BMB_MAXIMUM_MESSAGE_SIZE - 5) / 2)
+
+//Requests sent to this address are applied by every client and never answered, only writes can be broadcast
+#define MODBUS_BROADCAST_ADDRESS (0)
+
+//Time a master waits after a broadcast before the bus is free again, the specification suggests 100ms to 200ms
+#ifndef BMB_TURNAROUND_DELAY_MICROSECONDS
+#define BMB_TURNAROUND_DELAY_MICROSECONDS (100000)
+#endif
+
+//Exception codes, a client replies with one of these when modbus_request_t.result is set to it
+#define MODBUS_EXCEPTION_ILLEGAL_FUNCTION       (1)
+#define MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS   (2)
+#define MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE     (3)
+#define MODBUS_EXCEPTION_SERVER_DEVICE_FAILURE  (4)
+#define MODBUS_EXCEPTION_SERVER_DEVICE_BUSY     (6)
+
+//Diagnostics (0x08) sub-functions answered by a client built with BMB_STATISTICS, the others get MODBUS_EXCEPTION_ILLEGAL_FUNCTION
+#define MODBUS_DIAGNOSTIC_RETURN_QUERY_DATA         (0x00) //Echoes the data word
+#define MODBUS_DIAGNOSTIC_CLEAR_COUNTERS            (0x0A)
+#define MODBUS_DIAGNOSTIC_BUS_MESSAGE_COUNT         (0x0B)
+#define MODBUS_DIAGNOSTIC_BUS_ERROR_COUNT           (0x0C) //CRC errors
+#define MODBUS_DIAGNOSTIC_EXCEPTION_COUNT           (0x0D)
+#define MODBUS_DIAGNOSTIC_SERVER_MESSAGE_COUNT      (0x0E)
+#define MODBUS_DIAGNOSTIC_NO_RESPONSE_COUNT         (0x0F)
+#define MODBUS_DIAGNOSTIC_NAK_COUNT                 (0x10) //Always 0, negative acknowledges are never sent
+#define MODBUS_DIAGNOSTIC_BUSY_COUNT                (0x11)
+#define MODBUS_DIAGNOSTIC_OVERRUN_COUNT             (0x12)
+#define MODBUS_DIAGNOSTIC_CLEAR_OVERRUN             (0x14)
 
 typedef struct {
     uint16_t data[BMB_MAXIMUM_MESSAGE_SIZE/2];
     uint16_t size; //It can be a number of registers OR a number of bits
     uint8_t function;
     uint16_t address;
-    int8_t result;
+    int8_t result; //0 on success, a MODBUS_EXCEPTION_ code to reply with an exception, negative to not reply at all
+#ifdef BMB_CLIENT_READ_WRITE_FUNCTION //These are only needed if we implement the read-write function
+    //For read/write multiple registers (0x17) address/size are the registers to read, address2/size2 are the registers
+    //written from data. The write is applied first, then data is filled with the registers read.
+    uint16_t address2;
+    uint16_t size2;
+#endif //BMB_CLIENT_READ_WRITE_FUNCTION
 }modbus_request_t;
 
 typedef struct {
@@ -67,38 +103,256 @@ typedef struct {
     uint8_t size; //It is the number of bytes in the response
 }modbus_uart_data_t;
 
+#ifdef BMB_SCATTER_GATHER
+//One contiguous piece of a frame
+typedef struct{
+    const uint8_t * data;
+    uint16_t length;
+}modbus_span_t;
+
+/**
+ * @brief A frame sent in pieces, so register data can be sent from where the application keeps it
+ *
+ * The spans are sent in order: the header built by the library, the payload in application memory and the CRC
+ * (computed over the other two). DMA descriptor chains and writev()/sendmsg() can take them as they are.
+ */
+typedef struct{
+    modbus_span_t span[3];
+    uint8_t count; //Spans in use, 1 when the whole frame is contiguous
+    uint8_t crc[2];
+}modbus_uart_vector_t;
+#endif //BMB_SCATTER_GATHER
+
 typedef enum{
-    CLIENT_NO_INIT=0, CLIENT_STATE_IDLE, CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE, CLIENT_STATE_FUNCTION_CODE, CLIENT_STATE_HEADER, CLIENT_STATE_HEADER_CHECK, CLIENT_STATE_DATA, CLIENT_STATE_FOOTER, CLIENT_STATE_FOOTER2, CLIENT_STATE_PROCESSING_REQUEST, CLIENT_STATE_SENDING_RESPONSE
+    CLIENT_NO_INIT=0, CLIENT_STATE_IDLE, CLIENT_STATE_WAITING_FOR_NEXT_MESSAGE, CLIENT_STATE_FUNCTION_CODE, CLIENT_STATE_HEADER, CLIENT_STATE_HEADER_CHECK, CLIENT_STATE_DATA, CLIENT_STATE_FOOTER, CLIENT_STATE_FOOTER2, CLIENT_STATE_PROCESSING_REQUEST, CLIENT_STATE_RESPONSE_READY, CLIENT_STATE_SENDING_RESPONSE, CLIENT_STATE_REJECTING
 }modbus_client_state_t;
 
+#ifdef BMB_CLIENT_FIFO_QUEUE
+/**
+ * @brief Ring buffer drained by read FIFO queue (0x18) requests
+ *
+ * The capacity must be a power of two (up to 128). The application pushes with bmodbus_fifo_push(), which is safe
+ * to call from an interrupt while the library drains the queue.
+ */
+typedef struct{
+    uint16_t * buffer;
+    uint8_t mask; //capacity - 1
+    volatile uint8_t head; //Free running index, only written by the producer
+    volatile uint8_t tail; //Free running index, only written by the library
+}modbus_fifo_t;
+#endif //BMB_CLIENT_FIFO_QUEUE
+
+#ifdef BMB_CLIENT_FILE_RECORD
+/**
+ * @brief Streaming callbacks for read/write file record (0x14/0x15)
+ *
+ * Record data is passed one register at a time as the frame arrives, so it never has to be stored in modbus_request_t.
+ * Because writes are streamed before the CRC has been checked, write_complete() reports whether the frame was valid and
+ * the application should only commit the data it received when it is called with valid set.
+ * The callbacks are called from bmodbus_client_next_byte(), so from the interrupt if that is where bytes are received.
+ */
+typedef struct{
+    int8_t (*read)(void * context, uint16_t file, uint16_t record, uint16_t * value); //Return 0 on success, or the exception code to reply with
+    int8_t (*write)(void * context, uint16_t file, uint16_t record, uint16_t value); //Return 0 on success, or the exception code to reply with
+    void (*write_complete)(void * context, uint8_t valid); //Optional, may be NULL
+    void * context;
+}modbus_file_record_t;
+#endif //BMB_CLIENT_FILE_RECORD
+
+//Read/write multiple registers has the longest header (two address and count pairs), then mask write (address and two masks)
+#ifdef BMB_CLIENT_READ_WRITE_FUNCTION
+#define BMB_HEADER_WORDS 4
+#else
+#define BMB_HEADER_WORDS 3
+#endif //BMB_CLIENT_READ_WRITE_FUNCTION
+
 typedef union{
-    uint16_t word[2];
-    uint8_t byte[4];
+    uint16_t word[BMB_HEADER_WORDS];
+    uint8_t byte[BMB_HEADER_WORDS * 2];
 }header_t;
 typedef union{
     uint16_t half;
     uint8_t byte[2];
 }uint16_bytes;
 
+#ifdef BMB_STATISTICS
+/**
+ * @brief Bus health counters of a client or master instance
+ *
+ * Each one is a single increment where it happens, they wrap around at 65535 like the counters of the diagnostics
+ * function. A client also reports them to masters through diagnostics (0x08) and get comm event counter (0x0B).
+ */
+typedef struct{
+    uint16_t frames; //Frames seen on the bus (client) or responses received (master)
+    uint16_t frames_for_us; //Frames addressed to this client (or broadcast), responses from the client the master asked
+    uint16_t crc_errors;
+    uint16_t framing_errors; //Frames cut short, inconsistent with their header or with bad ASCII characters
+    uint16_t overruns; //Frames dropped because the previous request was still being handled or the buffer was full
+    uint16_t exceptions; //Exception responses sent (client) or received (master)
+    uint16_t busy; //Client only, exceptions sent with MODBUS_EXCEPTION_SERVER_DEVICE_BUSY
+    uint16_t no_responses; //Client only, requests completed without a response (broadcasts or a negative result)
+    uint16_t events; //Client only, the comm event counter: requests completed without an exception
+    uint16_t timeouts; //Master only, requests given up with bmodbus_master_timeout()
+    uint16_t retries; //Master only, requests sent again to the same client after a timeout
+}modbus_statistics_t;
+#endif //BMB_STATISTICS
+
+#ifdef BMB_LATENCY
+//Resolution of the latency histograms, the smallest bucket is 1 << BMB_LATENCY_SHIFT microseconds
+#ifndef BMB_LATENCY_SHIFT
+#define BMB_LATENCY_SHIFT (6)
+#endif
+//Buckets per histogram, four per power of two, the last one also holds everything above it (524ms with the defaults)
+#ifndef BMB_LATENCY_BUCKETS
+#define BMB_LATENCY_BUCKETS (48)
+#endif
+//One histogram per function code up to read FIFO queue (0x18)
+#define BMB_LATENCY_FUNCTIONS (0x19)
+
+/**
+ * @brief Log-linear histogram of latencies
+ *
+ * Bucket i holds the latencies from bmodbus_latency_bucket_microseconds(i) up to the start of the next bucket, so the
+ * error is at most 25%. The counts stop at 65535 instead of wrapping around.
+ */
+typedef struct{
+    uint16_t count[BMB_LATENCY_BUCKETS];
+}modbus_latency_histogram_t;
+
+//Latency histograms of an instance, indexed by function code
+typedef struct{
+    modbus_latency_histogram_t function[BMB_LATENCY_FUNCTIONS];
+}modbus_latency_t;
+
+//Returns the time in microseconds, micros() on an Arduino for example
+typedef uint32_t (*modbus_clock_t)(void);
+#endif //BMB_LATENCY
+
+#ifdef BMB_BUS_PROFILE
+//Gaps between frames are counted by powers of two of the interframe delay, the last bucket holds 128 times and above
+#define BMB_BUS_GAP_BUCKETS (8)
+
+/**
+ * @brief Bus usage measured from the timestamps of the bytes received
+ *
+ * Attach one to the instance on each bus with bmodbus_client_set_bus_profile() or bmodbus_master_set_bus_profile(), or
+ * feed it directly with bmodbus_bus_profile_byte(). The timestamps wrap around after 71 minutes, so read it and start a
+ * new window with bmodbus_bus_profile_init() more often than that.
+ */
+typedef struct{
+    uint32_t interframe_delay;
+    uint32_t start; //First byte of the window
+    uint32_t last; //Last byte seen (or sent by the master)
+    uint32_t sent; //Time the last master request was sent
+    uint32_t bytes; //Received and sent
+    uint32_t frames;
+    uint32_t longest_gap; //Longest time without a byte between two frames
+    uint16_t gaps[BMB_BUS_GAP_BUCKETS]; //Gaps between frames: [1, 2) interframe delays, [2, 4), [4, 8)...
+    uint32_t turnaround_total; //Sum of the slave turnaround times, from the request sent to the first byte back
+    uint32_t turnaround_minimum;
+    uint32_t turnaround_maximum;
+    uint16_t turnarounds;
+    uint8_t started;
+    uint8_t awaiting; //A request was sent, the next byte starts the response
+}modbus_bus_profile_t;
+#endif //BMB_BUS_PROFILE
+
+#ifdef BMB_CAPTURE
+/* Capture files start with "BMBC" and the version byte, then one record per call of an ingest API:
+ *   varint  microseconds since the previous record (since 0 for the first one)
+ *   byte    direction, BMB_CAPTURE_CLIENT, BMB_CAPTURE_MASTER or BMB_CAPTURE_MASTER_SENT, with BMB_CAPTURE_PACKET for packets
+ *   varint  length
+ *   varint  only if BMB_CAPTURE_HAS_EXTRA(): microseconds per byte of a bmodbus_*_received() call, or the expected
+ *           response length of a request sent
+ *   bytes   the data
+ * Varints are unsigned LEB128, 7 bits per byte with the top bit set on all but the last byte.
+ */
+#define BMB_CAPTURE_VERSION         (1)
+#define BMB_CAPTURE_CLIENT          (0) //Bytes given to a client
+#define BMB_CAPTURE_MASTER          (1) //Bytes given to a master
+#define BMB_CAPTURE_MASTER_SENT     (2) //A request frame sent by a master, recorded by bmodbus_master_send_complete()
+#define BMB_CAPTURE_PACKET          (0x80) //Given with bmodbus_*_received_packet()
+#define BMB_CAPTURE_HAS_EXTRA(direction, length) (((direction) == BMB_CAPTURE_MASTER_SENT) || (!((direction) & BMB_CAPTURE_PACKET) && ((length) > 1)))
+
+//Called with each piece of the capture, to a file, a ring buffer or a socket
+typedef void (*modbus_capture_write_t)(void * context, const uint8_t * data, uint16_t length);
+
+typedef struct{
+    modbus_capture_write_t write;
+    void * context;
+    uint32_t last; //Timestamp of the previous record
+}modbus_capture_t;
+#endif //BMB_CAPTURE
+
+#if defined(BMB_CLIENT_ASCII) || defined(BMB_MASTER_ASCII)
+//Modbus ASCII framing state, the decoded bytes go through the same state machine as RTU
+typedef struct{
+    uint8_t enabled;
+    uint8_t state;
+    uint8_t high; //First digit of the byte being decoded
+    uint8_t held; //Set once a byte is held back, the last byte of a frame is the LRC and it is not passed on
+    uint8_t last; //The byte held back
+    uint8_t value; //The byte passed on
+    uint8_t lrc; //Sum of the bytes, zero once the LRC has been added
+}modbus_ascii_t;
+
+//Default time allowed between two characters of an ASCII frame, use it in place of the interframe delay
+#define ASCII_CHARACTER_TIMEOUT_MICROSECONDS (1000000)
+#endif //BMB_CLIENT_ASCII || BMB_MASTER_ASCII
+
 typedef struct{
     modbus_client_state_t state;
     uint32_t last_microseconds;
     uint32_t interframe_delay;
     uint8_t client_address; //historically called slave address
+    uint8_t broadcast; //Set when the current request was sent to MODBUS_BROADCAST_ADDRESS, its response is empty
     //These are active function variables used in headers
     header_t header;
     uint16_bytes crc;
     uint8_t function;
 #ifdef BMB_CLIENT_ASCII
-    uint8_t ascii; //Used for modbus ascii
+    modbus_ascii_t ascii; //Used for modbus ascii
 #endif //BMB_CLIENT_ASCII
     uint16_t byte_count; //Used for keeping track of message length
-#ifdef BMB_CLIENT_READ_WRITE_FUNCTION //These are only needed if we implement the read-write function
-    uint16_t address2;
-    uint8_t size2;
-#endif //BMB_CLIENT_READ_WRITE_FUNCTION
     uint8_t index;
     uint8_t byte_size;
+    uint16_t reject_remaining; //Bytes left in a rejected frame, 0 when its length is unknown
+#ifdef BMB_CLIENT_REGISTER_BANK //Holding registers served directly by the library
+    uint16_t * holding_registers;
+    uint16_t holding_start;
+    uint16_t holding_count;
+#endif //BMB_CLIENT_REGISTER_BANK
+#ifdef BMB_CLIENT_FIFO_QUEUE //Queue drained directly into read FIFO queue responses
+    modbus_fifo_t * fifo;
+    uint16_t fifo_address;
+#endif //BMB_CLIENT_FIFO_QUEUE
+#ifdef BMB_CLIENT_FILE_RECORD //File record sub-request parsing
+    const modbus_file_record_t * files;
+    uint16_t file_number;
+    uint16_t file_record;
+    uint16_t file_remaining; //Record data bytes left in the current write sub-request
+    uint8_t file_index; //Position in the current sub-request header
+    uint8_t file_offset; //Next byte of the read response
+    int8_t file_status;
+#endif //BMB_CLIENT_FILE_RECORD
+#ifdef BMB_STATISTICS
+    modbus_statistics_t statistics;
+#endif //BMB_STATISTICS
+#ifdef BMB_LATENCY //From the request being handed to the application to its response being sent
+    modbus_latency_t latency;
+    modbus_clock_t latency_clock; //NULL until bmodbus_client_set_latency_clock()
+    uint32_t latency_start;
+    uint8_t latency_pending; //Set while latency_start belongs to the request being handled
+#endif //BMB_LATENCY
+#ifdef BMB_BUS_PROFILE
+    modbus_bus_profile_t * bus_profile; //NULL unless bmodbus_client_set_bus_profile() was called
+#endif //BMB_BUS_PROFILE
+#ifdef BMB_MONITOR
+    uint8_t promiscuous; //Every frame is taken as addressed to this client, used by modbus_monitor_t
+#endif //BMB_MONITOR
+#ifdef BMB_CAPTURE
+    modbus_capture_t * capture; //NULL unless bmodbus_client_set_capture() was called
+#endif //BMB_CAPTURE
     //Payload is outside of this struct so it can be configured differently for each instance
     union{
         modbus_request_t request;
@@ -107,6 +361,21 @@ typedef struct{
 
 }modbus_client_t;
 
+/**
+ * @brief The modbus CRC of a block of bytes, for transports that rebuild RTU frames (e.g. from Modbus TCP)
+ * @param data - the bytes
+ * @param length - the number of bytes
+ * @return the CRC, sent low byte first
+ */
+extern uint16_t bmodbus_crc(const uint8_t * data, uint16_t length);
+/**
+ * @brief The length of the RTU request at the start of a stream, for transports that split a byte stream (TCP) into frames
+ * @param frame - the bytes received so far, starting with the address of the request
+ * @param length - the number of bytes
+ * @return the length of the request with its CRC, 0 if more bytes are needed to tell, or length when the function is
+ * not supported (the client rejects everything received as one frame)
+ */
+extern uint16_t bmodbus_request_length(const uint8_t * frame, uint16_t length);
 
 /**
  * @brief Initialize the modbus client
@@ -135,7 +404,43 @@ extern void bmodbus_client_init(modbus_client_t *bmodbus, uint32_t interframe_de
  * @note: This function should be called for each byte received from the modbus master. It can be called from an interrupt, or the bytes can be sent via a task.
  */
 extern void bmodbus_client_next_byte(modbus_client_t *bmodbus, uint32_t microseconds, uint8_t byte);
+/**
+ * @brief send several bytes to the modbus client at once
+ *
+ * @param bmodbus - the modbus client instance
+ * @param microseconds - the time the last byte was received in microseconds
+ * @param bytes - pointer to the bytes received
+ * @param length - the number of bytes received
+ * @param microseconds_per_byte - the time in microseconds - as calculated by BYTE_TIMING_IN_MICROSECONDS(baudrate)
+ *
+ * @note In ASCII mode the hex digits are decoded two at a time, so it is cheaper than calling bmodbus_client_next_byte() per character.
+ */
+extern void bmodbus_client_received(modbus_client_t *bmodbus, uint32_t microseconds, uint8_t * bytes, uint8_t length, uint32_t microseconds_per_byte);
+/**
+ * @brief send a whole frame received from a packet transport (RTU over UDP or TCP) to the modbus client
+ *
+ * The packet boundaries are used as frame boundaries instead of the interframe delay, each packet starts a new frame.
+ * Packets that arrive while the previous request is still being handled are dropped.
+ * @param bmodbus - the modbus client instance
+ * @param microseconds - the time the packet was received in microseconds
+ * @param bytes - pointer to the packet
+ * @param length - the number of bytes in the packet
+ */
+extern void bmodbus_client_received_packet(modbus_client_t *bmodbus, uint32_t microseconds, const uint8_t * bytes, uint16_t length);
 extern void bmodbus_client_loop(modbus_client_t *bmodbus, uint32_t microsecond);
+#ifdef BMB_CLIENT_ASCII
+/**
+ * @brief Switch the client between RTU and ASCII framing
+ *
+ * In ASCII mode frames start with ':' and end with CR LF, so the interframe delay given to bmodbus_client_init() is
+ * used as the timeout between characters instead (ASCII_CHARACTER_TIMEOUT_MICROSECONDS is the usual value). Responses
+ * are hex encoded in the response buffer, so they need twice the room: reads whose ASCII response would not fit are
+ * refused with an illegal data value exception when their header arrives.
+ * @param bmodbus - the modbus client instance
+ * @param enable - 1 for ASCII, 0 for RTU
+ */
+extern void bmodbus_client_set_ascii(modbus_client_t *bmodbus, uint8_t enable);
+#endif //BMB_CLIENT_ASCII
 /**
  * @brief Get the next modbus request if there's one pending
  *
@@ -151,6 +456,83 @@ extern modbus_request_t * bmodbus_client_get_request(modbus_client_t *bmodbus);
  * @return a pointer to the response, or NULL if there's no response
  */
 extern modbus_uart_data_t * bmodbus_client_get_response(modbus_client_t * bmodbus);
+#ifdef BMB_SCATTER_GATHER
+/**
+ * @brief Get the response as spans, with the read data sent from application memory instead of being copied
+ *
+ * For read requests answered by the application (coils, discrete inputs, holding/input registers and read/write
+ * multiple registers), payload is sent as the data of the response. It must hold the byte count worth of data
+ * already in Modbus byte order (registers big endian, bits packed), and stay unchanged until
+ * bmodbus_client_send_complete(). Every other response (exceptions, writes, ASCII...) is returned as one span.
+ * Reads the library answers itself, from a register bank, a FIFO queue or the file records, are one span too: their data
+ * was already copied into the response buffer (the bank holds native endian registers) and payload is not used.
+ * @param bmodbus - the modbus client instance
+ * @param payload - the read data, NULL to use the request data like bmodbus_client_get_response()
+ * @param vector - filled in with the spans to send
+ * @return vector, or NULL if there's no response
+ */
+extern modbus_uart_vector_t * bmodbus_client_get_response_vector(modbus_client_t * bmodbus, const uint8_t * payload, modbus_uart_vector_t * vector);
+#endif //BMB_SCATTER_GATHER
+#ifdef BMB_CLIENT_REGISTER_BANK
+/**
+ * @brief Serve a block of holding registers directly from the library
+ *
+ * Requests for read holding registers (0x03), write single register (0x06), write multiple registers (0x10),
+ * mask write register (0x16) and read/write multiple registers (0x17) that fall completely inside the bank are
+ * applied by the library and never returned by bmodbus_client_get_request(). Everything else is passed to the application.
+ * @param bmodbus - the modbus client instance
+ * @param registers - the register storage, or NULL to disable the bank
+ * @param start_address - the modbus address of registers[0]
+ * @param count - the number of registers in the bank
+ * @return none
+ *
+ * @note When a bank is used the application must poll bmodbus_client_get_response() even if bmodbus_client_get_request() returned NULL.
+ * Define BMB_REGISTER_BANK_LOCK()/BMB_REGISTER_BANK_UNLOCK() (e.g. to disable interrupts) if the bank is shared with an interrupt.
+ */
+extern void bmodbus_client_set_holding_registers(modbus_client_t *bmodbus, uint16_t *registers, uint16_t start_address, uint16_t count);
+#endif //BMB_CLIENT_REGISTER_BANK
+#ifdef BMB_CLIENT_FIFO_QUEUE
+/**
+ * @brief Initialize a FIFO queue ring buffer
+ * @param fifo - the queue to initialize
+ * @param buffer - storage for the queued values
+ * @param capacity - the number of values in buffer, must be a power of two no larger than 128
+ * @return none
+ */
+extern void bmodbus_fifo_init(modbus_fifo_t *fifo, uint16_t *buffer, uint8_t capacity);
+/**
+ * @brief Queue a value to be read by a master
+ * @param fifo - the queue
+ * @param value - the value to queue
+ * @return 0 on success, -1 if the queue is full
+ */
+extern int8_t bmodbus_fifo_push(modbus_fifo_t *fifo, uint16_t value);
+/**
+ * @brief Serve read FIFO queue (0x18) requests for one pointer address from a ring buffer
+ *
+ * Each request for fifo_address is answered by the library with up to 31 values, which are removed from the queue as
+ * they are copied into the response frame. Fewer are sent when the response buffer (or its ASCII encoding) cannot hold
+ * 31, the rest stay queued for the next request. Requests for other pointer addresses are passed to the application, which
+ * fills data and sets size to the number of values. A size the response cannot hold (31 at most) is answered with
+ * MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE.
+ * @param bmodbus - the modbus client instance
+ * @param fifo_address - the FIFO pointer address the queue answers to
+ * @param fifo - the queue, or NULL to disable it
+ * @return none
+ * @note The application must poll bmodbus_client_get_response() even if bmodbus_client_get_request() returned NULL.
+ */
+extern void bmodbus_client_set_fifo(modbus_client_t *bmodbus, uint16_t fifo_address, modbus_fifo_t *fifo);
+#endif //BMB_CLIENT_FIFO_QUEUE
+#ifdef BMB_CLIENT_FILE_RECORD
+/**
+ * @brief Serve read/write file record (0x14/0x15) requests through streaming callbacks
+ * @param bmodbus - the modbus client instance
+ * @param files - the callbacks, or NULL to ignore file record requests
+ * @return none
+ * @note File record requests are answered by the library, the application must poll bmodbus_client_get_response().
+ */
+extern void bmodbus_client_set_file_records(modbus_client_t *bmodbus, const modbus_file_record_t *files);
+#endif //BMB_CLIENT_FILE_RECORD
 /**
  * @brief Update the state machine
  *
@@ -160,6 +542,115 @@ extern modbus_uart_data_t * bmodbus_client_get_response(modbus_client_t * bmodbu
  * @note This function should be called when the response is sent. It will reset the state machine and prepare for the next request.
  */
 extern void bmodbus_client_send_complete(modbus_client_t * bmodbus);
+#ifdef BMB_STATISTICS
+/**
+ * @brief Get the bus health counters of a client
+ * @param bmodbus - the modbus client instance
+ * @return the counters, they are updated in place
+ */
+extern const modbus_statistics_t * bmodbus_client_statistics(modbus_client_t *bmodbus);
+/**
+ * @brief Clear the bus health counters of a client, as diagnostics sub-function 0x0A does
+ * @param bmodbus - the modbus client instance
+ */
+extern void bmodbus_client_clear_statistics(modbus_client_t *bmodbus);
+#endif //BMB_STATISTICS
+#ifdef BMB_LATENCY
+/**
+ * @brief Set the clock used to time the requests of a client
+ *
+ * The client API has no timestamps outside of the bytes received, so latencies are only recorded once it is set.
+ * @param bmodbus - the modbus client instance
+ * @param clock - returns the time in microseconds, it is called twice per request
+ */
+extern void bmodbus_client_set_latency_clock(modbus_client_t *bmodbus, modbus_clock_t clock);
+/**
+ * @brief Get the latency histograms of a client
+ *
+ * A request is timed from bmodbus_client_get_request() (or bmodbus_client_get_response() for requests the library
+ * answers itself) to bmodbus_client_send_complete().
+ * @param bmodbus - the modbus client instance
+ * @return the histograms, indexed by function code
+ */
+extern const modbus_latency_t * bmodbus_client_latency(modbus_client_t *bmodbus);
+/**
+ * @brief Clear the latency histograms of a client
+ * @param bmodbus - the modbus client instance
+ */
+extern void bmodbus_client_clear_latency(modbus_client_t *bmodbus);
+/**
+ * @brief Get the lowest latency of a histogram bucket
+ * @param bucket - 0 to BMB_LATENCY_BUCKETS - 1
+ * @return the latency in microseconds
+ */
+extern uint32_t bmodbus_latency_bucket_microseconds(uint8_t bucket);
+/**
+ * @brief Estimate a percentile of a latency histogram
+ * @param histogram - the histogram
+ * @param permille - the percentile in tenths of a percent, 500 for the median and 990 for the 99th percentile
+ * @return the lowest latency of the bucket holding the percentile in microseconds, 0 if the histogram is empty
+ */
+extern uint32_t bmodbus_latency_percentile(const modbus_latency_histogram_t *histogram, uint16_t permille);
+#endif //BMB_LATENCY
+#ifdef BMB_BUS_PROFILE
+/**
+ * @brief Start a new measurement window
+ * @param profile - the bus profile
+ * @param interframe_delay - the interframe delay of the bus, INTERFRAME_DELAY_MICROSECONDS(baudrate)
+ */
+extern void bmodbus_bus_profile_init(modbus_bus_profile_t *profile, uint32_t interframe_delay);
+/**
+ * @brief Account for a byte received on the bus
+ * @param profile - the bus profile
+ * @param microseconds - the time the byte was received
+ */
+extern void bmodbus_bus_profile_byte(modbus_bus_profile_t *profile, uint32_t microseconds);
+/**
+ * @brief Account for a request sent on the bus, the first byte received after it gives the slave turnaround time
+ * @param profile - the bus profile
+ * @param microseconds - the time the last byte was sent
+ * @param bytes - the length of the request
+ */
+extern void bmodbus_bus_profile_sent(modbus_bus_profile_t *profile, uint32_t microseconds, uint16_t bytes);
+/**
+ * @brief Get the share of the window the bus was carrying bytes
+ * @param profile - the bus profile
+ * @param microseconds_per_byte - BYTE_TIMING_IN_MICROSECONDS(baudrate)
+ * @return the utilization in tenths of a percent (0 to 1000), the idle share is 1000 minus it
+ */
+extern uint16_t bmodbus_bus_utilization(const modbus_bus_profile_t *profile, uint32_t microseconds_per_byte);
+/**
+ * @brief Profile the bus of a client, every byte given to bmodbus_client_next_byte() or bmodbus_client_received() is counted
+ * @param bmodbus - the modbus client instance
+ * @param profile - the bus profile, or NULL to stop
+ */
+extern void bmodbus_client_set_bus_profile(modbus_client_t *bmodbus, modbus_bus_profile_t *profile);
+#endif //BMB_BUS_PROFILE
+#ifdef BMB_CAPTURE
+/**
+ * @brief Start a capture, the file header is written straight away
+ * @param capture - the capture instance
+ * @param write - called with every piece of the capture
+ * @param context - passed to write
+ */
+extern void bmodbus_capture_init(modbus_capture_t *capture, modbus_capture_write_t write, void * context);
+/**
+ * @brief Write a capture record, the ingest APIs of an instance with a capture call it for you
+ * @param capture - the capture instance
+ * @param microseconds - the timestamp given to the ingest API
+ * @param direction - BMB_CAPTURE_CLIENT, BMB_CAPTURE_MASTER or BMB_CAPTURE_MASTER_SENT, ORed with BMB_CAPTURE_PACKET for packets
+ * @param bytes - the data
+ * @param length - the number of bytes
+ * @param extra - microseconds per byte, or the expected response length for BMB_CAPTURE_MASTER_SENT
+ */
+extern void bmodbus_capture_record(modbus_capture_t *capture, uint32_t microseconds, uint8_t direction, const uint8_t * bytes, uint16_t length, uint32_t extra);
+/**
+ * @brief Record every byte given to a client, tools/bmodbus_replay.c plays the capture back
+ * @param bmodbus - the modbus client instance
+ * @param capture - the capture, or NULL to stop
+ */
+extern void bmodbus_client_set_capture(modbus_client_t *bmodbus, modbus_capture_t *capture);
+#endif //BMB_CAPTURE
 
 /**
  * @brief Deinitialize the modbus client
@@ -181,7 +672,7 @@ extern void bmodbus_client_deinit(modbus_client_t *bmodbus);
 
  */
 typedef enum{
-    MASTER_NO_INIT=0, MASTER_STATE_IDLE, MASTER_STATE_SENDING_REQUEST, MASTER_STATE_WAITING_FOR_RESPONSE, MASTER_STATE_PROCESSING_RESPONSE, MASTER_STATE_RESPONSE_READY
+    MASTER_NO_INIT=0, MASTER_STATE_IDLE, MASTER_STATE_SENDING_REQUEST, MASTER_STATE_WAITING_FOR_RESPONSE, MASTER_STATE_PROCESSING_RESPONSE, MASTER_STATE_RESPONSE_READY, MASTER_STATE_TURNAROUND
 }modbus_master_state_t;
 
 typedef struct{
@@ -190,15 +681,61 @@ typedef struct{
     uint8_t expected_response_size;
 }modbus_uart_request_t;
 
+//One sub-request of a read/write file record request, a record is one 16 bit register
+typedef struct{
+    uint16_t file; //File number 1->65535
+    uint16_t record; //Starting record 0->9999
+    uint16_t length; //Number of records
+    const uint16_t * data; //Values to write, unused for reads
+}modbus_file_subrequest_t;
+
+//State of a write file record transfer split over as many requests as needed
+typedef struct{
+    const uint16_t * data;
+    uint32_t remaining; //Records not yet acknowledged
+    uint16_t file;
+    uint16_t record;
+    uint16_t in_flight; //Records in the request waiting for a response
+    uint8_t client_address;
+    int8_t result; //0, or the exception the client answered with, which stops the transfer (set it back to 0 to retry)
+}modbus_file_transfer_t;
+
+#ifdef BMB_MASTER_CALLBACK
+//Called when the request in flight completes, response is NULL if it was given up (bad response or timeout)
+typedef void (*modbus_master_callback_t)(void * context, modbus_request_t * response);
+#endif //BMB_MASTER_CALLBACK
+
 typedef struct{
     modbus_master_state_t state;
     uint32_t interframe_delay;
+    uint32_t turnaround_delay;
     uint32_t last_microseconds;
     uint16_bytes crc;
     uint8_t client_address; //historically called slave address
     uint16_t register_address;
     uint8_t function;
     uint8_t byte_count;
+#ifdef BMB_MASTER_ASCII
+    modbus_ascii_t ascii;
+#endif //BMB_MASTER_ASCII
+#ifdef BMB_STATISTICS
+    modbus_statistics_t statistics;
+    uint8_t failed; //The last request was given up, the next one to the same client and function is a retry
+#endif //BMB_STATISTICS
+#ifdef BMB_LATENCY //From the request being sent to its response being ready
+    modbus_latency_t latency;
+    uint32_t latency_start;
+#endif //BMB_LATENCY
+#ifdef BMB_BUS_PROFILE
+    modbus_bus_profile_t * bus_profile; //NULL unless bmodbus_master_set_bus_profile() was called
+#endif //BMB_BUS_PROFILE
+#ifdef BMB_CAPTURE
+    modbus_capture_t * capture; //NULL unless bmodbus_master_set_capture() was called
+#endif //BMB_CAPTURE
+#ifdef BMB_MASTER_CALLBACK
+    modbus_master_callback_t callback; //NULL unless bmodbus_master_set_callback() was called
+    void * callback_context;
+#endif //BMB_MASTER_CALLBACK
     union{
         modbus_request_t response;
         modbus_uart_request_t request;
@@ -216,6 +753,33 @@ typedef struct{
  *
  */
 extern void bmodbus_master_init(modbus_master_t *bmodbus, uint32_t interframe_delay);
+/**
+ * @brief Set how long the master waits after a broadcast before completing it
+ *
+ * @param bmodbus - pointer to the modbus master instance
+ * @param turnaround_delay - the time in microseconds, BMB_TURNAROUND_DELAY_MICROSECONDS by default
+ */
+extern void bmodbus_master_set_turnaround_delay(modbus_master_t *bmodbus, uint32_t turnaround_delay);
+#ifdef BMB_MASTER_ASCII
+/**
+ * @brief Switch the master between RTU and ASCII framing
+ *
+ * In ASCII mode requests are built hex encoded (so they need twice the room) and responses end with CR LF, the
+ * interframe delay given to bmodbus_master_init() is used as the timeout between characters.
+ * @param bmodbus - pointer to the modbus master instance
+ * @param enable - 1 for ASCII, 0 for RTU
+ */
+extern void bmodbus_master_set_ascii(modbus_master_t *bmodbus, uint8_t enable);
+#endif //BMB_MASTER_ASCII
+/**
+ * @brief Advance the time based parts of the modbus master
+ *
+ * Write requests built with MODBUS_BROADCAST_ADDRESS as the client address are not answered, instead they complete
+ * (with an empty response) once the turnaround delay has passed after bmodbus_master_send_complete().
+ * @param bmodbus - pointer to the modbus master instance
+ * @param microseconds - the current time in microseconds
+ */
+extern void bmodbus_master_loop(modbus_master_t *bmodbus, uint32_t microseconds);
 /**
  *
  * @brief notify the modbus master that the request has completely sent
@@ -251,6 +815,16 @@ extern void bmodbus_master_next_byte(modbus_master_t *bmodbus, uint32_t microsec
  *
  */
 extern void bmodbus_master_received(modbus_master_t *bmodbus, uint32_t microseconds, uint8_t * bytes, uint8_t length, uint32_t microseconds_per_byte);
+/**
+ * @brief notify the modbus master that a packet has been received from a packet transport (RTU over UDP or TCP)
+ *
+ * No interframe timing is used, the response is assembled from every packet received since bmodbus_master_send_complete().
+ * @param bmodbus - pointer to the modbus master instance
+ * @param microseconds - the time the packet was received in microseconds
+ * @param bytes - pointer to the packet
+ * @param length - the number of bytes in the packet
+ */
+extern void bmodbus_master_received_packet(modbus_master_t *bmodbus, uint32_t microseconds, const uint8_t * bytes, uint16_t length);
 /**
  * @brief Get the next modbus request if there's one pending
  *
@@ -261,8 +835,77 @@ extern void bmodbus_master_received(modbus_master_t *bmodbus, uint32_t microseco
  * It has very low overhead and can be called as quickly as desired. It a delay occurs prior to calling it, it will just increase the response time.
  *
  * @note This function is typically called from the main loop to return a request to the application. The application should call modbus_finish_request() when it's done with the request.
+ * @note If the client answered with an exception, result holds the exception code (MODBUS_EXCEPTION_*) and size is 0.
  */
 extern modbus_request_t * bmodbus_master_get_response(modbus_master_t *bmodbus);
+/**
+ * @brief Give up on the request in flight, the master is idle again
+ *
+ * The timeout is up to the application (or the transport), it depends on the client and the bus.
+ * @param bmodbus - pointer to the modbus master instance
+ */
+extern void bmodbus_master_timeout(modbus_master_t *bmodbus);
+#ifdef BMB_STATISTICS
+/**
+ * @brief Get the bus health counters of a master
+ * @param bmodbus - pointer to the modbus master instance
+ * @return the counters, they are updated in place
+ */
+extern const modbus_statistics_t * bmodbus_master_statistics(modbus_master_t *bmodbus);
+/**
+ * @brief Clear the bus health counters of a master
+ * @param bmodbus - pointer to the modbus master instance
+ */
+extern void bmodbus_master_clear_statistics(modbus_master_t *bmodbus);
+#endif //BMB_STATISTICS
+#ifdef BMB_LATENCY
+/**
+ * @brief Get the latency histograms of a master
+ *
+ * A request is timed from bmodbus_master_send_complete() to its response being ready (exceptions included), using
+ * the timestamps passed to the master. Broadcasts and requests given up are not counted.
+ * @param bmodbus - pointer to the modbus master instance
+ * @return the histograms, indexed by function code
+ */
+extern const modbus_latency_t * bmodbus_master_latency(modbus_master_t *bmodbus);
+/**
+ * @brief Clear the latency histograms of a master
+ * @param bmodbus - pointer to the modbus master instance
+ */
+extern void bmodbus_master_clear_latency(modbus_master_t *bmodbus);
+#endif //BMB_LATENCY
+#ifdef BMB_BUS_PROFILE
+/**
+ * @brief Profile the bus of a master, its requests and every byte it receives are counted along with the slave turnaround times
+ *
+ * A master only sees its own transactions, so give it every byte received, even when no response is expected.
+ * @param bmodbus - pointer to the modbus master instance
+ * @param profile - the bus profile, or NULL to stop
+ */
+extern void bmodbus_master_set_bus_profile(modbus_master_t *bmodbus, modbus_bus_profile_t *profile);
+#endif //BMB_BUS_PROFILE
+#ifdef BMB_MASTER_CALLBACK
+/**
+ * @brief Be called when a request completes instead of polling bmodbus_master_get_response()
+ *
+ * The callback runs from the call that completed the request: bmodbus_master_next_byte() (so maybe an interrupt) or
+ * bmodbus_master_received() for responses, bmodbus_master_loop() for broadcasts and bmodbus_master_timeout().
+ * The master is in MASTER_STATE_RESPONSE_READY (or idle if the request was given up), so the callback can build the
+ * next request straight away. The response is overwritten by that request, copy what is needed first.
+ * @param bmodbus - pointer to the modbus master instance
+ * @param callback - the callback, or NULL to stop
+ * @param context - passed to the callback
+ */
+extern void bmodbus_master_set_callback(modbus_master_t *bmodbus, modbus_master_callback_t callback, void * context);
+#endif //BMB_MASTER_CALLBACK
+#ifdef BMB_CAPTURE
+/**
+ * @brief Record every request sent by a master and every byte given to it
+ * @param bmodbus - pointer to the modbus master instance
+ * @param capture - the capture, or NULL to stop
+ */
+extern void bmodbus_master_set_capture(modbus_master_t *bmodbus, modbus_capture_t *capture);
+#endif //BMB_CAPTURE
 /**
  * @brief Build a modbus master read coils request
  * @param bmodbus - pointer to modbus master instance
@@ -302,7 +945,7 @@ extern modbus_uart_request_t * bmodbus_master_read_input_registers(modbus_master
 /**
  * @brief Build a modbus master write single coil request
  * @param bmodbus - pointer to modbus master instance
- * @param client_address - the address of the client 1->254
+ * @param client_address - the address of the client 1->254, or MODBUS_BROADCAST_ADDRESS
  * @param address - the address of the coil to write 0->65535
  * @param value - the value to write 0xFF00 or 0x0000
  * @return a pointer to the request, or NULL if there's no request
@@ -311,7 +954,7 @@ extern modbus_uart_request_t * bmodbus_master_write_single_coil(modbus_master_t
 /**
  * @brief Build a modbus master write single register request
  * @param bmodbus - pointer to modbus master instance
- * @param client_address - the address of the client 1->254
+ * @param client_address - the address of the client 1->254, or MODBUS_BROADCAST_ADDRESS
  * @param address - the address of the register to write 0->65535
  * @param value - the value to write 0->65535
  * @return a pointer to the request, or NULL if there's no request
@@ -320,7 +963,7 @@ extern modbus_uart_request_t * bmodbus_master_write_single_register(modbus_maste
 /**
  * @brief Build a modbus master write multiple coils request
  * @param bmodbus - pointer to modbus master instance
- * @param client_address - the address of the client 1->254
+ * @param client_address - the address of the client 1->254, or MODBUS_BROADCAST_ADDRESS
  * @param address - the starting address of the coils to write 0->65535
  * @param count - the number of coils to write
  * @param data - pointer to the data to write
@@ -330,13 +973,325 @@ extern modbus_uart_request_t * bmodbus_master_write_multiple_coils(modbus_master
 /**
  * @brief Build a modbus master write multiple registers request
  * @param bmodbus - pointer to modbus master instance
- * @param client_address - the address of the client 1->254
+ * @param client_address - the address of the client 1->254, or MODBUS_BROADCAST_ADDRESS
  * @param address - the starting address of the registers to write 0->65535
  * @param count - the number of registers to write
  * @param data - pointer to the data to write
  * @return a pointer to the request, or NULL if there's no request
  */
 extern modbus_uart_request_t * bmodbus_master_write_multiple_registers(modbus_master_t *bmodbus, uint8_t client_address, uint16_t address, uint16_t count, uint16_t *data);
+#ifdef BMB_SCATTER_GATHER
+/**
+ * @brief Build a write multiple coils (0x0F) or registers (0x10) request sent from application memory
+ *
+ * Only the header is built in the master, the values are sent from data so they can be larger than
+ * BMB_MAXIMUM_MESSAGE_SIZE allows (up to the 123 registers or 1968 coils of the specification). With ASCII the frame
+ * has to be hex encoded, so it is copied and returned as one span.
+ * @param bmodbus - pointer to modbus master instance
+ * @param client_address - the address of the client 1->254, or MODBUS_BROADCAST_ADDRESS
+ * @param function - 0x0F or 0x10
+ * @param address - the starting address 0->65535
+ * @param count - the number of coils or registers
+ * @param data - the values in Modbus byte order (registers big endian, coils packed), unchanged until the request is sent
+ * @param vector - filled in with the spans to send
+ * @return vector, or NULL if the request cannot be sent
+ */
+extern modbus_uart_vector_t * bmodbus_master_write_multiple_vector(modbus_master_t *bmodbus, uint8_t client_address, uint8_t function, uint16_t address, uint16_t count, const uint8_t *data, modbus_uart_vector_t * vector);
+#endif //BMB_SCATTER_GATHER
+/**
+ * @brief Build a modbus master mask write register request
+ *
+ * The client computes (register AND and_mask) OR (or_mask AND (NOT and_mask)), so individual bits can be updated in a single transaction.
+ * @param bmodbus - pointer to modbus master instance
+ * @param client_address - the address of the client 1->254, or MODBUS_BROADCAST_ADDRESS
+ * @param address - the address of the register to modify 0->65535
+ * @param and_mask - bits set to 1 are kept from the current value
+ * @param or_mask - bits to set where and_mask is 0
+ * @return a pointer to the request, or NULL if there's no request
+ */
+extern modbus_uart_request_t * bmodbus_master_mask_write_register(modbus_master_t *bmodbus, uint8_t client_address, uint16_t address, uint16_t and_mask, uint16_t or_mask);
+/**
+ * @brief Build a modbus master read FIFO queue request
+ *
+ * The response data holds the queued values and size is the number of values (up to 31).
+ * @param bmodbus - pointer to modbus master instance
+ * @param client_address - the address of the client 1->254
+ * @param fifo_address - the FIFO pointer address 0->65535
+ * @return a pointer to the request, or NULL if there's no request
+ */
+extern modbus_uart_request_t * bmodbus_master_read_fifo_queue(modbus_master_t *bmodbus, uint8_t client_address, uint16_t fifo_address);
+/**
+ * @brief Build a modbus master diagnostics request
+ *
+ * The response data holds the data word of the answer (the counter for the MODBUS_DIAGNOSTIC_*_COUNT sub-functions) and size is 1.
+ * @param bmodbus - pointer to modbus master instance
+ * @param client_address - the address of the client 1->254
+ * @param sub_function - one of MODBUS_DIAGNOSTIC_*
+ * @param data - the data word, 0 for all but MODBUS_DIAGNOSTIC_RETURN_QUERY_DATA
+ * @return a pointer to the request, or NULL if there's no request
+ */
+extern modbus_uart_request_t * bmodbus_master_diagnostics(modbus_master_t *bmodbus, uint8_t client_address, uint16_t sub_function, uint16_t data);
+/**
+ * @brief Build a modbus master get comm event counter request
+ *
+ * The response data holds the status word (0xFFFF while the client is busy) then the event count, size is 2.
+ * @param bmodbus - pointer to modbus master instance
+ * @param client_address - the address of the client 1->254
+ * @return a pointer to the request, or NULL if there's no request
+ */
+extern modbus_uart_request_t * bmodbus_master_get_comm_event_counter(modbus_master_t *bmodbus, uint8_t client_address);
+/**
+ * @brief Build a modbus master read file record request
+ *
+ * All sub-requests are batched into one frame. The response data holds the records of every sub-request in order and size is the total number of records.
+ * @param bmodbus - pointer to modbus master instance
+ * @param client_address - the address of the client 1->254
+ * @param subrequests - the records to read
+ * @param count - the number of sub-requests
+ * @return a pointer to the request, or NULL if there's no request (or it does not fit in BMB_MAXIMUM_MESSAGE_SIZE)
+ */
+extern modbus_uart_request_t * bmodbus_master_read_file_record(modbus_master_t *bmodbus, uint8_t client_address, const modbus_file_subrequest_t *subrequests, uint8_t count);
+/**
+ * @brief Build a modbus master write file record request
+ * @param bmodbus - pointer to modbus master instance
+ * @param client_address - the address of the client 1->254, or MODBUS_BROADCAST_ADDRESS
+ * @param subrequests - the records to write
+ * @param count - the number of sub-requests
+ * @return a pointer to the request, or NULL if there's no request (or it does not fit in BMB_MAXIMUM_MESSAGE_SIZE)
+ */
+extern modbus_uart_request_t * bmodbus_master_write_file_record(modbus_master_t *bmodbus, uint8_t client_address, const modbus_file_subrequest_t *subrequests, uint8_t count);
+/**
+ * @brief Start writing a block of records that may be larger than a single request
+ * @param transfer - the transfer state
+ * @param client_address - the address of the client 1->254
+ * @param file - the first file number
+ * @param record - the first record, the transfer continues in the next file after record 9999
+ * @param data - the records to write, it must stay valid until the transfer is done
+ * @param count - the number of records
+ * @return none
+ */
+extern void bmodbus_master_file_transfer_init(modbus_file_transfer_t *transfer, uint8_t client_address, uint16_t file, uint16_t record, const uint16_t *data, uint32_t count);
+/**
+ * @brief Build the next request of a file transfer
+ *
+ * Call it as soon as the previous response is ready (or the master gave up on it), each request is packed as full as
+ * the frame allows so the bus stays saturated. A request that got no valid response is built again, an exception
+ * response stops the transfer with the exception code in transfer->result.
+ * @param bmodbus - pointer to modbus master instance
+ * @param transfer - the transfer state
+ * @return a pointer to the request, or NULL if the master is still busy or the transfer is done (or stopped)
+ */
+extern modbus_uart_request_t * bmodbus_master_file_transfer_next(modbus_master_t *bmodbus, modbus_file_transfer_t *transfer);
+/**
+ * @brief Check if every record of a file transfer has been acknowledged, or the client refused one of the requests
+ * @param bmodbus - pointer to modbus master instance
+ * @param transfer - the transfer state
+ * @return 1 when done (transfer->result tells if it completed), otherwise 0
+ */
+extern uint8_t bmodbus_master_file_transfer_done(modbus_master_t *bmodbus, modbus_file_transfer_t *transfer);
+/**
+ * @brief Build a modbus master read/write multiple registers request
+ *
+ * The client applies the write before performing the read, so a write-then-read control cycle takes a single round trip.
+ * @param bmodbus - pointer to modbus master instance
+ * @param client_address - the address of the client 1->254
+ * @param read_address - the starting address of the registers to read 0->65535
+ * @param read_count - the number of registers to read
+ * @param write_address - the starting address of the registers to write 0->65535
+ * @param write_count - the number of registers to write
+ * @param data - pointer to the data to write
+ * @return a pointer to the request, or NULL if there's no request
+ */
+extern modbus_uart_request_t * bmodbus_master_read_write_multiple_registers(modbus_master_t *bmodbus, uint8_t client_address, uint16_t read_address, uint16_t read_count, uint16_t write_address, uint16_t write_count, uint16_t *data);
+
+#ifdef BMB_MONITOR
+/**
+ * @}
+ * \defgroup monitor_api Modbus Monitor API
+ * \brief API for passively decoding the traffic of a line
+ * @{
+ */
+
+//A request seen on the bus and the response that answered it
+typedef struct{
+    const modbus_request_t * request; //As a client sees it, result is the exception a client would reply with if it is malformed
+    const modbus_request_t * response; //As a master sees it, NULL for broadcasts and requests that were not answered
+    uint32_t request_microseconds; //Last byte of the request
+    uint32_t response_microseconds; //Last byte of the response
+    uint8_t client_address;
+    uint8_t request_too_large; //The data written did not fit the buffer, request data only holds the start of it
+    uint8_t response_too_large; //A valid response did not fit the buffer, it was skipped by its length and response is NULL
+}modbus_transaction_t;
+
+typedef void (*modbus_monitor_callback_t)(void * context, const modbus_transaction_t * transaction);
+
+/**
+ * @brief Decodes every transaction on a line without sending anything
+ *
+ * Requests go through the client state machine with any address accepted, then the next frame is decoded as the
+ * response by the master state machine. A frame that is not a valid response is taken as the next request. Only the
+ * checks of the specification are applied, frames larger than BMB_MAXIMUM_MESSAGE_SIZE are followed by their length
+ * and reported as too large instead of being refused.
+ */
+typedef struct{
+    modbus_client_t requests;
+    modbus_master_t responses;
+    uint16_t response_size; //Length of the response expected by the specification, it can be larger than the buffer
+    uint16_t skip_crc; //CRC of the response being skipped
+    uint8_t skip_remaining; //Bytes left in a response too large for the buffer, they are only checked
+    uint32_t response_timeout;
+    modbus_monitor_callback_t callback;
+    void * context;
+}modbus_monitor_t;
+
+/**
+ * @brief Initialize a bus monitor
+ * @param monitor - the monitor instance
+ * @param interframe_delay - the interframe delay of the line, INTERFRAME_DELAY_MICROSECONDS(baudrate)
+ * @param response_timeout - the time in microseconds after a request when it is considered unanswered
+ * @param callback - called for each transaction, the pointers are only valid during the call
+ * @param context - passed to the callback
+ */
+extern void bmodbus_monitor_init(modbus_monitor_t *monitor, uint32_t interframe_delay, uint32_t response_timeout, modbus_monitor_callback_t callback, void * context);
+/**
+ * @brief Give the monitor the next byte seen on the line, in either direction
+ * @param monitor - the monitor instance
+ * @param microseconds - the time the byte was received
+ * @param byte - the byte
+ */
+extern void bmodbus_monitor_next_byte(modbus_monitor_t *monitor, uint32_t microseconds, uint8_t byte);
+/**
+ * @brief Give the monitor several bytes seen on the line at once
+ * @param monitor - the monitor instance
+ * @param microseconds - the time the last byte was received
+ * @param bytes - the bytes
+ * @param length - the number of bytes
+ * @param microseconds_per_byte - BYTE_TIMING_IN_MICROSECONDS(baudrate)
+ */
+extern void bmodbus_monitor_received(modbus_monitor_t *monitor, uint32_t microseconds, const uint8_t * bytes, uint16_t length, uint32_t microseconds_per_byte);
+#endif //BMB_MONITOR
+
+#ifdef BMB_MASTER_POOL
+/**
+ * @}
+ * \defgroup pool_api Modbus Master Pool API
+ * \brief API for running requests over several buses through one transaction table
+ * @{
+ */
+
+//Results of a transaction that did not get a response, positive results are the exception the client answered with
+#define BMB_POOL_TIMEOUT        (-1) //No response before the pool timeout
+#define BMB_POOL_BAD_RESPONSE   (-2) //The response was dropped (CRC, wrong client or function, bad length)
+#define BMB_POOL_REFUSED        (-3) //The request could not be built (count too large for the buffer)
+
+#define BMB_POOL_NONE           (0xFFFF) //End of a list of entries
+
+//One transaction, submitted with bmodbus_pool_submit() and returned by bmodbus_pool_completion()
+typedef struct{
+    void * cookie; //Given back untouched
+    uint16_t * data; //Values to write, or where the values read are stored (bytes for coils and discrete inputs)
+    uint16_t address;
+    uint16_t value_or_count; //The value of single writes, the room in data for read FIFO queue, otherwise the count
+    uint16_t size; //Values in the response, as in modbus_request_t
+    uint8_t client_address;
+    uint8_t function;
+    int8_t result; //0 on success, an exception code, or BMB_POOL_TIMEOUT/BMB_POOL_BAD_RESPONSE/BMB_POOL_REFUSED
+    uint8_t bus;
+    uint16_t next; //Next entry of the list it is in
+}modbus_pool_entry_t;
+
+//A bus of the pool, the application gives the bytes it receives to the master
+typedef struct{
+    modbus_master_t master;
+    uint32_t sent; //When the request in flight was sent
+    uint16_t head; //Transactions waiting for the bus
+    uint16_t tail;
+    uint16_t in_flight; //BMB_POOL_NONE when the bus is free
+    uint8_t sending; //The request is being sent, waiting for bmodbus_pool_send_complete()
+}modbus_pool_bus_t;
+
+//Called when a request is ready to go out on a bus, bmodbus_pool_send_complete() is called once it has been sent
+typedef void (*modbus_pool_send_t)(void * context, uint8_t bus, const uint8_t * data, uint8_t size);
+
+/**
+ * @brief Masters for several buses sharing one table of transactions
+ *
+ * Each bus has one request in flight and a queue of requests waiting for it, in the order they were submitted.
+ * Completed transactions from every bus go to a single completion queue. The table is allocated by the application,
+ * so the pool never allocates and every operation is constant time.
+ */
+typedef struct{
+    modbus_pool_bus_t * buses;
+    modbus_pool_entry_t * entries;
+    uint16_t entry_count;
+    uint16_t free; //Unused entries
+    uint16_t done_head; //Completed transactions, oldest first
+    uint16_t done_tail;
+    uint32_t timeout;
+    modbus_pool_send_t send;
+    void * context;
+    uint8_t bus_count;
+}modbus_pool_t;
+
+/**
+ * @brief Initialize a pool and the master of each of its buses
+ * @param pool - the pool instance
+ * @param buses - one per bus, they must stay valid as long as the pool is used
+ * @param bus_count - number of buses
+ * @param entries - the transaction table, it limits the transactions submitted and not yet collected
+ * @param entry_count - number of entries, less than BMB_POOL_NONE
+ * @param interframe_delay - INTERFRAME_DELAY_MICROSECONDS(baudrate), it is also kept between requests on a bus
+ * @param timeout - the time in microseconds after a request is sent when it is given up
+ * @param send - called with each request to send
+ * @param context - passed to send
+ */
+extern void bmodbus_pool_init(modbus_pool_t *pool, modbus_pool_bus_t *buses, uint8_t bus_count, modbus_pool_entry_t *entries, uint16_t entry_count, uint32_t interframe_delay, uint32_t timeout, modbus_pool_send_t send, void * context);
+/**
+ * @brief Queue a transaction on a bus
+ *
+ * Reads of coils and discrete inputs, holding and input registers, single and multiple writes of coils and registers,
+ * mask write register (data holds the AND and OR masks) and read FIFO queue are supported.
+ * @param pool - the pool instance
+ * @param bus - the bus the client is on
+ * @param client_address - the address of the client, MODBUS_BROADCAST_ADDRESS for writes to every client of the bus
+ * @param function - the function code
+ * @param address - the starting address
+ * @param value_or_count - the value of single writes (0/1 for a coil), otherwise the count, for read FIFO queue the
+ * room in data (up to 31 values), values past it are dropped and size only counts the values kept
+ * @param data - values to write or room for the values read (two masks for mask write register), it must stay valid
+ * until the transaction completes. Only single writes may pass NULL
+ * @param cookie - returned with the completion
+ * @return 0 if it was queued, -1 if the table is full, the bus does not exist, the function is not supported or data is missing
+ */
+extern int8_t bmodbus_pool_submit(modbus_pool_t *pool, uint8_t bus, uint8_t client_address, uint8_t function, uint16_t address, uint16_t value_or_count, uint16_t *data, void * cookie);
+/**
+ * @brief Complete the responses received, give up on late ones and send the next request of every free bus
+ * @param pool - the pool instance
+ * @param microseconds - the current time in microseconds
+ */
+extern void bmodbus_pool_loop(modbus_pool_t *pool, uint32_t microseconds);
+/**
+ * @brief Notify the pool that the request passed to send has been sent
+ * @param pool - the pool instance
+ * @param bus - the bus it was sent on
+ * @param microseconds - the time the last byte was sent
+ */
+extern void bmodbus_pool_send_complete(modbus_pool_t *pool, uint8_t bus, uint32_t microseconds);
+/**
+ * @brief Get the master of a bus, the bytes received on the bus are given to it (bmodbus_master_received() etc.)
+ * @param pool - the pool instance
+ * @param bus - the bus
+ * @return the master
+ */
+extern modbus_master_t * bmodbus_pool_master(modbus_pool_t *pool, uint8_t bus);
+/**
+ * @brief Collect the oldest completed transaction, its entry is free again
+ * @param pool - the pool instance
+ * @param completion - filled in with the transaction, result and size are set
+ * @return 1 if a transaction was collected, 0 if none are complete
+ */
+extern uint8_t bmodbus_pool_completion(modbus_pool_t *pool, modbus_pool_entry_t *completion);
+#endif //BMB_MASTER_POOL
 
 #endif
 
@@ -0,0 +1,270 @@
+/**
+ * @file bmodbus_coroutine.hpp
+ * @brief C++20 coroutines on top of the bModbus master
+ *
+ * Control code is written as sequential coroutines instead of state machines polling bmodbus_master_get_response():
+ *
+ *     bmodbus::task poll(bmodbus::master & line){
+ *         auto status = co_await line.read_holding(7, 0x100, 2);
+ *         if(status.ok()){
+ *             co_await line.write_register(7, 0x200, status.data[0] + 1);
+ *         }
+ *     }
+ *
+ * The event loop sends the frames passed to the send function, calls send_complete() once they are out, gives the
+ * bytes it receives to received() and calls loop() regularly. Coroutines are only resumed from loop(), so the
+ * application decides where (and on which thread) its control code runs and nothing is allocated besides the
+ * coroutine frames. bmodbus.c has to be built with BMB_MASTER_CALLBACK.
+ */
+
+/* MIT Style License
+ * Copyright (c) 2025 Bill McCartney
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef BMODBUS_COROUTINE_HPP
+#define BMODBUS_COROUTINE_HPP
+
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include "bmodbus.h"
+
+#ifndef BMB_MASTER_CALLBACK
+#error "bmodbus_coroutine.hpp needs BMB_MASTER_CALLBACK, define it for bmodbus.c as well"
+#endif
+#ifdef BMODBUS_NO_MASTER
+#error "bmodbus_coroutine.hpp needs the master"
+#endif
+
+namespace bmodbus {
+
+//Results of a request that did not get a response, positive results are the exception the client answered with
+constexpr int8_t timeout = -1; //No response before the timeout given to the master
+constexpr int8_t bad_response = -2; //The response was dropped (CRC, wrong client or function, bad length)
+constexpr int8_t refused = -3; //The request could not be built (master busy, count too large for the buffer)
+
+//What a co_await on a request gives back
+struct response{
+    int8_t result = 0; //0 on success, an exception code, or timeout/bad_response/refused
+    uint16_t size = 0; //Values read, as in modbus_request_t (registers, or bytes for coils and discrete inputs)
+    uint16_t data[BMB_MAXIMUM_MESSAGE_SIZE / 2] = {};
+
+    bool ok() const noexcept { return result == 0; }
+};
+
+class master;
+
+//A coroutine started by calling it, it runs until its first co_await and is resumed by master::loop()
+class task{
+public:
+    struct promise_type{
+        task get_return_object() noexcept { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; } //Kept until the task is destroyed, so done() works
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+        master * awaiting = nullptr; //The master of the last request awaited
+    };
+
+    task(task && other) noexcept : handle_(other.handle_) { other.handle_ = nullptr; }
+    task(const task &) = delete;
+    task & operator=(const task &) = delete;
+    //A task destroyed while it waits gives up on its request, the master must outlive it
+    ~task();
+
+    bool done() const noexcept { return !handle_ || handle_.done(); }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+    std::coroutine_handle<promise_type> handle_;
+};
+
+//A request built on the master, sent when it is awaited
+class [[nodiscard]] operation{
+public:
+    bool await_ready() const noexcept { return request_ == nullptr; }
+    void await_suspend(std::coroutine_handle<task::promise_type> handle) noexcept;
+    response await_resume() noexcept {
+        if(request_ == nullptr){
+            response_.result = refused;
+        }
+        return response_;
+    }
+
+private:
+    friend class master;
+    operation(master & owner, modbus_uart_request_t * request) noexcept : owner_(owner), request_(request) {}
+    master & owner_;
+    modbus_uart_request_t * request_;
+    response response_;
+};
+
+//A modbus master with one request in flight, awaited by a coroutine
+class master{
+public:
+    using send_function = void (*)(void * context, const uint8_t * data, uint8_t size);
+
+    /**
+     * @param interframe_delay - INTERFRAME_DELAY_MICROSECONDS(baudrate), also kept between requests, 0 for packet transports
+     * @param timeout_microseconds - the time after a request is sent when it is given up
+     * @param send - called with each frame to send, it must not give the response back before returning
+     * @param context - passed to send
+     */
+    master(uint32_t interframe_delay, uint32_t timeout_microseconds, send_function send, void * context) noexcept
+        : timeout_(timeout_microseconds), send_(send), context_(context) {
+        bmodbus_master_init(&master_, interframe_delay);
+        master_.last_microseconds = 0;
+        bmodbus_master_set_callback(&master_, &master::completed, this);
+    }
+    master(const master &) = delete; //The C master calls back with this pointer
+    master & operator=(const master &) = delete;
+
+    modbus_master_t * native() noexcept { return &master_; }
+    bool busy() const noexcept { return pending_ != nullptr; }
+
+    void send_complete(uint32_t microseconds) noexcept {
+        sent_ = microseconds;
+        bmodbus_master_send_complete(&master_, microseconds);
+    }
+    void received(uint32_t microseconds, const uint8_t * bytes, uint8_t length, uint32_t microseconds_per_byte) noexcept {
+        bmodbus_master_received(&master_, microseconds, const_cast<uint8_t *>(bytes), length, microseconds_per_byte);
+    }
+    void received_packet(uint32_t microseconds, const uint8_t * bytes, uint16_t length) noexcept {
+        bmodbus_master_received_packet(&master_, microseconds, bytes, length);
+    }
+
+    //Gives up on late responses and resumes the coroutine waiting for the request that completed
+    void loop(uint32_t microseconds) noexcept {
+        bmodbus_master_loop(&master_, microseconds);
+        if((pending_ != nullptr) && !finished_ && (master_.state == MASTER_STATE_WAITING_FOR_RESPONSE) &&
+           ((microseconds - sent_) >= timeout_)){
+            timing_out_ = true;
+            bmodbus_master_timeout(&master_);
+            timing_out_ = false;
+        }
+        //The line has to be quiet before the next request, which the coroutine may build as soon as it runs
+        if(finished_ && ((microseconds - master_.last_microseconds) >= master_.interframe_delay)){
+            std::coroutine_handle<> waiting = waiting_;
+            pending_ = nullptr;
+            waiting_ = nullptr;
+            finished_ = false;
+            waiting.resume();
+        }
+    }
+
+    operation read_coils(uint8_t client, uint16_t address, uint16_t count) noexcept {
+        return operation(*this, bmodbus_master_read_coils(&master_, client, address, count));
+    }
+    operation read_discrete_inputs(uint8_t client, uint16_t address, uint16_t count) noexcept {
+        return operation(*this, bmodbus_master_read_discrete_inputs(&master_, client, address, count));
+    }
+    operation read_holding(uint8_t client, uint16_t address, uint16_t count) noexcept {
+        return operation(*this, bmodbus_master_read_holding_registers(&master_, client, address, count));
+    }
+    operation read_input(uint8_t client, uint16_t address, uint16_t count) noexcept {
+        return operation(*this, bmodbus_master_read_input_registers(&master_, client, address, count));
+    }
+    operation write_coil(uint8_t client, uint16_t address, bool value) noexcept {
+        return operation(*this, bmodbus_master_write_single_coil(&master_, client, address, value ? 1 : 0));
+    }
+    operation write_register(uint8_t client, uint16_t address, uint16_t value) noexcept {
+        return operation(*this, bmodbus_master_write_single_register(&master_, client, address, value));
+    }
+    operation write_coils(uint8_t client, uint16_t address, uint16_t count, const uint8_t * values) noexcept {
+        return operation(*this, bmodbus_master_write_multiple_coils(&master_, client, address, count, const_cast<uint8_t *>(values)));
+    }
+    operation write_registers(uint8_t client, uint16_t address, uint16_t count, const uint16_t * values) noexcept {
+        return operation(*this, bmodbus_master_write_multiple_registers(&master_, client, address, count, const_cast<uint16_t *>(values)));
+    }
+    operation mask_write(uint8_t client, uint16_t address, uint16_t and_mask, uint16_t or_mask) noexcept {
+        return operation(*this, bmodbus_master_mask_write_register(&master_, client, address, and_mask, or_mask));
+    }
+    operation read_write(uint8_t client, uint16_t read_address, uint16_t read_count, uint16_t write_address, uint16_t write_count, const uint16_t * values) noexcept {
+        return operation(*this, bmodbus_master_read_write_multiple_registers(&master_, client, read_address, read_count, write_address, write_count, const_cast<uint16_t *>(values)));
+    }
+    operation read_fifo(uint8_t client, uint16_t address) noexcept {
+        return operation(*this, bmodbus_master_read_fifo_queue(&master_, client, address));
+    }
+
+private:
+    friend class operation;
+    friend class task;
+
+    void start(operation * awaiting, std::coroutine_handle<> handle) noexcept {
+        pending_ = awaiting;
+        waiting_ = handle;
+        send_(context_, awaiting->request_->data, awaiting->request_->size);
+    }
+
+    //Forgets the coroutine waiting for the request in flight, the request is given up unless it already completed
+    void cancel(std::coroutine_handle<> handle) noexcept {
+        if((handle == nullptr) || (waiting_ != handle)){
+            return;
+        }
+        bool finished = finished_;
+        pending_ = nullptr;
+        waiting_ = nullptr;
+        finished_ = false;
+        if(!finished){
+            bmodbus_master_timeout(&master_); //completed() has nothing left to fill in
+        }
+    }
+
+    //Called by the C master from whatever call completed the request, only the result is kept until loop() resumes
+    static void completed(void * context, modbus_request_t * response) noexcept {
+        master * self = static_cast<master *>(context);
+        if((self->pending_ == nullptr) || self->finished_){
+            return; //A request built but never awaited
+        }
+        struct response & result = self->pending_->response_;
+        if(response != nullptr){
+            result.result = response->result;
+            result.size = response->size;
+            std::memcpy(result.data, response->data, sizeof(result.data));
+        }else{
+            result.result = self->timing_out_ ? timeout : bad_response;
+        }
+        self->finished_ = true;
+    }
+
+    modbus_master_t master_;
+    uint32_t timeout_;
+    uint32_t sent_ = 0;
+    send_function send_;
+    void * context_;
+    operation * pending_ = nullptr;
+    std::coroutine_handle<> waiting_ = nullptr;
+    bool finished_ = false;
+    bool timing_out_ = false;
+};
+
+inline void operation::await_suspend(std::coroutine_handle<task::promise_type> handle) noexcept {
+    handle.promise().awaiting = &owner_;
+    owner_.start(this, handle);
+}
+
+inline task::~task(){
+    if(handle_){
+        if((handle_.promise().awaiting != nullptr) && !handle_.done()){
+            handle_.promise().awaiting->cancel(handle_);
+        }
+        handle_.destroy();
+    }
+}
+
+} //namespace bmodbus
+
+#endif //BMODBUS_COROUTINE_HPP
@@ -0,0 +1,24 @@
+#define FAKE_MAIN
+#define BENCH_OUTPUT_CHAR(c) bench_serial_write(c)
+static void bench_serial_write(const char c);
+#include "bench_embedded.h"
+
+static void bench_serial_write(const char c){
+    if(c == '\n'){
+        Serial.flush(); //Keep the serial interrupts out of the next measurement
+    }
+    Serial.write((uint8_t)c);
+}
+
+void setup(){
+    Serial.begin(115200);
+    Serial.println("Booted");
+}
+
+void loop(){
+    delay(100);
+    Serial.println("Before benchmark");
+    Serial.flush();
+    bench_main();
+    Serial.flush();
+}
@@ -0,0 +1,23 @@
+import sys
+import serial
+import os
+port = os.environ.get("SERIAL_PORT", "/dev/ttyNONE_SPECIFIED")
+ser = serial.Serial(port, 115200, timeout=1)
+print("opened serial port", ser.name)
+# read up to 30 seconds of data, slow boards take a while to go through every function
+data = b""
+for i in range(30):
+    next = ser.read(1 * 11520)  # 1 seconds max
+    if type(next) is bytes:
+        data += next
+        runs = data.split(b"Benchmark completed")
+        if len(runs) > 2:
+            data = runs[1]  # The first complete run, the one before may have started before the port was opened
+            break
+text = data.decode('utf-8', errors='replace')
+# Only the CSV lines are printed so the output can be saved and compared between boards and commits
+rows = [line for line in text.splitlines() if line.count(",") == 6]
+print("\n".join(rows))
+if len(rows) > 1:
+    sys.exit(0)
+sys.exit(12)  # Nothing was measured
@@ -0,0 +1,306 @@
+//
+// Micro-benchmarks of the parser, encoder and CRC hot paths
+//
+// Every supported function code is run at several frame sizes and one row is printed per case, as CSV (default) or
+// JSON (--json), with the columns always in the same order so the output of two commits can be diffed.
+// Times are in nanoseconds, per byte of the frame handled or per frame.
+//
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//The hot paths are static, so the library is built into the benchmark
+#include "bmodbus.c"
+
+#define BENCH_DEFAULT_ITERATIONS 20000
+#define BENCH_CLIENT_ADDRESS 2
+#define BENCH_BYTE_TIME BYTE_TIMING_IN_MICROSECONDS(38400)
+
+typedef struct{
+    uint8_t function;
+    uint16_t count; //Units read or written
+}bench_case_t;
+
+typedef struct{
+    uint16_t request_bytes;
+    uint16_t response_bytes;
+    double crc; //ns per byte
+    double parse; //ns per byte
+    double encode; //ns per frame
+    double build; //ns per frame
+    double receive; //ns per byte
+    double receive_completed; //ns per frame
+}bench_result_t;
+
+static const bench_case_t bench_cases[] = {
+    {1, 1}, {1, 64}, {1, 512}, {1, 2000},
+    {2, 1}, {2, 64}, {2, 512}, {2, 2000},
+    {3, 1}, {3, 8}, {3, 32}, {3, 125},
+    {4, 1}, {4, 8}, {4, 32}, {4, 125},
+    {5, 1},
+    {6, 1},
+    {15, 1}, {15, 64}, {15, 512}, {15, 1968},
+    {16, 1}, {16, 8}, {16, 32}, {16, 123},
+    {0x16, 1},
+#ifdef BMB_CLIENT_READ_WRITE_FUNCTION
+    {0x17, 1}, {0x17, 8}, {0x17, 32}, {0x17, 121},
+#endif //BMB_CLIENT_READ_WRITE_FUNCTION
+    {0x18, 1}, {0x18, 31},
+#ifdef BMB_CLIENT_FILE_RECORD
+    {0x14, 1}, {0x14, 8}, {0x14, 32}, {0x14, 120},
+    {0x15, 1}, {0x15, 8}, {0x15, 32}, {0x15, 119},
+#endif //BMB_CLIENT_FILE_RECORD
+};
+
+static uint16_t bench_values[BMB_MAXIMUM_MESSAGE_SIZE];
+static volatile uint16_t bench_sink;
+//Called through a volatile pointer so the compiler cannot drop the copies the baselines measure
+static void * (*volatile bench_copy)(void *, const void *, size_t) = memcpy;
+
+#ifdef BMB_CLIENT_FILE_RECORD
+static int8_t bench_file_read(void * context, uint16_t file, uint16_t record, uint16_t * value){
+    MODBUS_UNUSED(context);
+    *value = file + record;
+    return 0;
+}
+
+static int8_t bench_file_write(void * context, uint16_t file, uint16_t record, uint16_t value){
+    MODBUS_UNUSED(context);
+    bench_sink = file + record + value;
+    return 0;
+}
+
+static const modbus_file_record_t bench_files = {bench_file_read, bench_file_write, NULL, NULL};
+#endif //BMB_CLIENT_FILE_RECORD
+
+static uint64_t bench_nanoseconds(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+//Builds the request of a case, NULL if it does not fit in BMB_MAXIMUM_MESSAGE_SIZE
+static modbus_uart_request_t * bench_request(modbus_master_t * master, const bench_case_t * bench){
+#ifdef BMB_CLIENT_FILE_RECORD
+    modbus_file_subrequest_t subrequest = {1, 0, bench->count, bench_values};
+#endif //BMB_CLIENT_FILE_RECORD
+    master->state = MASTER_STATE_IDLE;
+    switch(bench->function){
+        case 1: return bmodbus_master_read_coils(master, BENCH_CLIENT_ADDRESS, 0, bench->count);
+        case 2: return bmodbus_master_read_discrete_inputs(master, BENCH_CLIENT_ADDRESS, 0, bench->count);
+        case 3: return bmodbus_master_read_holding_registers(master, BENCH_CLIENT_ADDRESS, 0, bench->count);
+        case 4: return bmodbus_master_read_input_registers(master, BENCH_CLIENT_ADDRESS, 0, bench->count);
+        case 5: return bmodbus_master_write_single_coil(master, BENCH_CLIENT_ADDRESS, 0, 1);
+        case 6: return bmodbus_master_write_single_register(master, BENCH_CLIENT_ADDRESS, 0, 0x1234);
+        case 15: return bmodbus_master_write_multiple_coils(master, BENCH_CLIENT_ADDRESS, 0, bench->count, (uint8_t *)bench_values);
+        case 16: return bmodbus_master_write_multiple_registers(master, BENCH_CLIENT_ADDRESS, 0, bench->count, bench_values);
+        case 0x16: return bmodbus_master_mask_write_register(master, BENCH_CLIENT_ADDRESS, 0, 0xF0F0, 0x0505);
+#ifdef BMB_CLIENT_READ_WRITE_FUNCTION
+        case 0x17: return bmodbus_master_read_write_multiple_registers(master, BENCH_CLIENT_ADDRESS, 0, bench->count, 0x100, bench->count, bench_values);
+#endif //BMB_CLIENT_READ_WRITE_FUNCTION
+        case 0x18: return bmodbus_master_read_fifo_queue(master, BENCH_CLIENT_ADDRESS, 0);
+#ifdef BMB_CLIENT_FILE_RECORD
+        case 0x14: return bmodbus_master_read_file_record(master, BENCH_CLIENT_ADDRESS, &subrequest, 1);
+        case 0x15: return bmodbus_master_write_file_record(master, BENCH_CLIENT_ADDRESS, &subrequest, 1);
+#endif //BMB_CLIENT_FILE_RECORD
+        default: return NULL;
+    }
+}
+
+//Feeds a frame to a client as if it came from a serial port at 38400 baud, after an idle bus
+static void bench_client_frame(modbus_client_t * client, uint32_t * microseconds, const uint8_t * frame, uint16_t length){
+    uint16_t i;
+    *microseconds += client->interframe_delay + 1;
+    for(i = 0; i < length; i++){
+        bmodbus_client_next_byte(client, *microseconds, frame[i]);
+        *microseconds += BENCH_BYTE_TIME;
+    }
+}
+
+static int bench_run(const bench_case_t * bench, uint32_t iterations, bench_result_t * result){
+    static modbus_client_t client, client_snapshot;
+    static modbus_master_t master, master_snapshot;
+    uint8_t request[BMB_MAXIMUM_MESSAGE_SIZE], response[BMB_MAXIMUM_MESSAGE_SIZE];
+    modbus_uart_request_t * built;
+    modbus_request_t * handled;
+    modbus_uart_data_t * answer;
+    uint32_t microseconds = 0, n;
+    uint64_t start, baseline;
+    uint16_t crc, i;
+
+    bmodbus_client_init(&client, INTERFRAME_DELAY_MICROSECONDS(38400), BENCH_CLIENT_ADDRESS);
+#ifdef BMB_CLIENT_FILE_RECORD
+    bmodbus_client_set_file_records(&client, &bench_files);
+#endif //BMB_CLIENT_FILE_RECORD
+    bmodbus_master_init(&master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    built = bench_request(&master, bench);
+    if(built == NULL){
+        return -1;
+    }
+    result->request_bytes = built->size;
+    memcpy(request, built->data, built->size);
+
+    //Request building (modbus_master_send_internal or the builder of the function)
+    start = bench_nanoseconds();
+    for(n = 0; n < iterations; n++){
+        bench_request(&master, bench);
+    }
+    result->build = (double)(bench_nanoseconds() - start) / iterations;
+
+    //CRC over the request frame
+    start = bench_nanoseconds();
+    for(n = 0; n < iterations; n++){
+        crc = 0xFFFF;
+        for(i = 0; i < result->request_bytes; i++){
+            crc = crc_update(crc, request[i]);
+        }
+        bench_sink = crc;
+    }
+    result->crc = (double)(bench_nanoseconds() - start) / ((double)iterations * result->request_bytes);
+
+    //Client parsing, byte by byte up to the complete request
+    start = bench_nanoseconds();
+    for(n = 0; n < iterations; n++){
+        bench_client_frame(&client, &microseconds, request, result->request_bytes);
+    }
+    result->parse = (double)(bench_nanoseconds() - start) / ((double)iterations * result->request_bytes);
+    if((client.state != CLIENT_STATE_PROCESSING_REQUEST) && (client.state != CLIENT_STATE_RESPONSE_READY)){
+        return -1; //Rejected, file records are answered while they are parsed
+    }
+
+    //Response encoding, from a copy of the client holding the handled request
+    handled = bmodbus_client_get_request(&client);
+    if(handled != NULL){
+        for(i = 0; i < BMB_MAXIMUM_MESSAGE_SIZE / 2; i++){
+            handled->data[i] = bench_values[i];
+        }
+        if(bench->function == 0x18){
+            handled->size = bench->count;
+        }
+    }
+    memcpy(&client_snapshot, &client, sizeof(client));
+    start = bench_nanoseconds();
+    for(n = 0; n < iterations; n++){
+        bench_copy(&client, &client_snapshot, sizeof(client));
+    }
+    baseline = bench_nanoseconds() - start;
+    start = bench_nanoseconds();
+    for(n = 0; n < iterations; n++){
+        bench_copy(&client, &client_snapshot, sizeof(client));
+        bmodbus_encode_client_response(&client);
+    }
+    result->encode = (double)(bench_nanoseconds() - start - baseline) / iterations;
+    bench_copy(&client, &client_snapshot, sizeof(client));
+    answer = bmodbus_client_get_response(&client);
+    if((answer == NULL) || (answer->size == 0)){
+        return -1;
+    }
+    result->response_bytes = answer->size;
+    memcpy(response, answer->data, answer->size);
+
+    //Master receiving, byte by byte up to the decoded response
+    bench_request(&master, bench);
+    bmodbus_master_send_complete(&master, microseconds);
+    memcpy(&master_snapshot, &master, sizeof(master));
+    start = bench_nanoseconds();
+    for(n = 0; n < iterations; n++){
+        bench_copy(&master, &master_snapshot, sizeof(master));
+    }
+    baseline = bench_nanoseconds() - start;
+    start = bench_nanoseconds();
+    for(n = 0; n < iterations; n++){
+        bench_copy(&master, &master_snapshot, sizeof(master));
+        for(i = 0; i < result->response_bytes; i++){
+            bmodbus_master_next_byte(&master, microseconds + i * BENCH_BYTE_TIME, response[i]);
+        }
+    }
+    result->receive = (double)(bench_nanoseconds() - start - baseline) / ((double)iterations * result->response_bytes);
+    if(master.state != MASTER_STATE_RESPONSE_READY){
+        return -1;
+    }
+
+    //Response validation and decoding on its own, from a master holding all but the last byte
+    bench_copy(&master, &master_snapshot, sizeof(master));
+    for(i = 0; i + 1 < result->response_bytes; i++){
+        bmodbus_master_next_byte(&master, microseconds + i * BENCH_BYTE_TIME, response[i]);
+    }
+    memcpy(&master_snapshot, &master, sizeof(master));
+    start = bench_nanoseconds();
+    for(n = 0; n < iterations; n++){
+        bench_copy(&master, &master_snapshot, sizeof(master));
+        master.payload.request.data[master.byte_count++] = response[result->response_bytes - 1];
+    }
+    baseline = bench_nanoseconds() - start;
+    start = bench_nanoseconds();
+    for(n = 0; n < iterations; n++){
+        bench_copy(&master, &master_snapshot, sizeof(master));
+        master.payload.request.data[master.byte_count++] = response[result->response_bytes - 1];
+        master_receive_completed(&master);
+    }
+    result->receive_completed = (double)(bench_nanoseconds() - start - baseline) / iterations;
+    return (master.state == MASTER_STATE_RESPONSE_READY) ? 0 : -1;
+}
+
+int main(int argc, char ** argv){
+    uint32_t iterations = BENCH_DEFAULT_ITERATIONS;
+    uint8_t json = 0;
+    bench_result_t result;
+    size_t c, rows = 0;
+    int i;
+    for(i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--json") == 0){
+            json = 1;
+        }else if((strcmp(argv[i], "--iterations") == 0) && (i + 1 < argc)){
+            iterations = (uint32_t)strtoul(argv[++i], NULL, 0);
+        }else{
+            fprintf(stderr, "usage: %s [--json] [--iterations N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if(iterations == 0){
+        iterations = 1;
+    }
+    for(i = 0; i < BMB_MAXIMUM_MESSAGE_SIZE; i++){
+        bench_values[i] = (uint16_t)(0x0101 * i + 0x1234);
+    }
+    if(json){
+        printf("[\n");
+    }else{
+        printf("function,count,request_bytes,response_bytes,crc_ns_per_byte,parse_ns_per_byte,encode_ns,encode_ns_per_byte,"
+               "build_ns,build_ns_per_byte,receive_ns_per_byte,receive_completed_ns,receive_completed_ns_per_byte\n");
+    }
+    for(c = 0; c < sizeof(bench_cases) / sizeof(bench_cases[0]); c++){
+        if(bench_run(&bench_cases[c], iterations, &result) < 0){
+            fprintf(stderr, "function 0x%02x count %u could not be run with BMB_MAXIMUM_MESSAGE_SIZE %u\n",
+                    bench_cases[c].function, bench_cases[c].count, (unsigned)BMB_MAXIMUM_MESSAGE_SIZE);
+            continue;
+        }
+        if(json){
+            printf("%s  {\"function\": %u, \"count\": %u, \"request_bytes\": %u, \"response_bytes\": %u, \"crc_ns_per_byte\": %.3f, "
+                   "\"parse_ns_per_byte\": %.3f, \"encode_ns\": %.3f, \"encode_ns_per_byte\": %.3f, \"build_ns\": %.3f, "
+                   "\"build_ns_per_byte\": %.3f, \"receive_ns_per_byte\": %.3f, \"receive_completed_ns\": %.3f, "
+                   "\"receive_completed_ns_per_byte\": %.3f}",
+                   rows ? ",\n" : "", bench_cases[c].function, bench_cases[c].count, result.request_bytes, result.response_bytes,
+                   result.crc, result.parse, result.encode, result.encode / result.response_bytes, result.build,
+                   result.build / result.request_bytes, result.receive, result.receive_completed,
+                   result.receive_completed / result.response_bytes);
+        }else{
+            printf("%u,%u,%u,%u,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                   bench_cases[c].function, bench_cases[c].count, result.request_bytes, result.response_bytes,
+                   result.crc, result.parse, result.encode, result.encode / result.response_bytes, result.build,
+                   result.build / result.request_bytes, result.receive, result.receive_completed,
+                   result.receive_completed / result.response_bytes);
+        }
+        rows++;
+    }
+    if(json){
+        printf("\n]\n");
+    }
+    return 0;
+}
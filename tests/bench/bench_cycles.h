@@ -0,0 +1,141 @@
+//
+// Cycle counter used by the embedded benchmark, picked from the target the sketch or the host build is compiled for.
+//
+// bench_cycles_init() starts the counter, bench_cycles() reads it and bench_cycles_elapsed() turns two readings into
+// a count, taking care of counters that count down or are narrower than 32 bits. BENCH_CYCLES_UNIT names what is
+// counted, it is only "cycles" where the core clock is counted directly.
+//
+#ifndef BENCH_CYCLES_H
+#define BENCH_CYCLES_H
+
+#include <stdint.h>
+
+#if defined(__XTENSA__) //ESP32, ESP32-S3: the ccount special register
+#define BENCH_CYCLES_UNIT "cycles"
+static inline void bench_cycles_init(void){
+}
+static inline uint32_t bench_cycles(void){
+    uint32_t count;
+    __asm__ __volatile__("rsr %0, ccount" : "=a"(count));
+    return count;
+}
+static inline uint32_t bench_cycles_elapsed(uint32_t start, uint32_t end){
+    return end - start;
+}
+
+#elif defined(ESP_PLATFORM) //RISC-V ESP32 variants hide the cycle counter behind the IDF
+#include "esp_cpu.h"
+#define BENCH_CYCLES_UNIT "cycles"
+static inline void bench_cycles_init(void){
+}
+static inline uint32_t bench_cycles(void){
+    return (uint32_t)esp_cpu_get_cycle_count();
+}
+static inline uint32_t bench_cycles_elapsed(uint32_t start, uint32_t end){
+    return end - start;
+}
+
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__) //Cortex-M3/M4/M7/M33: DWT CYCCNT
+#define BENCH_CYCLES_UNIT "cycles"
+#define BENCH_DEMCR      (*(volatile uint32_t *)0xE000EDFCu)
+#define BENCH_DWT_CTRL   (*(volatile uint32_t *)0xE0001000u)
+#define BENCH_DWT_CYCCNT (*(volatile uint32_t *)0xE0001004u)
+static inline void bench_cycles_init(void){
+    BENCH_DEMCR |= (1u << 24); //TRCENA, powers the DWT
+    BENCH_DWT_CYCCNT = 0;
+    BENCH_DWT_CTRL |= 1u; //CYCCNTENA
+}
+static inline uint32_t bench_cycles(void){
+    return BENCH_DWT_CYCCNT;
+}
+static inline uint32_t bench_cycles_elapsed(uint32_t start, uint32_t end){
+    return end - start;
+}
+
+#elif defined(__ARM_ARCH_6M__) //Cortex-M0/M0+ have no DWT counter, SysTick counts the core clock down instead
+#define BENCH_CYCLES_UNIT "cycles"
+#define BENCH_SYST_CSR (*(volatile uint32_t *)0xE000E010u)
+#define BENCH_SYST_RVR (*(volatile uint32_t *)0xE000E014u)
+#define BENCH_SYST_CVR (*(volatile uint32_t *)0xE000E018u)
+static inline void bench_cycles_init(void){
+    if(!(BENCH_SYST_CSR & 1u)){ //Left alone when the core already runs it for millis()
+        BENCH_SYST_RVR = 0x00FFFFFFu;
+        BENCH_SYST_CVR = 0;
+        BENCH_SYST_CSR = 5u; //Enabled, core clock, no interrupt
+    }
+}
+static inline uint32_t bench_cycles(void){
+    return BENCH_SYST_CVR;
+}
+//Only valid for intervals shorter than one SysTick period (1ms on most cores)
+static inline uint32_t bench_cycles_elapsed(uint32_t start, uint32_t end){
+    return (start >= end) ? start - end : start + BENCH_SYST_RVR + 1u - end;
+}
+
+#elif defined(__riscv) //RP2350 Hazard3 and other machine mode RISC-V cores
+#define BENCH_CYCLES_UNIT "cycles"
+static inline void bench_cycles_init(void){
+}
+static inline uint32_t bench_cycles(void){
+    uint32_t count;
+    __asm__ __volatile__("csrr %0, mcycle" : "=r"(count));
+    return count;
+}
+static inline uint32_t bench_cycles_elapsed(uint32_t start, uint32_t end){
+    return end - start;
+}
+
+#elif defined(__AVR__) //Timer1 without prescaler, it takes over the PWM of pins 9 and 10
+#include <avr/io.h>
+#define BENCH_CYCLES_UNIT "cycles"
+static inline void bench_cycles_init(void){
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+}
+static inline uint32_t bench_cycles(void){
+    return TCNT1;
+}
+//Only valid for intervals shorter than 65536 cycles
+static inline uint32_t bench_cycles_elapsed(uint32_t start, uint32_t end){
+    return (uint16_t)(end - start);
+}
+
+#elif defined(ARDUINO) //Anything else the Arduino cores support
+#define BENCH_CYCLES_UNIT "us"
+static inline void bench_cycles_init(void){
+}
+static inline uint32_t bench_cycles(void){
+    return (uint32_t)micros();
+}
+static inline uint32_t bench_cycles_elapsed(uint32_t start, uint32_t end){
+    return end - start;
+}
+
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) //Host emulation build, time stamp counter ticks
+#include <x86intrin.h>
+#define BENCH_CYCLES_UNIT "tsc"
+static inline void bench_cycles_init(void){
+}
+static inline uint32_t bench_cycles(void){
+    return (uint32_t)__rdtsc();
+}
+static inline uint32_t bench_cycles_elapsed(uint32_t start, uint32_t end){
+    return end - start;
+}
+
+#else //Host emulation build on other machines
+#include <time.h>
+#define BENCH_CYCLES_UNIT "ns"
+static inline void bench_cycles_init(void){
+}
+static inline uint32_t bench_cycles(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec);
+}
+static inline uint32_t bench_cycles_elapsed(uint32_t start, uint32_t end){
+    return end - start;
+}
+#endif
+
+#endif //BENCH_CYCLES_H
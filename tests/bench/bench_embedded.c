@@ -0,0 +1,266 @@
+//
+// Worst case timing of the receive path, per byte and per frame, on microcontrollers
+//
+// The Arduino sketch in tests/arduino/arduino_benchmark includes this file (copied as bench_embedded.h) with FAKE_MAIN
+// defined, the host emulation build runs it as a program. Every line is
+//     function,count,metric,min,avg,max,unit
+// where client_byte/master_byte are one call of bmodbus_client_next_byte()/bmodbus_master_next_byte() (the work an
+// interrupt does per received byte), client_frame/master_frame their sum over a frame, encode is
+// bmodbus_client_get_response() and build is the master request builder. The counter overhead is already removed.
+//
+#ifndef BENCH_EMBEDDED_AS_INCLUDE
+#define BENCH_EMBEDDED_AS_INCLUDE
+
+#if !defined(ARDUINO) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bmodbus.h"
+#include "bench_cycles.h"
+
+#ifndef BENCH_OUTPUT_CHAR //The sketch sends it to the serial port
+#define BENCH_OUTPUT_CHAR(c) putchar(c)
+#endif
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 32
+#endif
+
+#define BENCH_CLIENT_ADDRESS 2
+#define BENCH_BYTE_TIME BYTE_TIMING_IN_MICROSECONDS(38400)
+
+typedef struct{
+    uint32_t min;
+    uint32_t max;
+    uint32_t sum;
+    uint16_t samples;
+}bench_stat_t;
+
+typedef struct{
+    uint8_t function;
+    uint16_t count;
+}bench_embedded_case_t;
+
+//Cases that do not fit in BMB_MAXIMUM_MESSAGE_SIZE are skipped
+static const bench_embedded_case_t bench_embedded_cases[] = {
+    {1, 8}, {1, 64}, {1, 2000},
+    {2, 8}, {2, 64}, {2, 2000},
+    {3, 1}, {3, 8}, {3, 125},
+    {4, 1}, {4, 8}, {4, 125},
+    {5, 1},
+    {6, 1},
+    {15, 8}, {15, 64}, {15, 1968},
+    {16, 1}, {16, 8}, {16, 123},
+    {0x16, 1},
+#ifdef BMB_CLIENT_READ_WRITE_FUNCTION
+    {0x17, 1}, {0x17, 8}, {0x17, 121},
+#endif //BMB_CLIENT_READ_WRITE_FUNCTION
+    {0x18, 1}, {0x18, 31},
+};
+
+static uint16_t bench_embedded_values[BMB_MAXIMUM_MESSAGE_SIZE / 2];
+static uint32_t bench_overhead;
+
+static void bench_stat_reset(bench_stat_t * stat){
+    stat->min = 0xFFFFFFFFu;
+    stat->max = 0;
+    stat->sum = 0;
+    stat->samples = 0;
+}
+
+//Counts since start, without the cost of reading the counter
+static uint32_t bench_since(uint32_t start){
+    uint32_t elapsed = bench_cycles_elapsed(start, bench_cycles());
+    return (elapsed > bench_overhead) ? elapsed - bench_overhead : 0;
+}
+
+static void bench_stat_add(bench_stat_t * stat, uint32_t value){
+    if(value < stat->min){
+        stat->min = value;
+    }
+    if(value > stat->max){
+        stat->max = value;
+    }
+    stat->sum += value;
+    stat->samples++;
+}
+
+static void bench_print(const char * text){
+    while(*text){
+        BENCH_OUTPUT_CHAR(*text++);
+    }
+}
+
+static void bench_print_number(uint32_t value){
+    char digits[11];
+    uint8_t n = 0;
+    do{
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    }while(value);
+    while(n){
+        BENCH_OUTPUT_CHAR(digits[--n]);
+    }
+}
+
+static void bench_print_stat(const bench_embedded_case_t * bench, const char * metric, const bench_stat_t * stat){
+    if(stat->samples == 0){
+        return;
+    }
+    bench_print_number(bench->function);
+    BENCH_OUTPUT_CHAR(',');
+    bench_print_number(bench->count);
+    BENCH_OUTPUT_CHAR(',');
+    bench_print(metric);
+    BENCH_OUTPUT_CHAR(',');
+    bench_print_number(stat->min);
+    BENCH_OUTPUT_CHAR(',');
+    bench_print_number(stat->sum / stat->samples);
+    BENCH_OUTPUT_CHAR(',');
+    bench_print_number(stat->max);
+    BENCH_OUTPUT_CHAR(',');
+    bench_print(BENCH_CYCLES_UNIT);
+    BENCH_OUTPUT_CHAR('\n');
+}
+
+static modbus_uart_request_t * bench_embedded_request(modbus_master_t * master, const bench_embedded_case_t * bench){
+    master->state = MASTER_STATE_IDLE;
+    switch(bench->function){
+        case 1: return bmodbus_master_read_coils(master, BENCH_CLIENT_ADDRESS, 0, bench->count);
+        case 2: return bmodbus_master_read_discrete_inputs(master, BENCH_CLIENT_ADDRESS, 0, bench->count);
+        case 3: return bmodbus_master_read_holding_registers(master, BENCH_CLIENT_ADDRESS, 0, bench->count);
+        case 4: return bmodbus_master_read_input_registers(master, BENCH_CLIENT_ADDRESS, 0, bench->count);
+        case 5: return bmodbus_master_write_single_coil(master, BENCH_CLIENT_ADDRESS, 0, 1);
+        case 6: return bmodbus_master_write_single_register(master, BENCH_CLIENT_ADDRESS, 0, 0x1234);
+        case 15: return bmodbus_master_write_multiple_coils(master, BENCH_CLIENT_ADDRESS, 0, bench->count, (uint8_t *)bench_embedded_values);
+        case 16: return bmodbus_master_write_multiple_registers(master, BENCH_CLIENT_ADDRESS, 0, bench->count, bench_embedded_values);
+        case 0x16: return bmodbus_master_mask_write_register(master, BENCH_CLIENT_ADDRESS, 0, 0xF0F0, 0x0505);
+#ifdef BMB_CLIENT_READ_WRITE_FUNCTION
+        case 0x17: return bmodbus_master_read_write_multiple_registers(master, BENCH_CLIENT_ADDRESS, 0, bench->count, 0x100, bench->count, bench_embedded_values);
+#endif //BMB_CLIENT_READ_WRITE_FUNCTION
+        case 0x18: return bmodbus_master_read_fifo_queue(master, BENCH_CLIENT_ADDRESS, 0);
+        default: return NULL;
+    }
+}
+
+//Times one case, returns 0 if it had to be skipped
+static uint8_t bench_embedded_run(const bench_embedded_case_t * bench){
+    static modbus_client_t client;
+    static modbus_master_t master;
+    static uint8_t request[BMB_MAXIMUM_MESSAGE_SIZE], response[BMB_MAXIMUM_MESSAGE_SIZE];
+    bench_stat_t client_byte, client_frame, encode, build, master_byte, master_frame;
+    modbus_uart_request_t * built;
+    modbus_request_t * handled;
+    modbus_uart_data_t * answer;
+    uint32_t microseconds = 0, start, elapsed, frame;
+    uint16_t i, n, request_size, response_size;
+    bench_stat_reset(&client_byte);
+    bench_stat_reset(&client_frame);
+    bench_stat_reset(&encode);
+    bench_stat_reset(&build);
+    bench_stat_reset(&master_byte);
+    bench_stat_reset(&master_frame);
+    bmodbus_client_init(&client, INTERFRAME_DELAY_MICROSECONDS(38400), BENCH_CLIENT_ADDRESS);
+    bmodbus_master_init(&master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    built = bench_embedded_request(&master, bench);
+    if(built == NULL){
+        return 0;
+    }
+    request_size = built->size;
+    memcpy(request, built->data, request_size);
+    for(n = 0; n < BENCH_ITERATIONS; n++){
+        //The master builds the request
+        start = bench_cycles();
+        built = bench_embedded_request(&master, bench);
+        bench_stat_add(&build, bench_since(start));
+
+        //The client receives it byte by byte
+        frame = 0;
+        microseconds += client.interframe_delay + 1;
+        for(i = 0; i < request_size; i++){
+            start = bench_cycles();
+            bmodbus_client_next_byte(&client, microseconds, request[i]);
+            elapsed = bench_since(start);
+            bench_stat_add(&client_byte, elapsed);
+            frame += elapsed;
+            microseconds += BENCH_BYTE_TIME;
+        }
+        bench_stat_add(&client_frame, frame);
+
+        //The application answers and the response is encoded
+        handled = bmodbus_client_get_request(&client);
+        if(handled == NULL){
+            return 0; //Rejected, it does not fit this build
+        }
+        for(i = 0; i < BMB_MAXIMUM_MESSAGE_SIZE / 2; i++){
+            handled->data[i] = bench_embedded_values[i];
+        }
+        if(bench->function == 0x18){
+            handled->size = bench->count;
+        }
+        start = bench_cycles();
+        answer = bmodbus_client_get_response(&client);
+        bench_stat_add(&encode, bench_since(start));
+        if((answer == NULL) || (answer->size == 0) || (answer->data[1] & 0x80)){
+            return 0;
+        }
+        response_size = answer->size;
+        memcpy(response, answer->data, response_size);
+        bmodbus_client_send_complete(&client);
+
+        //The master receives the response byte by byte
+        bmodbus_master_send_complete(&master, microseconds);
+        frame = 0;
+        for(i = 0; i < response_size; i++){
+            microseconds += BENCH_BYTE_TIME;
+            start = bench_cycles();
+            bmodbus_master_next_byte(&master, microseconds, response[i]);
+            elapsed = bench_since(start);
+            bench_stat_add(&master_byte, elapsed);
+            frame += elapsed;
+        }
+        bench_stat_add(&master_frame, frame);
+        if(master.state != MASTER_STATE_RESPONSE_READY){
+            return 0;
+        }
+    }
+    bench_print_stat(bench, "client_byte", &client_byte);
+    bench_print_stat(bench, "client_frame", &client_frame);
+    bench_print_stat(bench, "encode", &encode);
+    bench_print_stat(bench, "build", &build);
+    bench_print_stat(bench, "master_byte", &master_byte);
+    bench_print_stat(bench, "master_frame", &master_frame);
+    return 1;
+}
+
+#ifndef FAKE_MAIN
+int main(void) {
+#else
+int bench_main(void){
+#endif
+    uint32_t start, elapsed;
+    uint16_t i;
+    bench_cycles_init();
+    //The cost of reading the counter itself, taken off every measurement
+    bench_overhead = 0xFFFFFFFFu;
+    for(i = 0; i < 64; i++){
+        start = bench_cycles();
+        elapsed = bench_cycles_elapsed(start, bench_cycles());
+        if(elapsed < bench_overhead){
+            bench_overhead = elapsed;
+        }
+    }
+    for(i = 0; i < BMB_MAXIMUM_MESSAGE_SIZE / 2; i++){
+        bench_embedded_values[i] = (uint16_t)(0x0101 * i + 0x1234);
+    }
+    bench_print("function,count,metric,min,avg,max,unit\n");
+    for(i = 0; i < sizeof(bench_embedded_cases) / sizeof(bench_embedded_cases[0]); i++){
+        bench_embedded_run(&bench_embedded_cases[i]);
+    }
+    bench_print("Benchmark completed\n");
+    return 0;
+}
+#endif //BENCH_EMBEDDED_AS_INCLUDE
@@ -217,7 +217,7 @@ void test_read_coil(void) {
 }
 
 void test_write_coils(void){
-    uint8_t writing_coils_address_0x1234_at_slave_2[] = {0x02, 0x0f, 0x12, 0x34, 0x07, 0xd0, 0xfa, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x9b, 0xe3, };
+    uint8_t writing_coils_address_0x1234_at_slave_2[] = {0x02, 0x0f, 0x12, 0x34, 0x07, 0xb0, 0xf6, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xe9, 0xb3, };
     modbus_request_t * request = NULL;
     modbus_uart_data_t * response = NULL;
     modbus_client_t modbus1;
@@ -237,7 +237,7 @@ void test_write_coils(void){
     TEST_ASSERT_EQUAL(CLIENT_STATE_PROCESSING_REQUEST, modbus1.state);
     TEST_ASSERT_EQUAL(0x0f, request->function);
     TEST_ASSERT_EQUAL(0x1234, request->address);
-    TEST_ASSERT_EQUAL(0x07d0, request->size); //Number of bits!
+    TEST_ASSERT_EQUAL(0x07b0, request->size); //Number of bits!
 
     for(int j=0;j<(request->size+7)/8;j++){
         TEST_ASSERT_EQUAL_UINT8(0xff, ((uint8_t*)(request->data))[j]);
@@ -251,7 +251,7 @@ void test_write_coils(void){
     TEST_ASSERT_EQUAL(0x12, response->data[2]);
     TEST_ASSERT_EQUAL(0x34, response->data[3]);
     TEST_ASSERT_EQUAL(0x07, response->data[4]);
-    TEST_ASSERT_EQUAL(0xd0, response->data[5]);
+    TEST_ASSERT_EQUAL(0xb0, response->data[5]);
 }
 
 void test_write_coil(void){
@@ -598,6 +598,1626 @@ void test_master_write_single_coil(void){
     TEST_ASSERT_EQUAL_UINT8_ARRAY(sending_request->data, client_response->data, client_response->size);
 }
 
+void test_client_unsupported_function(void){
+    uint8_t read_exception_status_at_slave_2[] = {0x02, 0x07, 0x41, 0x12, };
+    modbus_client_t modbus1;
+    bmodbus_client_init(&modbus1, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    uint32_t fake_time = 0;
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    for(uint16_t i=0;i<sizeof(read_exception_status_at_slave_2);i++) {
+        bmodbus_client_next_byte(&modbus1, fake_time, read_exception_status_at_slave_2[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    //The client answers with an illegal function exception by itself
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_request(&modbus1));
+    TEST_ASSERT_EQUAL(CLIENT_STATE_RESPONSE_READY, modbus1.state);
+    modbus_uart_data_t * response = bmodbus_client_get_response(&modbus1);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(5, response->size);
+    TEST_ASSERT_EQUAL(0x02, response->data[0]);
+    TEST_ASSERT_EQUAL(0x87, response->data[1]);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_FUNCTION, response->data[2]);
+}
+
+void test_client_exception_responses(void){
+    uint8_t read_126_registers_at_slave_2[] = {0x02, 0x03, 0x00, 0x00, 0x00, 0x7e, 0xc5, 0xd9, };
+    uint8_t read_1_register_at_slave_2[] = {0x02, 0x03, 0x00, 0x00, 0x00, 0x01, 0x84, 0x39, };
+    //A count of 0 with the CRC of the first 7 bytes as the first two data bytes
+    uint8_t write_0_registers_crc_in_data[] = {0x02, 0x10, 0x00, 0x00, 0x00, 0x00, 0x04, 0x3b, 0x93, 0x12, 0x34, 0x0d, 0x77, };
+    modbus_request_t * request = NULL;
+    modbus_uart_data_t * response = NULL;
+    modbus_client_t modbus1;
+    bmodbus_client_init(&modbus1, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    uint32_t fake_time = 0;
+    //Counts beyond the specification are rejected without involving the application
+    for(uint16_t i=0;i<sizeof(read_126_registers_at_slave_2);i++) {
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+        bmodbus_client_next_byte(&modbus1, fake_time, read_126_registers_at_slave_2[i]);
+        if((i >= 5) && (i < sizeof(read_126_registers_at_slave_2) - 1)){ //Rejected once the count arrives, answered after the CRC
+            TEST_ASSERT_EQUAL(CLIENT_STATE_REJECTING, modbus1.state);
+        }
+    }
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_request(&modbus1));
+    response = bmodbus_client_get_response(&modbus1);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(5, response->size);
+    TEST_ASSERT_EQUAL(0x83, response->data[1]);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, response->data[2]);
+    TEST_ASSERT_EQUAL(0xf1, response->data[3]);
+    TEST_ASSERT_EQUAL(0x31, response->data[4]);
+    bmodbus_client_send_complete(&modbus1);
+
+    //A rejected frame is skipped by its length, data that happens to look like a valid CRC does not end it early
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    for(uint16_t i=0;i<sizeof(write_0_registers_crc_in_data);i++) {
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+        bmodbus_client_next_byte(&modbus1, fake_time, write_0_registers_crc_in_data[i]);
+        if((i >= 5) && (i < sizeof(write_0_registers_crc_in_data) - 1)){
+            TEST_ASSERT_EQUAL(CLIENT_STATE_REJECTING, modbus1.state);
+        }
+    }
+    response = bmodbus_client_get_response(&modbus1);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(0x90, response->data[1]);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, response->data[2]);
+    bmodbus_client_send_complete(&modbus1);
+
+    //With a bad CRC at its end the rejected frame gets no reply
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    write_0_registers_crc_in_data[sizeof(write_0_registers_crc_in_data) - 1] ^= 0xFF;
+    for(uint16_t i=0;i<sizeof(write_0_registers_crc_in_data);i++) {
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+        bmodbus_client_next_byte(&modbus1, fake_time, write_0_registers_crc_in_data[i]);
+    }
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_response(&modbus1));
+
+    //The application can reply with an exception by setting the result
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    for(uint16_t i=0;i<sizeof(read_1_register_at_slave_2);i++) {
+        bmodbus_client_next_byte(&modbus1, fake_time, read_1_register_at_slave_2[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    request = bmodbus_client_get_request(&modbus1);
+    TEST_ASSERT_NOT_EQUAL(NULL, request);
+    request->result = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    response = bmodbus_client_get_response(&modbus1);
+    TEST_ASSERT_EQUAL(5, response->size);
+    TEST_ASSERT_EQUAL(0x83, response->data[1]);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, response->data[2]);
+    bmodbus_client_send_complete(&modbus1);
+
+    //A negative result means no reply at all
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    for(uint16_t i=0;i<sizeof(read_1_register_at_slave_2);i++) {
+        bmodbus_client_next_byte(&modbus1, fake_time, read_1_register_at_slave_2[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    request = bmodbus_client_get_request(&modbus1);
+    TEST_ASSERT_NOT_EQUAL(NULL, request);
+    request->result = -1;
+    response = bmodbus_client_get_response(&modbus1);
+    TEST_ASSERT_EQUAL(0, response->size);
+}
+
+void test_master_write_coils(void){
+    uint32_t fake_time = 0;
+    uint8_t coils[] = {0xcd, 0x01};
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_request_t * client_request = NULL;
+    modbus_uart_data_t * client_response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    sending_request = bmodbus_master_write_multiple_coils(&modbus_master, 2, 0x0013, 10, coils);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    TEST_ASSERT_EQUAL(11, sending_request->size);
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    client_request = bmodbus_client_get_request(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_request);
+    TEST_ASSERT_EQUAL(0x0f, client_request->function);
+    TEST_ASSERT_EQUAL(0x0013, client_request->address);
+    TEST_ASSERT_EQUAL(10, client_request->size);
+    //Coils are kept in byte order
+    TEST_ASSERT_EQUAL_UINT8(0xcd, ((uint8_t*)client_request->data)[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x01, ((uint8_t*)client_request->data)[1]);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400);
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100; // just wait a bit
+    bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(MASTER_STATE_RESPONSE_READY, modbus_master.state);
+    modbus_request_t * response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(0, response->result);
+    TEST_ASSERT_EQUAL(0x0f, response->function);
+    TEST_ASSERT_EQUAL(0x0013, response->address);
+}
+
+void test_master_exception_response(void){
+    uint32_t fake_time = 0;
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_uart_data_t * client_response = NULL;
+    modbus_request_t * request = NULL;
+    modbus_request_t * response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+
+    sending_request = bmodbus_master_read_holding_registers(&modbus_master, 2, 0x0100, 125);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    TEST_ASSERT_EQUAL(255, sending_request->expected_response_size);
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    request = bmodbus_client_get_request(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, request);
+    request->result = MODBUS_EXCEPTION_SERVER_DEVICE_BUSY;
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_EQUAL(5, client_response->size);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100; // just wait a bit
+    //The frame completes after 5 bytes instead of the 255 expected for the read
+    bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(MASTER_STATE_RESPONSE_READY, modbus_master.state);
+    response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(3, response->function);
+    TEST_ASSERT_EQUAL(0x0100, response->address);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_SERVER_DEVICE_BUSY, response->result);
+    TEST_ASSERT_EQUAL(0, response->size);
+    bmodbus_client_send_complete(&modbus_client);
+
+    //Exceptions to a variable length response are recognized too
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    sending_request = bmodbus_master_read_fifo_queue(&modbus_master, 2, 0x04de);
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    request = bmodbus_client_get_request(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, request);
+    request->result = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    client_response = bmodbus_client_get_response(&modbus_client);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100; // just wait a bit
+    bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(0x18, response->function);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, response->result);
+    bmodbus_client_send_complete(&modbus_client);
+
+    //A queue longer than the 31 values a response holds is refused, not cut short
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    modbus_master.state = MASTER_STATE_IDLE;
+    sending_request = bmodbus_master_read_fifo_queue(&modbus_master, 2, 0x04de);
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    request = bmodbus_client_get_request(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, request);
+    request->size = 32;
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_EQUAL(5, client_response->size);
+    TEST_ASSERT_EQUAL(0x98, client_response->data[1]);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, client_response->data[2]);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100; // just wait a bit
+    bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, response->result);
+}
+
+void test_master_broadcast(void){
+    uint32_t fake_time = 0;
+    uint16_t values[2] = {0x1234, 0x5678};
+    uint8_t broadcast_read[] = {0x00, 0x03, 0x00, 0x00, 0x00, 0x01, 0x85, 0xdb, };
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_uart_data_t * client_response = NULL;
+    modbus_request_t * request = NULL;
+    modbus_request_t * response = NULL;
+    modbus_client_t modbus_clients[2];
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_clients[0], INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_client_init(&modbus_clients[1], INTERFRAME_DELAY_MICROSECONDS(38400), 3);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_master_set_turnaround_delay(&modbus_master, 100000);
+
+    //Reads cannot be broadcast
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_read_holding_registers(&modbus_master, MODBUS_BROADCAST_ADDRESS, 0x0010, 2));
+    sending_request = bmodbus_master_write_multiple_registers(&modbus_master, MODBUS_BROADCAST_ADDRESS, 0x0010, 2, values);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_clients[0], fake_time, sending_request->data[i]);
+        bmodbus_client_next_byte(&modbus_clients[1], fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    //Every client applies the write and sends nothing back
+    for(int j=0;j<2;j++){
+        request = bmodbus_client_get_request(&modbus_clients[j]);
+        TEST_ASSERT_NOT_EQUAL(NULL, request);
+        TEST_ASSERT_EQUAL(16, request->function);
+        TEST_ASSERT_EQUAL(0x0010, request->address);
+        TEST_ASSERT_EQUAL(0x5678, request->data[1]);
+        client_response = bmodbus_client_get_response(&modbus_clients[j]);
+        TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+        TEST_ASSERT_EQUAL(0, client_response->size);
+        bmodbus_client_send_complete(&modbus_clients[j]);
+    }
+    //The master completes once the turnaround delay has passed
+    bmodbus_master_loop(&modbus_master, fake_time + 50000);
+    TEST_ASSERT_EQUAL(MASTER_STATE_TURNAROUND, modbus_master.state);
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_get_response(&modbus_master));
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_write_single_register(&modbus_master, 2, 0x0010, 1)); //Still busy
+    fake_time += 100000;
+    bmodbus_master_loop(&modbus_master, fake_time);
+    response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(16, response->function);
+    TEST_ASSERT_EQUAL(0, response->result);
+    TEST_ASSERT_EQUAL(0, response->size);
+
+    //A broadcast read is ignored without an exception
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    for(uint16_t i=0;i<sizeof(broadcast_read);i++){
+        bmodbus_client_next_byte(&modbus_clients[0], fake_time, broadcast_read[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_request(&modbus_clients[0]));
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_response(&modbus_clients[0]));
+}
+
+void test_master_request_limits(void){
+    uint16_t values[2] = {0};
+    uint16_t largest = BMB_MAXIMUM_REGISTER_COUNT < 125 ? BMB_MAXIMUM_REGISTER_COUNT : 125;
+    modbus_master_t modbus_master;
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    //Counts outside the specification are refused, the expected response size would not be valid
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_read_holding_registers(&modbus_master, 1, 0, 0));
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_read_holding_registers(&modbus_master, 1, 0, 126));
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_read_input_registers(&modbus_master, 1, 0, 0xFFFE));
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_read_coils(&modbus_master, 1, 0, 2001));
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_write_multiple_registers(&modbus_master, 1, 0, 124, values));
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_read_write_multiple_registers(&modbus_master, 1, 0, 126, 0, 1, values));
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_read_write_multiple_registers(&modbus_master, 1, 0, 1, 0, 0, values));
+    //So are requests whose response would not fit the buffer
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_read_holding_registers(&modbus_master, 1, 0, largest + 1));
+    TEST_ASSERT_EQUAL(MASTER_STATE_IDLE, modbus_master.state);
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_master_read_holding_registers(&modbus_master, 1, 0, largest));
+    TEST_ASSERT_EQUAL(largest * 2 + 5, modbus_master.payload.request.expected_response_size);
+}
+
+void test_packet_framing(void){
+    uint8_t junk[] = {0x02, 0x03, 0x00};
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_uart_data_t * client_response = NULL;
+    modbus_request_t * request = NULL;
+    modbus_request_t * response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+
+    //Each packet is a frame, a truncated one is dropped even without an interframe gap
+    bmodbus_client_received_packet(&modbus_client, 1000, junk, sizeof(junk));
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_request(&modbus_client));
+    sending_request = bmodbus_master_read_holding_registers(&modbus_master, 2, 0x0010, 2);
+    bmodbus_client_received_packet(&modbus_client, 1000, sending_request->data, sending_request->size);
+    request = bmodbus_client_get_request(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, request);
+    TEST_ASSERT_EQUAL(0x0010, request->address);
+    request->data[0] = 0x1234;
+    request->data[1] = 0x5678;
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_EQUAL(9, client_response->size);
+    //Packets arriving while the response is pending are ignored
+    bmodbus_client_received_packet(&modbus_client, 1000, sending_request->data, sending_request->size);
+    TEST_ASSERT_EQUAL(CLIENT_STATE_SENDING_RESPONSE, modbus_client.state);
+
+    //The master accepts the response split across packets
+    bmodbus_master_send_complete(&modbus_master, 1000);
+    bmodbus_master_received_packet(&modbus_master, 2000, client_response->data, 4);
+    TEST_ASSERT_EQUAL(MASTER_STATE_WAITING_FOR_RESPONSE, modbus_master.state);
+    bmodbus_master_received_packet(&modbus_master, 2000, client_response->data + 4, client_response->size - 4);
+    response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(0x1234, response->data[0]);
+    TEST_ASSERT_EQUAL(0x5678, response->data[1]);
+    bmodbus_client_send_complete(&modbus_client);
+}
+
+#ifdef BMB_SCATTER_GATHER
+//Joins the spans of a vector back into one frame
+static uint16_t vector_flatten(const modbus_uart_vector_t * vector, uint8_t * frame){
+    uint16_t n = 0;
+    for(uint8_t i=0;i<vector->count;i++){
+        for(uint16_t j=0;j<vector->span[i].length;j++){
+            frame[n++] = vector->span[i].data[j];
+        }
+    }
+    return n;
+}
+
+void test_scatter_gather(void){
+    uint8_t wire_registers[4] = {0x12, 0x34, 0x56, 0x78};
+    uint16_t registers[2] = {0x1234, 0x5678};
+    uint8_t coils[2] = {0xcd, 0x01};
+    uint8_t frame[BMB_MAXIMUM_MESSAGE_SIZE];
+    uint8_t joined[BMB_MAXIMUM_MESSAGE_SIZE];
+    uint16_t n;
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_uart_data_t * client_response = NULL;
+    modbus_uart_vector_t vector;
+    modbus_request_t * request = NULL;
+    modbus_client_t modbus_clients[2];
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_clients[0], INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_client_init(&modbus_clients[1], INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+
+    //The read data is sent from the application buffer, the frame is the same as the copied one
+    sending_request = bmodbus_master_read_input_registers(&modbus_master, 2, 0x0010, 2);
+    bmodbus_client_received_packet(&modbus_clients[0], 0, sending_request->data, sending_request->size);
+    bmodbus_client_received_packet(&modbus_clients[1], 0, sending_request->data, sending_request->size);
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_client_get_request(&modbus_clients[0]));
+    TEST_ASSERT_EQUAL_PTR(&vector, bmodbus_client_get_response_vector(&modbus_clients[0], wire_registers, &vector));
+    TEST_ASSERT_EQUAL(3, vector.count);
+    TEST_ASSERT_EQUAL(3, vector.span[0].length);
+    TEST_ASSERT_EQUAL_PTR(wire_registers, vector.span[1].data);
+    TEST_ASSERT_EQUAL(4, vector.span[1].length);
+    request = bmodbus_client_get_request(&modbus_clients[1]);
+    request->data[0] = registers[0];
+    request->data[1] = registers[1];
+    client_response = bmodbus_client_get_response(&modbus_clients[1]);
+    n = vector_flatten(&vector, frame);
+    TEST_ASSERT_EQUAL(client_response->size, n);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(client_response->data, frame, n);
+    TEST_ASSERT_EQUAL(CLIENT_STATE_SENDING_RESPONSE, modbus_clients[0].state);
+    bmodbus_client_send_complete(&modbus_clients[0]);
+    bmodbus_client_send_complete(&modbus_clients[1]);
+
+    //Anything else is a single span, here an exception
+    modbus_master.state = MASTER_STATE_IDLE;
+    sending_request = bmodbus_master_write_single_register(&modbus_master, 2, 0x0010, 1);
+    bmodbus_client_received_packet(&modbus_clients[0], 0, sending_request->data, sending_request->size);
+    request = bmodbus_client_get_request(&modbus_clients[0]);
+    request->result = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_client_get_response_vector(&modbus_clients[0], wire_registers, &vector));
+    TEST_ASSERT_EQUAL(1, vector.count);
+    TEST_ASSERT_EQUAL(5, vector.span[0].length);
+    TEST_ASSERT_EQUAL(0x86, vector.span[0].data[1]);
+    bmodbus_client_send_complete(&modbus_clients[0]);
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_response_vector(&modbus_clients[0], wire_registers, &vector));
+
+#ifdef BMB_CLIENT_REGISTER_BANK
+    //Reads served from a register bank are built by the library, the payload is not sent
+    bmodbus_client_set_holding_registers(&modbus_clients[0], registers, 0x0030, 2);
+    modbus_master.state = MASTER_STATE_IDLE;
+    sending_request = bmodbus_master_read_holding_registers(&modbus_master, 2, 0x0030, 2);
+    bmodbus_client_received_packet(&modbus_clients[0], 0, sending_request->data, sending_request->size);
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_request(&modbus_clients[0]));
+    TEST_ASSERT_EQUAL_PTR(&vector, bmodbus_client_get_response_vector(&modbus_clients[0], coils, &vector));
+    TEST_ASSERT_EQUAL(1, vector.count);
+    TEST_ASSERT_EQUAL(9, vector.span[0].length);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(wire_registers, vector.span[0].data + 3, 4);
+    bmodbus_client_send_complete(&modbus_clients[0]);
+    bmodbus_client_set_holding_registers(&modbus_clients[0], NULL, 0, 0);
+#endif //BMB_CLIENT_REGISTER_BANK
+
+    //Master writes send the values from the application buffer too
+    modbus_master.state = MASTER_STATE_IDLE;
+    sending_request = bmodbus_master_write_multiple_registers(&modbus_master, 2, 0x0020, 2, registers);
+    memcpy(frame, sending_request->data, sending_request->size);
+    n = sending_request->size;
+    modbus_master.state = MASTER_STATE_IDLE;
+    TEST_ASSERT_EQUAL_PTR(&vector, bmodbus_master_write_multiple_vector(&modbus_master, 2, 16, 0x0020, 2, wire_registers, &vector));
+    TEST_ASSERT_EQUAL(3, vector.count);
+    TEST_ASSERT_EQUAL_PTR(wire_registers, vector.span[1].data);
+    TEST_ASSERT_EQUAL(MASTER_STATE_SENDING_REQUEST, modbus_master.state);
+    TEST_ASSERT_EQUAL(n, vector_flatten(&vector, joined));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(frame, joined, n);
+    modbus_master.state = MASTER_STATE_IDLE;
+    sending_request = bmodbus_master_write_multiple_coils(&modbus_master, 2, 0x0020, 9, coils);
+    memcpy(frame, sending_request->data, sending_request->size);
+    n = sending_request->size;
+    modbus_master.state = MASTER_STATE_IDLE;
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_master_write_multiple_vector(&modbus_master, 2, 15, 0x0020, 9, coils, &vector));
+    TEST_ASSERT_EQUAL(n, vector_flatten(&vector, joined));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(frame, joined, n);
+    //The limits of the specification still apply
+    modbus_master.state = MASTER_STATE_IDLE;
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_write_multiple_vector(&modbus_master, 2, 16, 0x0020, 124, wire_registers, &vector));
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_write_multiple_vector(&modbus_master, 2, 3, 0x0020, 2, wire_registers, &vector));
+    TEST_ASSERT_EQUAL(MASTER_STATE_IDLE, modbus_master.state);
+}
+#endif //BMB_SCATTER_GATHER
+
+#if defined(BMB_CLIENT_ASCII) && defined(BMB_MASTER_ASCII)
+void test_ascii_framing(void){
+    uint32_t fake_time = 0;
+    uint8_t bad_lrc[] = ":1103006B00037F\r\n";
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_uart_data_t * client_response = NULL;
+    modbus_request_t * request = NULL;
+    modbus_request_t * response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_client, ASCII_CHARACTER_TIMEOUT_MICROSECONDS, 0x11);
+    bmodbus_master_init(&modbus_master, ASCII_CHARACTER_TIMEOUT_MICROSECONDS);
+    bmodbus_client_set_ascii(&modbus_client, 1);
+    bmodbus_master_set_ascii(&modbus_master, 1);
+
+    //The example from the specification
+    sending_request = bmodbus_master_read_holding_registers(&modbus_master, 0x11, 0x006B, 3);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    TEST_ASSERT_EQUAL(17, sending_request->size);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(":1103006B00037E\r\n", sending_request->data, 17);
+    //Characters can come one at a time...
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(9600) * 1; // 1 byte
+    }
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    request = bmodbus_client_get_request(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, request);
+    TEST_ASSERT_EQUAL(3, request->function);
+    TEST_ASSERT_EQUAL(0x006B, request->address);
+    TEST_ASSERT_EQUAL(3, request->size);
+    request->data[0] = 0x022B;
+    request->data[1] = 0x0000;
+    request->data[2] = 0x0064;
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL(23, client_response->size);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(":110306022B0000006455\r\n", client_response->data, 23);
+    //...or all at once
+    bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(9600));
+    TEST_ASSERT_EQUAL(MASTER_STATE_RESPONSE_READY, modbus_master.state);
+    response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(3, response->size);
+    TEST_ASSERT_EQUAL(0x022B, response->data[0]);
+    TEST_ASSERT_EQUAL(0x0064, response->data[2]);
+    bmodbus_client_send_complete(&modbus_client);
+
+    //A frame with a bad LRC is dropped, the next ':' starts over
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(9600) * 100;
+    bmodbus_client_received(&modbus_client, fake_time, bad_lrc, sizeof(bad_lrc) - 1, BYTE_TIMING_IN_MICROSECONDS(9600));
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_request(&modbus_client));
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(9600) * 100;
+    bmodbus_client_received(&modbus_client, fake_time, (uint8_t *)":1107E8\r\n", 9, BYTE_TIMING_IN_MICROSECONDS(9600));
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(":11870167\r\n", client_response->data, 11); //Illegal function
+    bmodbus_client_send_complete(&modbus_client);
+
+    //Reads are sized for ASCII when their header arrives, 61 registers take 255 characters and 62 would not fit
+    sending_request = bmodbus_master_read_holding_registers(&modbus_master, 0x11, 0, 62);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(9600) * 100;
+    bmodbus_client_received(&modbus_client, fake_time, sending_request->data, sending_request->size, BYTE_TIMING_IN_MICROSECONDS(9600));
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_request(&modbus_client));
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL(11, client_response->size);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(":11830369\r\n", client_response->data, 11); //Illegal data value
+    bmodbus_client_send_complete(&modbus_client);
+    bmodbus_master_timeout(&modbus_master);
+    sending_request = bmodbus_master_read_holding_registers(&modbus_master, 0x11, 0, 61);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(9600) * 100;
+    bmodbus_client_received(&modbus_client, fake_time, sending_request->data, sending_request->size, BYTE_TIMING_IN_MICROSECONDS(9600));
+    request = bmodbus_client_get_request(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, request);
+    memset(request->data, 0, 61 * sizeof(uint16_t));
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL(255, client_response->size);
+    bmodbus_client_send_complete(&modbus_client);
+}
+#endif //BMB_CLIENT_ASCII && BMB_MASTER_ASCII
+
+#ifdef BMB_CLIENT_READ_WRITE_FUNCTION
+void test_master_read_write_registers(void){
+    uint32_t fake_time = 0;
+    uint16_t data[3] = {0x0102, 0x0304, 0x0506};
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_request_t * client_request = NULL;
+    modbus_uart_data_t * client_response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    sending_request = bmodbus_master_read_write_multiple_registers(&modbus_master, 2, 0x0100, 2, 0x0200, 3, data);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    TEST_ASSERT_EQUAL(13 + sizeof(data), sending_request->size);
+    for(int i=0;i<sending_request->size;i++){
+        TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_request(&modbus_client));
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    client_request = bmodbus_client_get_request(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_request);
+    TEST_ASSERT_EQUAL(0x17, client_request->function);
+    TEST_ASSERT_EQUAL(0x0100, client_request->address);
+    TEST_ASSERT_EQUAL(2, client_request->size);
+    TEST_ASSERT_EQUAL(0x0200, client_request->address2);
+    TEST_ASSERT_EQUAL(3, client_request->size2);
+    TEST_ASSERT_EQUAL(0x0102, client_request->data[0]);
+    TEST_ASSERT_EQUAL(0x0304, client_request->data[1]);
+    TEST_ASSERT_EQUAL(0x0506, client_request->data[2]);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400);
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+
+    //The write is applied, now the read values replace the data
+    client_request->data[0] = 0xdead;
+    client_request->data[1] = 0xbeef;
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL(5 + 2 * 2, client_response->size);
+    TEST_ASSERT_EQUAL(0x17, client_response->data[1]);
+    TEST_ASSERT_EQUAL(0x04, client_response->data[2]);
+
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100; // just wait a bit
+    bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(MASTER_STATE_RESPONSE_READY, modbus_master.state);
+    modbus_request_t * response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(0x17, response->function);
+    TEST_ASSERT_EQUAL(0x0100, response->address);
+    TEST_ASSERT_EQUAL(2, response->size);
+    TEST_ASSERT_EQUAL(0xdead, response->data[0]);
+    TEST_ASSERT_EQUAL(0xbeef, response->data[1]);
+}
+#endif //BMB_CLIENT_READ_WRITE_FUNCTION
+
+void test_master_mask_write_register(void){
+    uint32_t fake_time = 0;
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_request_t * client_request = NULL;
+    modbus_uart_data_t * client_response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    sending_request = bmodbus_master_mask_write_register(&modbus_master, 2, 0x0004, 0x00f2, 0x0025);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    TEST_ASSERT_EQUAL(10, sending_request->size);
+    for(int i=0;i<sending_request->size;i++){
+        TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_request(&modbus_client));
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    client_request = bmodbus_client_get_request(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_request);
+    TEST_ASSERT_EQUAL(0x16, client_request->function);
+    TEST_ASSERT_EQUAL(0x0004, client_request->address);
+    TEST_ASSERT_EQUAL(1, client_request->size);
+    TEST_ASSERT_EQUAL(0x00f2, client_request->data[0]);
+    TEST_ASSERT_EQUAL(0x0025, client_request->data[1]);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400);
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL(10, client_response->size);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100; // just wait a bit
+    bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(MASTER_STATE_RESPONSE_READY, modbus_master.state);
+    modbus_request_t * response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(0, response->result);
+    TEST_ASSERT_EQUAL(0x16, response->function);
+
+    //The response is an echo of the request
+    sending_request = bmodbus_master_mask_write_register(&modbus_master, 2, 0x0004, 0x00f2, 0x0025);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(sending_request->data, client_response->data, client_response->size);
+}
+
+#ifdef BMB_CLIENT_REGISTER_BANK
+void test_client_register_bank(void){
+    uint32_t fake_time = 0;
+    uint16_t registers[4] = {0x0012, 0x3456, 0x789a, 0xbcde};
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_uart_data_t * client_response = NULL;
+    modbus_request_t * response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_client_set_holding_registers(&modbus_client, registers, 0x0100, 4);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+
+    //Mask write is applied by the library, the application never sees the request
+    sending_request = bmodbus_master_mask_write_register(&modbus_master, 2, 0x0100, 0x00f2, 0x0025);
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_request(&modbus_client));
+    TEST_ASSERT_EQUAL(0x0017, registers[0]);
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL(10, client_response->size);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100; // just wait a bit
+    bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_master_get_response(&modbus_master));
+    bmodbus_client_send_complete(&modbus_client);
+
+    //Reads are served from the bank
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    sending_request = bmodbus_master_read_holding_registers(&modbus_master, 2, 0x0101, 3);
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100; // just wait a bit
+    bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(3, response->size);
+    TEST_ASSERT_EQUAL(0x3456, response->data[0]);
+    TEST_ASSERT_EQUAL(0x789a, response->data[1]);
+    TEST_ASSERT_EQUAL(0xbcde, response->data[2]);
+    bmodbus_client_send_complete(&modbus_client);
+
+    //Anything reaching outside the bank goes to the application
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    sending_request = bmodbus_master_read_holding_registers(&modbus_master, 2, 0x0102, 3);
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_client_get_request(&modbus_client));
+}
+#endif //BMB_CLIENT_REGISTER_BANK
+
+#ifdef BMB_CLIENT_FIFO_QUEUE
+void test_master_read_fifo_queue(void){
+    uint32_t fake_time = 0;
+    uint16_t storage[4];
+    modbus_fifo_t fifo;
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_uart_data_t * client_response = NULL;
+    modbus_request_t * response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_fifo_init(&fifo, storage, 4);
+    bmodbus_client_set_fifo(&modbus_client, 0x04de, &fifo);
+    TEST_ASSERT_EQUAL(0, bmodbus_fifo_push(&fifo, 0x01b8));
+    TEST_ASSERT_EQUAL(0, bmodbus_fifo_push(&fifo, 0x1284));
+    TEST_ASSERT_EQUAL(0, bmodbus_fifo_push(&fifo, 0x5678));
+    TEST_ASSERT_EQUAL(0, bmodbus_fifo_push(&fifo, 0x9abc));
+    TEST_ASSERT_EQUAL(-1, bmodbus_fifo_push(&fifo, 0xdef0)); //Full
+
+    sending_request = bmodbus_master_read_fifo_queue(&modbus_master, 2, 0x04de);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    TEST_ASSERT_EQUAL(6, sending_request->size);
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    //The queue is served by the library
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_request(&modbus_client));
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL(8 + 2 * 4, client_response->size);
+    TEST_ASSERT_EQUAL(0x00, client_response->data[2]);
+    TEST_ASSERT_EQUAL(0x0a, client_response->data[3]);
+    TEST_ASSERT_EQUAL(0x04, client_response->data[5]);
+    TEST_ASSERT_EQUAL(0x01, client_response->data[6]);
+    TEST_ASSERT_EQUAL(0xb8, client_response->data[7]);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100; // just wait a bit
+    bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(MASTER_STATE_RESPONSE_READY, modbus_master.state);
+    response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(0x18, response->function);
+    TEST_ASSERT_EQUAL(4, response->size);
+    TEST_ASSERT_EQUAL(0x01b8, response->data[0]);
+    TEST_ASSERT_EQUAL(0x1284, response->data[1]);
+    TEST_ASSERT_EQUAL(0x5678, response->data[2]);
+    TEST_ASSERT_EQUAL(0x9abc, response->data[3]);
+    bmodbus_client_send_complete(&modbus_client);
+
+    //The queue was drained, so the next read is empty
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    sending_request = bmodbus_master_read_fifo_queue(&modbus_master, 2, 0x04de);
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL(8, client_response->size);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100; // just wait a bit
+    bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(0, response->size);
+}
+#endif //BMB_CLIENT_FIFO_QUEUE
+
+#ifdef BMB_CLIENT_FILE_RECORD
+//Records are kept in a small window, a record's slot is its position counted across files
+#define TEST_FILE_SLOTS 512
+static uint16_t test_file_store[TEST_FILE_SLOTS];
+static uint16_t test_file_writes;
+static uint8_t test_file_commits;
+
+static uint16_t test_file_slot(uint16_t file, uint16_t record){
+    return (uint16_t)(((uint32_t)file * 10000 + record) % TEST_FILE_SLOTS);
+}
+static int8_t test_file_read(void * context, uint16_t file, uint16_t record, uint16_t * value){
+    (void)context;
+    *value = test_file_store[test_file_slot(file, record)];
+    return 0;
+}
+static int8_t test_file_write(void * context, uint16_t file, uint16_t record, uint16_t value){
+    (void)context;
+    test_file_store[test_file_slot(file, record)] = value;
+    test_file_writes++;
+    return 0;
+}
+static void test_file_write_complete(void * context, uint8_t valid){
+    (void)context;
+    if(valid){
+        test_file_commits++;
+    }
+}
+
+//File 3 is write protected
+static int8_t test_file_write_protected(void * context, uint16_t file, uint16_t record, uint16_t value){
+    if(file == 3){
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    }
+    return test_file_write(context, file, record, value);
+}
+
+void test_master_file_record(void){
+    uint32_t fake_time = 0;
+    uint16_t values1[3] = {0x1234, 0x5678, 0x9abc};
+    uint16_t values2[2] = {0x0102, 0x0304};
+    modbus_file_subrequest_t subrequests[2];
+    modbus_file_record_t files = {test_file_read, test_file_write, test_file_write_complete, NULL};
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_uart_data_t * client_response = NULL;
+    modbus_request_t * response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_client_set_file_records(&modbus_client, &files);
+    test_file_writes = 0;
+    test_file_commits = 0;
+
+    subrequests[0].file = 4;
+    subrequests[0].record = 7;
+    subrequests[0].length = 3;
+    subrequests[0].data = values1;
+    subrequests[1].file = 3;
+    subrequests[1].record = 9;
+    subrequests[1].length = 2;
+    subrequests[1].data = values2;
+    sending_request = bmodbus_master_write_file_record(&modbus_master, 2, subrequests, 2);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    TEST_ASSERT_EQUAL(3 + 7 + 6 + 7 + 4 + 2, sending_request->size);
+    TEST_ASSERT_EQUAL(7 + 6 + 7 + 4, sending_request->data[2]);
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    //The records were streamed to the application as they arrived
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_request(&modbus_client));
+    TEST_ASSERT_EQUAL(5, test_file_writes);
+    TEST_ASSERT_EQUAL(1, test_file_commits);
+    TEST_ASSERT_EQUAL(0x5678, test_file_store[test_file_slot(4, 8)]);
+    TEST_ASSERT_EQUAL(0x0304, test_file_store[test_file_slot(3, 10)]);
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL(sending_request->size, client_response->size);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(sending_request->data, client_response->data, client_response->size);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100; // just wait a bit
+    bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(MASTER_STATE_RESPONSE_READY, modbus_master.state);
+    bmodbus_client_send_complete(&modbus_client);
+
+    //Read both blocks back in one request
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    sending_request = bmodbus_master_read_file_record(&modbus_master, 2, subrequests, 2);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    TEST_ASSERT_EQUAL(3 + 14 + 2, sending_request->size);
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL(5 + 2 + 6 + 2 + 4, client_response->size);
+    TEST_ASSERT_EQUAL(14, client_response->data[2]);
+    TEST_ASSERT_EQUAL(7, client_response->data[3]);
+    TEST_ASSERT_EQUAL(6, client_response->data[4]);
+    TEST_ASSERT_EQUAL(0x12, client_response->data[5]);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100; // just wait a bit
+    bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(MASTER_STATE_RESPONSE_READY, modbus_master.state);
+    response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(0x14, response->function);
+    TEST_ASSERT_EQUAL(5, response->size);
+    TEST_ASSERT_EQUAL_HEX16_ARRAY(values1, response->data, 3);
+    TEST_ASSERT_EQUAL_HEX16_ARRAY(values2, response->data + 3, 2);
+    bmodbus_client_send_complete(&modbus_client);
+
+    //A frame with a bad CRC is streamed but never committed
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    sending_request = bmodbus_master_write_file_record(&modbus_master, 2, subrequests, 1);
+    sending_request->data[sending_request->size - 1] ^= 0xFF;
+    for(int i=0;i<sending_request->size;i++){
+        bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+    }
+    TEST_ASSERT_EQUAL(1, test_file_commits);
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_response(&modbus_client));
+}
+
+void test_client_file_record_limits(void){
+    uint32_t fake_time = 0;
+    //A sub-request of 0x8000 records in a byte count of 9, its data would not fit in the frame
+    uint8_t write_length_past_byte_count[] = {0x02, 0x15, 0x09, 0x06, 0x00, 0x01, 0x00, 0x00, 0x80, 0x00, 0x12, 0x34, 0x17, 0x31, };
+    //Record 10000 does not exist
+    uint8_t write_record_10000[] = {0x02, 0x15, 0x09, 0x06, 0x00, 0x01, 0x27, 0x10, 0x00, 0x01, 0x12, 0x34, 0xa8, 0x25, };
+    //Records 9999 and 10000, the second one does not exist
+    uint8_t read_past_record_9999[] = {0x02, 0x14, 0x07, 0x06, 0x00, 0x01, 0x27, 0x0f, 0x00, 0x02, 0x8f, 0x9d, };
+    modbus_file_record_t files = {test_file_read, test_file_write, test_file_write_complete, NULL};
+    modbus_uart_data_t * client_response = NULL;
+    modbus_client_t modbus_client;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_client_set_file_records(&modbus_client, &files);
+    test_file_writes = 0;
+    test_file_commits = 0;
+
+    bmodbus_client_received(&modbus_client, fake_time, write_length_past_byte_count, sizeof(write_length_past_byte_count), BYTE_TIMING_IN_MICROSECONDS(38400));
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL(5, client_response->size);
+    TEST_ASSERT_EQUAL(0x95, client_response->data[1]);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, client_response->data[2]);
+    bmodbus_client_send_complete(&modbus_client);
+
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    bmodbus_client_received(&modbus_client, fake_time, write_record_10000, sizeof(write_record_10000), BYTE_TIMING_IN_MICROSECONDS(38400));
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL(0x95, client_response->data[1]);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, client_response->data[2]);
+    bmodbus_client_send_complete(&modbus_client);
+    TEST_ASSERT_EQUAL(0, test_file_writes);
+    TEST_ASSERT_EQUAL(0, test_file_commits);
+
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    bmodbus_client_received(&modbus_client, fake_time, read_past_record_9999, sizeof(read_past_record_9999), BYTE_TIMING_IN_MICROSECONDS(38400));
+    client_response = bmodbus_client_get_response(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+    TEST_ASSERT_EQUAL(0x94, client_response->data[1]);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, client_response->data[2]);
+}
+
+void test_master_file_transfer(void){
+    uint32_t fake_time = 0;
+    uint16_t values[300];
+    uint8_t requests = 0;
+    modbus_file_transfer_t transfer;
+    modbus_file_record_t files = {test_file_read, test_file_write, test_file_write_complete, NULL};
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_uart_data_t * client_response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_client_set_file_records(&modbus_client, &files);
+    for(int i=0;i<300;i++){
+        values[i] = 0xA000 + i;
+    }
+    test_file_writes = 0;
+    test_file_commits = 0;
+    //Starting near the end of file 1 means the transfer continues into file 2
+    bmodbus_master_file_transfer_init(&transfer, 2, 1, 9990, values, 300);
+    while(!bmodbus_master_file_transfer_done(&modbus_master, &transfer)){
+        sending_request = bmodbus_master_file_transfer_next(&modbus_master, &transfer);
+        TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+        TEST_ASSERT_TRUE(sending_request->size <= BMB_MAXIMUM_MESSAGE_SIZE);
+        requests++;
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+        for(int i=0;i<sending_request->size;i++){
+            bmodbus_client_next_byte(&modbus_client, fake_time, sending_request->data[i]);
+            fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 1; // 1 byte
+        }
+        bmodbus_master_send_complete(&modbus_master, fake_time);
+        //The next request waits for the response
+        TEST_ASSERT_EQUAL(NULL, bmodbus_master_file_transfer_next(&modbus_master, &transfer));
+        client_response = bmodbus_client_get_response(&modbus_client);
+        TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100; // just wait a bit
+        bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+        TEST_ASSERT_EQUAL(MASTER_STATE_RESPONSE_READY, modbus_master.state);
+        bmodbus_client_send_complete(&modbus_client);
+    }
+    //Each frame carries up to 119 records (245 byte limit), the file boundary is crossed inside the first one
+    TEST_ASSERT_EQUAL(3, requests);
+    TEST_ASSERT_EQUAL(300, test_file_writes);
+    TEST_ASSERT_EQUAL(3, test_file_commits);
+    TEST_ASSERT_EQUAL(0xA000, test_file_store[test_file_slot(1, 9990)]);
+    TEST_ASSERT_EQUAL(0xA000 + 10, test_file_store[test_file_slot(2, 0)]);
+    TEST_ASSERT_EQUAL(0xA000 + 299, test_file_store[test_file_slot(2, 289)]);
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_file_transfer_next(&modbus_master, &transfer));
+}
+
+void test_master_file_transfer_exception(void){
+    uint32_t fake_time = 0;
+    uint16_t values[300];
+    uint8_t requests = 0;
+    modbus_file_transfer_t transfer;
+    modbus_file_record_t files = {test_file_read, test_file_write_protected, test_file_write_complete, NULL};
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_uart_data_t * client_response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_client_set_file_records(&modbus_client, &files);
+    for(int i=0;i<300;i++){
+        values[i] = 0xB000 + i;
+    }
+    //The first request writes to file 3, the exception stops the transfer instead of sending the same records again
+    bmodbus_master_file_transfer_init(&transfer, 2, 3, 9900, values, 300);
+    while(!bmodbus_master_file_transfer_done(&modbus_master, &transfer) && (requests < 10)){
+        sending_request = bmodbus_master_file_transfer_next(&modbus_master, &transfer);
+        TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+        requests++;
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+        bmodbus_client_received(&modbus_client, fake_time, sending_request->data, sending_request->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+        bmodbus_master_send_complete(&modbus_master, fake_time);
+        client_response = bmodbus_client_get_response(&modbus_client);
+        TEST_ASSERT_NOT_EQUAL(NULL, client_response);
+        fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+        bmodbus_master_received(&modbus_master, fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+        bmodbus_client_send_complete(&modbus_client);
+    }
+    TEST_ASSERT_EQUAL(1, requests);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, transfer.result);
+    TEST_ASSERT_EQUAL(300, transfer.remaining);
+    TEST_ASSERT_EQUAL(3, transfer.file);
+    TEST_ASSERT_EQUAL(9900, transfer.record);
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_file_transfer_next(&modbus_master, &transfer));
+
+    //Clearing the result retries from the first record that was not acknowledged
+    transfer.result = 0;
+    TEST_ASSERT_FALSE(bmodbus_master_file_transfer_done(&modbus_master, &transfer));
+    sending_request = bmodbus_master_file_transfer_next(&modbus_master, &transfer);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    TEST_ASSERT_EQUAL(3, (sending_request->data[4] << 8) | sending_request->data[5]); //File of the first sub-request
+}
+#endif //BMB_CLIENT_FILE_RECORD
+
+#ifdef BMB_STATISTICS
+//Sends a request from the master to the client and the response back, returns the master response
+static modbus_request_t * statistics_transaction(modbus_master_t * master, modbus_client_t * client, modbus_uart_request_t * request, uint32_t * fake_time){
+    modbus_uart_data_t * response;
+    *fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    bmodbus_client_received(client, *fake_time, request->data, request->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    bmodbus_master_send_complete(master, *fake_time);
+    response = bmodbus_client_get_response(client);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    *fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    bmodbus_master_received(master, *fake_time, response->data, response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    bmodbus_client_send_complete(client);
+    return bmodbus_master_get_response(master);
+}
+
+void test_statistics(void){
+    uint8_t read_1_register_at_slave_5[] = {0x05, 0x03, 0x00, 0x00, 0x00, 0x01, 0x85, 0x8e, };
+    uint8_t read_1_register_at_slave_2_bad_crc[] = {0x02, 0x03, 0x00, 0x00, 0x00, 0x01, 0x84, 0x3a, };
+    uint32_t fake_time = 0;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    modbus_uart_request_t * request;
+    modbus_request_t * client_request;
+    modbus_request_t * response;
+    const modbus_statistics_t * statistics = bmodbus_client_statistics(&modbus_client);
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+
+    //Frames for other clients and frames with a bad CRC are only counted
+    bmodbus_client_received(&modbus_client, fake_time, read_1_register_at_slave_5, sizeof(read_1_register_at_slave_5), BYTE_TIMING_IN_MICROSECONDS(38400));
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    bmodbus_client_received(&modbus_client, fake_time, read_1_register_at_slave_2_bad_crc, sizeof(read_1_register_at_slave_2_bad_crc), BYTE_TIMING_IN_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(2, statistics->frames);
+    TEST_ASSERT_EQUAL(1, statistics->frames_for_us);
+    TEST_ASSERT_EQUAL(1, statistics->crc_errors);
+    TEST_ASSERT_EQUAL(NULL, bmodbus_client_get_request(&modbus_client));
+
+    //A frame cut short by the interframe delay is a framing error
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    bmodbus_client_received(&modbus_client, fake_time, read_1_register_at_slave_2_bad_crc, 4, BYTE_TIMING_IN_MICROSECONDS(38400));
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    request = bmodbus_master_read_holding_registers(&modbus_master, 2, 0, 1);
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    bmodbus_client_received(&modbus_client, fake_time, request->data, request->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(1, statistics->framing_errors);
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    client_request = bmodbus_client_get_request(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_request);
+    client_request->data[0] = 0x1234;
+    fake_time += BYTE_TIMING_IN_MICROSECONDS(38400) * 100;
+    bmodbus_master_received(&modbus_master, fake_time, bmodbus_client_get_response(&modbus_client)->data, 7, BYTE_TIMING_IN_MICROSECONDS(38400));
+    bmodbus_client_send_complete(&modbus_client);
+    TEST_ASSERT_EQUAL(1, statistics->events);
+
+    //The client answers diagnostics from its counters
+    response = statistics_transaction(&modbus_master, &modbus_client, bmodbus_master_diagnostics(&modbus_master, 2, MODBUS_DIAGNOSTIC_BUS_MESSAGE_COUNT, 0), &fake_time);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(0, response->result);
+    TEST_ASSERT_EQUAL(MODBUS_DIAGNOSTIC_BUS_MESSAGE_COUNT, response->address);
+    TEST_ASSERT_EQUAL(1, response->size);
+    TEST_ASSERT_EQUAL(5, response->data[0]);
+    response = statistics_transaction(&modbus_master, &modbus_client, bmodbus_master_diagnostics(&modbus_master, 2, MODBUS_DIAGNOSTIC_BUS_ERROR_COUNT, 0), &fake_time);
+    TEST_ASSERT_EQUAL(1, response->data[0]);
+    response = statistics_transaction(&modbus_master, &modbus_client, bmodbus_master_diagnostics(&modbus_master, 2, MODBUS_DIAGNOSTIC_RETURN_QUERY_DATA, 0xa55a), &fake_time);
+    TEST_ASSERT_EQUAL(0xa55a, response->data[0]);
+    response = statistics_transaction(&modbus_master, &modbus_client, bmodbus_master_diagnostics(&modbus_master, 2, 0x01, 0), &fake_time);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_FUNCTION, response->result);
+    TEST_ASSERT_EQUAL(1, statistics->exceptions);
+    TEST_ASSERT_EQUAL(1, bmodbus_master_statistics(&modbus_master)->exceptions);
+    response = statistics_transaction(&modbus_master, &modbus_client, bmodbus_master_get_comm_event_counter(&modbus_master, 2), &fake_time);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(2, response->size);
+    TEST_ASSERT_EQUAL(0x0000, response->data[0]);
+    TEST_ASSERT_EQUAL(4, response->data[1]); //The read and three diagnostics, not the exception
+    response = statistics_transaction(&modbus_master, &modbus_client, bmodbus_master_diagnostics(&modbus_master, 2, MODBUS_DIAGNOSTIC_CLEAR_COUNTERS, 0), &fake_time);
+    TEST_ASSERT_EQUAL(0, response->result);
+    TEST_ASSERT_EQUAL(0, statistics->crc_errors);
+
+    //Diagnostics cannot be broadcast
+    TEST_ASSERT_EQUAL(NULL, bmodbus_master_diagnostics(&modbus_master, MODBUS_BROADCAST_ADDRESS, MODBUS_DIAGNOSTIC_CLEAR_COUNTERS, 0));
+
+    //Sending the same request again after giving up on it is a retry
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_master_read_holding_registers(&modbus_master, 2, 0, 1));
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    bmodbus_master_timeout(&modbus_master);
+    TEST_ASSERT_EQUAL(MASTER_STATE_IDLE, modbus_master.state);
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_master_read_holding_registers(&modbus_master, 2, 0, 1));
+    TEST_ASSERT_EQUAL(1, bmodbus_master_statistics(&modbus_master)->timeouts);
+    TEST_ASSERT_EQUAL(1, bmodbus_master_statistics(&modbus_master)->retries);
+    TEST_ASSERT_EQUAL(7, bmodbus_master_statistics(&modbus_master)->frames);
+    bmodbus_master_clear_statistics(&modbus_master);
+    TEST_ASSERT_EQUAL(0, bmodbus_master_statistics(&modbus_master)->frames);
+}
+#endif //BMB_STATISTICS
+
+#ifdef BMB_LATENCY
+static uint32_t test_latency_time;
+static uint32_t test_latency_clock(void){
+    return test_latency_time;
+}
+
+void test_latency(void){
+    uint32_t fake_time = 0;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    modbus_uart_request_t * request;
+    modbus_uart_data_t * response;
+    const modbus_latency_histogram_t * histogram;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_client_set_latency_clock(&modbus_client, test_latency_clock);
+
+    //Buckets are linear within each power of two
+    TEST_ASSERT_EQUAL(0, bmodbus_latency_bucket_microseconds(0));
+    TEST_ASSERT_EQUAL(3 << BMB_LATENCY_SHIFT, bmodbus_latency_bucket_microseconds(3));
+    TEST_ASSERT_EQUAL(4 << BMB_LATENCY_SHIFT, bmodbus_latency_bucket_microseconds(4));
+    TEST_ASSERT_EQUAL(8 << BMB_LATENCY_SHIFT, bmodbus_latency_bucket_microseconds(8));
+    TEST_ASSERT_EQUAL(10 << BMB_LATENCY_SHIFT, bmodbus_latency_bucket_microseconds(9));
+
+    request = bmodbus_master_read_holding_registers(&modbus_master, 2, 0, 1);
+    bmodbus_client_received(&modbus_client, fake_time, request->data, request->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    //The client is timed from the application getting the request to the response being sent
+    test_latency_time = 1000;
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_client_get_request(&modbus_client));
+    test_latency_time = 6000;
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_client_get_request(&modbus_client)); //Still timed from the first call
+    response = bmodbus_client_get_response(&modbus_client);
+    test_latency_time = 6000 + 5000;
+    bmodbus_client_send_complete(&modbus_client);
+    histogram = &(bmodbus_client_latency(&modbus_client)->function[3]);
+    TEST_ASSERT_EQUAL(8192, bmodbus_latency_percentile(histogram, 500)); //10ms is in the bucket starting at 8192us
+    TEST_ASSERT_EQUAL(0, bmodbus_latency_percentile(&(bmodbus_client_latency(&modbus_client)->function[4]), 500));
+
+    //The master is timed from the request being sent to the response being ready
+    fake_time += 20000;
+    bmodbus_master_received(&modbus_master, fake_time, response->data, response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(MASTER_STATE_RESPONSE_READY, modbus_master.state);
+    histogram = &(bmodbus_master_latency(&modbus_master)->function[3]);
+    TEST_ASSERT_EQUAL(16384, bmodbus_latency_percentile(histogram, 990));
+
+    //Anything too long goes in the last bucket
+    request = bmodbus_master_read_holding_registers(&modbus_master, 2, 0, 1);
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    fake_time += 4000000;
+    bmodbus_master_received(&modbus_master, fake_time, response->data, response->size, BYTE_TIMING_IN_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(1, histogram->count[BMB_LATENCY_BUCKETS - 1]);
+    TEST_ASSERT_EQUAL(16384, bmodbus_latency_percentile(histogram, 500));
+    TEST_ASSERT_EQUAL(bmodbus_latency_bucket_microseconds(BMB_LATENCY_BUCKETS - 1), bmodbus_latency_percentile(histogram, 1000));
+    bmodbus_master_clear_latency(&modbus_master);
+    TEST_ASSERT_EQUAL(0, bmodbus_latency_percentile(histogram, 1000));
+}
+#endif //BMB_LATENCY
+
+#ifdef BMB_BUS_PROFILE
+void test_bus_profile(void){
+    uint8_t read_1_register_at_slave_5[] = {0x05, 0x03, 0x00, 0x00, 0x00, 0x01, 0x85, 0x8e, };
+    uint32_t byte_time = BYTE_TIMING_IN_MICROSECONDS(38400), fake_time;
+    modbus_bus_profile_t bus, master_bus;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    modbus_uart_request_t * request;
+    modbus_uart_data_t * response;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_bus_profile_init(&bus, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_bus_profile_init(&master_bus, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_client_set_bus_profile(&modbus_client, &bus);
+    bmodbus_master_set_bus_profile(&modbus_master, &master_bus);
+    TEST_ASSERT_EQUAL(0, bmodbus_bus_utilization(&bus, byte_time));
+
+    //Two frames for another client, 5ms apart, the client sees every byte on the bus
+    fake_time = 7 * byte_time;
+    bmodbus_client_received(&modbus_client, fake_time, read_1_register_at_slave_5, 8, byte_time);
+    fake_time += 5000 + 7 * byte_time;
+    bmodbus_client_received(&modbus_client, fake_time, read_1_register_at_slave_5, 8, byte_time);
+    TEST_ASSERT_EQUAL(16, bus.bytes);
+    TEST_ASSERT_EQUAL(2, bus.frames);
+    TEST_ASSERT_EQUAL(5000, bus.longest_gap);
+    TEST_ASSERT_EQUAL(1, bus.gaps[1]); //5000us is between 2 and 4 interframe delays (1750us above 19200 baud)
+    TEST_ASSERT_EQUAL(16 * byte_time * 1000 / (fake_time + byte_time), bmodbus_bus_utilization(&bus, byte_time));
+
+    //The master measures the slave turnaround, from its request to the first byte back
+    request = bmodbus_master_read_holding_registers(&modbus_master, 2, 0, 1);
+    fake_time += 100000;
+    bmodbus_client_received(&modbus_client, fake_time, request->data, request->size, byte_time);
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_client_get_request(&modbus_client));
+    response = bmodbus_client_get_response(&modbus_client);
+    fake_time += 3000 + (response->size - 1) * byte_time;
+    bmodbus_master_received(&modbus_master, fake_time, response->data, response->size, byte_time);
+    TEST_ASSERT_EQUAL(MASTER_STATE_RESPONSE_READY, modbus_master.state);
+    TEST_ASSERT_EQUAL(1, master_bus.turnarounds);
+    TEST_ASSERT_EQUAL(3000, master_bus.turnaround_minimum);
+    TEST_ASSERT_EQUAL(3000, master_bus.turnaround_maximum);
+    TEST_ASSERT_EQUAL(2, master_bus.frames);
+    TEST_ASSERT_EQUAL(8 + 7, master_bus.bytes);
+    TEST_ASSERT_EQUAL(0, master_bus.gaps[0] + master_bus.gaps[1] + master_bus.gaps[2]); //The turnaround is not an interframe gap
+}
+#endif //BMB_BUS_PROFILE
+
+#ifdef BMB_MONITOR
+#define TEST_MONITOR_TRANSACTIONS 4
+static uint8_t test_monitor_count;
+static uint8_t test_monitor_address[TEST_MONITOR_TRANSACTIONS];
+static uint8_t test_monitor_function[TEST_MONITOR_TRANSACTIONS];
+static uint8_t test_monitor_answered[TEST_MONITOR_TRANSACTIONS];
+static uint16_t test_monitor_value[TEST_MONITOR_TRANSACTIONS];
+
+static void test_monitor_callback(void * context, const modbus_transaction_t * transaction){
+    (void)context;
+    if(test_monitor_count < TEST_MONITOR_TRANSACTIONS){
+        test_monitor_address[test_monitor_count] = transaction->client_address;
+        test_monitor_function[test_monitor_count] = transaction->request->function;
+        test_monitor_answered[test_monitor_count] = (transaction->response != NULL);
+        test_monitor_value[test_monitor_count] = (transaction->response != NULL) ? transaction->response->data[0] : transaction->request->data[0];
+    }
+    test_monitor_count++;
+}
+
+void test_monitor(void){
+    uint32_t byte_time = BYTE_TIMING_IN_MICROSECONDS(38400), fake_time = 0;
+    modbus_monitor_t monitor;
+    modbus_master_t modbus_master;
+    modbus_client_t modbus_client;
+    modbus_uart_request_t * request;
+    modbus_request_t * client_request;
+    modbus_uart_data_t * response;
+    bmodbus_monitor_init(&monitor, INTERFRAME_DELAY_MICROSECONDS(38400), 100000, test_monitor_callback, NULL);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 7);
+    test_monitor_count = 0;
+
+    //A read and its response are paired
+    request = bmodbus_master_read_holding_registers(&modbus_master, 7, 0x10, 1);
+    fake_time += 10000;
+    bmodbus_monitor_received(&monitor, fake_time, request->data, request->size, byte_time);
+    bmodbus_client_received(&modbus_client, fake_time, request->data, request->size, byte_time);
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    client_request = bmodbus_client_get_request(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_request);
+    client_request->data[0] = 0xbeef;
+    response = bmodbus_client_get_response(&modbus_client);
+    fake_time += 5000;
+    bmodbus_monitor_received(&monitor, fake_time, response->data, response->size, byte_time);
+    bmodbus_client_send_complete(&modbus_client);
+    TEST_ASSERT_EQUAL(1, test_monitor_count);
+    TEST_ASSERT_EQUAL(7, test_monitor_address[0]);
+    TEST_ASSERT_EQUAL(3, test_monitor_function[0]);
+    TEST_ASSERT_EQUAL(1, test_monitor_answered[0]);
+    TEST_ASSERT_EQUAL(0xbeef, test_monitor_value[0]);
+
+    //A write to a client that is not there, the next request shows it was not answered
+    modbus_master.state = MASTER_STATE_IDLE;
+    request = bmodbus_master_write_single_register(&modbus_master, 9, 0x20, 0x1234);
+    fake_time += 10000;
+    bmodbus_monitor_received(&monitor, fake_time, request->data, request->size, byte_time);
+    TEST_ASSERT_EQUAL(1, test_monitor_count);
+    //The master gives up quickly and sends a broadcast, the frame is not a response so it is the next request
+    modbus_master.state = MASTER_STATE_IDLE;
+    request = bmodbus_master_write_single_register(&modbus_master, MODBUS_BROADCAST_ADDRESS, 0x20, 0x5678);
+    fake_time += 10000;
+    bmodbus_monitor_received(&monitor, fake_time, request->data, request->size, byte_time);
+    TEST_ASSERT_EQUAL(3, test_monitor_count);
+    TEST_ASSERT_EQUAL(9, test_monitor_address[1]);
+    TEST_ASSERT_EQUAL(6, test_monitor_function[1]);
+    TEST_ASSERT_EQUAL(0, test_monitor_answered[1]);
+    TEST_ASSERT_EQUAL(0x1234, test_monitor_value[1]);
+    TEST_ASSERT_EQUAL(MODBUS_BROADCAST_ADDRESS, test_monitor_address[2]);
+    TEST_ASSERT_EQUAL(0, test_monitor_answered[2]);
+    TEST_ASSERT_EQUAL(0x5678, test_monitor_value[2]);
+
+    //A request that is never answered is reported once the timeout has passed
+    modbus_master.state = MASTER_STATE_IDLE;
+    request = bmodbus_master_read_input_registers(&modbus_master, 11, 0, 2);
+    fake_time += 10000;
+    bmodbus_monitor_received(&monitor, fake_time, request->data, request->size, byte_time);
+    modbus_master.state = MASTER_STATE_IDLE;
+    request = bmodbus_master_read_input_registers(&modbus_master, 12, 0, 2);
+    fake_time += 200000;
+    bmodbus_monitor_received(&monitor, fake_time, request->data, request->size, byte_time);
+    TEST_ASSERT_EQUAL(4, test_monitor_count);
+    TEST_ASSERT_EQUAL(11, test_monitor_address[3]);
+    TEST_ASSERT_EQUAL(4, test_monitor_function[3]);
+    TEST_ASSERT_EQUAL(0, test_monitor_answered[3]);
+    TEST_ASSERT_EQUAL(MASTER_STATE_WAITING_FOR_RESPONSE, monitor.responses.state); //Waiting for client 12
+}
+#endif //BMB_MONITOR
+
+#ifdef BMB_CAPTURE
+static uint8_t test_capture_buffer[128];
+static uint16_t test_capture_length;
+
+static void test_capture_write(void * context, const uint8_t * data, uint16_t length){
+    (void)context;
+    while(length-- && test_capture_length < sizeof(test_capture_buffer)){
+        test_capture_buffer[test_capture_length++] = *data++;
+    }
+}
+
+void test_capture(void){
+    uint32_t byte_time = BYTE_TIMING_IN_MICROSECONDS(38400);
+    modbus_capture_t capture;
+    modbus_master_t modbus_master;
+    modbus_client_t modbus_client;
+    modbus_uart_request_t * request;
+    modbus_request_t * client_request;
+    modbus_uart_data_t * response;
+    uint8_t * record, * frame;
+    test_capture_length = 0;
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 7);
+    bmodbus_capture_init(&capture, test_capture_write, NULL);
+    bmodbus_client_set_capture(&modbus_client, &capture);
+    bmodbus_master_set_capture(&modbus_master, &capture);
+    TEST_ASSERT_EQUAL(5, test_capture_length);
+    TEST_ASSERT_EQUAL_MEMORY("BMBC", test_capture_buffer, 4);
+    TEST_ASSERT_EQUAL(BMB_CAPTURE_VERSION, test_capture_buffer[4]);
+
+    //A burst of bytes is one record with the byte time, the client still sees the request
+    request = bmodbus_master_read_holding_registers(&modbus_master, 7, 0x10, 1);
+    bmodbus_client_received(&modbus_client, 10000, request->data, request->size, byte_time);
+    client_request = bmodbus_client_get_request(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, client_request);
+    TEST_ASSERT_EQUAL(0x10, client_request->address);
+    record = test_capture_buffer + 5;
+    TEST_ASSERT_EQUAL(0x90, record[0]); //10000 as a varint
+    TEST_ASSERT_EQUAL(0x4e, record[1]);
+    TEST_ASSERT_EQUAL(BMB_CAPTURE_CLIENT, record[2]);
+    TEST_ASSERT_EQUAL(8, record[3]);
+    TEST_ASSERT_EQUAL(0x84, record[4]); //260
+    TEST_ASSERT_EQUAL(0x02, record[5]);
+    TEST_ASSERT_EQUAL_MEMORY(request->data, record + 6, 8);
+    frame = record + 6;
+
+    //The request sent by the master carries the expected response length
+    bmodbus_master_send_complete(&modbus_master, 10000);
+    record += 14;
+    TEST_ASSERT_EQUAL(0, record[0]);
+    TEST_ASSERT_EQUAL(BMB_CAPTURE_MASTER_SENT, record[1]);
+    TEST_ASSERT_EQUAL(8, record[2]);
+    TEST_ASSERT_EQUAL(7, record[3]);
+    TEST_ASSERT_EQUAL_MEMORY(request->data, record + 4, 8);
+
+    //Single bytes have no byte time
+    client_request->data[0] = 0x1234;
+    response = bmodbus_client_get_response(&modbus_client);
+    bmodbus_master_next_byte(&modbus_master, 12000, response->data[0]);
+    record += 12;
+    TEST_ASSERT_EQUAL(0xd0, record[0]); //2000
+    TEST_ASSERT_EQUAL(0x0f, record[1]);
+    TEST_ASSERT_EQUAL(BMB_CAPTURE_MASTER, record[2]);
+    TEST_ASSERT_EQUAL(1, record[3]);
+    TEST_ASSERT_EQUAL(response->data[0], record[4]);
+    record += 5;
+
+    //Packets are flagged, the rest of the response completes the read
+    bmodbus_master_set_capture(&modbus_master, NULL);
+    bmodbus_master_received(&modbus_master, 12000 + (response->size - 1) * byte_time, response->data + 1, response->size - 1, byte_time);
+    TEST_ASSERT_EQUAL(record - test_capture_buffer, test_capture_length);
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_master_get_response(&modbus_master));
+    bmodbus_client_send_complete(&modbus_client);
+    bmodbus_client_received_packet(&modbus_client, 20000, frame, 8); //The master payload holds the response now
+    TEST_ASSERT_EQUAL(BMB_CAPTURE_CLIENT | BMB_CAPTURE_PACKET, record[2]);
+    TEST_ASSERT_EQUAL(8, record[3]);
+    TEST_ASSERT_EQUAL(record + 12 - test_capture_buffer, test_capture_length);
+}
+#endif //BMB_CAPTURE
+
+#ifdef BMB_MASTER_CALLBACK
+static uint8_t test_callback_count;
+static int8_t test_callback_result;
+static uint16_t test_callback_value;
+
+static void test_master_callback_function(void * context, modbus_request_t * response){
+    modbus_master_t * master = (modbus_master_t *)context;
+    test_callback_count++;
+    test_callback_result = (response != NULL) ? response->result : -1;
+    test_callback_value = (response != NULL) ? response->data[0] : 0;
+    if((response != NULL) && (response->function == 3)){ //The next request is built straight from the callback
+        TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_master_write_single_register(master, 7, 0x10, test_callback_value + 1));
+    }
+}
+
+void test_master_callback(void){
+    uint32_t byte_time = BYTE_TIMING_IN_MICROSECONDS(38400), fake_time = 10000;
+    modbus_master_t modbus_master;
+    modbus_client_t modbus_client;
+    modbus_uart_request_t * request;
+    modbus_request_t * client_request;
+    modbus_uart_data_t * response;
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 7);
+    bmodbus_master_set_callback(&modbus_master, test_master_callback_function, &modbus_master);
+    test_callback_count = 0;
+
+    //A response calls back with the values read
+    request = bmodbus_master_read_holding_registers(&modbus_master, 7, 0x10, 1);
+    bmodbus_client_received(&modbus_client, fake_time, request->data, request->size, byte_time);
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    client_request = bmodbus_client_get_request(&modbus_client);
+    client_request->data[0] = 0x4321;
+    response = bmodbus_client_get_response(&modbus_client);
+    fake_time += 5000;
+    bmodbus_master_received(&modbus_master, fake_time, response->data, response->size, byte_time);
+    bmodbus_client_send_complete(&modbus_client);
+    TEST_ASSERT_EQUAL(1, test_callback_count);
+    TEST_ASSERT_EQUAL(0, test_callback_result);
+    TEST_ASSERT_EQUAL(0x4321, test_callback_value);
+    TEST_ASSERT_EQUAL(MASTER_STATE_SENDING_REQUEST, modbus_master.state);
+
+    //The write built by the callback is not answered, giving up on it calls back once
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    bmodbus_master_timeout(&modbus_master);
+    bmodbus_master_timeout(&modbus_master);
+    TEST_ASSERT_EQUAL(2, test_callback_count);
+    TEST_ASSERT_EQUAL(-1, test_callback_result);
+
+    //A corrupted response is given up as well
+    request = bmodbus_master_read_input_registers(&modbus_master, 7, 0, 1);
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    {
+        uint8_t corrupted[] = {0x07, 0x04, 0x02, 0x12, 0x34, 0x00, 0x00};
+        fake_time += 5000;
+        bmodbus_master_received(&modbus_master, fake_time, corrupted, sizeof(corrupted), byte_time);
+    }
+    TEST_ASSERT_EQUAL(3, test_callback_count);
+    TEST_ASSERT_EQUAL(-1, test_callback_result);
+
+    //Broadcasts call back once the turnaround delay has passed
+    request = bmodbus_master_write_single_register(&modbus_master, MODBUS_BROADCAST_ADDRESS, 0x10, 1);
+    TEST_ASSERT_NOT_EQUAL(NULL, request);
+    bmodbus_master_send_complete(&modbus_master, fake_time);
+    bmodbus_master_loop(&modbus_master, fake_time + 1000);
+    TEST_ASSERT_EQUAL(3, test_callback_count);
+    bmodbus_master_loop(&modbus_master, fake_time + BMB_TURNAROUND_DELAY_MICROSECONDS);
+    TEST_ASSERT_EQUAL(4, test_callback_count);
+    TEST_ASSERT_EQUAL(0, test_callback_result);
+}
+#endif //BMB_MASTER_CALLBACK
+
+#if defined(BMB_MASTER_POOL) && defined(BMB_CLIENT_REGISTER_BANK)
+static uint8_t test_pool_frame[2][BMB_MAXIMUM_MESSAGE_SIZE];
+static uint8_t test_pool_size[2];
+static uint8_t test_pool_sends;
+
+static void test_pool_send(void * context, uint8_t bus, const uint8_t * data, uint8_t size){
+    (void)context;
+    memcpy(test_pool_frame[bus], data, size);
+    test_pool_size[bus] = size;
+    test_pool_sends++;
+}
+
+//Gives the frame sent on a bus to its client and the response back to the master of the bus, requests outside the bank get an exception
+static void test_pool_serve(modbus_pool_t * pool, modbus_client_t * client, uint8_t bus, uint32_t * fake_time){
+    uint32_t byte_time = BYTE_TIMING_IN_MICROSECONDS(38400);
+    modbus_request_t * request;
+    modbus_uart_data_t * response;
+    *fake_time += test_pool_size[bus] * byte_time;
+    bmodbus_pool_send_complete(pool, bus, *fake_time);
+    bmodbus_client_received(client, *fake_time, test_pool_frame[bus], test_pool_size[bus], byte_time);
+    request = bmodbus_client_get_request(client);
+    if(request != NULL){
+        request->result = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    }
+    response = bmodbus_client_get_response(client);
+    if(response != NULL){
+        *fake_time += 1000 + response->size * byte_time;
+        bmodbus_master_received(bmodbus_pool_master(pool, bus), *fake_time, response->data, response->size, byte_time);
+        bmodbus_client_send_complete(client);
+    }
+}
+
+void test_master_pool(void){
+    uint32_t fake_time = 10000;
+    uint16_t bank[2][8] = {{0x1000, 0x1001, 0x1002, 0x1003}, {0x2000, 0x2001}};
+    uint16_t first[3], second[2], values[2] = {0xaaaa, 0xbbbb}, lost[1];
+    int cookies[5];
+    modbus_pool_t pool;
+    modbus_pool_bus_t buses[2];
+    modbus_pool_entry_t entries[4];
+    modbus_pool_entry_t completion;
+    modbus_client_t clients[2];
+    bmodbus_client_init(&clients[0], INTERFRAME_DELAY_MICROSECONDS(38400), 5);
+    bmodbus_client_set_holding_registers(&clients[0], bank[0], 0, 8);
+    bmodbus_client_init(&clients[1], INTERFRAME_DELAY_MICROSECONDS(38400), 6);
+    bmodbus_client_set_holding_registers(&clients[1], bank[1], 0, 8);
+    bmodbus_pool_init(&pool, buses, 2, entries, 4, INTERFRAME_DELAY_MICROSECONDS(38400), 50000, test_pool_send, NULL);
+    test_pool_sends = 0;
+
+    //Two requests for bus 0, two for bus 1 and the table is full
+    TEST_ASSERT_EQUAL(0, bmodbus_pool_submit(&pool, 0, 5, 3, 0, 3, first, &cookies[0]));
+    TEST_ASSERT_EQUAL(0, bmodbus_pool_submit(&pool, 1, 6, 16, 2, 2, values, &cookies[1]));
+    TEST_ASSERT_EQUAL(0, bmodbus_pool_submit(&pool, 0, 5, 3, 1, 2, second, &cookies[2]));
+    TEST_ASSERT_EQUAL(0, bmodbus_pool_submit(&pool, 1, 9, 3, 0, 1, lost, &cookies[3]));
+    TEST_ASSERT_EQUAL(-1, bmodbus_pool_submit(&pool, 0, 5, 3, 0, 1, lost, &cookies[4]));
+    TEST_ASSERT_EQUAL(-1, bmodbus_pool_submit(&pool, 2, 5, 3, 0, 1, lost, &cookies[4]));
+
+    //Only the first request of each bus goes out
+    bmodbus_pool_loop(&pool, fake_time);
+    TEST_ASSERT_EQUAL(2, test_pool_sends);
+    TEST_ASSERT_EQUAL(0, bmodbus_pool_completion(&pool, &completion));
+    test_pool_serve(&pool, &clients[1], 1, &fake_time);
+    test_pool_serve(&pool, &clients[0], 0, &fake_time);
+    bmodbus_pool_loop(&pool, fake_time);
+    TEST_ASSERT_EQUAL(3, test_pool_sends); //Bus 0 only just received its response, it has to stay quiet for a while
+    TEST_ASSERT_EQUAL(1, bmodbus_pool_completion(&pool, &completion));
+    TEST_ASSERT_EQUAL_PTR(&cookies[0], completion.cookie);
+    TEST_ASSERT_EQUAL(0, completion.result);
+    TEST_ASSERT_EQUAL(3, completion.size);
+    TEST_ASSERT_EQUAL(0x1000, first[0]);
+    TEST_ASSERT_EQUAL(0x1002, first[2]);
+    TEST_ASSERT_EQUAL(1, bmodbus_pool_completion(&pool, &completion));
+    TEST_ASSERT_EQUAL_PTR(&cookies[1], completion.cookie);
+    TEST_ASSERT_EQUAL(0, completion.result);
+    TEST_ASSERT_EQUAL(0xaaaa, bank[1][2]);
+    TEST_ASSERT_EQUAL(0xbbbb, bank[1][3]);
+    TEST_ASSERT_EQUAL(0, bmodbus_pool_completion(&pool, &completion));
+
+    //The next requests follow the interframe delay, the one to a client that is not there times out
+    fake_time += INTERFRAME_DELAY_MICROSECONDS(38400);
+    bmodbus_pool_loop(&pool, fake_time);
+    TEST_ASSERT_EQUAL(4, test_pool_sends);
+    test_pool_serve(&pool, &clients[0], 0, &fake_time);
+    test_pool_serve(&pool, &clients[1], 1, &fake_time);
+    bmodbus_pool_loop(&pool, fake_time);
+    TEST_ASSERT_EQUAL(1, bmodbus_pool_completion(&pool, &completion));
+    TEST_ASSERT_EQUAL_PTR(&cookies[2], completion.cookie);
+    TEST_ASSERT_EQUAL(0x1001, second[0]);
+    TEST_ASSERT_EQUAL(0x1002, second[1]);
+    TEST_ASSERT_EQUAL(0, bmodbus_pool_completion(&pool, &completion));
+    fake_time += 50000;
+    bmodbus_pool_loop(&pool, fake_time);
+    TEST_ASSERT_EQUAL(1, bmodbus_pool_completion(&pool, &completion));
+    TEST_ASSERT_EQUAL_PTR(&cookies[3], completion.cookie);
+    TEST_ASSERT_EQUAL(BMB_POOL_TIMEOUT, completion.result);
+    TEST_ASSERT_EQUAL(1, completion.bus);
+
+    //Unsupported functions and writes without their values are not queued
+    TEST_ASSERT_EQUAL(-1, bmodbus_pool_submit(&pool, 1, 6, 0x2B, 0, 1, lost, &cookies[1]));
+    TEST_ASSERT_EQUAL(-1, bmodbus_pool_submit(&pool, 1, 6, 0x17, 0, 1, lost, &cookies[1]));
+    TEST_ASSERT_EQUAL(-1, bmodbus_pool_submit(&pool, 1, 6, 0x16, 0, 0, NULL, &cookies[1]));
+    TEST_ASSERT_EQUAL(-1, bmodbus_pool_submit(&pool, 1, 6, 16, 0, 2, NULL, &cookies[1]));
+    TEST_ASSERT_EQUAL(-1, bmodbus_pool_submit(&pool, 1, 6, 3, 0, 2, NULL, &cookies[1]));
+
+    //Exceptions are passed on, requests that cannot be built complete without being sent
+    TEST_ASSERT_EQUAL(0, bmodbus_pool_submit(&pool, 0, 5, 3, 0x100, 1, lost, &cookies[0]));
+    TEST_ASSERT_EQUAL(0, bmodbus_pool_submit(&pool, 1, 6, 3, 0, 200, lost, &cookies[2]));
+    bmodbus_pool_loop(&pool, fake_time);
+    TEST_ASSERT_EQUAL(5, test_pool_sends);
+    TEST_ASSERT_EQUAL(1, bmodbus_pool_completion(&pool, &completion));
+    TEST_ASSERT_EQUAL_PTR(&cookies[2], completion.cookie);
+    TEST_ASSERT_EQUAL(BMB_POOL_REFUSED, completion.result);
+    test_pool_serve(&pool, &clients[0], 0, &fake_time);
+    bmodbus_pool_loop(&pool, fake_time);
+    TEST_ASSERT_EQUAL(1, bmodbus_pool_completion(&pool, &completion));
+    TEST_ASSERT_EQUAL_PTR(&cookies[0], completion.cookie);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, completion.result);
+
+    //A corrupted response fails the transaction straight away
+    TEST_ASSERT_EQUAL(0, bmodbus_pool_submit(&pool, 0, 5, 3, 0, 1, lost, &cookies[3]));
+    fake_time += INTERFRAME_DELAY_MICROSECONDS(38400);
+    bmodbus_pool_loop(&pool, fake_time);
+    TEST_ASSERT_EQUAL(6, test_pool_sends);
+    test_pool_frame[0][2] ^= 1; //The client sees a bad CRC and says nothing
+    test_pool_serve(&pool, &clients[0], 0, &fake_time);
+    bmodbus_master_received(bmodbus_pool_master(&pool, 0), fake_time + 2000, test_pool_frame[0], test_pool_size[0], BYTE_TIMING_IN_MICROSECONDS(38400));
+    bmodbus_pool_loop(&pool, fake_time + 2000);
+    TEST_ASSERT_EQUAL(1, bmodbus_pool_completion(&pool, &completion));
+    TEST_ASSERT_EQUAL_PTR(&cookies[3], completion.cookie);
+    TEST_ASSERT_EQUAL(BMB_POOL_BAD_RESPONSE, completion.result);
+    TEST_ASSERT_EQUAL(0, bmodbus_pool_completion(&pool, &completion));
+#ifdef BMB_CLIENT_FIFO_QUEUE
+
+    //A FIFO queue longer than the room given only fills that room
+    uint16_t storage[4], queued[3] = {0, 0, 0x5a5a};
+    modbus_fifo_t fifo;
+    bmodbus_fifo_init(&fifo, storage, 4);
+    bmodbus_client_set_fifo(&clients[0], 0x04de, &fifo);
+    bmodbus_fifo_push(&fifo, 0x0101);
+    bmodbus_fifo_push(&fifo, 0x0202);
+    bmodbus_fifo_push(&fifo, 0x0303);
+    TEST_ASSERT_EQUAL(0, bmodbus_pool_submit(&pool, 0, 5, 0x18, 0x04de, 2, queued, &cookies[0]));
+    fake_time += INTERFRAME_DELAY_MICROSECONDS(38400) + 2000;
+    bmodbus_pool_loop(&pool, fake_time);
+    test_pool_serve(&pool, &clients[0], 0, &fake_time);
+    bmodbus_pool_loop(&pool, fake_time);
+    TEST_ASSERT_EQUAL(1, bmodbus_pool_completion(&pool, &completion));
+    TEST_ASSERT_EQUAL_PTR(&cookies[0], completion.cookie);
+    TEST_ASSERT_EQUAL(0, completion.result);
+    TEST_ASSERT_EQUAL(2, completion.size);
+    TEST_ASSERT_EQUAL(0x0101, queued[0]);
+    TEST_ASSERT_EQUAL(0x0202, queued[1]);
+    TEST_ASSERT_EQUAL(0x5a5a, queued[2]);
+#endif //BMB_CLIENT_FIFO_QUEUE
+}
+#endif //BMB_MASTER_POOL && BMB_CLIENT_REGISTER_BANK
+
 #ifndef FAKE_MAIN
 int main(void) {
 #else
@@ -614,6 +2234,8 @@ int unit_test_main(void){
     RUN_TEST(test_read_coil);
     RUN_TEST(test_write_coils);
     RUN_TEST(test_write_coil);
+    RUN_TEST(test_client_unsupported_function);
+    RUN_TEST(test_client_exception_responses);
 #endif //TEST_SKIP_CLIENT_ONLY_TESTS
     RUN_TEST(test_master_write_register);
     RUN_TEST(test_master_write_registers);
@@ -623,6 +2245,54 @@ int unit_test_main(void){
     RUN_TEST(test_master_read_input_registers);
 
     RUN_TEST(test_master_write_single_coil);
+    RUN_TEST(test_master_write_coils);
+    RUN_TEST(test_master_exception_response);
+    RUN_TEST(test_master_broadcast);
+    RUN_TEST(test_master_request_limits);
+    RUN_TEST(test_packet_framing);
+#ifdef BMB_SCATTER_GATHER
+    RUN_TEST(test_scatter_gather);
+#endif //BMB_SCATTER_GATHER
+#if defined(BMB_CLIENT_ASCII) && defined(BMB_MASTER_ASCII)
+    RUN_TEST(test_ascii_framing);
+#endif //BMB_CLIENT_ASCII && BMB_MASTER_ASCII
+#ifdef BMB_CLIENT_READ_WRITE_FUNCTION
+    RUN_TEST(test_master_read_write_registers);
+#endif //BMB_CLIENT_READ_WRITE_FUNCTION
+    RUN_TEST(test_master_mask_write_register);
+#ifdef BMB_CLIENT_REGISTER_BANK
+    RUN_TEST(test_client_register_bank);
+#endif //BMB_CLIENT_REGISTER_BANK
+#ifdef BMB_CLIENT_FIFO_QUEUE
+    RUN_TEST(test_master_read_fifo_queue);
+#endif //BMB_CLIENT_FIFO_QUEUE
+#ifdef BMB_CLIENT_FILE_RECORD
+    RUN_TEST(test_master_file_record);
+    RUN_TEST(test_client_file_record_limits);
+    RUN_TEST(test_master_file_transfer);
+    RUN_TEST(test_master_file_transfer_exception);
+#endif //BMB_CLIENT_FILE_RECORD
+#ifdef BMB_STATISTICS
+    RUN_TEST(test_statistics);
+#endif //BMB_STATISTICS
+#ifdef BMB_LATENCY
+    RUN_TEST(test_latency);
+#endif //BMB_LATENCY
+#ifdef BMB_BUS_PROFILE
+    RUN_TEST(test_bus_profile);
+#endif //BMB_BUS_PROFILE
+#ifdef BMB_MONITOR
+    RUN_TEST(test_monitor);
+#endif //BMB_MONITOR
+#ifdef BMB_CAPTURE
+    RUN_TEST(test_capture);
+#endif //BMB_CAPTURE
+#ifdef BMB_MASTER_CALLBACK
+    RUN_TEST(test_master_callback);
+#endif //BMB_MASTER_CALLBACK
+#if defined(BMB_MASTER_POOL) && defined(BMB_CLIENT_REGISTER_BANK)
+    RUN_TEST(test_master_pool);
+#endif //BMB_MASTER_POOL && BMB_CLIENT_REGISTER_BANK
     return UNITY_END();
 }
 
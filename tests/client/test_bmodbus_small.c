@@ -0,0 +1,237 @@
+//
+// Tests at the default message size (32 bytes), where valid requests and responses can be larger than the buffer
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bmodbus.h"
+#include "unity.h"
+
+void setUp(void) {
+    // Set up code before each test
+}
+
+void tearDown(void) {
+    // Clean up code after each test
+}
+
+//Gives a request built by the master to the client, returns the client's response (or NULL)
+static modbus_uart_data_t * small_exchange(modbus_client_t * client, modbus_master_t * master, modbus_uart_request_t * request, uint32_t * fake_time){
+    modbus_uart_data_t * client_response;
+    *fake_time += BYTE_TIMING_IN_MICROSECONDS(9600) * 100;
+    bmodbus_client_received(client, *fake_time, request->data, request->size, BYTE_TIMING_IN_MICROSECONDS(9600));
+    bmodbus_master_send_complete(master, *fake_time);
+    client_response = bmodbus_client_get_response(client);
+    if(client_response != NULL){
+        *fake_time += BYTE_TIMING_IN_MICROSECONDS(9600) * 100;
+        bmodbus_master_received(master, *fake_time, client_response->data, client_response->size, BYTE_TIMING_IN_MICROSECONDS(9600));
+        bmodbus_client_send_complete(client);
+    }
+    return client_response;
+}
+
+#if defined(BMB_CLIENT_ASCII) && defined(BMB_MASTER_ASCII) && defined(BMB_CLIENT_FIFO_QUEUE)
+void test_ascii_fifo_queue(void){
+    uint32_t fake_time = 0;
+    uint16_t storage[16];
+    uint16_t i;
+    modbus_fifo_t fifo;
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_request_t * response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_client, ASCII_CHARACTER_TIMEOUT_MICROSECONDS, 2);
+    bmodbus_master_init(&modbus_master, ASCII_CHARACTER_TIMEOUT_MICROSECONDS);
+    bmodbus_client_set_ascii(&modbus_client, 1);
+    bmodbus_master_set_ascii(&modbus_master, 1);
+    bmodbus_fifo_init(&fifo, storage, 16);
+    bmodbus_client_set_fifo(&modbus_client, 0x04de, &fifo);
+    for(i = 0; i < 12; i++){
+        TEST_ASSERT_EQUAL(0, bmodbus_fifo_push(&fifo, 0x1000 + i));
+    }
+
+    //Twelve values fit an RTU response but not its ASCII encoding, the ones that do not fit stay queued
+    for(i = 0; i < 12; i += 3){
+        sending_request = bmodbus_master_read_fifo_queue(&modbus_master, 2, 0x04de);
+        TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+        TEST_ASSERT_NOT_EQUAL(NULL, small_exchange(&modbus_client, &modbus_master, sending_request, &fake_time));
+        response = bmodbus_master_get_response(&modbus_master);
+        TEST_ASSERT_NOT_EQUAL(NULL, response);
+        TEST_ASSERT_EQUAL(0, response->result);
+        TEST_ASSERT_EQUAL(3, response->size);
+        TEST_ASSERT_EQUAL_HEX16(0x1000 + i, response->data[0]);
+        TEST_ASSERT_EQUAL_HEX16(0x1002 + i, response->data[2]);
+    }
+    TEST_ASSERT_EQUAL(fifo.head, fifo.tail);
+}
+#endif //BMB_CLIENT_ASCII && BMB_MASTER_ASCII && BMB_CLIENT_FIFO_QUEUE
+
+#if defined(BMB_CLIENT_ASCII) && defined(BMB_MASTER_ASCII) && defined(BMB_CLIENT_REGISTER_BANK) && defined(BMB_CLIENT_READ_WRITE_FUNCTION)
+void test_ascii_register_bank(void){
+    uint32_t fake_time = 0;
+    uint16_t bank[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    uint16_t value = 0x5555;
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_request_t * response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    bmodbus_client_init(&modbus_client, ASCII_CHARACTER_TIMEOUT_MICROSECONDS, 2);
+    bmodbus_master_init(&modbus_master, ASCII_CHARACTER_TIMEOUT_MICROSECONDS);
+    bmodbus_client_set_ascii(&modbus_client, 1);
+    bmodbus_master_set_ascii(&modbus_master, 1);
+    bmodbus_client_set_holding_registers(&modbus_client, bank, 0, 8);
+
+    //Reading six registers back would not fit in ASCII, so the write is refused before it reaches the bank
+    sending_request = bmodbus_master_read_write_multiple_registers(&modbus_master, 2, 0, 6, 7, 1, &value);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    TEST_ASSERT_NOT_EQUAL(NULL, small_exchange(&modbus_client, &modbus_master, sending_request, &fake_time));
+    response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, response->result);
+    TEST_ASSERT_EQUAL(7, bank[7]);
+
+    //Three registers fit, the write is applied and the registers read come back
+    sending_request = bmodbus_master_read_write_multiple_registers(&modbus_master, 2, 5, 3, 7, 1, &value);
+    TEST_ASSERT_NOT_EQUAL(NULL, sending_request);
+    TEST_ASSERT_NOT_EQUAL(NULL, small_exchange(&modbus_client, &modbus_master, sending_request, &fake_time));
+    response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(0, response->result);
+    TEST_ASSERT_EQUAL(3, response->size);
+    TEST_ASSERT_EQUAL_HEX16(5, response->data[0]);
+    TEST_ASSERT_EQUAL_HEX16(0x5555, response->data[2]);
+    TEST_ASSERT_EQUAL_HEX16(0x5555, bank[7]);
+}
+#endif //BMB_CLIENT_ASCII && BMB_MASTER_ASCII && BMB_CLIENT_REGISTER_BANK && BMB_CLIENT_READ_WRITE_FUNCTION
+
+#ifdef BMB_MONITOR
+static uint16_t test_monitor_count;
+static uint8_t test_monitor_function;
+static uint8_t test_monitor_answered;
+static uint8_t test_monitor_request_too_large;
+static uint8_t test_monitor_response_too_large;
+static int8_t test_monitor_result;
+static uint16_t test_monitor_size;
+static uint16_t test_monitor_value;
+
+static void test_monitor_callback(void * context, const modbus_transaction_t * transaction){
+    (void)context;
+    test_monitor_count++;
+    test_monitor_function = transaction->request->function;
+    test_monitor_result = transaction->request->result;
+    test_monitor_size = transaction->request->size;
+    test_monitor_answered = (transaction->response != NULL);
+    test_monitor_value = (transaction->response != NULL) ? transaction->response->data[0] : transaction->request->data[0];
+    test_monitor_request_too_large = transaction->request_too_large;
+    test_monitor_response_too_large = transaction->response_too_large;
+}
+
+//Appends the CRC to a frame and gives it to the monitor after a gap, returns the length with the CRC
+static uint16_t test_monitor_frame(modbus_monitor_t * monitor, uint32_t * fake_time, uint8_t * frame, uint16_t length){
+    uint16_t crc = bmodbus_crc(frame, length);
+    frame[length] = crc & 0xFF;
+    frame[length + 1] = (crc & 0xFF00) >> 8;
+    *fake_time += 10000 + (length + 2) * BYTE_TIMING_IN_MICROSECONDS(38400); //The time is the one of the last byte
+    bmodbus_monitor_received(monitor, *fake_time, frame, length + 2, BYTE_TIMING_IN_MICROSECONDS(38400));
+    return length + 2;
+}
+
+void test_monitor_oversized(void){
+    uint32_t fake_time = 0;
+    uint8_t frame[80];
+    uint16_t i, length;
+    modbus_monitor_t monitor;
+    bmodbus_monitor_init(&monitor, INTERFRAME_DELAY_MICROSECONDS(38400), 100000, test_monitor_callback, NULL);
+    test_monitor_count = 0;
+
+    //Reading 20 registers is valid, its 45 byte response is checked and skipped instead of being taken as unanswered
+    memcpy(frame, "\x07\x03\x00\x00\x00\x14", 6);
+    test_monitor_frame(&monitor, &fake_time, frame, 6);
+    TEST_ASSERT_EQUAL(0, test_monitor_count);
+    frame[2] = 40;
+    for(i = 0; i < 40; i++){
+        frame[3 + i] = (uint8_t)i;
+    }
+    test_monitor_frame(&monitor, &fake_time, frame, 43);
+    TEST_ASSERT_EQUAL(1, test_monitor_count);
+    TEST_ASSERT_EQUAL(3, test_monitor_function);
+    TEST_ASSERT_EQUAL(0, test_monitor_result);
+    TEST_ASSERT_EQUAL(20, test_monitor_size);
+    TEST_ASSERT_EQUAL(0, test_monitor_answered);
+    TEST_ASSERT_EQUAL(1, test_monitor_response_too_large);
+
+    //The traffic after it is still decoded
+    memcpy(frame, "\x07\x03\x00\x10\x00\x02", 6);
+    test_monitor_frame(&monitor, &fake_time, frame, 6);
+    memcpy(frame, "\x07\x03\x04\x12\x34\x56\x78", 7);
+    test_monitor_frame(&monitor, &fake_time, frame, 7);
+    TEST_ASSERT_EQUAL(2, test_monitor_count);
+    TEST_ASSERT_EQUAL(1, test_monitor_answered);
+    TEST_ASSERT_EQUAL(0, test_monitor_response_too_large);
+    TEST_ASSERT_EQUAL_HEX16(0x1234, test_monitor_value);
+
+    //Writing 20 registers, only the start of the data is kept and the echo is decoded
+    memcpy(frame, "\x07\x10\x00\x00\x00\x14\x28", 7);
+    for(i = 0; i < 40; i++){
+        frame[7 + i] = (uint8_t)(0xA0 + i);
+    }
+    test_monitor_frame(&monitor, &fake_time, frame, 47);
+    memcpy(frame, "\x07\x10\x00\x00\x00\x14", 6);
+    test_monitor_frame(&monitor, &fake_time, frame, 6);
+    TEST_ASSERT_EQUAL(3, test_monitor_count);
+    TEST_ASSERT_EQUAL(0x10, test_monitor_function);
+    TEST_ASSERT_EQUAL(0, test_monitor_result);
+    TEST_ASSERT_EQUAL(1, test_monitor_answered);
+    TEST_ASSERT_EQUAL(1, test_monitor_request_too_large);
+
+    //A FIFO read of 31 values, the length comes from the byte count
+    memcpy(frame, "\x07\x18\x04\xde", 4);
+    test_monitor_frame(&monitor, &fake_time, frame, 4);
+    memcpy(frame, "\x07\x18\x00\x40\x00\x1f", 6);
+    for(i = 0; i < 62; i++){
+        frame[6 + i] = (uint8_t)i;
+    }
+    length = test_monitor_frame(&monitor, &fake_time, frame, 68);
+    TEST_ASSERT_EQUAL(70, length);
+    TEST_ASSERT_EQUAL(4, test_monitor_count);
+    TEST_ASSERT_EQUAL(0x18, test_monitor_function);
+    TEST_ASSERT_EQUAL(1, test_monitor_response_too_large);
+
+    //A skipped response with a bad CRC is not a response
+    memcpy(frame, "\x07\x03\x00\x00\x00\x14", 6);
+    test_monitor_frame(&monitor, &fake_time, frame, 6);
+    frame[2] = 40;
+    for(i = 0; i < 40; i++){
+        frame[3 + i] = (uint8_t)i;
+    }
+    frame[43] = 0;
+    frame[44] = 0;
+    fake_time += 10000 + 45 * BYTE_TIMING_IN_MICROSECONDS(38400);
+    bmodbus_monitor_received(&monitor, fake_time, frame, 45, BYTE_TIMING_IN_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(5, test_monitor_count);
+    TEST_ASSERT_EQUAL(0, test_monitor_answered);
+    TEST_ASSERT_EQUAL(0, test_monitor_response_too_large);
+    memcpy(frame, "\x07\x03\x00\x10\x00\x02", 6);
+    test_monitor_frame(&monitor, &fake_time, frame, 6);
+    memcpy(frame, "\x07\x03\x04\x9a\xbc\xde\xf0", 7);
+    test_monitor_frame(&monitor, &fake_time, frame, 7);
+    TEST_ASSERT_EQUAL(6, test_monitor_count);
+    TEST_ASSERT_EQUAL(1, test_monitor_answered);
+    TEST_ASSERT_EQUAL_HEX16(0x9abc, test_monitor_value);
+}
+#endif //BMB_MONITOR
+
+int main(void) {
+    UNITY_BEGIN();
+#if defined(BMB_CLIENT_ASCII) && defined(BMB_MASTER_ASCII) && defined(BMB_CLIENT_FIFO_QUEUE)
+    RUN_TEST(test_ascii_fifo_queue);
+#endif //BMB_CLIENT_ASCII && BMB_MASTER_ASCII && BMB_CLIENT_FIFO_QUEUE
+#if defined(BMB_CLIENT_ASCII) && defined(BMB_MASTER_ASCII) && defined(BMB_CLIENT_REGISTER_BANK) && defined(BMB_CLIENT_READ_WRITE_FUNCTION)
+    RUN_TEST(test_ascii_register_bank);
+#endif //BMB_CLIENT_ASCII && BMB_MASTER_ASCII && BMB_CLIENT_REGISTER_BANK && BMB_CLIENT_READ_WRITE_FUNCTION
+#ifdef BMB_MONITOR
+    RUN_TEST(test_monitor_oversized);
+#endif //BMB_MONITOR
+    return UNITY_END();
+}
@@ -0,0 +1,173 @@
+//
+// Tests of the C++20 coroutine wrapper, a coroutine drives a client with a register bank through a simulated event loop
+//
+#include <cstring>
+#include "unity.h"
+#include "bmodbus_coroutine.hpp"
+
+static const uint32_t byte_time = BYTE_TIMING_IN_MICROSECONDS(38400);
+
+//The line between the master and the client, the event loop delivers what was sent
+struct wire{
+    uint8_t frame[BMB_MAXIMUM_MESSAGE_SIZE];
+    uint8_t size;
+    bool pending;
+};
+
+static void wire_send(void * context, const uint8_t * data, uint8_t size){
+    wire * line = static_cast<wire *>(context);
+    std::memcpy(line->frame, data, size);
+    line->size = size;
+    line->pending = true;
+}
+
+//One turn of the event loop, requests outside the bank are answered with an exception
+static void event_loop(bmodbus::master & line, wire & sent, modbus_client_t & client, uint32_t & now){
+    now += 1000;
+    if(sent.pending){
+        sent.pending = false;
+        now += sent.size * byte_time;
+        line.send_complete(now);
+        bmodbus_client_received(&client, now, sent.frame, sent.size, byte_time);
+        modbus_request_t * request = bmodbus_client_get_request(&client);
+        if(request != nullptr){
+            request->result = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        }
+        modbus_uart_data_t * response = bmodbus_client_get_response(&client);
+        if(response != nullptr){
+            now += 1000 + response->size * byte_time;
+            line.received(now, response->data, response->size, byte_time);
+            bmodbus_client_send_complete(&client);
+        }
+    }
+    line.loop(now);
+}
+
+struct results{
+    bmodbus::response read;
+    bmodbus::response write;
+    bmodbus::response absent;
+    bmodbus::response exception;
+    bmodbus::response too_large;
+    bmodbus::response broadcast;
+    int steps = 0;
+};
+
+static bmodbus::task control(bmodbus::master & line, results & out){
+    out.read = co_await line.read_holding(7, 0, 2);
+    out.steps++;
+    out.write = co_await line.write_register(7, 1, out.read.data[0] + 1);
+    out.steps++;
+    out.absent = co_await line.read_holding(9, 0, 1);
+    out.steps++;
+    out.exception = co_await line.read_holding(7, 0x100, 1);
+    out.steps++;
+    out.too_large = co_await line.read_holding(7, 0, 200);
+    out.steps++;
+    out.broadcast = co_await line.write_register(MODBUS_BROADCAST_ADDRESS, 3, 0x5555);
+    out.steps++;
+}
+
+void setUp(void){
+}
+
+void tearDown(void){
+}
+
+void test_coroutine_sequence(void){
+    uint16_t bank[8] = {0x1000, 0x2000, 0x3000, 0x4000};
+    uint32_t now = 10000;
+    wire sent = {};
+    modbus_client_t client;
+    results out;
+    bmodbus::master line(INTERFRAME_DELAY_MICROSECONDS(38400), 50000, wire_send, &sent);
+    bmodbus_client_init(&client, INTERFRAME_DELAY_MICROSECONDS(38400), 7);
+    bmodbus_client_set_holding_registers(&client, bank, 0, 8);
+
+    bmodbus::task running = control(line, out);
+    //The first request is sent as soon as the coroutine starts, nothing completes until the event loop runs
+    TEST_ASSERT_TRUE(sent.pending);
+    TEST_ASSERT_TRUE(line.busy());
+    TEST_ASSERT_EQUAL(0, out.steps);
+    for(int i = 0; (i < 1000) && !running.done(); i++){
+        event_loop(line, sent, client, now);
+    }
+    TEST_ASSERT_TRUE(running.done());
+    TEST_ASSERT_EQUAL(6, out.steps);
+    TEST_ASSERT_TRUE(out.read.ok());
+    TEST_ASSERT_EQUAL(2, out.read.size);
+    TEST_ASSERT_EQUAL_HEX16(0x1000, out.read.data[0]);
+    TEST_ASSERT_EQUAL_HEX16(0x2000, out.read.data[1]);
+    TEST_ASSERT_TRUE(out.write.ok());
+    TEST_ASSERT_EQUAL(bmodbus::timeout, out.absent.result);
+    TEST_ASSERT_EQUAL(MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, out.exception.result);
+    TEST_ASSERT_EQUAL(bmodbus::refused, out.too_large.result);
+    TEST_ASSERT_TRUE(out.broadcast.ok());
+    TEST_ASSERT_EQUAL_HEX16(0x1001, bank[1]);
+    TEST_ASSERT_EQUAL_HEX16(0x5555, bank[3]);
+    TEST_ASSERT_FALSE(line.busy());
+}
+
+void test_coroutine_bad_response(void){
+    uint32_t now = 10000;
+    wire sent = {};
+    results out;
+    bmodbus::master line(INTERFRAME_DELAY_MICROSECONDS(38400), 50000, wire_send, &sent);
+    bmodbus::task running = control(line, out);
+    //A response with a bad CRC completes the request as well, without waiting for the timeout
+    const uint8_t corrupted[] = {0x07, 0x03, 0x04, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00};
+    line.send_complete(now);
+    now += 10000;
+    line.received(now, corrupted, sizeof(corrupted), byte_time);
+    //The coroutine is only resumed once the line has been quiet for the interframe delay
+    line.loop(now);
+    TEST_ASSERT_EQUAL(0, out.steps);
+    line.loop(now + INTERFRAME_DELAY_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(1, out.steps);
+    TEST_ASSERT_EQUAL(bmodbus::bad_response, out.read.result);
+}
+
+void test_coroutine_destroyed(void){
+    uint16_t bank[8] = {0x1000, 0x2000, 0x3000, 0x4000};
+    uint32_t now = 10000;
+    wire sent = {};
+    modbus_client_t client;
+    results out;
+    bmodbus::master line(INTERFRAME_DELAY_MICROSECONDS(38400), 50000, wire_send, &sent);
+    bmodbus_client_init(&client, INTERFRAME_DELAY_MICROSECONDS(38400), 7);
+    bmodbus_client_set_holding_registers(&client, bank, 0, 8);
+    //A task destroyed while it waits gives up on its request, the master is free for the next one
+    {
+        bmodbus::task dropped = control(line, out);
+        line.send_complete(now);
+        TEST_ASSERT_TRUE(line.busy());
+    }
+    TEST_ASSERT_FALSE(line.busy());
+    TEST_ASSERT_EQUAL(MASTER_STATE_IDLE, line.native()->state);
+    //Also once its response arrived, before it was resumed
+    sent.pending = false;
+    {
+        bmodbus::task dropped = control(line, out);
+        event_loop(line, sent, client, now);
+        TEST_ASSERT_EQUAL(0, out.steps);
+        TEST_ASSERT_TRUE(line.busy());
+    }
+    TEST_ASSERT_FALSE(line.busy());
+    TEST_ASSERT_EQUAL(0, out.steps);
+
+    bmodbus::task running = control(line, out);
+    for(int i = 0; (i < 1000) && !running.done(); i++){
+        event_loop(line, sent, client, now);
+    }
+    TEST_ASSERT_TRUE(running.done());
+    TEST_ASSERT_EQUAL(6, out.steps);
+    TEST_ASSERT_TRUE(out.read.ok());
+}
+
+int main(void){
+    UNITY_BEGIN();
+    RUN_TEST(test_coroutine_sequence);
+    RUN_TEST(test_coroutine_bad_response);
+    RUN_TEST(test_coroutine_destroyed);
+    return UNITY_END();
+}
@@ -0,0 +1,494 @@
+//
+// Fuzzing harness for the client and master parsers
+//
+// The first byte of an input picks the entry point, the rest is the traffic:
+//   0 client, RTU bytes through bmodbus_client_next_byte()
+//   1 client, RTU bursts through bmodbus_client_received(), byte 1 sets the burst size
+//   2 client, ASCII bursts through bmodbus_client_received()
+//   3 client, RTU over TCP packets through bmodbus_client_received_packet()
+//   4 client, Modbus TCP frames through bmodbus_socket_mbap_to_rtu()
+//   5 master, RTU response through bmodbus_master_received(), bytes 1 and 2 pick the request and its count
+//   6 master, ASCII response, same layout as 5
+//   7 master, RTU over TCP response through bmodbus_master_received_packet(), same layout as 5
+//   8 monitor, RTU bursts through bmodbus_monitor_received()
+//
+// Built with -DBMB_LIBFUZZER and clang's -fsanitize=fuzzer it is a libFuzzer target. Otherwise it is a driver for AFL
+// (the input on stdin) and for corpus files given on the command line, and it has its own mutation loop so gcc builds
+// can fuzz too:
+//   fuzz_bmodbus --corpus DIR        writes the seed inputs, the frames of the unit tests, to DIR
+//   fuzz_bmodbus --iterations N      mutates the seeds N times
+//   fuzz_bmodbus FILE...             runs each file once
+//
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef BMB_LIBFUZZER
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include "bmodbus.h"
+#include "bmodbus_socket.h"
+
+#define FUZZ_TARGETS 9
+#define FUZZ_ADDRESS 1
+#define FUZZ_BYTE_TIME BYTE_TIMING_IN_MICROSECONDS(38400)
+#define FUZZ_MAXIMUM_INPUT 1024
+
+static modbus_client_t client;
+static modbus_master_t master;
+static uint16_t bank[64];
+static uint16_t fifo_storage[8];
+static modbus_fifo_t fifo;
+
+static int8_t fuzz_file_read(void * context, uint16_t file, uint16_t record, uint16_t * value){
+    (void)context;
+    if((file > 4) || (record > 100)){
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    }
+    *value = (uint16_t)(file ^ record);
+    return 0;
+}
+
+static int8_t fuzz_file_write(void * context, uint16_t file, uint16_t record, uint16_t value){
+    (void)context;
+    (void)value;
+    return ((file > 4) || (record > 100)) ? MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS : 0;
+}
+
+static const modbus_file_record_t files = {fuzz_file_read, fuzz_file_write, NULL, NULL};
+
+static void fuzz_monitor_callback(void * context, const modbus_transaction_t * transaction){
+    (void)context;
+    (void)transaction;
+}
+
+static void fuzz_client_init(uint8_t ascii){
+    bmodbus_client_init(&client, INTERFRAME_DELAY_MICROSECONDS(38400), FUZZ_ADDRESS);
+    bmodbus_client_set_holding_registers(&client, bank, 0, sizeof(bank) / sizeof(bank[0]));
+    bmodbus_fifo_init(&fifo, fifo_storage, sizeof(fifo_storage) / sizeof(fifo_storage[0]));
+    bmodbus_fifo_push(&fifo, 0x1234);
+    bmodbus_client_set_fifo(&client, 0x04de, &fifo);
+    bmodbus_client_set_file_records(&client, &files);
+    bmodbus_client_set_ascii(&client, ascii);
+}
+
+//Answers a request like an application would, every register it could ask for is filled in
+static void fuzz_client_drain(void){
+    modbus_request_t * request = bmodbus_client_get_request(&client);
+    if(request != NULL){
+        memset(request->data, 0xA5, sizeof(request->data));
+        request->result = (request->address == 0xFFFF) ? MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS : 0;
+    }
+    if(bmodbus_client_get_response(&client) != NULL){
+        bmodbus_client_send_complete(&client);
+    }
+}
+
+//Bursts of up to 16 bytes, a zero byte after a burst leaves a gap so the next one starts a new frame
+static void fuzz_client_bursts(const uint8_t * data, size_t size){
+    uint32_t t = 10000;
+    size_t i, chunk;
+    for(i = 0; i < size; i += chunk){
+        chunk = (size - i) > 16 ? 16 : (size - i);
+        t += (uint32_t)chunk * FUZZ_BYTE_TIME;
+        bmodbus_client_received(&client, t, (uint8_t *)data + i, (uint8_t)chunk, FUZZ_BYTE_TIME);
+        fuzz_client_drain();
+        if(data[i + chunk - 1] == 0){
+            t += 100000;
+        }
+    }
+}
+
+static modbus_uart_request_t * fuzz_master_request(uint8_t which, uint8_t count){
+    static const uint16_t values[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    static uint8_t coils[4] = {0x55, 0xAA, 0x0F, 0xF0};
+    modbus_file_subrequest_t subrequest = {1, 2, (uint16_t)(count % 8 + 1), values};
+    uint16_t n = (uint16_t)(count % 8 + 1);
+    switch(which % 14){
+        case 0: return bmodbus_master_read_coils(&master, FUZZ_ADDRESS, 0, count);
+        case 1: return bmodbus_master_read_discrete_inputs(&master, FUZZ_ADDRESS, 0, count);
+        case 2: return bmodbus_master_read_holding_registers(&master, FUZZ_ADDRESS, 0, count);
+        case 3: return bmodbus_master_read_input_registers(&master, FUZZ_ADDRESS, 0, count);
+        case 4: return bmodbus_master_write_single_coil(&master, FUZZ_ADDRESS, 0, 0xFF00);
+        case 5: return bmodbus_master_write_single_register(&master, FUZZ_ADDRESS, 0, count);
+        case 6: return bmodbus_master_write_multiple_coils(&master, FUZZ_ADDRESS, 0, (uint16_t)(count % 32 + 1), coils);
+        case 7: return bmodbus_master_write_multiple_registers(&master, FUZZ_ADDRESS, 0, n, (uint16_t *)values);
+        case 8: return bmodbus_master_mask_write_register(&master, FUZZ_ADDRESS, 0, 0xFF00, count);
+        case 9: return bmodbus_master_read_fifo_queue(&master, FUZZ_ADDRESS, 0x04de);
+        case 10: return bmodbus_master_diagnostics(&master, FUZZ_ADDRESS, 0, count);
+        case 11: return bmodbus_master_get_comm_event_counter(&master, FUZZ_ADDRESS);
+        case 12: return bmodbus_master_read_write_multiple_registers(&master, FUZZ_ADDRESS, 0, count, 0, n, (uint16_t *)values);
+        default: return (which & 0x80) ? bmodbus_master_write_file_record(&master, FUZZ_ADDRESS, &subrequest, 1) :
+                                         bmodbus_master_read_file_record(&master, FUZZ_ADDRESS, &subrequest, 1);
+    }
+}
+
+static void fuzz_master(uint8_t target, const uint8_t * data, size_t size){
+    uint32_t t = 10000;
+    size_t i, chunk;
+    if(size < 2){
+        return;
+    }
+    bmodbus_master_init(&master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_master_set_ascii(&master, target == 6);
+    if(fuzz_master_request(data[0], data[1]) == NULL){
+        return;
+    }
+    bmodbus_master_send_complete(&master, t);
+    for(i = 2; (i < size) && (master.state == MASTER_STATE_WAITING_FOR_RESPONSE); i += chunk){
+        chunk = (size - i) > 16 ? 16 : (size - i);
+        t += (uint32_t)chunk * FUZZ_BYTE_TIME;
+        if(target == 7){
+            bmodbus_master_received_packet(&master, t, data + i, (uint16_t)chunk);
+        }else{
+            bmodbus_master_received(&master, t, (uint8_t *)data + i, (uint8_t)chunk, FUZZ_BYTE_TIME);
+        }
+    }
+    bmodbus_master_get_response(&master);
+}
+
+static void fuzz_one(const uint8_t * data, size_t size){
+    static modbus_monitor_t monitor;
+    uint8_t rtu[BMB_SOCKET_PACKET_SIZE];
+    uint16_t transaction;
+    uint32_t t = 10000;
+    size_t i, chunk;
+    int length;
+    if(size < 1){
+        return;
+    }
+    switch(data[0] % FUZZ_TARGETS){
+        case 0:
+            fuzz_client_init(0);
+            for(i = 1; i < size; i++){
+                t += FUZZ_BYTE_TIME;
+                bmodbus_client_next_byte(&client, t, data[i]);
+                fuzz_client_drain();
+            }
+            break;
+        case 1:
+        case 2:
+            fuzz_client_init((data[0] % FUZZ_TARGETS) == 2);
+            fuzz_client_bursts(data + 1, size - 1);
+            break;
+        case 3:
+        case 4:
+            fuzz_client_init(0);
+            //Packets are delimited by a 16 bit length
+            for(i = 1; i + 2 <= size; i += 2 + chunk){
+                chunk = ((size_t)data[i] << 8 | data[i + 1]) % BMB_SOCKET_PACKET_SIZE;
+                if(chunk > size - i - 2){
+                    chunk = size - i - 2;
+                }
+                t += 1000;
+                if((data[0] % FUZZ_TARGETS) == 3){
+                    bmodbus_client_received_packet(&client, t, data + i + 2, (uint16_t)chunk);
+                }else if((length = bmodbus_socket_mbap_to_rtu(data + i + 2, (uint16_t)chunk, rtu, &transaction)) > 0){
+                    bmodbus_client_received_packet(&client, t, rtu, (uint16_t)length);
+                }
+                fuzz_client_drain();
+            }
+            break;
+        case 5:
+        case 6:
+        case 7:
+            fuzz_master(data[0] % FUZZ_TARGETS, data + 1, size - 1);
+            break;
+        default:
+            bmodbus_monitor_init(&monitor, INTERFRAME_DELAY_MICROSECONDS(38400), 100000, fuzz_monitor_callback, NULL);
+            for(i = 1; i < size; i += chunk){
+                chunk = (size - i) > 16 ? 16 : (size - i);
+                t += (uint32_t)chunk * FUZZ_BYTE_TIME;
+                bmodbus_monitor_received(&monitor, t, data + i, (uint16_t)chunk, FUZZ_BYTE_TIME);
+                if(data[i + chunk - 1] == 0){
+                    t += 100000;
+                }
+            }
+            break;
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size);
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size){
+    fuzz_one(data, size);
+    return 0;
+}
+
+#ifndef BMB_LIBFUZZER
+typedef struct{
+    uint8_t data[FUZZ_MAXIMUM_INPUT];
+    size_t size;
+}fuzz_input_t;
+
+#define FUZZ_MAXIMUM_SEEDS 1024
+static fuzz_input_t seeds[FUZZ_MAXIMUM_SEEDS];
+static size_t seed_count;
+
+static void fuzz_add_seed(uint8_t target, const uint8_t * prefix, size_t prefix_size, const uint8_t * frame, size_t size){
+    fuzz_input_t * seed;
+    if((seed_count == FUZZ_MAXIMUM_SEEDS) || (1 + prefix_size + size > FUZZ_MAXIMUM_INPUT)){
+        return;
+    }
+    seed = &seeds[seed_count++];
+    seed->data[0] = target;
+    if(prefix_size){
+        memcpy(seed->data + 1, prefix, prefix_size);
+    }
+    memcpy(seed->data + 1 + prefix_size, frame, size);
+    seed->size = 1 + prefix_size + size;
+}
+
+//A request the master would refuse to build, a count and byte count that agree with a valid CRC are hard to mutate into
+static void fuzz_add_large_request(uint8_t function, uint16_t count){
+    uint8_t frame[FUZZ_MAXIMUM_INPUT];
+    uint16_t n = 0, i, crc, bytes = (function <= 2 || function == 15) ? (uint16_t)((count + 7) / 8) : (uint16_t)(2 * count);
+    frame[n++] = FUZZ_ADDRESS;
+    frame[n++] = function;
+    frame[n++] = 0;
+    frame[n++] = 0;
+    frame[n++] = (uint8_t)(count >> 8);
+    frame[n++] = (uint8_t)count;
+    if(function == 0x17){ //Reads count registers and writes one
+        frame[n++] = 0;
+        frame[n++] = 0;
+        frame[n++] = 0;
+        frame[n++] = 1;
+        bytes = 2;
+    }
+    if((function == 15) || (function == 16) || (function == 0x17)){
+        frame[n++] = (uint8_t)bytes;
+        for(i = 0; i < bytes; i++){
+            frame[n++] = (uint8_t)i;
+        }
+    }
+    crc = bmodbus_crc(frame, n);
+    frame[n++] = crc & 0xFF;
+    frame[n++] = crc >> 8;
+    fuzz_add_seed(0, NULL, 0, frame, n);
+    fuzz_add_seed(1, NULL, 0, frame, n);
+}
+
+//Every request the master can build, with the response the client gives, in each framing
+static void fuzz_make_seeds(void){
+    static const uint8_t counts[] = {1, 2, 8, 16, 100};
+    uint8_t request[BMB_SOCKET_PACKET_SIZE], mbap[BMB_SOCKET_PACKET_SIZE + BMB_MBAP_HEADER_SIZE], prefix[2];
+    modbus_uart_request_t * built;
+    modbus_uart_data_t * response;
+    uint8_t which, c, ascii, request_size, packet[2];
+    int length;
+    //Requests around the limits of the buffer and of the specification
+    for(c = 0; c < 3; c++){
+        fuzz_add_large_request(1, (uint16_t)(8 * (BMB_MAXIMUM_MESSAGE_SIZE - 6 + c)));
+        fuzz_add_large_request(3, (uint16_t)((BMB_MAXIMUM_MESSAGE_SIZE - 6) / 2 + c));
+        fuzz_add_large_request(15, (uint16_t)(8 * (BMB_MAXIMUM_MESSAGE_SIZE - 1 + c)));
+        fuzz_add_large_request(16, (uint16_t)(BMB_MAXIMUM_MESSAGE_SIZE / 2 - 1 + c));
+        fuzz_add_large_request(0x17, (uint16_t)((BMB_MAXIMUM_MESSAGE_SIZE - 6) / 2 + c));
+    }
+    fuzz_add_large_request(1, 2000);
+    fuzz_add_large_request(3, 125);
+    fuzz_add_large_request(15, 1968);
+    fuzz_add_large_request(16, 123);
+    fuzz_add_large_request(0x17, 125);
+    for(ascii = 0; ascii < 2; ascii++){
+        for(which = 0; which < 15; which++){
+            for(c = 0; c < sizeof(counts); c++){
+                bmodbus_master_init(&master, INTERFRAME_DELAY_MICROSECONDS(38400));
+                bmodbus_master_set_ascii(&master, ascii);
+                prefix[0] = (which == 14) ? 0x80 | 13 : which;
+                prefix[1] = counts[c];
+                if((built = fuzz_master_request(prefix[0], prefix[1])) == NULL){
+                    continue;
+                }
+                request_size = built->size;
+                memcpy(request, built->data, request_size);
+                fuzz_add_seed(ascii ? 2 : 1, NULL, 0, request, request_size);
+                if(!ascii){
+                    fuzz_add_seed(0, NULL, 0, request, request_size);
+                    packet[0] = 0;
+                    packet[1] = request_size;
+                    memcpy(mbap + 2, request, request_size);
+                    memcpy(mbap, packet, 2);
+                    fuzz_add_seed(3, NULL, 0, mbap, request_size + 2u);
+                    length = bmodbus_socket_rtu_to_mbap(request, request_size, 1, mbap + 2);
+                    mbap[0] = 0;
+                    mbap[1] = (uint8_t)length;
+                    fuzz_add_seed(4, NULL, 0, mbap, (size_t)length + 2);
+                }
+                //The response of a client to the same request
+                fuzz_client_init(ascii);
+                bmodbus_client_received(&client, 10000, request, request_size, FUZZ_BYTE_TIME);
+                if(bmodbus_client_get_request(&client) != NULL){
+                    memset(client.payload.request.data, 0x5A, sizeof(client.payload.request.data));
+                }
+                if((response = bmodbus_client_get_response(&client)) == NULL){
+                    continue;
+                }
+                fuzz_add_seed(ascii ? 6 : 5, prefix, 2, response->data, response->size);
+                if(!ascii){
+                    fuzz_add_seed(7, prefix, 2, response->data, response->size);
+                    memcpy(mbap, request, request_size);
+                    memcpy(mbap + request_size, response->data, response->size);
+                    mbap[request_size + response->size] = 0; //A gap before the next request
+                    fuzz_add_seed(8, NULL, 0, mbap, (size_t)request_size + response->size + 1);
+                }
+            }
+        }
+    }
+}
+
+static int fuzz_write_corpus(const char * directory){
+    char path[4096];
+    FILE * file;
+    size_t i;
+    fuzz_make_seeds();
+    for(i = 0; i < seed_count; i++){
+        snprintf(path, sizeof(path), "%s/seed_%03u", directory, (unsigned int)i);
+        if((file = fopen(path, "wb")) == NULL){
+            perror(path);
+            return 1;
+        }
+        fwrite(seeds[i].data, 1, seeds[i].size, file);
+        fclose(file);
+    }
+    printf("%u seeds written to %s\n", (unsigned int)seed_count, directory);
+    return 0;
+}
+
+static uint32_t fuzz_random(void){
+    static uint32_t state = 0x12345678;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static void fuzz_mutate(fuzz_input_t * input){
+    const fuzz_input_t * other;
+    size_t at, n;
+    uint8_t rounds = (uint8_t)(1 + fuzz_random() % 4);
+    while(rounds--){
+        at = input->size ? fuzz_random() % input->size : 0;
+        switch(fuzz_random() % 6){
+            case 0: //Flip a bit, but keep the target
+                if(at){
+                    input->data[at] ^= (uint8_t)(1 << (fuzz_random() % 8));
+                }
+                break;
+            case 1: //An interesting value
+                if(at){
+                    static const uint8_t values[] = {0x00, 0x01, 0x7F, 0x80, 0xFF, 0xFE, ':', '\r', '\n'};
+                    input->data[at] = values[fuzz_random() % sizeof(values)];
+                }
+                break;
+            case 2: //Insert a byte
+                if((input->size < FUZZ_MAXIMUM_INPUT) && at){
+                    memmove(input->data + at + 1, input->data + at, input->size - at);
+                    input->data[at] = (uint8_t)fuzz_random();
+                    input->size++;
+                }
+                break;
+            case 3: //Drop a byte
+                if(at && (input->size > 2)){
+                    memmove(input->data + at, input->data + at + 1, input->size - at - 1);
+                    input->size--;
+                }
+                break;
+            case 4: //Append another seed of the same target, several frames in a row
+                other = &seeds[fuzz_random() % seed_count];
+                n = other->size - 1;
+                if((other->data[0] == input->data[0]) && (input->size + n <= FUZZ_MAXIMUM_INPUT)){
+                    memcpy(input->data + input->size, other->data + 1, n);
+                    input->size += n;
+                }
+                break;
+            default: //Truncate
+                if(at > 1){
+                    input->size = at;
+                }
+                break;
+        }
+    }
+}
+
+static fuzz_input_t input;
+
+//The sanitizers abort on an error (see below) and the input is kept so it can be run again as a file
+static void fuzz_save_input(int signal_number){
+    static const char message[] = "input saved to fuzz-crash\n";
+    int fd = open("fuzz-crash", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd >= 0){
+        if(write(fd, input.data, input.size) > 0){
+            (void)!write(STDERR_FILENO, message, sizeof(message) - 1);
+        }
+        close(fd);
+    }
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+}
+
+const char * __asan_default_options(void);
+const char * __asan_default_options(void){
+    return "abort_on_error=1";
+}
+
+const char * __ubsan_default_options(void);
+const char * __ubsan_default_options(void){
+    return "abort_on_error=1:print_stacktrace=1";
+}
+
+static int fuzz_iterations(unsigned long iterations){
+    unsigned long i;
+    fuzz_make_seeds();
+    signal(SIGABRT, fuzz_save_input);
+    signal(SIGSEGV, fuzz_save_input);
+    for(i = 0; i < seed_count; i++){
+        input = seeds[i];
+        fuzz_one(input.data, input.size);
+    }
+    for(i = 0; i < iterations; i++){
+        input = seeds[fuzz_random() % seed_count];
+        fuzz_mutate(&input);
+        fuzz_one(input.data, input.size);
+    }
+    printf("%lu mutations of %u seeds\n", iterations, (unsigned int)seed_count);
+    return 0;
+}
+
+static int fuzz_file(FILE * file){
+    static uint8_t data[FUZZ_MAXIMUM_INPUT * 4];
+    size_t size = fread(data, 1, sizeof(data), file);
+    fuzz_one(data, size);
+    return 0;
+}
+
+int main(int argc, char ** argv){
+    FILE * file;
+    int i;
+    if(argc == 1){
+        return fuzz_file(stdin); //AFL
+    }
+    if((strcmp(argv[1], "--corpus") == 0) && (argc == 3)){
+        return fuzz_write_corpus(argv[2]);
+    }
+    if((strcmp(argv[1], "--iterations") == 0) && (argc == 3)){
+        return fuzz_iterations(strtoul(argv[2], NULL, 0));
+    }
+    for(i = 1; i < argc; i++){
+        if((file = fopen(argv[i], "rb")) == NULL){
+            perror(argv[i]);
+            return 1;
+        }
+        fuzz_file(file);
+        fclose(file);
+    }
+    return 0;
+}
+#endif //BMB_LIBFUZZER
@@ -0,0 +1,307 @@
+//
+// Tests of the Linux I/O engine, each test runs on both backends (io_uring is skipped where the kernel refuses it)
+//
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "bmodbus.h"
+#include "bmodbus_io.h"
+#include "unity.h"
+
+void setUp(void) {
+    // Set up code before each test
+}
+
+void tearDown(void) {
+    // Clean up code after each test
+}
+
+static void test_handler(void * context, modbus_request_t * request){
+    uint16_t * calls = (uint16_t *)context;
+    (*calls)++;
+    for(uint16_t i=0;i<request->size;i++){
+        request->data[i] = request->address + i;
+    }
+}
+
+static void stream_pair(int fds[2]){
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+}
+
+//Starts the engine, returns 0 if the backend is not available here
+static int start(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoints, uint16_t count, uint8_t backend){
+    int used = bmodbus_io_init(io, endpoints, count, backend);
+    if((used < 0) && (backend == BMB_IO_URING)){
+        return 0;
+    }
+    TEST_ASSERT_EQUAL(backend, used);
+    return 1;
+}
+
+static void gateway(uint8_t backend){
+    uint16_t calls = 0;
+    uint8_t serial_response[16];
+    int tcp[2], tty[2], loops;
+    modbus_uart_request_t * sending_request;
+    modbus_request_t * response;
+    modbus_client_t modbus_clients[2];
+    modbus_master_t modbus_master, helper;
+    bmodbus_io_endpoint_t endpoints[3];
+    bmodbus_io_t io;
+    stream_pair(tcp);
+    stream_pair(tty);
+    bmodbus_client_init(&modbus_clients[0], INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_client_init(&modbus_clients[1], INTERFRAME_DELAY_MICROSECONDS(38400), 3);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_master_init(&helper, INTERFRAME_DELAY_MICROSECONDS(38400));
+    //The master and a client talk over a socket, the other client is on a "serial port" fed by the test
+    bmodbus_io_master_endpoint(&endpoints[0], tcp[0], &modbus_master, 0);
+    bmodbus_io_client_endpoint(&endpoints[1], tcp[1], &modbus_clients[0], test_handler, &calls, 0);
+    bmodbus_io_client_endpoint(&endpoints[2], tty[1], &modbus_clients[1], test_handler, &calls, BYTE_TIMING_IN_MICROSECONDS(38400));
+    if(!start(&io, endpoints, 3, backend)){
+        close(tcp[0]); close(tcp[1]); close(tty[0]); close(tty[1]);
+        TEST_IGNORE_MESSAGE("io_uring is not available");
+    }
+
+    //Nothing to do yet
+    TEST_ASSERT_EQUAL(0, bmodbus_io_run(&io, 0));
+    TEST_ASSERT_EQUAL(-1, bmodbus_io_master_send(&io, &endpoints[0]));
+    //The whole transaction is driven by the engine
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_master_read_holding_registers(&modbus_master, 2, 0x0040, 3));
+    TEST_ASSERT_EQUAL(0, bmodbus_io_master_send(&io, &endpoints[0]));
+    for(loops = 0; (loops < 20) && (modbus_master.state != MASTER_STATE_RESPONSE_READY); loops++){
+        TEST_ASSERT_TRUE(bmodbus_io_run(&io, 100) >= 0);
+    }
+    response = bmodbus_master_get_response(&modbus_master);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(3, response->size);
+    TEST_ASSERT_EQUAL(0x0040, response->data[0]);
+    TEST_ASSERT_EQUAL(0x0042, response->data[2]);
+    TEST_ASSERT_EQUAL(1, calls);
+
+    //The serial client gets its request in two pieces
+    sending_request = bmodbus_master_read_holding_registers(&helper, 3, 0x0100, 1);
+    TEST_ASSERT_EQUAL(3, write(tty[0], sending_request->data, 3));
+    for(loops = 0; (loops < 5) && (bmodbus_io_run(&io, 0) == 0); loops++){
+    }
+    TEST_ASSERT_EQUAL(5, write(tty[0], sending_request->data + 3, 5));
+    for(loops = 0; (loops < 20) && (calls < 2); loops++){
+        TEST_ASSERT_TRUE(bmodbus_io_run(&io, 100) >= 0);
+    }
+    TEST_ASSERT_EQUAL(2, calls);
+    for(loops = 0; (loops < 20) && (modbus_clients[1].state != CLIENT_STATE_IDLE); loops++){
+        TEST_ASSERT_TRUE(bmodbus_io_run(&io, 100) >= 0);
+    }
+    TEST_ASSERT_EQUAL(7, read(tty[0], serial_response, sizeof(serial_response)));
+    TEST_ASSERT_EQUAL(3, serial_response[0]);
+    TEST_ASSERT_EQUAL(0x01, serial_response[3]);
+    TEST_ASSERT_EQUAL(0x00, serial_response[4]);
+
+    //A peer going away stops its endpoint
+    close(tty[0]);
+    for(loops = 0; (loops < 20) && !endpoints[2].closed; loops++){
+        TEST_ASSERT_TRUE(bmodbus_io_run(&io, 100) >= 0);
+    }
+    TEST_ASSERT_TRUE(endpoints[2].closed);
+    TEST_ASSERT_FALSE(endpoints[1].closed);
+    bmodbus_io_deinit(&io);
+    close(tcp[0]);
+    close(tcp[1]);
+    close(tty[1]);
+}
+
+//Reads until the responses expected have all arrived
+static ssize_t collect(bmodbus_io_t * io, int fd, uint8_t * data, size_t expected){
+    ssize_t n, total = 0;
+    int loops;
+    for(loops = 0; (loops < 20) && ((size_t)total < expected); loops++){
+        TEST_ASSERT_TRUE(bmodbus_io_run(io, 10) >= 0);
+        n = read(fd, data + total, expected - total);
+        if(n > 0){
+            total += n;
+        }
+    }
+    return total;
+}
+
+static void tcp_stream(uint8_t backend){
+    uint16_t calls = 0;
+    uint8_t requests[64], responses[64];
+    size_t size;
+    int tcp[2], loops;
+    modbus_uart_request_t * sending_request;
+    modbus_client_t modbus_client;
+    modbus_master_t helper;
+    bmodbus_io_endpoint_t endpoint;
+    bmodbus_io_t io;
+    stream_pair(tcp);
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&helper, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_io_client_endpoint(&endpoint, tcp[1], &modbus_client, test_handler, &calls, 0);
+    TEST_ASSERT_TRUE(endpoint.tcp);
+    if(!start(&io, &endpoint, 1, backend)){
+        close(tcp[0]); close(tcp[1]);
+        TEST_IGNORE_MESSAGE("io_uring is not available");
+    }
+
+    //A request split in two writes is answered once it is whole
+    sending_request = bmodbus_master_read_holding_registers(&helper, 2, 0x0100, 2);
+    TEST_ASSERT_EQUAL(3, write(tcp[0], sending_request->data, 3));
+    for(loops = 0; loops < 3; loops++){
+        TEST_ASSERT_TRUE(bmodbus_io_run(&io, 10) >= 0);
+    }
+    TEST_ASSERT_EQUAL(0, calls);
+    TEST_ASSERT_EQUAL(5, write(tcp[0], sending_request->data + 3, 5));
+    TEST_ASSERT_EQUAL(9, collect(&io, tcp[0], responses, 9));
+    TEST_ASSERT_EQUAL(1, calls);
+    TEST_ASSERT_EQUAL(0x01, responses[3]);
+
+    //Two requests in one write are both answered, in order
+    helper.state = MASTER_STATE_IDLE;
+    sending_request = bmodbus_master_read_holding_registers(&helper, 2, 0x0200, 1);
+    memcpy(requests, sending_request->data, sending_request->size);
+    size = sending_request->size;
+    helper.state = MASTER_STATE_IDLE;
+    sending_request = bmodbus_master_read_holding_registers(&helper, 2, 0x0300, 1);
+    memcpy(requests + size, sending_request->data, sending_request->size);
+    size += sending_request->size;
+    TEST_ASSERT_EQUAL(size, write(tcp[0], requests, size));
+    TEST_ASSERT_EQUAL(14, collect(&io, tcp[0], responses, 14));
+    TEST_ASSERT_EQUAL(3, calls);
+    TEST_ASSERT_EQUAL(0x02, responses[3]);
+    TEST_ASSERT_EQUAL(0x03, responses[7 + 3]);
+    bmodbus_io_deinit(&io);
+    close(tcp[0]);
+    close(tcp[1]);
+}
+
+//One slot serving the TCP sessions accepted one after the other
+static void sessions(uint8_t backend){
+    uint16_t calls = 0;
+    uint8_t responses[16];
+    int first[2], second[2], loops, result;
+    modbus_uart_request_t * sending_request;
+    modbus_client_t modbus_client;
+    modbus_master_t helper;
+    bmodbus_io_endpoint_t endpoint;
+    bmodbus_io_t io;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&helper, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_io_client_endpoint(&endpoint, -1, &modbus_client, test_handler, &calls, 0);
+    if(!start(&io, &endpoint, 1, backend)){
+        TEST_IGNORE_MESSAGE("io_uring is not available");
+    }
+    TEST_ASSERT_TRUE(endpoint.closed);
+    TEST_ASSERT_EQUAL(0, bmodbus_io_run(&io, 0));
+
+    //The first session is served, then closed by the peer
+    stream_pair(first);
+    TEST_ASSERT_EQUAL(0, bmodbus_io_rebind(&io, &endpoint, first[1]));
+    TEST_ASSERT_TRUE(endpoint.tcp);
+    TEST_ASSERT_EQUAL(-1, bmodbus_io_rebind(&io, &endpoint, first[1]));
+    sending_request = bmodbus_master_read_holding_registers(&helper, 2, 0x0100, 1);
+    TEST_ASSERT_EQUAL(sending_request->size, write(first[0], sending_request->data, sending_request->size));
+    TEST_ASSERT_EQUAL(7, collect(&io, first[0], responses, 7));
+    TEST_ASSERT_EQUAL(0x01, responses[3]);
+    TEST_ASSERT_EQUAL(3, write(first[0], sending_request->data, 3));
+    close(first[0]);
+    for(loops = 0; (loops < 20) && !endpoint.closed; loops++){
+        TEST_ASSERT_TRUE(bmodbus_io_run(&io, 10) >= 0);
+    }
+    TEST_ASSERT_TRUE(endpoint.closed);
+    close(first[1]);
+
+    //The second session takes the slot, a half sent request of the first one is not mixed in
+    stream_pair(second);
+    TEST_ASSERT_EQUAL(0, bmodbus_io_rebind(&io, &endpoint, second[1]));
+    helper.state = MASTER_STATE_IDLE;
+    sending_request = bmodbus_master_read_holding_registers(&helper, 2, 0x0200, 1);
+    TEST_ASSERT_EQUAL(sending_request->size, write(second[0], sending_request->data, sending_request->size));
+    TEST_ASSERT_EQUAL(7, collect(&io, second[0], responses, 7));
+    TEST_ASSERT_EQUAL(0x02, responses[3]);
+    TEST_ASSERT_EQUAL(2, calls);
+
+    //Dropped by the server, the slot is free once the engine gave up on the session
+    TEST_ASSERT_TRUE(bmodbus_io_run(&io, 0) >= 0);
+    TEST_ASSERT_EQUAL(0, bmodbus_io_remove(&io, &endpoint));
+    TEST_ASSERT_TRUE(endpoint.closed);
+    result = bmodbus_io_rebind(&io, &endpoint, second[1]);
+    for(loops = 0; (loops < 20) && (result < 0); loops++){
+        TEST_ASSERT_EQUAL(EBUSY, errno);
+        TEST_ASSERT_TRUE(bmodbus_io_run(&io, 10) >= 0);
+        result = bmodbus_io_rebind(&io, &endpoint, second[1]);
+    }
+    TEST_ASSERT_EQUAL(0, result);
+    helper.state = MASTER_STATE_IDLE;
+    sending_request = bmodbus_master_read_holding_registers(&helper, 2, 0x0300, 1);
+    TEST_ASSERT_EQUAL(sending_request->size, write(second[0], sending_request->data, sending_request->size));
+    TEST_ASSERT_EQUAL(7, collect(&io, second[0], responses, 7));
+    TEST_ASSERT_EQUAL(0x03, responses[3]);
+    bmodbus_io_deinit(&io);
+    close(second[0]);
+    close(second[1]);
+}
+
+void test_io_epoll(void){
+    gateway(BMB_IO_EPOLL);
+}
+
+void test_io_uring(void){
+    gateway(BMB_IO_URING);
+}
+
+void test_io_stream_epoll(void){
+    tcp_stream(BMB_IO_EPOLL);
+}
+
+void test_io_stream_uring(void){
+    tcp_stream(BMB_IO_URING);
+}
+
+void test_io_sessions_epoll(void){
+    sessions(BMB_IO_EPOLL);
+}
+
+void test_io_sessions_uring(void){
+    sessions(BMB_IO_URING);
+}
+
+void test_io_auto(void){
+    bmodbus_io_endpoint_t endpoint;
+    modbus_client_t modbus_client;
+    bmodbus_io_t io;
+    int fds[2];
+    stream_pair(fds);
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_io_client_endpoint(&endpoint, fds[1], &modbus_client, NULL, NULL, 0);
+    //Falls back to epoll on its own
+    TEST_ASSERT_TRUE(bmodbus_io_init(&io, &endpoint, 1, BMB_IO_AUTO) >= 0);
+    TEST_ASSERT_EQUAL(0, bmodbus_io_run(&io, 10));
+    bmodbus_io_deinit(&io);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(void) {
+    signal(SIGPIPE, SIG_IGN);
+    UNITY_BEGIN();
+    RUN_TEST(test_io_epoll);
+    RUN_TEST(test_io_uring);
+    RUN_TEST(test_io_stream_epoll);
+    RUN_TEST(test_io_stream_uring);
+    RUN_TEST(test_io_sessions_epoll);
+    RUN_TEST(test_io_sessions_uring);
+    RUN_TEST(test_io_auto);
+    return UNITY_END();
+}
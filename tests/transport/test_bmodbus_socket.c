@@ -0,0 +1,233 @@
+//
+// Tests of the RTU over TCP/UDP adapters, they need a POSIX system with loopback networking
+//
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "bmodbus.h"
+#include "bmodbus_socket.h"
+#include "unity.h"
+
+void setUp(void) {
+    // Set up code before each test
+}
+
+void tearDown(void) {
+    // Clean up code after each test
+}
+
+static void test_handler(void * context, modbus_request_t * request){
+    uint16_t * calls = (uint16_t *)context;
+    (*calls)++;
+    for(uint16_t i=0;i<request->size;i++){
+        request->data[i] = request->address + i;
+    }
+}
+
+//Binds a UDP socket to an ephemeral loopback port
+static int udp_socket(struct sockaddr_in * address){
+    socklen_t length = sizeof(*address);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address->sin_port = 0;
+    bind(fd, (struct sockaddr *)address, sizeof(*address));
+    getsockname(fd, (struct sockaddr *)address, &length);
+    return fd;
+}
+
+void test_socket_client_packets(void){
+    uint8_t junk[] = {0x02, 0x03, 0x00};
+    uint16_t calls = 0;
+    uint8_t response[64];
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    int fds[2];
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, fds));
+
+    //A truncated datagram does not swallow the next one, even with no time between them
+    TEST_ASSERT_EQUAL(sizeof(junk), write(fds[0], junk, sizeof(junk)));
+    TEST_ASSERT_EQUAL(sizeof(junk), bmodbus_socket_client_service(&modbus_client, fds[1], NULL, test_handler, &calls));
+    sending_request = bmodbus_master_read_holding_registers(&modbus_master, 2, 0x0100, 2);
+    TEST_ASSERT_EQUAL(sending_request->size, write(fds[0], sending_request->data, sending_request->size));
+    TEST_ASSERT_EQUAL(sending_request->size, bmodbus_socket_client_service(&modbus_client, fds[1], NULL, test_handler, &calls));
+    TEST_ASSERT_EQUAL(1, calls);
+    TEST_ASSERT_EQUAL(9, read(fds[0], response, sizeof(response)));
+    TEST_ASSERT_EQUAL(0x04, response[2]);
+    TEST_ASSERT_EQUAL(0x01, response[3]);
+    TEST_ASSERT_EQUAL(0x00, response[4]);
+    //The master assembles the response from packets
+    bmodbus_master_send_complete(&modbus_master, 0);
+    bmodbus_master_received_packet(&modbus_master, 100000, response, 4);
+    bmodbus_master_received_packet(&modbus_master, 200000, response + 4, 5);
+    TEST_ASSERT_EQUAL(MASTER_STATE_RESPONSE_READY, modbus_master.state);
+    TEST_ASSERT_EQUAL(0x0101, bmodbus_master_get_response(&modbus_master)->data[1]);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_socket_client_stream(void){
+    uint16_t calls = 0;
+    uint8_t requests[64], response[64];
+    uint8_t size = 0;
+    modbus_uart_request_t * sending_request = NULL;
+    bmodbus_socket_stream_t stream;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    int fds[2];
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    bmodbus_socket_stream_init(&stream);
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    //A request split in two writes is answered once it is whole
+    sending_request = bmodbus_master_read_holding_registers(&modbus_master, 2, 0x0100, 2);
+    TEST_ASSERT_EQUAL(3, write(fds[0], sending_request->data, 3));
+    TEST_ASSERT_EQUAL(3, bmodbus_socket_client_service(&modbus_client, fds[1], &stream, test_handler, &calls));
+    TEST_ASSERT_EQUAL(0, calls);
+    TEST_ASSERT_EQUAL(-1, recv(fds[0], response, sizeof(response), MSG_DONTWAIT));
+    TEST_ASSERT_EQUAL(sending_request->size - 3, write(fds[0], sending_request->data + 3, sending_request->size - 3));
+    TEST_ASSERT_EQUAL(sending_request->size - 3, bmodbus_socket_client_service(&modbus_client, fds[1], &stream, test_handler, &calls));
+    TEST_ASSERT_EQUAL(1, calls);
+    TEST_ASSERT_EQUAL(9, read(fds[0], response, sizeof(response)));
+    TEST_ASSERT_EQUAL(0x01, response[3]);
+    TEST_ASSERT_EQUAL(0x00, response[4]);
+
+    //Two requests in one write are both answered, the second one with a byte count
+    modbus_master.state = MASTER_STATE_IDLE;
+    sending_request = bmodbus_master_read_holding_registers(&modbus_master, 2, 0x0200, 1);
+    memcpy(requests, sending_request->data, sending_request->size);
+    size = sending_request->size;
+    modbus_master.state = MASTER_STATE_IDLE;
+    sending_request = bmodbus_master_write_multiple_registers(&modbus_master, 2, 0x0300, 2, (uint16_t []){0x1111, 0x2222});
+    memcpy(requests + size, sending_request->data, sending_request->size);
+    size += sending_request->size;
+    TEST_ASSERT_EQUAL(size, write(fds[0], requests, size));
+    TEST_ASSERT_EQUAL(size, bmodbus_socket_client_service(&modbus_client, fds[1], &stream, test_handler, &calls));
+    TEST_ASSERT_EQUAL(3, calls);
+    TEST_ASSERT_EQUAL(7 + 8, read(fds[0], response, sizeof(response)));
+    TEST_ASSERT_EQUAL(0x03, response[1]);
+    TEST_ASSERT_EQUAL(0x02, response[3]);
+    TEST_ASSERT_EQUAL(0x10, response[7 + 1]);
+    TEST_ASSERT_EQUAL(0, stream.length);
+
+    //A closed peer is reported
+    close(fds[0]);
+    TEST_ASSERT_EQUAL(0, bmodbus_socket_client_service(&modbus_client, fds[1], &stream, test_handler, &calls));
+    close(fds[1]);
+}
+
+void test_socket_udp_transaction(void){
+    uint16_t calls = 0;
+    uint8_t packet[64];
+    struct sockaddr_in client_address, master_address;
+    modbus_request_t * response = NULL;
+    modbus_client_t modbus_client;
+    modbus_master_t modbus_master;
+    int client_fd = udp_socket(&client_address);
+    int master_fd = udp_socket(&master_address);
+    TEST_ASSERT_TRUE(client_fd >= 0);
+    TEST_ASSERT_TRUE(master_fd >= 0);
+    TEST_ASSERT_EQUAL(0, connect(master_fd, (struct sockaddr *)&client_address, sizeof(client_address)));
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 2);
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+
+    //Nobody answers, so the master gives up and is free again
+    response = bmodbus_socket_master_transact(&modbus_master, master_fd, bmodbus_master_read_holding_registers(&modbus_master, 2, 0x0010, 3), 20);
+    TEST_ASSERT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(MASTER_STATE_IDLE, modbus_master.state);
+    //The client answers the stale request to the address it came from, which the master ignores as a late reply
+    TEST_ASSERT_TRUE(bmodbus_socket_client_service(&modbus_client, client_fd, NULL, test_handler, &calls) > 0);
+    TEST_ASSERT_EQUAL(1, calls);
+    TEST_ASSERT_EQUAL(11, recv(master_fd, packet, sizeof(packet), 0));
+
+    //Queue the reply to the next request before sending it, so a single thread can run both ends
+    {
+        modbus_master_t helper;
+        modbus_uart_request_t * request;
+        bmodbus_master_init(&helper, INTERFRAME_DELAY_MICROSECONDS(38400));
+        request = bmodbus_master_read_holding_registers(&helper, 2, 0x0020, 2);
+        TEST_ASSERT_EQUAL(request->size, sendto(master_fd, request->data, request->size, 0, (struct sockaddr *)&client_address, sizeof(client_address)));
+        TEST_ASSERT_TRUE(bmodbus_socket_client_service(&modbus_client, client_fd, NULL, test_handler, &calls) > 0);
+    }
+    response = bmodbus_socket_master_transact(&modbus_master, master_fd, bmodbus_master_read_holding_registers(&modbus_master, 2, 0x0020, 2), 1000);
+    TEST_ASSERT_NOT_EQUAL(NULL, response);
+    TEST_ASSERT_EQUAL(2, response->size);
+    TEST_ASSERT_EQUAL(0x0020, response->data[0]);
+    TEST_ASSERT_EQUAL(0x0021, response->data[1]);
+    TEST_ASSERT_EQUAL(2, calls);
+    //The request sent by the transaction is still queued at the client, it is answered like any other
+    TEST_ASSERT_TRUE(bmodbus_socket_client_service(&modbus_client, client_fd, NULL, test_handler, &calls) > 0);
+    TEST_ASSERT_EQUAL(3, calls);
+    close(client_fd);
+    close(master_fd);
+}
+
+void test_socket_send_vector(void){
+    uint8_t wire_registers[4] = {0x12, 0x34, 0x56, 0x78};
+    uint16_t registers[2] = {0x1234, 0x5678};
+    uint8_t packet[64];
+    modbus_uart_request_t * sending_request = NULL;
+    modbus_uart_vector_t vector;
+    modbus_master_t modbus_master;
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    bmodbus_master_init(&modbus_master, INTERFRAME_DELAY_MICROSECONDS(38400));
+    //The spans arrive as one frame
+    TEST_ASSERT_NOT_EQUAL(NULL, bmodbus_master_write_multiple_vector(&modbus_master, 2, 16, 0x0020, 2, wire_registers, &vector));
+    TEST_ASSERT_EQUAL(13, bmodbus_socket_send_vector(fds[0], &vector));
+    TEST_ASSERT_EQUAL(13, read(fds[1], packet, sizeof(packet)));
+    modbus_master.state = MASTER_STATE_IDLE;
+    sending_request = bmodbus_master_write_multiple_registers(&modbus_master, 2, 0x0020, 2, registers);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(sending_request->data, packet, 13);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_socket_mbap(void){
+    const uint8_t mbap[] = {0x12, 0x34, 0x00, 0x00, 0x00, 0x06, 0x07, 0x03, 0x00, 0x10, 0x00, 0x02};
+    uint8_t rtu[BMB_SOCKET_PACKET_SIZE], back[BMB_SOCKET_PACKET_SIZE];
+    uint16_t transaction = 0;
+    modbus_client_t modbus_client;
+    modbus_request_t * request;
+    bmodbus_client_init(&modbus_client, INTERFRAME_DELAY_MICROSECONDS(38400), 7);
+    //The RTU frame gets the unit as address and a CRC the client accepts
+    TEST_ASSERT_EQUAL(8, bmodbus_socket_mbap_to_rtu(mbap, sizeof(mbap), rtu, &transaction));
+    TEST_ASSERT_EQUAL(0x1234, transaction);
+    bmodbus_client_received_packet(&modbus_client, 1000, rtu, 8);
+    request = bmodbus_client_get_request(&modbus_client);
+    TEST_ASSERT_NOT_EQUAL(NULL, request);
+    TEST_ASSERT_EQUAL(0x10, request->address);
+    TEST_ASSERT_EQUAL(2, request->size);
+    //And converts back to the same MBAP frame
+    TEST_ASSERT_EQUAL(sizeof(mbap), bmodbus_socket_rtu_to_mbap(rtu, 8, transaction, back));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(mbap, back, sizeof(mbap));
+    //Other protocols and truncated frames are refused
+    memcpy(back, mbap, sizeof(mbap));
+    back[3] = 1;
+    TEST_ASSERT_EQUAL(-1, bmodbus_socket_mbap_to_rtu(back, sizeof(mbap), rtu, &transaction));
+    TEST_ASSERT_EQUAL(-1, bmodbus_socket_mbap_to_rtu(mbap, sizeof(mbap) - 1, rtu, &transaction));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_socket_client_packets);
+    RUN_TEST(test_socket_client_stream);
+    RUN_TEST(test_socket_udp_transaction);
+    RUN_TEST(test_socket_send_vector);
+    RUN_TEST(test_socket_mbap);
+    return UNITY_END();
+}
@@ -0,0 +1,547 @@
+//
+// Simulates a line of modbus slaves for load testing masters and gateways without hardware
+//
+// Every slave is a modbus_client_t with its own holding register bank. The farm listens on a pty (a multi-drop RTU
+// line where every slave sees every byte and frames are told apart by the interframe delay of --baud), on TCP (RTU over TCP, one frame per segment, each
+// connection gets its own line of slaves over the same registers, Modbus TCP with --mbap) or, with --check, on a
+// socket pair to a master in a child process that checks every answer. Responses are delayed by --latency plus up to --jitter microseconds, and a
+// share of them (in permille) can be dropped with --silence or sent with a bad CRC with --crc-errors.
+//
+//   bmodbus_farm [--slaves N] [--registers N] [--latency US] [--jitter US] [--silence PERMILLE] [--crc-errors PERMILLE]
+//                [--baud N] [--duration S] [--mbap] [--exec COMMAND] (--pty | --tcp PORT | --check TRANSACTIONS)
+//
+// --exec runs COMMAND with the shell once the farm is listening, with BMB_FARM_PTY or BMB_FARM_PORT set, and the farm
+// stops with the exit status of the command when it finishes. --tcp 0 picks a free port.
+//
+// Holding register i of slave a starts as (a << 8) ^ i, input register i reads as its complement. Other functions are
+// answered with an exception.
+//
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600 //posix_openpt()
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bmodbus.h"
+#include "bmodbus_socket.h"
+
+#define FARM_MAXIMUM_BUSES 256
+#define FARM_MAXIMUM_SLAVES 247
+
+typedef struct{
+    uint16_t slaves;
+    uint16_t registers; //Per slave
+    uint32_t latency; //Microseconds from the request to the response
+    uint32_t jitter; //Up to this many more microseconds
+    uint16_t silence; //Permille of responses never sent
+    uint16_t crc_errors; //Permille of responses sent with a bad CRC
+    uint32_t baud;
+    double duration; //Seconds, 0 to run until interrupted
+    uint8_t mbap; //TCP connections speak Modbus TCP instead of RTU over TCP
+    const char * exec;
+}farm_options_t;
+
+typedef struct{
+    int fd;
+    uint8_t packets; //Sockets carry one frame per segment, a pty is a byte stream timed like a serial line
+    uint8_t mbap; //Frames have an MBAP header instead of the address and CRC
+    uint16_t transaction; //Of the last MBAP request, echoed in the response
+    modbus_client_t * clients; //clients[a - 1] answers address a
+    uint8_t pending; //A response is waiting for its due time
+    uint32_t due;
+    uint16_t length;
+    uint8_t response[BMB_SOCKET_PACKET_SIZE];
+}farm_bus_t;
+
+typedef struct{
+    unsigned long requests;
+    unsigned long responses;
+    unsigned long broadcasts;
+    unsigned long silenced;
+    unsigned long crc_errors;
+    unsigned long overruns; //A request came while the previous response was still waiting
+}farm_totals_t;
+
+static farm_options_t options = {FARM_MAXIMUM_SLAVES, 256, 0, 0, 0, 0, 19200, 0, 0, NULL};
+static farm_totals_t totals;
+static farm_bus_t buses[FARM_MAXIMUM_BUSES];
+static uint16_t bus_count;
+static uint16_t * registers; //options.slaves banks of options.registers
+static volatile sig_atomic_t stopping;
+static pid_t child; //Of --exec or --check
+static int child_status = -1;
+
+static void farm_stop(int signal_number){
+    (void)signal_number;
+    stopping = 1;
+}
+
+static uint16_t farm_register(uint8_t address, uint16_t index){
+    return (uint16_t)((address << 8) ^ index);
+}
+
+//Requests the register bank does not answer
+static void farm_handler(uint8_t address, modbus_request_t * request){
+    uint16_t i;
+    if(request->function != 4){
+        request->result = (request->function == 3) ? MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS : MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+        return;
+    }
+    if(((uint32_t)request->address + request->size) > options.registers){
+        request->result = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        return;
+    }
+    for(i = 0; i < request->size; i++){
+        request->data[i] = (uint16_t)~farm_register(address, (uint16_t)(request->address + i));
+    }
+}
+
+static int farm_roll(uint16_t permille){
+    return permille && ((uint16_t)(rand() % 1000) < permille);
+}
+
+//Takes the response of a client, if it has one, and schedules it
+static void farm_respond(farm_bus_t * bus, modbus_client_t * client, uint32_t now){
+    modbus_request_t * request = bmodbus_client_get_request(client);
+    modbus_uart_data_t * response;
+    if(request != NULL){
+        farm_handler(client->client_address, request);
+    }
+    response = bmodbus_client_get_response(client);
+    if(response == NULL){
+        return;
+    }
+    if(response->size == 0){
+        if(client == bus->clients){ //Every slave takes a broadcast, it is counted once
+            totals.requests++;
+            totals.broadcasts++;
+        }
+    }else if(farm_roll(options.silence)){
+        totals.requests++;
+        totals.silenced++;
+    }else{
+        totals.requests++;
+        if(bus->pending){
+            totals.overruns++;
+        }
+        if(bus->mbap){
+            bus->length = (uint16_t)bmodbus_socket_rtu_to_mbap(response->data, response->size, bus->transaction, bus->response);
+        }else{
+            memcpy(bus->response, response->data, response->size);
+            bus->length = response->size;
+        }
+        if(farm_roll(options.crc_errors)){
+            //Modbus TCP has no CRC, a bad protocol identifier gets the frame dropped the same way
+            bus->response[bus->mbap ? 2 : bus->length - 1] ^= 0x5a;
+            totals.crc_errors++;
+        }
+        bus->due = now + options.latency + (options.jitter ? (uint32_t)rand() % (options.jitter + 1) : 0);
+        bus->pending = 1;
+    }
+    //The slave is free again as soon as its response is queued
+    bmodbus_client_send_complete(client);
+}
+
+static farm_bus_t * farm_add_bus(int fd, uint8_t packets, uint8_t mbap){
+    farm_bus_t * bus;
+    uint16_t i;
+    if(bus_count == FARM_MAXIMUM_BUSES){
+        return NULL;
+    }
+    bus = &buses[bus_count];
+    bus->clients = calloc(options.slaves, sizeof(modbus_client_t));
+    if(bus->clients == NULL){
+        return NULL;
+    }
+    for(i = 0; i < options.slaves; i++){
+        bmodbus_client_init(&bus->clients[i], INTERFRAME_DELAY_MICROSECONDS(options.baud), (uint8_t)(i + 1));
+        bmodbus_client_set_holding_registers(&bus->clients[i], registers + (size_t)i * options.registers, 0, options.registers);
+    }
+    bus->fd = fd;
+    bus->packets = packets;
+    bus->mbap = mbap;
+    bus->pending = 0;
+    bus_count++;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return bus;
+}
+
+static void farm_remove_bus(uint16_t index){
+    close(buses[index].fd);
+    free(buses[index].clients);
+    buses[index] = buses[--bus_count];
+}
+
+//Returns 0 when the peer has gone
+static int farm_read(farm_bus_t * bus){
+    uint8_t data[BMB_SOCKET_PACKET_SIZE], frame[BMB_SOCKET_PACKET_SIZE];
+    uint32_t now;
+    ssize_t n;
+    int length;
+    uint16_t i;
+    n = read(bus->fd, data, bus->packets ? sizeof(data) : 255); //bmodbus_client_received() takes up to 255 bytes
+    if(n < 0){
+        return (errno == EAGAIN) || (errno == EINTR);
+    }
+    if(n == 0){
+        return 0;
+    }
+    now = bmodbus_socket_microseconds();
+    if(bus->mbap){
+        if((length = bmodbus_socket_mbap_to_rtu(data, (uint16_t)n, frame, &bus->transaction)) < 0){
+            return 1;
+        }
+        memcpy(data, frame, (size_t)length);
+        n = length;
+    }
+    if(bus->packets){
+        //Every segment is a whole frame, only the slave it is addressed to needs to see it
+        if(data[0] == MODBUS_BROADCAST_ADDRESS){
+            for(i = 0; i < options.slaves; i++){
+                bmodbus_client_received_packet(&bus->clients[i], now, data, (uint16_t)n);
+                farm_respond(bus, &bus->clients[i], now);
+            }
+        }else if(data[0] <= options.slaves){
+            bmodbus_client_received_packet(&bus->clients[data[0] - 1], now, data, (uint16_t)n);
+            farm_respond(bus, &bus->clients[data[0] - 1], now);
+        }
+        return 1;
+    }
+    //A multi-drop line, every slave sees every byte and the ones not addressed skip the frame. A pty delivers a frame
+    //at once rather than at the baud rate, so the bytes of a read all get the time it arrived.
+    for(i = 0; i < options.slaves; i++){
+        bmodbus_client_received(&bus->clients[i], now, data, (uint8_t)n, 0);
+        farm_respond(bus, &bus->clients[i], now);
+    }
+    return 1;
+}
+
+static void farm_send_due(uint32_t now){
+    uint16_t i;
+    for(i = 0; i < bus_count; i++){
+        if(buses[i].pending && ((int32_t)(buses[i].due - now) <= 0)){
+            buses[i].pending = 0;
+            if(write(buses[i].fd, buses[i].response, buses[i].length) == buses[i].length){
+                totals.responses++;
+            }
+        }
+    }
+}
+
+//Milliseconds poll() may wait for, the last fraction of a millisecond is slept in farm_serve()
+static int farm_timeout(uint32_t now, uint32_t * next){
+    uint16_t i;
+    int32_t soonest = 100000;
+    for(i = 0; i < bus_count; i++){
+        if(buses[i].pending && ((int32_t)(buses[i].due - now) < soonest)){
+            soonest = (int32_t)(buses[i].due - now);
+        }
+    }
+    *next = now + (uint32_t)soonest;
+    return soonest > 0 ? soonest / 1000 : 0;
+}
+
+static void farm_serve(int listener){
+    struct pollfd events[FARM_MAXIMUM_BUSES + 1];
+    struct timespec ts;
+    uint32_t now, next;
+    double end = options.duration;
+    uint16_t i, polled;
+    int n, fd, timeout;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    end += ts.tv_sec + ts.tv_nsec * 1e-9;
+    while(!stopping && (bus_count || (listener >= 0))){
+        if((child > 0) && (waitpid(child, &n, WNOHANG) == child)){
+            child_status = WIFEXITED(n) ? WEXITSTATUS(n) : 1;
+            child = 0;
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        if((options.duration > 0) && ((ts.tv_sec + ts.tv_nsec * 1e-9) >= end)){
+            break;
+        }
+        for(i = 0; i < bus_count; i++){
+            events[i].fd = buses[i].fd;
+            events[i].events = POLLIN;
+        }
+        polled = bus_count; //Buses are removed below, the listener stays at this index
+        events[polled].fd = listener;
+        events[polled].events = POLLIN;
+        now = bmodbus_socket_microseconds();
+        timeout = farm_timeout(now, &next);
+        n = poll(events, polled + 1, timeout);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("poll");
+            return;
+        }
+        for(i = polled; i-- > 0; ){
+            if((events[i].revents & (POLLIN | POLLHUP | POLLERR)) && !farm_read(&buses[i])){
+                farm_remove_bus(i);
+            }
+        }
+        if((listener >= 0) && (events[polled].revents & POLLIN)){
+            fd = accept(listener, NULL, NULL);
+            if((fd >= 0) && (farm_add_bus(fd, 1, options.mbap) == NULL)){
+                close(fd);
+            }
+        }
+        now = bmodbus_socket_microseconds();
+        if((int32_t)(next - now) > 0 && (int32_t)(next - now) < 1000){
+            ts.tv_sec = 0;
+            ts.tv_nsec = (long)(next - now) * 1000;
+            nanosleep(&ts, NULL);
+            now = bmodbus_socket_microseconds();
+        }
+        farm_send_due(now);
+    }
+}
+
+static int farm_pty(void){
+    struct termios t;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY), peer;
+    const char * name;
+    if((fd < 0) || (grantpt(fd) != 0) || (unlockpt(fd) != 0) || ((name = ptsname(fd)) == NULL)){
+        perror("pty");
+        return -1;
+    }
+    //Raw bytes, and the farm keeps the slave end open so the master can reopen it
+    peer = open(name, O_RDWR | O_NOCTTY);
+    if((peer < 0) || (tcgetattr(peer, &t) != 0)){
+        perror(name);
+        return -1;
+    }
+    t.c_iflag &= (tcflag_t)~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    t.c_oflag &= (tcflag_t)~OPOST;
+    t.c_lflag &= (tcflag_t)~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    t.c_cflag &= (tcflag_t)~(CSIZE | PARENB);
+    t.c_cflag |= CS8;
+    tcsetattr(peer, TCSANOW, &t);
+    setenv("BMB_FARM_PTY", name, 1);
+    printf("pty %s\n", name);
+    fflush(stdout);
+    return fd;
+}
+
+static int farm_tcp(uint16_t port){
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    char text[8];
+    int fd = socket(AF_INET, SOCK_STREAM, 0), on = 1;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if((fd < 0) || (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) || (listen(fd, 64) != 0)){
+        perror("tcp");
+        return -1;
+    }
+    getsockname(fd, (struct sockaddr *)&address, &length);
+    port = ntohs(address.sin_port);
+    snprintf(text, sizeof(text), "%u", port);
+    setenv("BMB_FARM_PORT", text, 1);
+    printf("tcp %u\n", port);
+    fflush(stdout);
+    return fd;
+}
+
+static int check_compare(const void * a, const void * b){
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+//The master side of --check, reads random blocks and checks every value that comes back
+static int farm_check_master(int fd, unsigned long transactions){
+    static modbus_master_t master;
+    static uint32_t latencies[100000];
+    modbus_uart_request_t * request;
+    modbus_request_t * response;
+    unsigned long i, answered = 0, wrong = 0;
+    uint32_t start, n = 0;
+    uint16_t j, first, count, expected;
+    uint8_t address, function;
+    bmodbus_master_init(&master, INTERFRAME_DELAY_MICROSECONDS(options.baud));
+    srand(2);
+    for(i = 0; i < transactions; i++){
+        address = (uint8_t)(1 + rand() % options.slaves);
+        function = (uint8_t)(3 + (i & 1));
+        count = (uint16_t)(1 + rand() % 32);
+        first = (uint16_t)(rand() % (options.registers - count + 1));
+        request = (function == 3) ? bmodbus_master_read_holding_registers(&master, address, first, count) :
+                                    bmodbus_master_read_input_registers(&master, address, first, count);
+        start = bmodbus_socket_microseconds();
+        response = bmodbus_socket_master_transact(&master, fd, request, 100 + (int)((options.latency + options.jitter) / 1000));
+        if(response == NULL){
+            continue;
+        }
+        if(n < sizeof(latencies) / sizeof(latencies[0])){
+            latencies[n++] = bmodbus_socket_microseconds() - start;
+        }
+        answered++;
+        for(j = 0; j < count; j++){
+            expected = farm_register(address, (uint16_t)(first + j));
+            if((response->size != count) || (response->data[j] != ((function == 3) ? expected : (uint16_t)~expected))){
+                wrong++;
+                break;
+            }
+        }
+    }
+    qsort(latencies, n, sizeof(latencies[0]), check_compare);
+    printf("check transactions %lu answered %lu wrong %lu latency p50 %u us p99 %u us max %u us\n", transactions,
+           answered, wrong, n ? latencies[n / 2] : 0, n ? latencies[(n * 99) / 100] : 0, n ? latencies[n - 1] : 0);
+    if(wrong || ((answered < transactions) && !options.silence && !options.crc_errors)){
+        return 1;
+    }
+    return 0;
+}
+
+//The exit status of the child, once it is done
+static int farm_wait(void){
+    int status;
+    if(child <= 0){
+        return child_status;
+    }
+    if(waitpid(child, &status, 0) != child){
+        return 1;
+    }
+    child = 0;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+static int farm_exec(const char * command){
+    fflush(stdout);
+    child = fork();
+    if(child == 0){
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+    }
+    return child > 0 ? 0 : -1;
+}
+
+static int farm_check(unsigned long transactions){
+    int fds[2], status;
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0){
+        perror("socketpair");
+        return 1;
+    }
+    fflush(stdout);
+    child = fork();
+    if(child == 0){
+        close(fds[0]);
+        status = farm_check_master(fds[1], transactions);
+        close(fds[1]);
+        exit(status);
+    }
+    close(fds[1]);
+    if((child < 0) || (farm_add_bus(fds[0], 1, 0) == NULL)){
+        return 1;
+    }
+    farm_serve(-1);
+    return farm_wait();
+}
+
+static void usage(void){
+    fprintf(stderr, "usage: bmodbus_farm [--slaves N] [--registers N] [--latency US] [--jitter US] [--silence PERMILLE]\n"
+                    "                    [--crc-errors PERMILLE] [--baud N] [--duration S] [--mbap] [--exec COMMAND]\n"
+                    "                    (--pty | --tcp PORT | --check N)\n");
+}
+
+int main(int argc, char **argv){
+    struct sigaction action;
+    unsigned long check = 0;
+    long port = -1;
+    int i, pty = 0, listener = -1, result = 0;
+    for(i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--pty") == 0){
+            pty = 1;
+        }else if(strcmp(argv[i], "--mbap") == 0){
+            options.mbap = 1;
+        }else if(i + 1 >= argc){
+            usage();
+            return 2;
+        }else if(strcmp(argv[i], "--slaves") == 0){
+            options.slaves = (uint16_t)strtoul(argv[++i], NULL, 0);
+        }else if(strcmp(argv[i], "--registers") == 0){
+            options.registers = (uint16_t)strtoul(argv[++i], NULL, 0);
+        }else if(strcmp(argv[i], "--latency") == 0){
+            options.latency = (uint32_t)strtoul(argv[++i], NULL, 0);
+        }else if(strcmp(argv[i], "--jitter") == 0){
+            options.jitter = (uint32_t)strtoul(argv[++i], NULL, 0);
+        }else if(strcmp(argv[i], "--silence") == 0){
+            options.silence = (uint16_t)strtoul(argv[++i], NULL, 0);
+        }else if(strcmp(argv[i], "--crc-errors") == 0){
+            options.crc_errors = (uint16_t)strtoul(argv[++i], NULL, 0);
+        }else if(strcmp(argv[i], "--baud") == 0){
+            options.baud = (uint32_t)strtoul(argv[++i], NULL, 0);
+        }else if(strcmp(argv[i], "--duration") == 0){
+            options.duration = atof(argv[++i]);
+        }else if(strcmp(argv[i], "--tcp") == 0){
+            port = strtol(argv[++i], NULL, 0);
+        }else if(strcmp(argv[i], "--exec") == 0){
+            options.exec = argv[++i];
+        }else if(strcmp(argv[i], "--check") == 0){
+            check = strtoul(argv[++i], NULL, 0);
+        }else{
+            usage();
+            return 2;
+        }
+    }
+    if((options.slaves == 0) || (options.slaves > FARM_MAXIMUM_SLAVES) || (options.registers == 0) || (options.baud == 0) ||
+       ((pty + (port >= 0) + (check > 0)) != 1)){
+        usage();
+        return 2;
+    }
+    registers = malloc((size_t)options.slaves * options.registers * sizeof(uint16_t));
+    if(registers == NULL){
+        return 1;
+    }
+    for(i = 0; i < (int)options.slaves * options.registers; i++){
+        registers[i] = farm_register((uint8_t)(1 + i / options.registers), (uint16_t)(i % options.registers));
+    }
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = farm_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    srand(1);
+    if(check){
+        result = farm_check(check);
+    }else{
+        if(pty){
+            if(((i = farm_pty()) < 0) || (farm_add_bus(i, 0, 0) == NULL)){
+                return 1;
+            }
+        }else if((listener = farm_tcp((uint16_t)port)) < 0){
+            return 1;
+        }
+        if((options.exec != NULL) && (farm_exec(options.exec) != 0)){
+            return 1;
+        }
+        farm_serve(listener);
+        if(options.exec != NULL){
+            result = farm_wait();
+        }
+    }
+    printf("farm requests %lu responses %lu broadcasts %lu silenced %lu crc errors %lu overruns %lu\n", totals.requests,
+           totals.responses, totals.broadcasts, totals.silenced, totals.crc_errors, totals.overruns);
+    return result;
+}
@@ -0,0 +1,502 @@
+//
+// Open-loop load generator for modbus clients and gateways
+//
+// Requests are scheduled at a fixed rate whatever the responses do, and each latency is measured from the time the
+// request was scheduled rather than the time it could be sent, so a stalled server shows up in the tail latencies
+// instead of slowing the generator down (no coordinated omission). The service time, from the request leaving to its
+// response, is reported as well.
+//
+//   bmodbus_loadgen (--pty DEVICE | --tcp HOST:PORT [--mbap] [--connections N]) [--rate PER_SECOND] [--duration S]
+//                   [--mix FUNCTION:WEIGHT,...] [--size N] [--slaves N] [--registers N] [--timeout MS] [--baud N]
+//                   [--json] [--strict]
+//
+// A pty is a serial line, one request at a time with the interframe delay of --baud left between frames. TCP carries RTU
+// frames, or Modbus TCP with --mbap, over each of the connections. The mix takes functions 3, 4, 6 and 16, reads and
+// writes are of 1 to --size registers somewhere in the first --registers of a slave from 1 to --slaves.
+// --strict fails the run on any timeout, exception or request still queued at the end.
+//
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bmodbus.h"
+#include "bmodbus_socket.h"
+
+#define LOADGEN_MAXIMUM_CONNECTIONS 256
+#define LOADGEN_MAXIMUM_MIX 8
+
+typedef struct{
+    uint8_t function;
+    uint16_t weight;
+}loadgen_mix_t;
+
+typedef struct{
+    const char * pty;
+    const char * tcp;
+    uint8_t mbap;
+    uint16_t connections;
+    double rate;
+    double duration;
+    loadgen_mix_t mix[LOADGEN_MAXIMUM_MIX];
+    uint8_t mix_count;
+    uint16_t size;
+    uint16_t slaves;
+    uint16_t registers;
+    uint32_t timeout; //Microseconds
+    uint32_t baud;
+    uint8_t json;
+    uint8_t strict;
+}loadgen_options_t;
+
+typedef struct{
+    int fd;
+    modbus_master_t master;
+    uint8_t busy;
+    uint64_t intended; //When the request was scheduled, nanoseconds
+    uint64_t sent;
+    uint64_t quiet; //A pty line must be idle until then before the next request
+    uint16_t transaction;
+}loadgen_connection_t;
+
+typedef struct{
+    unsigned long scheduled;
+    unsigned long sent;
+    unsigned long completed;
+    unsigned long exceptions;
+    unsigned long timeouts;
+    unsigned long backlog; //Scheduled but never sent
+    unsigned long per_function[0x11];
+}loadgen_totals_t;
+
+static loadgen_options_t options;
+static loadgen_connection_t connections[LOADGEN_MAXIMUM_CONNECTIONS];
+static loadgen_totals_t totals;
+static uint32_t * latencies; //Microseconds from the scheduled time
+static uint32_t * services; //Microseconds from the time sent
+static unsigned long samples, capacity;
+static volatile sig_atomic_t stopping;
+
+static void loadgen_stop(int signal_number){
+    (void)signal_number;
+    stopping = 1;
+}
+
+static uint64_t loadgen_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int loadgen_parse_mix(const char * text){
+    char * end;
+    options.mix_count = 0;
+    while(*text && (options.mix_count < LOADGEN_MAXIMUM_MIX)){
+        options.mix[options.mix_count].function = (uint8_t)strtoul(text, &end, 0);
+        if(*end != ':'){
+            return -1;
+        }
+        options.mix[options.mix_count].weight = (uint16_t)strtoul(end + 1, &end, 0);
+        switch(options.mix[options.mix_count].function){
+            case 3: case 4: case 6: case 16: break;
+            default: return -1;
+        }
+        options.mix_count++;
+        if(*end == ','){
+            end++;
+        }
+        text = end;
+    }
+    return options.mix_count ? 0 : -1;
+}
+
+static uint8_t loadgen_pick_function(void){
+    uint32_t total = 0, pick;
+    uint8_t i;
+    for(i = 0; i < options.mix_count; i++){
+        total += options.mix[i].weight;
+    }
+    pick = total ? (uint32_t)rand() % total : 0;
+    for(i = 0; i + 1 < options.mix_count; i++){
+        if(pick < options.mix[i].weight){
+            break;
+        }
+        pick -= options.mix[i].weight;
+    }
+    return options.mix[i].function;
+}
+
+static int loadgen_open_pty(const char * path){
+    struct termios t;
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if((fd < 0) || (tcgetattr(fd, &t) != 0)){
+        perror(path);
+        return -1;
+    }
+    t.c_iflag &= (tcflag_t)~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    t.c_oflag &= (tcflag_t)~OPOST;
+    t.c_lflag &= (tcflag_t)~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    t.c_cflag &= (tcflag_t)~(CSIZE | PARENB);
+    t.c_cflag |= CS8;
+    tcsetattr(fd, TCSANOW, &t);
+    return fd;
+}
+
+static int loadgen_open_tcp(const char * target){
+    char host[256];
+    const char * colon = strrchr(target, ':');
+    struct addrinfo hints, * result;
+    int fd, on = 1;
+    if((colon == NULL) || ((size_t)(colon - target) >= sizeof(host))){
+        return -1;
+    }
+    memcpy(host, target, (size_t)(colon - target));
+    host[colon - target] = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host, colon + 1, &hints, &result) != 0){
+        fprintf(stderr, "%s: unknown host\n", target);
+        return -1;
+    }
+    fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if((fd < 0) || (connect(fd, result->ai_addr, result->ai_addrlen) != 0)){
+        perror(target);
+        freeaddrinfo(result);
+        return -1;
+    }
+    freeaddrinfo(result);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); //Every frame is a segment
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static modbus_uart_request_t * loadgen_build(modbus_master_t * master, uint8_t function){
+    static uint16_t values[123];
+    uint16_t count = (uint16_t)(1 + rand() % options.size), address;
+    uint8_t slave = (uint8_t)(1 + rand() % options.slaves);
+    if((function == 16) && (count > 123)){
+        count = 123;
+    }else if(count > 125){
+        count = 125;
+    }
+    if(count > options.registers){
+        count = options.registers;
+    }
+    address = (uint16_t)(rand() % (options.registers - count + 1));
+    switch(function){
+        case 3: return bmodbus_master_read_holding_registers(master, slave, address, count);
+        case 4: return bmodbus_master_read_input_registers(master, slave, address, count);
+        case 6: return bmodbus_master_write_single_register(master, slave, address, (uint16_t)rand());
+        default:
+            values[0] = (uint16_t)rand();
+            return bmodbus_master_write_multiple_registers(master, slave, address, count, values);
+    }
+}
+
+static void loadgen_send(loadgen_connection_t * connection, uint64_t intended){
+    uint8_t frame[BMB_SOCKET_PACKET_SIZE];
+    modbus_uart_request_t * request;
+    uint8_t function = loadgen_pick_function();
+    int length;
+    connection->master.state = MASTER_STATE_IDLE;
+    request = loadgen_build(&connection->master, function);
+    if(request == NULL){
+        return;
+    }
+    if(options.mbap){
+        length = bmodbus_socket_rtu_to_mbap(request->data, request->size, ++connection->transaction, frame);
+    }else{
+        memcpy(frame, request->data, request->size);
+        length = request->size;
+    }
+    connection->intended = intended;
+    connection->sent = loadgen_now();
+    if(write(connection->fd, frame, (size_t)length) != length){
+        bmodbus_master_timeout(&connection->master);
+        totals.timeouts++;
+        return;
+    }
+    bmodbus_master_send_complete(&connection->master, (uint32_t)(connection->sent / 1000u));
+    connection->busy = 1;
+    totals.sent++;
+    if(function < sizeof(totals.per_function) / sizeof(totals.per_function[0])){
+        totals.per_function[function]++;
+    }
+}
+
+static void loadgen_finish(loadgen_connection_t * connection, uint64_t now){
+    modbus_request_t * response = bmodbus_master_get_response(&connection->master);
+    if(response == NULL){
+        return;
+    }
+    connection->busy = 0;
+    if(options.pty){
+        connection->quiet = now + (uint64_t)INTERFRAME_DELAY_MICROSECONDS(options.baud) * 1000u;
+    }
+    totals.completed++;
+    if(response->result){
+        totals.exceptions++;
+    }
+    if(samples < capacity){
+        latencies[samples] = (uint32_t)((now - connection->intended) / 1000u);
+        services[samples] = (uint32_t)((now - connection->sent) / 1000u);
+        samples++;
+    }
+}
+
+static void loadgen_read(loadgen_connection_t * connection){
+    uint8_t data[BMB_SOCKET_PACKET_SIZE], frame[BMB_SOCKET_PACKET_SIZE];
+    uint16_t transaction;
+    uint64_t now;
+    ssize_t n;
+    int length;
+    n = read(connection->fd, data, options.pty ? 255 : sizeof(data)); //bmodbus_master_received() takes up to 255 bytes
+    if(n <= 0){
+        if((n == 0) || ((errno != EAGAIN) && (errno != EINTR))){
+            fprintf(stderr, "connection lost\n");
+            stopping = 1;
+        }
+        return;
+    }
+    now = loadgen_now();
+    if(!connection->busy){
+        return; //A late response to a request that timed out
+    }
+    if(options.pty){
+        bmodbus_master_received(&connection->master, (uint32_t)(now / 1000u), data, (uint8_t)n, 0); //The frame arrives at once
+    }else if(options.mbap){
+        length = bmodbus_socket_mbap_to_rtu(data, (uint16_t)n, frame, &transaction);
+        if((length < 0) || (transaction != connection->transaction)){
+            return;
+        }
+        bmodbus_master_received_packet(&connection->master, (uint32_t)(now / 1000u), frame, (uint16_t)length);
+    }else{
+        bmodbus_master_received_packet(&connection->master, (uint32_t)(now / 1000u), data, (uint16_t)n);
+    }
+    loadgen_finish(connection, now);
+}
+
+static int loadgen_compare(const void * a, const void * b){
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t loadgen_percentile(const uint32_t * sorted, unsigned long permille){
+    if(samples == 0){
+        return 0;
+    }
+    return sorted[(samples - 1) * permille / 1000];
+}
+
+static void loadgen_report(double seconds){
+    static const unsigned long permilles[] = {500, 900, 990, 999, 1000};
+    static const char * const names[] = {"p50", "p90", "p99", "p99.9", "max"};
+    unsigned int i;
+    qsort(latencies, samples, sizeof(latencies[0]), loadgen_compare);
+    qsort(services, samples, sizeof(services[0]), loadgen_compare);
+    if(options.json){
+        printf("{\"rate\": %.1f, \"seconds\": %.3f, \"scheduled\": %lu, \"sent\": %lu, \"completed\": %lu, \"throughput\": %.1f, "
+               "\"exceptions\": %lu, \"timeouts\": %lu, \"backlog\": %lu", options.rate, seconds, totals.scheduled, totals.sent,
+               totals.completed, totals.completed / seconds, totals.exceptions, totals.timeouts, totals.backlog);
+        for(i = 0; i < sizeof(permilles) / sizeof(permilles[0]); i++){
+            printf(", \"latency_%s\": %u, \"service_%s\": %u", names[i], loadgen_percentile(latencies, permilles[i]),
+                   names[i], loadgen_percentile(services, permilles[i]));
+        }
+        printf("}\n");
+        return;
+    }
+    printf("rate %.1f/s for %.3f s: scheduled %lu sent %lu completed %lu (%.1f/s) exceptions %lu timeouts %lu backlog %lu\n",
+           options.rate, seconds, totals.scheduled, totals.sent, totals.completed, totals.completed / seconds,
+           totals.exceptions, totals.timeouts, totals.backlog);
+    printf("functions 3:%lu 4:%lu 6:%lu 16:%lu\n", totals.per_function[3], totals.per_function[4], totals.per_function[6],
+           totals.per_function[16]);
+    printf("%-8s %10s %10s\n", "us", "latency", "service");
+    for(i = 0; i < sizeof(permilles) / sizeof(permilles[0]); i++){
+        printf("%-8s %10u %10u\n", names[i], loadgen_percentile(latencies, permilles[i]), loadgen_percentile(services, permilles[i]));
+    }
+}
+
+static int loadgen_run(void){
+    struct pollfd events[LOADGEN_MAXIMUM_CONNECTIONS];
+    uint64_t start, end, now, next, interval, soonest;
+    unsigned long queued = 0; //Scheduled and waiting for a free connection
+    struct timespec ts;
+    uint16_t i;
+    int timeout;
+    interval = (uint64_t)(1e9 / options.rate);
+    start = loadgen_now();
+    end = start + (uint64_t)(options.duration * 1e9);
+    next = start;
+    for(;;){
+        now = loadgen_now();
+        while(!stopping && (next <= now) && (next < end)){
+            totals.scheduled++;
+            queued++;
+            next += interval;
+        }
+        //Requests go out in the order they were scheduled, the oldest one first
+        for(i = 0; (i < options.connections) && queued; i++){
+            if(!connections[i].busy && (now >= connections[i].quiet)){
+                loadgen_send(&connections[i], next - queued * interval);
+                queued--;
+            }
+        }
+        now = loadgen_now(); //After the sends, which are stamped later than the time above
+        soonest = (next < end) && !stopping ? next : UINT64_MAX;
+        for(i = 0; i < options.connections; i++){
+            if(connections[i].busy){
+                if(now - connections[i].sent >= (uint64_t)options.timeout * 1000u){
+                    bmodbus_master_timeout(&connections[i].master);
+                    connections[i].busy = 0;
+                    connections[i].quiet = options.pty ? now + (uint64_t)INTERFRAME_DELAY_MICROSECONDS(options.baud) * 1000u : 0;
+                    totals.timeouts++;
+                }else if(connections[i].sent + (uint64_t)options.timeout * 1000u < soonest){
+                    soonest = connections[i].sent + (uint64_t)options.timeout * 1000u;
+                }
+            }
+            if(queued && !connections[i].busy && (connections[i].quiet < soonest)){
+                soonest = connections[i].quiet;
+            }
+            events[i].fd = connections[i].fd;
+            events[i].events = POLLIN;
+        }
+        if(soonest == UINT64_MAX){
+            for(i = 0; (i < options.connections) && !connections[i].busy; i++){
+            }
+            if(i == options.connections){
+                break; //Nothing more to send or wait for
+            }
+        }
+        timeout = (soonest <= now) ? 0 : (int)((soonest - now) / 1000000u);
+        if((soonest > now) && (timeout == 0)){
+            //poll() counts in milliseconds, a late send would show up as latency that is not the server's
+            ts.tv_sec = 0;
+            ts.tv_nsec = (long)(soonest - now);
+            nanosleep(&ts, NULL);
+        }
+        if(poll(events, options.connections, timeout) < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("poll");
+            return 1;
+        }
+        for(i = 0; i < options.connections; i++){
+            if(events[i].revents & (POLLIN | POLLHUP | POLLERR)){
+                loadgen_read(&connections[i]);
+            }
+        }
+    }
+    totals.backlog = queued;
+    loadgen_report((loadgen_now() - start) * 1e-9);
+    if(totals.completed == 0){
+        return 1;
+    }
+    return options.strict && (totals.exceptions || totals.timeouts || totals.backlog);
+}
+
+static void usage(void){
+    fprintf(stderr, "usage: bmodbus_loadgen (--pty DEVICE | --tcp HOST:PORT [--mbap] [--connections N]) [--rate PER_SECOND]\n"
+                    "                       [--duration S] [--mix FUNCTION:WEIGHT,...] [--size N] [--slaves N] [--registers N]\n"
+                    "                       [--timeout MS] [--baud N] [--json] [--strict]\n");
+}
+
+int main(int argc, char **argv){
+    struct sigaction action;
+    uint16_t i;
+    int a;
+    options.connections = 1;
+    options.rate = 100;
+    options.duration = 10;
+    options.size = 16;
+    options.slaves = 247;
+    options.registers = 256;
+    options.timeout = 100000;
+    options.baud = 19200;
+    loadgen_parse_mix("3:70,4:10,6:10,16:10");
+    for(a = 1; a < argc; a++){
+        if(strcmp(argv[a], "--mbap") == 0){
+            options.mbap = 1;
+        }else if(strcmp(argv[a], "--json") == 0){
+            options.json = 1;
+        }else if(strcmp(argv[a], "--strict") == 0){
+            options.strict = 1;
+        }else if(a + 1 >= argc){
+            usage();
+            return 2;
+        }else if(strcmp(argv[a], "--pty") == 0){
+            options.pty = argv[++a];
+        }else if(strcmp(argv[a], "--tcp") == 0){
+            options.tcp = argv[++a];
+        }else if(strcmp(argv[a], "--connections") == 0){
+            options.connections = (uint16_t)strtoul(argv[++a], NULL, 0);
+        }else if(strcmp(argv[a], "--rate") == 0){
+            options.rate = atof(argv[++a]);
+        }else if(strcmp(argv[a], "--duration") == 0){
+            options.duration = atof(argv[++a]);
+        }else if(strcmp(argv[a], "--mix") == 0){
+            if(loadgen_parse_mix(argv[++a]) != 0){
+                usage();
+                return 2;
+            }
+        }else if(strcmp(argv[a], "--size") == 0){
+            options.size = (uint16_t)strtoul(argv[++a], NULL, 0);
+        }else if(strcmp(argv[a], "--slaves") == 0){
+            options.slaves = (uint16_t)strtoul(argv[++a], NULL, 0);
+        }else if(strcmp(argv[a], "--registers") == 0){
+            options.registers = (uint16_t)strtoul(argv[++a], NULL, 0);
+        }else if(strcmp(argv[a], "--timeout") == 0){
+            options.timeout = (uint32_t)strtoul(argv[++a], NULL, 0) * 1000u;
+        }else if(strcmp(argv[a], "--baud") == 0){
+            options.baud = (uint32_t)strtoul(argv[++a], NULL, 0);
+        }else{
+            usage();
+            return 2;
+        }
+    }
+    if(((options.pty == NULL) == (options.tcp == NULL)) || (options.rate <= 0) || (options.duration <= 0) ||
+       (options.size == 0) || (options.slaves == 0) || (options.slaves > 247) || (options.registers == 0) || (options.baud == 0) ||
+       (options.connections == 0) || (options.connections > LOADGEN_MAXIMUM_CONNECTIONS) || (options.pty && options.mbap)){
+        usage();
+        return 2;
+    }
+    if(options.pty){
+        options.connections = 1; //One master per line
+    }
+    capacity = (unsigned long)(options.rate * options.duration) + 1;
+    latencies = malloc(capacity * sizeof(uint32_t));
+    services = malloc(capacity * sizeof(uint32_t));
+    if((latencies == NULL) || (services == NULL)){
+        return 1;
+    }
+    for(i = 0; i < options.connections; i++){
+        bmodbus_master_init(&connections[i].master, INTERFRAME_DELAY_MICROSECONDS(options.baud));
+        connections[i].fd = options.pty ? loadgen_open_pty(options.pty) : loadgen_open_tcp(options.tcp);
+        if(connections[i].fd < 0){
+            return 1;
+        }
+    }
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = loadgen_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    srand(1);
+    return loadgen_run();
+}
@@ -0,0 +1,388 @@
+//
+// Replays bmodbus captures (see BMB_CAPTURE in bmodbus.h) through a client and a master
+//
+// Bytes given to a client are fed to a client again and bytes given to a master are fed to a master armed with the
+// request it sent, through the same ingest API and with the same timing, so a parser change can be checked against
+// captures from the field. Replay runs as fast as possible unless --realtime is given.
+//
+//   bmodbus_replay [--realtime] [--ascii] [--address N] [--repeat N] [--print] capture.bmbc
+//   bmodbus_replay --generate capture.bmbc [transactions]
+//
+// --print writes one line per request and response decoded, the output of two builds can be diffed.
+//
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bmodbus.h"
+
+#define REPLAY_BAUD 19200
+#define REPLAY_HEADER_SIZE 5
+
+typedef struct{
+    int realtime;
+    int ascii;
+    int print;
+    int address; //-1 to take every frame
+    unsigned long repeat;
+}replay_options_t;
+
+typedef struct{
+    unsigned long records;
+    unsigned long client_bytes;
+    unsigned long master_bytes;
+    unsigned long requests;
+    unsigned long responses;
+    unsigned long sent;
+    unsigned long unanswered;
+}replay_totals_t;
+
+typedef struct{
+    modbus_client_t client;
+    modbus_master_t master;
+    uint16_t registers[256]; //Only used by --generate
+    replay_options_t options;
+    replay_totals_t totals;
+}replay_t;
+
+static double replay_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//Returns the number of bytes read, 0 on a truncated varint
+static size_t replay_varint(const uint8_t *data, size_t length, uint32_t *value){
+    size_t i;
+    uint32_t v = 0;
+    for(i = 0; (i < length) && (i < 5); i++){
+        v |= (uint32_t)(data[i] & 0x7f) << (7 * i);
+        if(!(data[i] & 0x80)){
+            *value = v;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static void replay_print_request(const char *what, uint8_t address, const modbus_request_t *request, int with_data){
+    uint16_t i;
+    printf("%s %u %02x %u %u", what, address, request->function, request->address, request->size);
+    if(request->result){
+        printf(" exception %d\n", request->result);
+        return;
+    }
+    for(i = 0; with_data && (i < request->size) && (i < BMB_MAXIMUM_MESSAGE_SIZE/2); i++){
+        printf(" %04x", request->data[i]);
+    }
+    printf("\n");
+}
+
+//Answers whatever the client decoded so it is ready for the next request
+static void replay_client_drain(replay_t *replay){
+    modbus_request_t *request = bmodbus_client_get_request(&replay->client);
+    if(request != NULL){
+        replay->totals.requests++;
+        if(replay->options.print){
+            replay_print_request("request", replay->client.client_address, request, request->function > 4);
+        }
+        if(request->function <= 4){
+            memset(request->data, 0, sizeof(request->data)); //The replay has no registers of its own
+        }
+    }
+    if(bmodbus_client_get_response(&replay->client) != NULL){
+        bmodbus_client_send_complete(&replay->client);
+    }
+}
+
+//Returns byte i of the request frame, ASCII frames are hex pairs after the ':'
+static uint8_t replay_frame_byte(const replay_t *replay, const uint8_t *frame, uint16_t i){
+    unsigned int value = 0;
+    char hex[3];
+    if(!replay->options.ascii){
+        return frame[i];
+    }
+    hex[0] = (char)frame[1 + 2 * i];
+    hex[1] = (char)frame[2 + 2 * i];
+    hex[2] = 0;
+    sscanf(hex, "%x", &value);
+    return (uint8_t)value;
+}
+
+//Puts the master in the state it was in once it had sent the request
+static void replay_master_sent(replay_t *replay, uint32_t microseconds, const uint8_t *frame, uint16_t length, uint32_t expected){
+    modbus_master_t *master = &replay->master;
+    if(master->state == MASTER_STATE_WAITING_FOR_RESPONSE){
+        replay->totals.unanswered++;
+    }
+    if(length > sizeof(master->payload.request.data)){
+        master->state = MASTER_STATE_IDLE;
+        return;
+    }
+    memcpy(master->payload.request.data, frame, length);
+    master->payload.request.size = (uint8_t)length;
+    master->payload.request.expected_response_size = (uint8_t)expected;
+    master->client_address = replay_frame_byte(replay, frame, 0);
+    master->function = replay_frame_byte(replay, frame, 1);
+    master->register_address = (replay_frame_byte(replay, frame, 2) << 8) | replay_frame_byte(replay, frame, 3);
+    master->byte_count = 0;
+    master->state = MASTER_STATE_SENDING_REQUEST;
+    bmodbus_master_send_complete(master, microseconds);
+    replay->totals.sent++;
+}
+
+static void replay_master_drain(replay_t *replay){
+    modbus_request_t *response = bmodbus_master_get_response(&replay->master);
+    if(response != NULL){
+        replay->totals.responses++;
+        if(replay->options.print){
+            replay_print_request("response", replay->master.client_address, response, response->function <= 4);
+        }
+        replay->master.state = MASTER_STATE_IDLE;
+    }
+}
+
+static void replay_reset(replay_t *replay){
+    bmodbus_client_init(&replay->client, INTERFRAME_DELAY_MICROSECONDS(REPLAY_BAUD), (uint8_t)(replay->options.address < 0 ? 1 : replay->options.address));
+#ifdef BMB_MONITOR
+    replay->client.promiscuous = replay->options.address < 0;
+#endif //BMB_MONITOR
+    bmodbus_master_init(&replay->master, INTERFRAME_DELAY_MICROSECONDS(REPLAY_BAUD));
+    bmodbus_client_set_ascii(&replay->client, (uint8_t)replay->options.ascii);
+    bmodbus_master_set_ascii(&replay->master, (uint8_t)replay->options.ascii);
+}
+
+//Returns 0 on success
+static int replay_run(replay_t *replay, const uint8_t *data, size_t length){
+    size_t offset = REPLAY_HEADER_SIZE, n;
+    uint32_t microseconds = 0, delta, count, extra;
+    uint8_t direction;
+    double start = replay_now(), elapsed = 0;
+    struct timespec ts;
+    while(offset < length){
+        if((n = replay_varint(data + offset, length - offset, &delta)) == 0){
+            break;
+        }
+        offset += n;
+        if(offset >= length){
+            break;
+        }
+        direction = data[offset++];
+        if((n = replay_varint(data + offset, length - offset, &count)) == 0){
+            break;
+        }
+        offset += n;
+        extra = 0;
+        if(BMB_CAPTURE_HAS_EXTRA(direction, count)){
+            if((n = replay_varint(data + offset, length - offset, &extra)) == 0){
+                break;
+            }
+            offset += n;
+        }
+        if(count > length - offset){
+            break;
+        }
+        microseconds += delta;
+        if(replay->options.realtime){
+            elapsed += delta * 1e-6;
+            while(replay_now() - start < elapsed){
+                ts.tv_sec = 0;
+                ts.tv_nsec = 100000;
+                nanosleep(&ts, NULL);
+            }
+        }
+        switch(direction & ~BMB_CAPTURE_PACKET){
+            case BMB_CAPTURE_CLIENT:
+                if(direction & BMB_CAPTURE_PACKET){
+                    bmodbus_client_received_packet(&replay->client, microseconds, data + offset, (uint16_t)count);
+                }else if(count == 1){
+                    bmodbus_client_next_byte(&replay->client, microseconds, data[offset]);
+                }else{
+                    bmodbus_client_received(&replay->client, microseconds, (uint8_t *)(data + offset), (uint8_t)count, extra);
+                }
+                replay_client_drain(replay);
+                replay->totals.client_bytes += count;
+                break;
+            case BMB_CAPTURE_MASTER:
+                if(direction & BMB_CAPTURE_PACKET){
+                    bmodbus_master_received_packet(&replay->master, microseconds, data + offset, (uint16_t)count);
+                }else if(count == 1){
+                    bmodbus_master_next_byte(&replay->master, microseconds, data[offset]);
+                }else{
+                    bmodbus_master_received(&replay->master, microseconds, (uint8_t *)(data + offset), (uint8_t)count, extra);
+                }
+                replay_master_drain(replay);
+                replay->totals.master_bytes += count;
+                break;
+            case BMB_CAPTURE_MASTER_SENT:
+                replay_master_sent(replay, microseconds, data + offset, (uint16_t)count, extra);
+                break;
+            default:
+                fprintf(stderr, "unknown direction 0x%02x at offset %zu\n", direction, offset);
+                return 1;
+        }
+        offset += count;
+        replay->totals.records++;
+    }
+    if(offset != length){
+        fprintf(stderr, "truncated record at offset %zu\n", offset);
+        return 1;
+    }
+    return 0;
+}
+
+static void generate_write(void *context, const uint8_t *data, uint16_t length){
+    fwrite(data, 1, length, (FILE *)context);
+}
+
+//Sends a frame a UART FIFO at a time, like an interrupt handler would
+static void generate_send(replay_t *replay, int to_client, uint32_t *microseconds, const uint8_t *data, uint8_t length, uint8_t corrupt){
+    uint8_t frame[BMB_MAXIMUM_MESSAGE_SIZE], chunk;
+    uint32_t byte_time = BYTE_TIMING_IN_MICROSECONDS(REPLAY_BAUD);
+    uint16_t i;
+    memcpy(frame, data, length);
+    if(corrupt){
+        frame[length / 2] ^= 0x10;
+    }
+    for(i = 0; i < length; i += chunk){
+        chunk = (uint8_t)((length - i) > 16 ? 16 : (length - i));
+        *microseconds += chunk * byte_time;
+        if(to_client){
+            bmodbus_client_received(&replay->client, *microseconds, frame + i, chunk, byte_time);
+        }else{
+            bmodbus_master_received(&replay->master, *microseconds, frame + i, chunk, byte_time);
+        }
+    }
+}
+
+//Writes a capture of a master polling a client with a register bank, a few frames are corrupted
+static int generate(const char *path, unsigned long transactions){
+    static replay_t replay;
+    modbus_capture_t capture;
+    modbus_uart_request_t *request;
+    modbus_uart_data_t *response;
+    uint16_t values[8];
+    uint32_t microseconds = 0;
+    unsigned long i;
+    FILE *file = fopen(path, "wb");
+    if(file == NULL){
+        perror(path);
+        return 1;
+    }
+    memset(&replay, 0, sizeof(replay));
+    bmodbus_client_init(&replay.client, INTERFRAME_DELAY_MICROSECONDS(REPLAY_BAUD), 1);
+    bmodbus_master_init(&replay.master, INTERFRAME_DELAY_MICROSECONDS(REPLAY_BAUD));
+    bmodbus_client_set_holding_registers(&replay.client, replay.registers, 0, 256);
+    bmodbus_capture_init(&capture, generate_write, file);
+    bmodbus_client_set_capture(&replay.client, &capture);
+    bmodbus_master_set_capture(&replay.master, &capture);
+    srand(1);
+    for(i = 0; i < transactions; i++){
+        replay.master.state = MASTER_STATE_IDLE;
+        values[0] = (uint16_t)i;
+        switch(i % 4){
+            case 0: request = bmodbus_master_read_holding_registers(&replay.master, 1, (uint16_t)(rand() % 200), (uint16_t)(1 + rand() % 50)); break;
+            case 1: request = bmodbus_master_write_single_register(&replay.master, 1, (uint16_t)(rand() % 256), values[0]); break;
+            case 2: request = bmodbus_master_write_multiple_registers(&replay.master, 1, (uint16_t)(rand() % 240), 8, values); break;
+            default: request = bmodbus_master_read_holding_registers(&replay.master, (uint8_t)(2 + rand() % 3), 0, 4); break; //Nobody answers
+        }
+        if(request == NULL){
+            continue;
+        }
+        microseconds += 5000;
+        generate_send(&replay, 1, &microseconds, request->data, request->size, (uint8_t)(rand() % 50 == 0));
+        bmodbus_master_send_complete(&replay.master, microseconds);
+        response = bmodbus_client_get_response(&replay.client);
+        if(response == NULL){
+            bmodbus_master_timeout(&replay.master);
+            continue;
+        }
+        microseconds += 1000;
+        generate_send(&replay, 0, &microseconds, response->data, response->size, (uint8_t)(rand() % 50 == 0));
+        bmodbus_client_send_complete(&replay.client);
+    }
+    fclose(file);
+    return 0;
+}
+
+static void usage(void){
+    fprintf(stderr, "usage: bmodbus_replay [--realtime] [--ascii] [--address N] [--repeat N] [--print] capture.bmbc\n"
+                    "       bmodbus_replay --generate capture.bmbc [transactions]\n");
+}
+
+int main(int argc, char **argv){
+    static replay_t replay;
+    const char *path = NULL;
+    const uint8_t *data;
+    struct stat st;
+    unsigned long r;
+    double start, seconds;
+    int i, fd, result = 0;
+    replay.options.address = -1;
+    replay.options.repeat = 1;
+    for(i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--generate") == 0 && i + 1 < argc){
+            return generate(argv[i + 1], (i + 2 < argc) ? strtoul(argv[i + 2], NULL, 0) : 1000);
+        }else if(strcmp(argv[i], "--realtime") == 0){
+            replay.options.realtime = 1;
+        }else if(strcmp(argv[i], "--ascii") == 0){
+            replay.options.ascii = 1;
+        }else if(strcmp(argv[i], "--print") == 0){
+            replay.options.print = 1;
+        }else if(strcmp(argv[i], "--address") == 0 && i + 1 < argc){
+            replay.options.address = atoi(argv[++i]);
+        }else if(strcmp(argv[i], "--repeat") == 0 && i + 1 < argc){
+            replay.options.repeat = strtoul(argv[++i], NULL, 0);
+        }else if(argv[i][0] != '-' && path == NULL){
+            path = argv[i];
+        }else{
+            usage();
+            return 2;
+        }
+    }
+    if(path == NULL){
+        usage();
+        return 2;
+    }
+    //Captures can be gigabytes, map them rather than reading them in
+    if(((fd = open(path, O_RDONLY)) < 0) || (fstat(fd, &st) != 0)){
+        perror(path);
+        return 1;
+    }
+    if(st.st_size < REPLAY_HEADER_SIZE){
+        fprintf(stderr, "%s: not a capture\n", path);
+        return 1;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED){
+        perror(path);
+        return 1;
+    }
+    if((memcmp(data, "BMBC", 4) != 0) || (data[4] != BMB_CAPTURE_VERSION)){
+        fprintf(stderr, "%s: not a version %d capture\n", path, BMB_CAPTURE_VERSION);
+        return 1;
+    }
+    start = replay_now();
+    for(r = 0; (r < replay.options.repeat) && (result == 0); r++){
+        replay_reset(&replay);
+        result = replay_run(&replay, data, (size_t)st.st_size);
+    }
+    seconds = replay_now() - start;
+    printf("records %lu client bytes %lu master bytes %lu requests %lu sent %lu responses %lu unanswered %lu\n",
+           replay.totals.records, replay.totals.client_bytes, replay.totals.master_bytes, replay.totals.requests,
+           replay.totals.sent, replay.totals.responses, replay.totals.unanswered);
+    printf("%.3f s, %.1f MB/s\n", seconds, seconds > 0 ? (replay.totals.client_bytes + replay.totals.master_bytes) / seconds / 1e6 : 0.0);
+    munmap((void *)data, (size_t)st.st_size);
+    return result;
+}
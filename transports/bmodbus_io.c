@@ -0,0 +1,631 @@
+/* MIT Style License
+
+Copyright (c) 2025 Bill McCartney
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE //syscall() and MAP_POPULATE
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#ifndef BMB_IO_NO_URING //Define it to build against headers older than io_uring
+#include <linux/io_uring.h>
+#endif //BMB_IO_NO_URING
+#include "bmodbus_io.h"
+
+#define IO_OP_READ 1
+#define IO_OP_WRITE 2
+#define IO_OP_OTHER 3 //Completions that belong to no endpoint operation, the timeout and the cancels
+#define IO_USER_DATA(index, op) (((uint64_t)(index) << 2) | (op))
+#define IO_TIMEOUT_USER_DATA (~(uint64_t)0) //Its operation bits read IO_OP_OTHER
+#define IO_MAXIMUM_ENTRIES 32768u //Largest ring the kernel accepts
+#define IO_WAITING_FOR_OUTPUT 2 //Value of writing while epoll waits for room to write
+
+void bmodbus_io_client_endpoint(bmodbus_io_endpoint_t * endpoint, int fd, modbus_client_t * client, bmodbus_socket_handler_t handler, void * context, uint32_t microseconds_per_byte){
+    socklen_t type_length = sizeof(int);
+    int type = 0;
+    memset(endpoint, 0, offsetof(bmodbus_io_endpoint_t, stream));
+    bmodbus_socket_stream_init(&endpoint->stream);
+    endpoint->fd = fd;
+    endpoint->client = client;
+    endpoint->handler = handler;
+    endpoint->context = context;
+    endpoint->microseconds_per_byte = microseconds_per_byte;
+    //TCP has no packet boundaries, datagrams and serial ports do not need the stream
+    endpoint->tcp = (microseconds_per_byte == 0) && (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_length) == 0) && (type == SOCK_STREAM);
+}
+
+void bmodbus_io_master_endpoint(bmodbus_io_endpoint_t * endpoint, int fd, modbus_master_t * master, uint32_t microseconds_per_byte){
+    memset(endpoint, 0, offsetof(bmodbus_io_endpoint_t, stream));
+    bmodbus_socket_stream_init(&endpoint->stream);
+    endpoint->fd = fd;
+    endpoint->master = master;
+    endpoint->microseconds_per_byte = microseconds_per_byte;
+}
+
+//The frame the endpoint sends lives in the payload of its modbus instance
+static uint8_t * io_frame(bmodbus_io_endpoint_t * endpoint, uint16_t * size){
+    if(endpoint->client != NULL){
+        *size = endpoint->client->payload.response.size;
+        return endpoint->client->payload.response.data;
+    }
+    *size = endpoint->master->payload.request.size;
+    return endpoint->master->payload.request.data;
+}
+
+static uint16_t io_index(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint){
+    return (uint16_t)(endpoint - io->endpoints);
+}
+
+#ifndef BMB_IO_NO_URING
+static int io_uring_enter_wait(bmodbus_io_t * io, unsigned wait){
+    int n;
+    do{
+        n = (int)syscall(__NR_io_uring_enter, io->fd, io->queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    }while((n < 0) && (errno == EINTR));
+    io->queued = *io->sq_tail - __atomic_load_n(io->sq_head, __ATOMIC_ACQUIRE);
+    return n;
+}
+
+static int io_uring_queue(bmodbus_io_t * io, uint8_t opcode, int fd, void * address, unsigned length, uint64_t offset, uint16_t buffer, uint64_t user_data){
+    struct io_uring_sqe * sqe;
+    unsigned tail = *io->sq_tail, index;
+    if((tail - __atomic_load_n(io->sq_head, __ATOMIC_ACQUIRE)) >= io->sq_entries){
+        //Full, hand what is queued to the kernel to make room
+        if((io_uring_enter_wait(io, 0) < 0) || (io->queued >= io->sq_entries)){
+            return -1;
+        }
+    }
+    index = tail & io->sq_mask;
+    sqe = &((struct io_uring_sqe *)io->sqes)[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)address;
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->buf_index = buffer;
+    sqe->user_data = user_data;
+    io->sq_array[index] = index;
+    __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    io->queued++;
+    return 0;
+}
+
+static void io_uring_stop(bmodbus_io_t * io){
+    if(io->sqes != NULL){
+        munmap(io->sqes, io->sqes_size);
+    }
+    if((io->cq_ring != NULL) && (io->cq_ring != io->sq_ring)){
+        munmap(io->cq_ring, io->cq_ring_size);
+    }
+    if(io->sq_ring != NULL){
+        munmap(io->sq_ring, io->sq_ring_size);
+    }
+    if(io->fd >= 0){
+        close(io->fd);
+    }
+    io->sqes = NULL;
+    io->cq_ring = NULL;
+    io->sq_ring = NULL;
+    io->fd = -1;
+}
+
+//Registers the receive buffer and the instance payload of every endpoint, the ring works without them if this fails
+static void io_uring_register_buffers(bmodbus_io_t * io){
+    struct iovec * vectors = malloc(2u * io->count * sizeof(struct iovec));
+    uint16_t size, i;
+    if(vectors == NULL){
+        return;
+    }
+    for(i = 0; i < io->count; i++){
+        vectors[2 * i].iov_base = io->endpoints[i].stream.data;
+        vectors[2 * i].iov_len = sizeof(io->endpoints[i].stream.data);
+        vectors[2 * i + 1].iov_base = io_frame(&io->endpoints[i], &size);
+        vectors[2 * i + 1].iov_len = BMB_MAXIMUM_MESSAGE_SIZE;
+    }
+    io->fixed = (syscall(__NR_io_uring_register, io->fd, IORING_REGISTER_BUFFERS, vectors, 2u * io->count) == 0);
+    free(vectors);
+}
+
+static int io_uring_start(bmodbus_io_t * io){
+    struct io_uring_params params;
+    unsigned entries = 2u * io->count + 2u; //A read and a write per endpoint, and the timeout
+    void * map;
+    memset(&params, 0, sizeof(params));
+    if(entries > IO_MAXIMUM_ENTRIES){
+        entries = IO_MAXIMUM_ENTRIES;
+    }
+    io->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if(io->fd < 0){
+        return -1;
+    }
+    if(!(params.features & IORING_FEAT_FAST_POLL)){
+        //Without it every idle socket read holds a kernel worker, epoll scales better
+        io_uring_stop(io);
+        errno = ENOTSUP;
+        return -1;
+    }
+    io->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    io->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(io->cq_ring_size > io->sq_ring_size){
+            io->sq_ring_size = io->cq_ring_size;
+        }
+        io->cq_ring_size = io->sq_ring_size;
+    }
+    map = mmap(NULL, io->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->fd, IORING_OFF_SQ_RING);
+    if(map == MAP_FAILED){
+        io_uring_stop(io);
+        return -1;
+    }
+    io->sq_ring = map;
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        io->cq_ring = io->sq_ring;
+    }else{
+        map = mmap(NULL, io->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->fd, IORING_OFF_CQ_RING);
+        if(map == MAP_FAILED){
+            io_uring_stop(io);
+            return -1;
+        }
+        io->cq_ring = map;
+    }
+    io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    map = mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->fd, IORING_OFF_SQES);
+    if(map == MAP_FAILED){
+        io_uring_stop(io);
+        return -1;
+    }
+    io->sqes = map;
+    io->sq_head = (unsigned *)(io->sq_ring + params.sq_off.head);
+    io->sq_tail = (unsigned *)(io->sq_ring + params.sq_off.tail);
+    io->sq_array = (unsigned *)(io->sq_ring + params.sq_off.array);
+    io->sq_mask = *(unsigned *)(io->sq_ring + params.sq_off.ring_mask);
+    io->sq_entries = params.sq_entries;
+    io->cq_head = (unsigned *)(io->cq_ring + params.cq_off.head);
+    io->cq_tail = (unsigned *)(io->cq_ring + params.cq_off.tail);
+    io->cq_mask = *(unsigned *)(io->cq_ring + params.cq_off.ring_mask);
+    io->cqes = io->cq_ring + params.cq_off.cqes;
+    io_uring_register_buffers(io);
+    return 0;
+}
+#endif //BMB_IO_NO_URING
+
+//Stops serving an endpoint, an instance waiting on its write is released
+static void io_close(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint){
+    endpoint->closed = 1;
+    if(endpoint->writing){
+        endpoint->writing = 0;
+        if(endpoint->client != NULL){
+            bmodbus_client_send_complete(endpoint->client);
+        }else{
+            bmodbus_master_timeout(endpoint->master);
+        }
+    }
+    if(io->backend == BMB_IO_EPOLL){
+        epoll_ctl(io->fd, EPOLL_CTL_DEL, endpoint->fd, NULL);
+    }
+}
+
+static void io_written(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint, size_t length);
+static void io_client_stream(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint);
+
+//Starts (or carries on) writing the frame of the endpoint
+static int io_write(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint){
+    uint16_t size;
+    uint8_t * frame = io_frame(endpoint, &size);
+    struct epoll_event event;
+    ssize_t n;
+#ifndef BMB_IO_NO_URING
+    if(io->backend == BMB_IO_URING){
+        uint16_t index = io_index(io, endpoint);
+        if(io_uring_queue(io, io->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, endpoint->fd, frame + endpoint->written,
+                          size - endpoint->written, 0, 2 * index + 1, IO_USER_DATA(index, IO_OP_WRITE)) < 0){
+            endpoint->writing = 1;
+            io_close(io, endpoint);
+            return -1;
+        }
+        endpoint->writing = 1;
+        endpoint->submitted++;
+        return 0;
+    }
+#endif //BMB_IO_NO_URING
+    n = write(endpoint->fd, frame + endpoint->written, size - endpoint->written);
+    if(n >= 0){
+        if(endpoint->writing == 0){
+            endpoint->writing = 1;
+        }
+        io_written(io, endpoint, (size_t)n);
+        return 0;
+    }
+    if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)){
+        endpoint->writing = 1;
+        io_close(io, endpoint);
+        return -1;
+    }
+    if(endpoint->writing != IO_WAITING_FOR_OUTPUT){
+        event.events = EPOLLIN | EPOLLOUT;
+        event.data.u32 = io_index(io, endpoint);
+        epoll_ctl(io->fd, EPOLL_CTL_MOD, endpoint->fd, &event);
+    }
+    endpoint->writing = IO_WAITING_FOR_OUTPUT;
+    return 0;
+}
+
+static void io_written(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint, size_t length){
+    struct epoll_event event;
+    uint16_t size;
+    io_frame(endpoint, &size);
+    endpoint->written += (uint16_t)length;
+    if(endpoint->written < size){
+        io_write(io, endpoint);
+        return;
+    }
+    if(endpoint->writing == IO_WAITING_FOR_OUTPUT){
+        event.events = EPOLLIN;
+        event.data.u32 = io_index(io, endpoint);
+        epoll_ctl(io->fd, EPOLL_CTL_MOD, endpoint->fd, &event);
+    }
+    endpoint->writing = 0;
+    endpoint->written = 0;
+    if(endpoint->client != NULL){
+        bmodbus_client_send_complete(endpoint->client);
+        if(endpoint->tcp){
+            io_client_stream(io, endpoint); //The requests that came in the meantime
+        }
+    }else{
+        bmodbus_master_send_complete(endpoint->master, bmodbus_socket_microseconds());
+    }
+}
+
+//Answers the request a client completed, if any
+static void io_client_respond(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint){
+    modbus_request_t * request = bmodbus_client_get_request(endpoint->client);
+    modbus_uart_data_t * response;
+    if(request != NULL){
+        if(endpoint->handler != NULL){
+            endpoint->handler(endpoint->context, request);
+        }else{
+            request->result = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        }
+    }
+    response = bmodbus_client_get_response(endpoint->client);
+    if(response == NULL){
+        return;
+    }
+    if(response->size == 0){ //Broadcast
+        bmodbus_client_send_complete(endpoint->client);
+        return;
+    }
+    endpoint->written = 0;
+    io_write(io, endpoint);
+}
+
+//Answers the whole requests held by a TCP client one at a time, the next one waits until the response is written
+static void io_client_stream(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint){
+    uint32_t now = bmodbus_socket_microseconds();
+    while(!endpoint->writing && !endpoint->closed && bmodbus_socket_stream_next(&endpoint->stream, endpoint->client, now)){
+        io_client_respond(io, endpoint);
+    }
+}
+
+//Where the next read of an endpoint lands and how much room it has
+static uint8_t * io_read_buffer(bmodbus_io_endpoint_t * endpoint, size_t * room){
+    uint16_t kept = endpoint->tcp ? endpoint->stream.length : 0;
+    *room = sizeof(endpoint->stream.data) - kept;
+    return endpoint->stream.data + kept;
+}
+
+static void io_received(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint, size_t length){
+    uint32_t now = bmodbus_socket_microseconds(), duration, last;
+    size_t offset, chunk;
+    if(endpoint->tcp){
+        endpoint->stream.length += (uint16_t)length;
+        io_client_stream(io, endpoint);
+        return;
+    }
+    if(endpoint->microseconds_per_byte == 0){ //Datagrams are whole frames, the master assembles its response from any packets
+        if(endpoint->client != NULL){
+            bmodbus_client_received_packet(endpoint->client, now, endpoint->stream.data, (uint16_t)length);
+        }else{
+            bmodbus_master_received_packet(endpoint->master, now, endpoint->stream.data, (uint16_t)length);
+        }
+    }else{
+        //Serial bytes are timed as if the last one just arrived, but never as overlapping the previous read
+        last = (endpoint->client != NULL) ? endpoint->client->last_microseconds : endpoint->master->last_microseconds;
+        duration = (uint32_t)length * endpoint->microseconds_per_byte;
+        if((now - last) < duration){
+            now = last + duration;
+        }
+        for(offset = 0; offset < length; offset += chunk){
+            chunk = (length - offset > 255) ? 255 : length - offset;
+            if(endpoint->client != NULL){
+                bmodbus_client_received(endpoint->client, now - (uint32_t)(length - offset - chunk) * endpoint->microseconds_per_byte,
+                                        endpoint->stream.data + offset, (uint8_t)chunk, endpoint->microseconds_per_byte);
+            }else{
+                bmodbus_master_received(endpoint->master, now - (uint32_t)(length - offset - chunk) * endpoint->microseconds_per_byte,
+                                        endpoint->stream.data + offset, (uint8_t)chunk, endpoint->microseconds_per_byte);
+            }
+        }
+    }
+    if((endpoint->client != NULL) && !endpoint->writing){
+        io_client_respond(io, endpoint);
+    }
+}
+
+static void io_master_loop(bmodbus_io_t * io){
+    uint32_t now = bmodbus_socket_microseconds();
+    uint16_t i;
+    for(i = 0; i < io->count; i++){
+        if(io->endpoints[i].master != NULL){
+            bmodbus_master_loop(io->endpoints[i].master, now);
+        }
+    }
+}
+
+int bmodbus_io_init(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoints, uint16_t count, uint8_t backend){
+    struct epoll_event event;
+    uint16_t i;
+    memset(io, 0, sizeof(*io));
+    io->fd = -1;
+    io->endpoints = endpoints;
+    io->count = count;
+    for(i = 0; i < count; i++){
+        endpoints[i].reading = 0;
+        endpoints[i].writing = 0;
+        endpoints[i].written = 0;
+        endpoints[i].submitted = 0;
+        endpoints[i].closed = (endpoints[i].fd < 0); //A slot waiting for bmodbus_io_rebind()
+    }
+#ifndef BMB_IO_NO_URING
+    if(backend != BMB_IO_EPOLL){
+        if(io_uring_start(io) == 0){
+            io->backend = BMB_IO_URING;
+            return BMB_IO_URING;
+        }
+        if(backend == BMB_IO_URING){
+            return -1;
+        }
+    }
+#else
+    if(backend == BMB_IO_URING){
+        errno = ENOSYS;
+        return -1;
+    }
+#endif //BMB_IO_NO_URING
+    io->fd = epoll_create1(EPOLL_CLOEXEC);
+    if(io->fd < 0){
+        return -1;
+    }
+    for(i = 0; i < count; i++){
+        if(endpoints[i].closed){
+            continue;
+        }
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        if(epoll_ctl(io->fd, EPOLL_CTL_ADD, endpoints[i].fd, &event) < 0){
+            close(io->fd);
+            io->fd = -1;
+            return -1;
+        }
+    }
+    io->backend = BMB_IO_EPOLL;
+    return BMB_IO_EPOLL;
+}
+
+int bmodbus_io_master_send(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint){
+    if((endpoint->master == NULL) || (endpoint->master->state != MASTER_STATE_SENDING_REQUEST) || endpoint->writing || endpoint->closed){
+        return -1;
+    }
+    endpoint->written = 0;
+    return io_write(io, endpoint);
+}
+
+#ifndef BMB_IO_NO_URING
+static void io_uring_completed(bmodbus_io_t * io, uint64_t user_data, int result){
+    bmodbus_io_endpoint_t * endpoint = &io->endpoints[user_data >> 2];
+    endpoint->submitted--;
+    if(endpoint->closed){
+        //Left over from before it was closed
+        if((user_data & 3) == IO_OP_READ){
+            endpoint->reading = 0;
+        }
+        return;
+    }
+    if((user_data & 3) == IO_OP_READ){
+        endpoint->reading = 0;
+        if(result > 0){
+            io_received(io, endpoint, (size_t)result);
+        }else if((result == 0) || ((result != -EAGAIN) && (result != -EINTR))){
+            io_close(io, endpoint);
+        }
+        return;
+    }
+    if(result >= 0){
+        io_written(io, endpoint, (size_t)result);
+    }else if((result == -EAGAIN) || (result == -EINTR)){
+        io_write(io, endpoint);
+    }else{
+        io_close(io, endpoint);
+    }
+}
+
+static int io_uring_run(bmodbus_io_t * io, int timeout_ms){
+    struct io_uring_cqe * cqe;
+    bmodbus_io_endpoint_t * endpoint;
+    uint64_t user_data;
+    unsigned head, tail;
+    int handled = 0, result;
+    uint8_t * buffer;
+    size_t room;
+    unsigned wait = (timeout_ms != 0);
+    uint16_t i;
+    //Every endpoint always has a read waiting, they are all submitted along with the responses in one call
+    for(i = 0; i < io->count; i++){
+        endpoint = &io->endpoints[i];
+        //A TCP client moves the bytes it keeps once its response is written, no read may be landing behind them then
+        if(endpoint->reading || endpoint->closed || (endpoint->tcp && endpoint->writing)){
+            continue;
+        }
+        buffer = io_read_buffer(endpoint, &room);
+        if(io_uring_queue(io, io->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, endpoint->fd, buffer,
+                          (unsigned)room, 0, 2 * i, IO_USER_DATA(i, IO_OP_READ)) < 0){
+            break; //Tried again on the next run
+        }
+        endpoint->reading = 1;
+        endpoint->submitted++;
+    }
+    if(timeout_ms > 0){
+        //Ends the wait after the timeout, or as soon as anything else completes
+        io->timeout[0] = timeout_ms / 1000;
+        io->timeout[1] = (int64_t)(timeout_ms % 1000) * 1000000;
+        //A full ring is handed to the kernel first, if there is still no room a wait without its timeout could last forever
+        if(io_uring_queue(io, IORING_OP_TIMEOUT, -1, io->timeout, 1, 1, 0, IO_TIMEOUT_USER_DATA) < 0){
+            wait = 0; //Only what is already complete is handled
+        }
+    }
+    if(io_uring_enter_wait(io, wait) < 0){
+        return -1;
+    }
+    head = *io->cq_head;
+    tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+    while(head != tail){
+        cqe = &((struct io_uring_cqe *)io->cqes)[head & io->cq_mask];
+        user_data = cqe->user_data;
+        result = cqe->res;
+        __atomic_store_n(io->cq_head, ++head, __ATOMIC_RELEASE);
+        if((user_data & 3) != IO_OP_OTHER){
+            io_uring_completed(io, user_data, result);
+            handled++;
+        }
+        tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+    }
+    io_master_loop(io);
+    return handled;
+}
+#endif //BMB_IO_NO_URING
+
+static int io_epoll_run(bmodbus_io_t * io, int timeout_ms){
+    struct epoll_event events[64];
+    bmodbus_io_endpoint_t * endpoint;
+    struct epoll_event event;
+    ssize_t received;
+    uint8_t * buffer;
+    size_t room;
+    int n, i;
+    n = epoll_wait(io->fd, events, sizeof(events) / sizeof(events[0]), timeout_ms);
+    if(n < 0){
+        return (errno == EINTR) ? 0 : -1;
+    }
+    for(i = 0; i < n; i++){
+        endpoint = &io->endpoints[events[i].data.u32];
+        if(endpoint->closed){
+            continue;
+        }
+        if((events[i].events & EPOLLOUT) && endpoint->writing){
+            io_write(io, endpoint);
+        }
+        if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+            buffer = io_read_buffer(endpoint, &room);
+            if(room == 0){ //Requests are waiting for the response being written, only its room to write matters until then
+                event.events = EPOLLOUT;
+                event.data.u32 = events[i].data.u32;
+                epoll_ctl(io->fd, EPOLL_CTL_MOD, endpoint->fd, &event);
+                continue;
+            }
+            received = read(endpoint->fd, buffer, room);
+            if(received > 0){
+                io_received(io, endpoint, (size_t)received);
+            }else if((received == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))){
+                io_close(io, endpoint);
+            }
+        }
+    }
+    io_master_loop(io);
+    return n;
+}
+
+int bmodbus_io_remove(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint){
+    if(!endpoint->closed){
+        io_close(io, endpoint);
+    }
+#ifndef BMB_IO_NO_URING
+    if((io->backend == BMB_IO_URING) && endpoint->reading){
+        //The read holds on to the descriptor until it completes, even once the application closed it
+        return io_uring_queue(io, IORING_OP_ASYNC_CANCEL, -1, (void *)(uintptr_t)IO_USER_DATA(io_index(io, endpoint), IO_OP_READ),
+                              0, 0, 0, IO_USER_DATA(io_index(io, endpoint), IO_OP_OTHER));
+    }
+#endif //BMB_IO_NO_URING
+    return 0;
+}
+
+int bmodbus_io_rebind(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint, int fd){
+    socklen_t type_length = sizeof(int);
+    struct epoll_event event;
+    int type = 0;
+    if(!endpoint->closed || endpoint->submitted){
+        errno = EBUSY; //Still served, or io_uring has not given back the operations of the last session yet
+        return -1;
+    }
+    endpoint->fd = fd;
+    endpoint->reading = 0;
+    endpoint->writing = 0;
+    endpoint->written = 0;
+    bmodbus_socket_stream_init(&endpoint->stream);
+    if(endpoint->client != NULL){
+        endpoint->tcp = (endpoint->microseconds_per_byte == 0) && (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_length) == 0) && (type == SOCK_STREAM);
+    }
+    if(io->backend == BMB_IO_EPOLL){
+        event.events = EPOLLIN;
+        event.data.u32 = io_index(io, endpoint);
+        if(epoll_ctl(io->fd, EPOLL_CTL_ADD, fd, &event) < 0){
+            return -1;
+        }
+    }
+    endpoint->closed = 0;
+    return 0;
+}
+
+int bmodbus_io_run(bmodbus_io_t * io, int timeout_ms){
+#ifndef BMB_IO_NO_URING
+    if(io->backend == BMB_IO_URING){
+        return io_uring_run(io, timeout_ms);
+    }
+#endif //BMB_IO_NO_URING
+    return io_epoll_run(io, timeout_ms);
+}
+
+void bmodbus_io_deinit(bmodbus_io_t * io){
+#ifndef BMB_IO_NO_URING
+    if(io->backend == BMB_IO_URING){
+        io_uring_stop(io);
+        return;
+    }
+#endif //BMB_IO_NO_URING
+    if(io->fd >= 0){
+        close(io->fd);
+        io->fd = -1;
+    }
+}
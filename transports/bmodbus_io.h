@@ -0,0 +1,169 @@
+/**
+ * @file bmodbus_io.h
+ * @brief Linux I/O engine for gateways serving many sockets and serial ports from one thread
+ *
+ * Every endpoint is a file descriptor (a TCP session, a connected UDP socket or a tty) bound to one modbus client or master.
+ * With io_uring, a read stays queued on every endpoint and the reads, the responses and the wait all go to the kernel
+ * in a single system call per bmodbus_io_run(). Reads land in the endpoint buffer and responses are written straight
+ * from the payload buffer of the modbus instance, both registered with the ring when the kernel allows it. Where
+ * io_uring is not available (old kernels, containers that filter it) the same endpoints are served with epoll.
+ * Writes to a closed TCP peer raise SIGPIPE, so gateways should ignore it.
+ *
+ * The endpoint array is fixed by bmodbus_io_init(), a server accepting TCP sessions sizes it for the most sessions it
+ * serves. Slots bound to a descriptor of -1 start out closed, an accepted session is given a closed slot with
+ * bmodbus_io_rebind() and a session the peer closed (or that the server drops with bmodbus_io_remove()) frees its slot.
+ */
+
+/* MIT Style License
+ * Copyright (c) 2025 Bill McCartney
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef BMODBUS_IO_H
+#define BMODBUS_IO_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bmodbus.h"
+#include "bmodbus_socket.h"
+
+//Backends for bmodbus_io_init()
+#define BMB_IO_AUTO 0 //io_uring when the kernel allows it, epoll otherwise
+#define BMB_IO_URING 1
+#define BMB_IO_EPOLL 2
+
+typedef struct{
+    int fd;
+    uint32_t microseconds_per_byte; //0 for sockets, where the frames are rebuilt from the packets, the byte time for serial ports
+    modbus_client_t * client; //Only one of client and master is set
+    modbus_master_t * master;
+    bmodbus_socket_handler_t handler; //Called with client requests, NULL answers them with an exception
+    void * context;
+    uint8_t reading; //A read is queued
+    uint8_t writing; //A write is queued or partially done
+    uint8_t closed; //Set when the peer closed the connection or the descriptor failed, it is no longer served
+    uint8_t tcp; //A client on a stream socket, its requests are split out of the bytes kept in stream
+    uint8_t submitted; //io_uring operations on the descriptor that have not completed yet
+    uint16_t written; //Bytes of the current write already sent
+    bmodbus_socket_stream_t stream; //Reads land in stream.data, after the bytes kept when tcp is set
+}bmodbus_io_endpoint_t;
+
+typedef struct{
+    uint8_t backend; //BMB_IO_URING or BMB_IO_EPOLL once initialized
+    uint8_t fixed; //Set when the buffers are registered with the ring
+    int fd; //The ring or the epoll instance
+    bmodbus_io_endpoint_t * endpoints;
+    uint16_t count;
+    //io_uring state, the ring layout comes from the kernel
+    uint8_t * sq_ring;
+    uint8_t * cq_ring;
+    void * sqes;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned * sq_head;
+    unsigned * sq_tail;
+    unsigned * sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned * cq_head;
+    unsigned * cq_tail;
+    unsigned cq_mask;
+    void * cqes;
+    unsigned queued; //Submission entries not yet passed to the kernel
+    int64_t timeout[2]; //Timeout of the current wait, read by the kernel
+}bmodbus_io_t;
+
+/**
+ * @brief Bind a descriptor to a modbus client
+ *
+ * @param endpoint - the endpoint to set up, it must stay valid as long as the engine runs
+ * @param fd - the socket or tty, it should be non blocking
+ * @param client - the initialized client
+ * @param handler - called with requests the library does not answer itself
+ * @param context - passed to the handler
+ * @param microseconds_per_byte - 0 for sockets, the byte time (BYTE_TIMING_IN_MICROSECONDS) for serial ports. A
+ * datagram is one frame, the bytes of a TCP session are kept until they make up whole requests
+ */
+extern void bmodbus_io_client_endpoint(bmodbus_io_endpoint_t * endpoint, int fd, modbus_client_t * client, bmodbus_socket_handler_t handler, void * context, uint32_t microseconds_per_byte);
+
+/**
+ * @brief Bind a descriptor to a modbus master
+ *
+ * Requests are started with bmodbus_io_master_send(), the response is ready once the master state is
+ * MASTER_STATE_RESPONSE_READY. Timeouts are up to the application, it calls bmodbus_master_timeout() to give up on a
+ * request (rather than setting the state by hand, which would skip the statistics, latency and completion callback).
+ */
+extern void bmodbus_io_master_endpoint(bmodbus_io_endpoint_t * endpoint, int fd, modbus_master_t * master, uint32_t microseconds_per_byte);
+
+/**
+ * @brief Start the engine on an array of endpoints
+ *
+ * @param io - the engine
+ * @param endpoints - the endpoints, all of them already bound, those with a descriptor of -1 wait for bmodbus_io_rebind()
+ * @param count - number of endpoints
+ * @param backend - BMB_IO_AUTO, or BMB_IO_URING/BMB_IO_EPOLL to force one
+ * @return the backend in use, or -1 if it could not be started (errno is set)
+ */
+extern int bmodbus_io_init(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoints, uint16_t count, uint8_t backend);
+
+/**
+ * @brief Stop serving an endpoint, a request waiting on its response write is released
+ *
+ * The descriptor is left open. With io_uring the read still queued on it is cancelled, the slot can be rebound once
+ * bmodbus_io_run() has handled the cancellation.
+ * @return 0, or -1 if the cancellation could not be queued (errno is set)
+ */
+extern int bmodbus_io_remove(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint);
+
+/**
+ * @brief Bind a closed endpoint to a new descriptor, typically a TCP session just accepted
+ *
+ * The client or master, the handler and the byte time of the endpoint are kept, the bytes of the last session are dropped.
+ * @param fd - the new descriptor, it should be non blocking
+ * @return 0, or -1 (errno is set). EBUSY means the endpoint is still served, or that io_uring has not completed the
+ * operations of the last session, the call can be made again after the next bmodbus_io_run()
+ */
+extern int bmodbus_io_rebind(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint, int fd);
+
+/**
+ * @brief Send the request built on the master of an endpoint
+ *
+ * @return 0 when the write is queued (io_uring) or done (epoll), -1 if the master has nothing to send
+ */
+extern int bmodbus_io_master_send(bmodbus_io_t * io, bmodbus_io_endpoint_t * endpoint);
+
+/**
+ * @brief Submit the queued I/O, wait for activity and handle it
+ *
+ * Received frames are parsed, client requests are passed to the handler and their responses queued.
+ * @param io - the engine
+ * @param timeout_ms - longest wait, 0 to only handle what is already complete, -1 to wait forever
+ * @return the number of completions handled, or -1 on error (errno is set)
+ */
+extern int bmodbus_io_run(bmodbus_io_t * io, int timeout_ms);
+
+/**
+ * @brief Stop the engine, the descriptors are left open
+ */
+extern void bmodbus_io_deinit(bmodbus_io_t * io);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //BMODBUS_IO_H
@@ -0,0 +1,259 @@
+/* MIT Style License
+
+Copyright (c) 2025 Bill McCartney
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "bmodbus_socket.h"
+
+#ifndef MSG_NOSIGNAL //A closed TCP peer must not kill the process
+#define MSG_NOSIGNAL 0
+#endif
+
+uint32_t bmodbus_socket_microseconds(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u);
+}
+
+void bmodbus_socket_stream_init(bmodbus_socket_stream_t * stream){
+    stream->length = 0;
+    stream->skip = 0;
+}
+
+uint16_t bmodbus_socket_stream_next(bmodbus_socket_stream_t * stream, modbus_client_t * client, uint32_t microseconds){
+    uint16_t frame = 0, i;
+    if(stream->skip){ //The rest of a frame that did not fit
+        i = (stream->skip < stream->length) ? stream->skip : stream->length;
+        stream->skip -= i;
+        stream->length -= i;
+        memmove(stream->data, stream->data + i, stream->length);
+    }
+#ifdef BMB_CLIENT_ASCII
+    if(client->ascii.enabled){ //ASCII frames end with CR LF
+        for(i = 0; (i < stream->length) && (frame == 0); i++){
+            if(stream->data[i] == '\n'){
+                frame = i + 1;
+            }
+        }
+    }else
+#endif //BMB_CLIENT_ASCII
+    {
+        frame = bmodbus_request_length(stream->data, stream->length);
+        if(frame > sizeof(stream->data)){ //Too long to be answered, it is dropped
+            stream->skip = frame;
+            return bmodbus_socket_stream_next(stream, client, microseconds);
+        }
+        if(frame > stream->length){
+            frame = 0;
+        }
+    }
+    if((frame == 0) && (stream->length == sizeof(stream->data))){
+        frame = stream->length; //Full without a whole frame, only garbage gets here
+    }
+    if(frame == 0){
+        return 0;
+    }
+    bmodbus_client_received_packet(client, microseconds, stream->data, frame);
+    stream->length -= frame;
+    memmove(stream->data, stream->data + frame, stream->length);
+    return frame;
+}
+
+//Answers the request the client completed, if any, peer is only set for UDP
+static int socket_client_respond(modbus_client_t * client, int fd, bmodbus_socket_handler_t handler, void * context, struct sockaddr_storage * peer, socklen_t peer_length){
+    modbus_request_t * request;
+    modbus_uart_data_t * response;
+    ssize_t n;
+    request = bmodbus_client_get_request(client);
+    if(request != NULL){
+        if(handler != NULL){
+            handler(context, request);
+        }else{
+            request->result = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        }
+    }
+    response = bmodbus_client_get_response(client);
+    if(response == NULL){ //Incomplete or not for this client
+        return 0;
+    }
+    if(response->size){
+        //UDP answers whoever sent the request, TCP has no peer address (or refuses one since it is connected)
+        n = sendto(fd, response->data, response->size, MSG_NOSIGNAL, peer_length ? (struct sockaddr *)peer : NULL, peer_length);
+        if((n < 0) && (errno == EISCONN)){
+            n = send(fd, response->data, response->size, MSG_NOSIGNAL);
+        }
+        if(n < 0){
+            bmodbus_client_send_complete(client);
+            return -1;
+        }
+    }
+    bmodbus_client_send_complete(client);
+    return 0;
+}
+
+int bmodbus_socket_client_service(modbus_client_t * client, int fd, bmodbus_socket_stream_t * stream, bmodbus_socket_handler_t handler, void * context){
+    uint8_t packet[BMB_SOCKET_PACKET_SIZE];
+    struct sockaddr_storage peer;
+    socklen_t peer_length = sizeof(peer);
+    uint32_t now;
+    ssize_t received;
+    if(stream != NULL){ //The stream is never left full, so there is always room to read
+        received = recv(fd, stream->data + stream->length, sizeof(stream->data) - stream->length, 0);
+        if(received <= 0){
+            return (int)received;
+        }
+        stream->length += (uint16_t)received;
+        now = bmodbus_socket_microseconds();
+        while(bmodbus_socket_stream_next(stream, client, now)){
+            if(socket_client_respond(client, fd, handler, context, NULL, 0) < 0){
+                return -1;
+            }
+        }
+        return (int)received;
+    }
+    received = recvfrom(fd, packet, sizeof(packet), 0, (struct sockaddr *)&peer, &peer_length);
+    if(received <= 0){
+        return (int)received;
+    }
+    bmodbus_client_received_packet(client, bmodbus_socket_microseconds(), packet, (uint16_t)received);
+    if(socket_client_respond(client, fd, handler, context, &peer, peer_length) < 0){
+        return -1;
+    }
+    return (int)received;
+}
+
+modbus_request_t * bmodbus_socket_master_transact(modbus_master_t * master, int fd, modbus_uart_request_t * request, int timeout_ms){
+    uint8_t packet[BMB_SOCKET_PACKET_SIZE];
+    struct pollfd event;
+    uint32_t start, elapsed_ms;
+    socklen_t type_length = sizeof(int);
+    int type = 0;
+    ssize_t n;
+    if(request == NULL){
+        return NULL;
+    }
+    if((getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_length) == 0) && (type == SOCK_STREAM)){
+        while(recv(fd, packet, sizeof(packet), MSG_DONTWAIT) > 0){
+            //A late response to a request given up, with no packet boundaries it would be taken as the start of this one
+        }
+    }
+    if(send(fd, request->data, request->size, MSG_NOSIGNAL) != (ssize_t)request->size){
+        bmodbus_master_timeout(master); //Give up on the request
+        return NULL;
+    }
+    start = bmodbus_socket_microseconds();
+    bmodbus_master_send_complete(master, start);
+    event.fd = fd;
+    event.events = POLLIN;
+    while((master->state == MASTER_STATE_WAITING_FOR_RESPONSE) || (master->state == MASTER_STATE_TURNAROUND)){
+        elapsed_ms = (bmodbus_socket_microseconds() - start) / 1000u;
+        if(master->state == MASTER_STATE_TURNAROUND){ //Nothing comes back from a broadcast
+            if((elapsed_ms * 1000u) < master->turnaround_delay){
+                poll(NULL, 0, (int)((master->turnaround_delay / 1000u) - elapsed_ms) + 1);
+            }
+            bmodbus_master_loop(master, bmodbus_socket_microseconds());
+            continue;
+        }
+        if(elapsed_ms >= (uint32_t)timeout_ms){
+            break;
+        }
+        n = poll(&event, 1, timeout_ms - (int)elapsed_ms);
+        if((n < 0) && (errno == EINTR)){
+            continue;
+        }
+        if(n <= 0){
+            break;
+        }
+        n = recv(fd, packet, sizeof(packet), 0);
+        if(n <= 0){
+            break;
+        }
+        bmodbus_master_received_packet(master, bmodbus_socket_microseconds(), packet, (uint16_t)n);
+    }
+    if(master->state != MASTER_STATE_RESPONSE_READY){
+        bmodbus_master_timeout(master); //Give up on the request
+        return NULL;
+    }
+    return bmodbus_master_get_response(master);
+}
+
+int bmodbus_socket_mbap_to_rtu(const uint8_t * mbap, uint16_t length, uint8_t * rtu, uint16_t * transaction){
+    uint16_t pdu, crc;
+    if(length < BMB_MBAP_HEADER_SIZE + 1){
+        return -1;
+    }
+    pdu = (uint16_t)(((mbap[4] << 8) | mbap[5]) - 1); //The length field counts the unit byte
+    if((mbap[2] != 0) || (mbap[3] != 0) || (pdu == 0xFFFF) || (pdu > length - BMB_MBAP_HEADER_SIZE) || (pdu + 3 > BMB_SOCKET_PACKET_SIZE)){
+        return -1;
+    }
+    *transaction = (uint16_t)((mbap[0] << 8) | mbap[1]);
+    rtu[0] = mbap[6];
+    memcpy(rtu + 1, mbap + BMB_MBAP_HEADER_SIZE, pdu);
+    crc = bmodbus_crc(rtu, (uint16_t)(pdu + 1));
+    rtu[pdu + 1] = crc & 0xFF;
+    rtu[pdu + 2] = (crc & 0xFF00) >> 8;
+    return pdu + 3;
+}
+
+int bmodbus_socket_rtu_to_mbap(const uint8_t * rtu, uint16_t length, uint16_t transaction, uint8_t * mbap){
+    uint16_t pdu;
+    if(length < 4){
+        return -1;
+    }
+    pdu = (uint16_t)(length - 3);
+    mbap[0] = (uint8_t)(transaction >> 8);
+    mbap[1] = (uint8_t)transaction;
+    mbap[2] = 0;
+    mbap[3] = 0;
+    mbap[4] = (uint8_t)((pdu + 1) >> 8);
+    mbap[5] = (uint8_t)(pdu + 1);
+    mbap[6] = rtu[0];
+    memcpy(mbap + BMB_MBAP_HEADER_SIZE, rtu + 1, pdu);
+    return pdu + BMB_MBAP_HEADER_SIZE;
+}
+
+#ifdef BMB_SCATTER_GATHER
+int bmodbus_socket_send_vector(int fd, const modbus_uart_vector_t * vector){
+    struct iovec spans[3];
+    struct msghdr message;
+    ssize_t n;
+    uint8_t i;
+    for(i = 0; i < vector->count; i++){
+        spans[i].iov_base = (void *)vector->span[i].data;
+        spans[i].iov_len = vector->span[i].length;
+    }
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = spans;
+    message.msg_iovlen = vector->count;
+    n = sendmsg(fd, &message, MSG_NOSIGNAL);
+    if((n < 0) && (errno == ENOTSOCK)){
+        n = writev(fd, spans, vector->count);
+    }
+    return (int)n;
+}
+#endif //BMB_SCATTER_GATHER
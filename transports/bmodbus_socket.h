@@ -0,0 +1,141 @@
+/**
+ * @file bmodbus_socket.h
+ * @brief RTU over TCP and UDP for POSIX systems
+ *
+ * Cellular modems and serial servers often tunnel raw RTU frames over a socket. These adapters give bmodbus whole
+ * frames, so no interframe timing is needed and a single process can serve as many tunneled devices as it has sockets.
+ * A UDP datagram is one frame. TCP has no packet boundaries, so the bytes of a connection are kept in a
+ * bmodbus_socket_stream_t and split into requests by their function and byte count (or at the LF of ASCII frames).
+ * The master assembles a response from as many reads as it takes.
+ */
+
+/* MIT Style License
+ * Copyright (c) 2025 Bill McCartney
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef BMODBUS_SOCKET_H
+#define BMODBUS_SOCKET_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "bmodbus.h"
+
+//Largest packet read from a socket, big enough for an ASCII frame of a full size request
+#define BMB_SOCKET_PACKET_SIZE (2 * BMB_MAXIMUM_MESSAGE_SIZE + 8)
+
+//Bytes read from a TCP connection that do not make up a whole request yet, one per connection
+typedef struct{
+    uint16_t length; //Bytes held in data
+    uint16_t skip; //Bytes still to drop of a frame longer than data
+    uint8_t data[BMB_SOCKET_PACKET_SIZE];
+}bmodbus_socket_stream_t;
+
+/**
+ * @brief Called for requests the library cannot answer by itself
+ *
+ * It fills in the request exactly like a main loop application would (data, size and result).
+ */
+typedef void (*bmodbus_socket_handler_t)(void * context, modbus_request_t * request);
+
+/**
+ * @brief Current time in microseconds from the monotonic clock
+ */
+extern uint32_t bmodbus_socket_microseconds(void);
+
+/**
+ * @brief Empty a stream, when its connection is opened
+ */
+extern void bmodbus_socket_stream_init(bmodbus_socket_stream_t * stream);
+
+/**
+ * @brief Hand the next whole request held by a stream to a client
+ *
+ * The request is passed to bmodbus_client_received_packet() and removed from the stream, the bytes after it are kept.
+ * Call it again once the client has answered, one read can hold several requests.
+ * @param stream - the bytes of the connection, appended after stream->length by the caller
+ * @param client - the modbus client instance, it tells whether the connection carries ASCII frames
+ * @param microseconds - the current time in microseconds
+ * @return the length of the request, or 0 if the stream does not hold a whole request yet
+ */
+extern uint16_t bmodbus_socket_stream_next(bmodbus_socket_stream_t * stream, modbus_client_t * client, uint32_t microseconds);
+
+/**
+ * @brief Read from a TCP or UDP socket, handle the requests received and send the responses back
+ *
+ * UDP responses go back to the address the packet came from, so one unconnected socket can serve every device.
+ * @param client - the modbus client instance
+ * @param fd - the socket, it should be readable (it is read once)
+ * @param stream - the bytes kept between reads of a TCP connection, NULL for UDP where every datagram is a frame
+ * @param handler - called with requests the library does not answer itself, NULL answers them with an exception
+ * @param context - passed to the handler
+ * @return the number of bytes read, 0 if a TCP peer closed the connection, -1 on error (errno is set)
+ */
+extern int bmodbus_socket_client_service(modbus_client_t * client, int fd, bmodbus_socket_stream_t * stream, bmodbus_socket_handler_t handler, void * context);
+
+/**
+ * @brief Send a master request over a connected socket and wait for its response
+ *
+ * Broadcasts complete after the turnaround delay of the master. On TCP the bytes already waiting on the socket are
+ * dropped before sending, they can only be a response that came after its request was given up.
+ * @param master - the modbus master instance
+ * @param fd - the connected socket
+ * @param request - the request returned by one of the bmodbus_master_ builders
+ * @param timeout_ms - how long to wait for the response
+ * @return the response, or NULL on a timeout or a socket error (the master is then free for the next request)
+ */
+extern modbus_request_t * bmodbus_socket_master_transact(modbus_master_t * master, int fd, modbus_uart_request_t * request, int timeout_ms);
+
+//Modbus TCP frames carry a 7 byte MBAP header (transaction, protocol 0, length, unit) instead of the address and CRC
+#define BMB_MBAP_HEADER_SIZE 7
+
+/**
+ * @brief Turn a Modbus TCP (MBAP) frame into the RTU frame bmodbus expects, the unit becomes the address
+ * @param mbap - the frame read from the socket
+ * @param length - its length
+ * @param rtu - filled in with the RTU frame, BMB_SOCKET_PACKET_SIZE bytes
+ * @param transaction - filled in with the transaction identifier, to be echoed with the response
+ * @return the length of the RTU frame, or -1 if the header is not a valid MBAP header
+ */
+extern int bmodbus_socket_mbap_to_rtu(const uint8_t * mbap, uint16_t length, uint8_t * rtu, uint16_t * transaction);
+
+/**
+ * @brief Turn an RTU frame from bmodbus into a Modbus TCP (MBAP) frame, the CRC is dropped
+ * @param rtu - the frame from bmodbus_client_get_response() or a bmodbus_master_ builder
+ * @param length - its length, including the CRC
+ * @param transaction - the transaction identifier
+ * @param mbap - filled in with the frame, length + BMB_MBAP_HEADER_SIZE - 3 bytes
+ * @return the length of the MBAP frame, or -1 if the RTU frame is too short
+ */
+extern int bmodbus_socket_rtu_to_mbap(const uint8_t * rtu, uint16_t length, uint16_t transaction, uint8_t * mbap);
+
+#ifdef BMB_SCATTER_GATHER
+/**
+ * @brief Send the spans of a frame with a single gathered write, without copying them together
+ *
+ * Works on sockets and on other descriptors such as ttys.
+ * @param fd - the connected socket or descriptor
+ * @param vector - the spans from bmodbus_client_get_response_vector() or bmodbus_master_write_multiple_vector()
+ * @return the number of bytes sent, or -1 on error (errno is set)
+ */
+extern int bmodbus_socket_send_vector(int fd, const modbus_uart_vector_t * vector);
+#endif //BMB_SCATTER_GATHER
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //BMODBUS_SOCKET_H